@@ -0,0 +1,276 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "camera.h"
+#include "adaptive.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* Everything a tile needs to know about the part of the image it lives in */
+struct AdaptiveRegion {
+    struct Scene* scene;
+    struct Camera* camera;
+    int width;
+    int rowStart;
+    float threshold;
+    float* image;
+    unsigned char* mask;
+    int* primitiveIds;
+};
+
+/* Traces a single pixel, unless an earlier pass already did */
+static void TracePixel(struct AdaptiveRegion* region, int row, int col)
+{
+    int index = row * region->width + col;
+    if(region->mask[index] == ADAPTIVE_PIXEL_TRACED)
+        return;
+
+    vec3 finalOutput = {0, 0, 0};
+    struct RayHit hit;
+    TraceCameraRay(region->scene, region->camera, region->rowStart + row, col, finalOutput, &hit);
+
+    vec3_dup(&region->image[index*3], finalOutput);
+    region->primitiveIds[index] = hit.primitiveId;
+    region->mask[index] = ADAPTIVE_PIXEL_TRACED;
+}
+
+/* 
+ * Corners agree if they all hit the same primitive and no color channel
+ * differs by more than the threshold (relative to the brightest corner).
+ * Corners whose --spp samples hit different primitives sit on an edge, they never agree
+ */
+static int CornersAgree(struct AdaptiveRegion* region, int* corners)
+{
+    int i, k;
+    if(region->primitiveIds[corners[0]] == PRIMITIVE_ID_MIXED)
+        return 0;
+    for(i = 1; i < 4; i++) {
+        if(region->primitiveIds[corners[i]] != region->primitiveIds[corners[0]])
+            return 0;
+    }
+
+    for(k = 0; k < 3; k++) {
+        float minValue = region->image[corners[0]*3 + k];
+        float maxValue = minValue;
+        for(i = 1; i < 4; i++) {
+            minValue = fminf(minValue, region->image[corners[i]*3 + k]);
+            maxValue = fmaxf(maxValue, region->image[corners[i]*3 + k]);
+        }
+
+        /* Small floor so pure black regions still count as smooth */
+        if(maxValue - minValue > region->threshold * fmaxf(maxValue, 0.001f))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Fills the inside of a rectangle by bilinear interpolation of its (traced) corners */
+static void InterpolateRect(struct AdaptiveRegion* region, int r0, int c0, int r1, int c1)
+{
+    const float* topLeft = &region->image[(r0 * region->width + c0)*3];
+    const float* topRight = &region->image[(r0 * region->width + c1)*3];
+    const float* bottomLeft = &region->image[(r1 * region->width + c0)*3];
+    const float* bottomRight = &region->image[(r1 * region->width + c1)*3];
+    int primitiveId = region->primitiveIds[r0 * region->width + c0];
+
+    int i, j;
+    for(i = r0; i <= r1; i++) {
+        float v = (r1 == r0) ? 0.0f : (float)(i - r0) / (float)(r1 - r0);
+        for(j = c0; j <= c1; j++) {
+            int index = i * region->width + j;
+
+            /* Never overwrite something we actually traced */
+            if(region->mask[index] == ADAPTIVE_PIXEL_TRACED)
+                continue;
+
+            float u = (c1 == c0) ? 0.0f : (float)(j - c0) / (float)(c1 - c0);
+            vec3 top, bottom, color;
+            vec3_scale(top, topLeft, 1.0f - u);
+            vec3_scale(color, topRight, u);
+            vec3_add(top, top, color);
+            vec3_scale(bottom, bottomLeft, 1.0f - u);
+            vec3_scale(color, bottomRight, u);
+            vec3_add(bottom, bottom, color);
+            vec3_scale(top, top, 1.0f - v);
+            vec3_scale(bottom, bottom, v);
+            vec3_add(&region->image[index*3], top, bottom);
+
+            region->primitiveIds[index] = primitiveId;
+            region->mask[index] = ADAPTIVE_PIXEL_INTERPOLATED;
+        }
+    }
+}
+
+/* 
+ * Recursively refines the rectangle with inclusive corners (r0, c0) and (r1, c1).
+ * Children share their middle row/column with each other so corners get reused.
+ */
+static void RefineRect(struct AdaptiveRegion* region, int r0, int c0, int r1, int c1)
+{
+    TracePixel(region, r0, c0);
+    TracePixel(region, r0, c1);
+    TracePixel(region, r1, c0);
+    TracePixel(region, r1, c1);
+
+    /* Nothing left inside to interpolate */
+    if(r1 - r0 <= 1 && c1 - c0 <= 1)
+        return;
+
+    int corners[4] = {
+        r0 * region->width + c0, r0 * region->width + c1,
+        r1 * region->width + c0, r1 * region->width + c1
+    };
+    if(CornersAgree(region, corners)) {
+        InterpolateRect(region, r0, c0, r1, c1);
+        return;
+    }
+
+    /* Split in four. Thin rectangles are only split along their long side */
+    int rm = (r0 + r1) / 2;
+    int cm = (c0 + c1) / 2;
+    if(r1 - r0 <= 1) {
+        RefineRect(region, r0, c0, r1, cm);
+        RefineRect(region, r0, cm, r1, c1);
+    } else if(c1 - c0 <= 1) {
+        RefineRect(region, r0, c0, rm, c1);
+        RefineRect(region, rm, c0, r1, c1);
+    } else {
+        RefineRect(region, r0, c0, rm, cm);
+        RefineRect(region, r0, cm, rm, c1);
+        RefineRect(region, rm, c0, r1, cm);
+        RefineRect(region, rm, cm, r1, c1);
+    }
+}
+
+/* 
+ * Renders rowCount rows starting at rowStart with quadtree refinement.
+ * outImage and outMask only hold the rows being rendered (like the MPI buffers do)
+ */
+void RenderAdaptive(struct Scene* scene, struct Camera* camera, const int width, const int rowStart, const int rowCount, 
+    const float threshold, float* outImage, unsigned char* outMask)
+{
+    int* primitiveIds = (int*)malloc(rowCount * width * sizeof(int));
+    int i, j;
+    for(i = 0; i < rowCount * width; i++)
+        outMask[i] = ADAPTIVE_PIXEL_PENDING;
+
+    struct AdaptiveRegion region;
+    region.scene = scene;
+    region.camera = camera;
+    region.width = width;
+    region.rowStart = rowStart;
+    region.threshold = threshold;
+    region.image = outImage;
+    region.mask = outMask;
+    region.primitiveIds = primitiveIds;
+
+    /* 
+     * Top level tiles don't share edges with each other so every thread
+     * owns the pixels it writes
+     */
+    const int tilesDown = (rowCount + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+    const int tilesAcross = (width + ADAPTIVE_TILE_SIZE - 1) / ADAPTIVE_TILE_SIZE;
+    int tile;
+#ifdef USE_OPENMP
+    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) schedule(dynamic)
+#endif
+    for(tile = 0; tile < tilesDown * tilesAcross; tile++) {
+        int r0 = (tile / tilesAcross) * ADAPTIVE_TILE_SIZE;
+        int c0 = (tile % tilesAcross) * ADAPTIVE_TILE_SIZE;
+        int r1 = r0 + ADAPTIVE_TILE_SIZE - 1;
+        int c1 = c0 + ADAPTIVE_TILE_SIZE - 1;
+        if(r1 >= rowCount)
+            r1 = rowCount - 1;
+        if(c1 >= width)
+            c1 = width - 1;
+        RefineRect(&region, r0, c0, r1, c1);
+    }
+
+    /* Report how much work we saved */
+    int tracedPixels = 0;
+    for(i = 0; i < rowCount; i++) {
+        for(j = 0; j < width; j++) {
+            if(outMask[i * width + j] == ADAPTIVE_PIXEL_TRACED)
+                tracedPixels++;
+        }
+    }
+    printf("Adaptive sampling traced %d of %d pixels (%.1f%%) with threshold %.3f\n", 
+        tracedPixels, rowCount * width, 100.0f * tracedPixels / (rowCount * width), threshold);
+
+    free(primitiveIds);
+}
+
+/* 
+ * Traces every pixel again and reports how far the adaptive image is from the full render.
+ * Errors are relative to the brightest value in the full render, which is what
+ * the image gets scaled by before being saved.
+ */
+void CompareAdaptive(struct Scene* scene, struct Camera* camera, const int width, const int rowStart, const int rowCount, 
+    const float* image, const unsigned char* mask)
+{
+    float* fullImage = (float*)malloc(rowCount * width * sizeof(vec3));
+    int i, j, k;
+
+#ifdef USE_OPENMP
+    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) private(j) schedule(guided)
+#endif
+    for (i = 0; i < rowCount; i++) {
+        for (j = 0; j < width; j++) {
+            vec3 finalOutput = {0, 0, 0};
+            TraceCameraRay(scene, camera, rowStart + i, j, finalOutput, NULL);
+            vec3_dup(&fullImage[(i*width + j)*3], finalOutput);
+        }
+    }
+
+    float maxValue = 0.0f;
+    for(i = 0; i < rowCount * width * 3; i++)
+        maxValue = fmaxf(maxValue, fullImage[i]);
+    if(maxValue <= 0.0f)
+        maxValue = 1.0f;
+
+    double sumSquaredError = 0.0;
+    float maxError = 0.0f;
+    int interpolatedPixels = 0;
+    for(i = 0; i < rowCount * width; i++) {
+        if(mask[i] != ADAPTIVE_PIXEL_INTERPOLATED)
+            continue;
+        interpolatedPixels++;
+        for(k = 0; k < 3; k++) {
+            float error = fabsf(image[i*3 + k] - fullImage[i*3 + k]) / maxValue;
+            maxError = fmaxf(maxError, error);
+            sumSquaredError += error * error;
+        }
+    }
+
+    double rmsError = 0.0;
+    if(interpolatedPixels > 0)
+        rmsError = sqrt(sumSquaredError / (interpolatedPixels * 3));
+    printf("Adaptive vs full render over %d interpolated pixels: max error %.5f (%.2f/255), rms error %.6f\n",
+        interpolatedPixels, maxError, maxError * 255.0f, rmsError);
+
+    free(fullImage);
+}
+
+/* Turns the mask into a viewable 24-bit image: traced pixels are white, interpolated are black */
+void AdaptiveMaskToImage(const unsigned char* mask, const int pixelCount, unsigned char* outImage)
+{
+    int i;
+    for(i = 0; i < pixelCount; i++) {
+        unsigned char value = (mask[i] == ADAPTIVE_PIXEL_TRACED) ? 255 : 0;
+        outImage[i*3] = value;
+        outImage[i*3 + 1] = value;
+        outImage[i*3 + 2] = value;
+    }
+}
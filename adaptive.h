@@ -0,0 +1,35 @@
+#ifndef ADAPTIVE_H_
+#define ADAPTIVE_H_
+
+/* 
+ * Adaptive image-space subsampling.
+ * The image is split into tiles and only the corners of each tile are traced.
+ * If the corners hit the same primitive and their colors are close enough,
+ * the inside of the tile is interpolated. Otherwise the tile is split in four
+ * and we try again, down to single pixels.
+ */
+
+/* Defined in scene.h and raytracer.h */
+struct Scene;
+struct Camera;
+
+/* Values in the per-pixel mask */
+#define ADAPTIVE_PIXEL_PENDING 0
+#define ADAPTIVE_PIXEL_TRACED 1
+#define ADAPTIVE_PIXEL_INTERPOLATED 2
+
+/* Size of the top level tiles */
+#define ADAPTIVE_TILE_SIZE 16
+
+/* How far apart (relative to the brightest corner) corner colors may be */
+#define ADAPTIVE_DEFAULT_THRESHOLD 0.05f
+
+void RenderAdaptive(struct Scene* scene, struct Camera* camera, const int width, const int rowStart, const int rowCount, 
+    const float threshold, float* outImage, unsigned char* outMask);
+
+void CompareAdaptive(struct Scene* scene, struct Camera* camera, const int width, const int rowStart, const int rowCount, 
+    const float* image, const unsigned char* mask);
+
+void AdaptiveMaskToImage(const unsigned char* mask, const int pixelCount, unsigned char* outImage);
+
+#endif
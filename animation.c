@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "linmath.h"
+#include "animation.h"
+
+/* Keys can be given in any order in the file, so keep each track sorted as we go */
+static int AddKeyframe(struct KeyframeTrack* track, float frame, float* value)
+{
+    if(track->count >= MAX_KEYFRAMES) {
+        printf("too many keyframes (max %d)\n", MAX_KEYFRAMES);
+        return 0;
+    }
+
+    int i = track->count;
+    while(i > 0 && track->keys[i - 1].frame > frame) {
+        track->keys[i] = track->keys[i - 1];
+        i--;
+    }
+    track->keys[i].frame = frame;
+    vec3_dup(track->keys[i].value, value);
+    track->count++;
+    return 1;
+}
+
+/* 
+ * Loads an animation description. The format is one command per line:
+ *     frames <count>
+ *     camera <frame> <x> <y> <z>
+ *     target <frame> <x> <y> <z>
+ *     light <index> <frame> <x> <y> <z>
+ * Empty lines and lines starting with # are ignored.
+ * Returns 1 on success and 0 on failure
+ */
+int LoadAnimation(const char* fileName, struct Animation* outAnimation)
+{
+    FILE* file = fopen(fileName, "r");
+    if(!file) {
+        printf("could not open animation file %s\n", fileName);
+        return 0;
+    }
+
+    memset(outAnimation, 0, sizeof(struct Animation));
+
+    char line[256];
+    int lineNumber = 0;
+    int success = 1;
+    while(success && fgets(line, sizeof(line), file)) {
+        lineNumber++;
+
+        char command[32];
+        if(sscanf(line, "%31s", command) != 1 || command[0] == '#')
+            continue;
+
+        int index;
+        float frame;
+        vec3 value;
+        if(strcmp(command, "frames") == 0) {
+            success = sscanf(line, "%*s %d", &outAnimation->frameCount) == 1 && outAnimation->frameCount > 0;
+        } else if(strcmp(command, "camera") == 0) {
+            success = sscanf(line, "%*s %f %f %f %f", &frame, &value[0], &value[1], &value[2]) == 4 
+                && AddKeyframe(&outAnimation->camera, frame, value);
+        } else if(strcmp(command, "target") == 0) {
+            success = sscanf(line, "%*s %f %f %f %f", &frame, &value[0], &value[1], &value[2]) == 4 
+                && AddKeyframe(&outAnimation->target, frame, value);
+        } else if(strcmp(command, "light") == 0) {
+            success = sscanf(line, "%*s %d %f %f %f %f", &index, &frame, &value[0], &value[1], &value[2]) == 5 
+                && index >= 0 && index < MAX_LIGHTS
+                && AddKeyframe(&outAnimation->lights[index], frame, value);
+        } else {
+            success = 0;
+        }
+
+        if(!success) {
+            line[strcspn(line, "\r\n")] = '\0';
+            printf("%s:%d: could not understand \"%s\"\n", fileName, lineNumber, line);
+        }
+    }
+    fclose(file);
+
+    if(success && outAnimation->frameCount == 0) {
+        printf("%s: animation needs a \"frames\" line\n", fileName);
+        success = 0;
+    }
+    return success;
+}
+
+/* 
+ * Catmull-Rom interpolation of a track at the given frame.
+ * Gives smooth paths through every key. Returns 0 if the track is empty
+ */
+static int SampleTrack(struct KeyframeTrack* track, float frame, float* outValue)
+{
+    if(track->count == 0)
+        return 0;
+
+    /* Hold the end keys */
+    if(frame <= track->keys[0].frame) {
+        vec3_dup(outValue, track->keys[0].value);
+        return 1;
+    }
+    if(frame >= track->keys[track->count - 1].frame) {
+        vec3_dup(outValue, track->keys[track->count - 1].value);
+        return 1;
+    }
+
+    /* Find the segment we are in */
+    int i = 0;
+    while(track->keys[i + 1].frame < frame)
+        i++;
+
+    float* p0 = track->keys[(i > 0) ? i - 1 : i].value;
+    float* p1 = track->keys[i].value;
+    float* p2 = track->keys[i + 1].value;
+    float* p3 = track->keys[(i + 2 < track->count) ? i + 2 : i + 1].value;
+    float t = (frame - track->keys[i].frame) / (track->keys[i + 1].frame - track->keys[i].frame);
+    float t2 = t * t;
+    float t3 = t2 * t;
+
+    int k;
+    for(k = 0; k < 3; k++) {
+        outValue[k] = 0.5f * ((2.0f * p1[k]) 
+            + (-p0[k] + p2[k]) * t 
+            + (2.0f * p0[k] - 5.0f * p1[k] + 4.0f * p2[k] - p3[k]) * t2 
+            + (-p0[k] + 3.0f * p1[k] - 3.0f * p2[k] + p3[k]) * t3);
+    }
+    return 1;
+}
+
+/* Moves the camera and lights to where they are at the given frame. Tracks without keys are left alone */
+void ApplyAnimationFrame(struct Animation* animation, const int frame, struct Scene* scene, struct Camera* camera)
+{
+    vec3 position, target;
+    if(!SampleTrack(&animation->camera, (float)frame, position))
+        vec3_dup(position, camera->eyePos);
+    if(SampleTrack(&animation->target, (float)frame, target))
+        AimCamera(camera, position, target);
+    else
+        SetCameraPosition(camera, position);
+
+    int i;
+    for(i = 0; i < scene->lightCount; i++) {
+        if(SampleTrack(&animation->lights[i], (float)frame, position))
+            vec3_dup(scene->lights[i].position, position);
+    }
+}
+
+/* Turns "rendered.bmp" into "rendered_0042.bmp" */
+void GetFrameFileName(const char* baseFileName, const int frame, char* outFileName, const int outSize)
+{
+    const char* extension = strrchr(baseFileName, '.');
+    int stemLength = extension ? (int)(extension - baseFileName) : (int)strlen(baseFileName);
+    snprintf(outFileName, outSize, "%.*s_%04d%s", stemLength, baseFileName, frame, extension ? extension : "");
+}
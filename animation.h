@@ -0,0 +1,41 @@
+#ifndef ANIMATION_H_
+#define ANIMATION_H_
+
+#include "linmath.h"
+#include "scene.h"
+#include "raytracer.h"
+#include "camera.h"
+
+/* 
+ * Keyframed camera and light paths.
+ * Each track is a list of positions at given frames. Frames between
+ * keys are smoothly interpolated, frames outside them hold the end key.
+ * If the camera has target keys it is aimed at the target every frame,
+ * otherwise it only moves.
+ */
+#define MAX_KEYFRAMES 256
+
+struct Keyframe {
+    float frame;
+    vec3 value;
+};
+
+struct KeyframeTrack {
+    int count;
+    struct Keyframe keys[MAX_KEYFRAMES];
+};
+
+struct Animation {
+    int frameCount;
+    struct KeyframeTrack camera;
+    struct KeyframeTrack target;
+    struct KeyframeTrack lights[MAX_LIGHTS];
+};
+
+int LoadAnimation(const char* fileName, struct Animation* outAnimation);
+
+void ApplyAnimationFrame(struct Animation* animation, const int frame, struct Scene* scene, struct Camera* camera);
+
+void GetFrameFileName(const char* baseFileName, const int frame, char* outFileName, const int outSize);
+
+#endif
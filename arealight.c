@@ -0,0 +1,184 @@
+/* Default libraries */
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "rng.h"
+#include "arealight.h"
+
+/*
+ * Random points every light gets per camera sample. The coarse and fine grid together
+ * (AREA_LIGHT_COARSE_SIDE^2 + AREA_LIGHT_MAX_SIDE^2) and a fixed --light-samples grid fit
+ */
+#define AREA_LIGHT_POINTS AREA_LIGHT_MAX_SAMPLES
+
+void InitAreaLightEstimate(struct AreaLightEstimate* estimate)
+{
+    estimate->lit = 0.0f;
+    estimate->unshadowed = 0.0f;
+    estimate->samples = 0;
+    estimate->visible = 0;
+    estimate->blocked = 0;
+}
+
+/*
+ * About how much of a light reaches the surface at position (with normal), without shadows:
+ * what a point light in the middle gives, widened by how big the light looks so a light
+ * partly behind the surface still counts. In units of shadedColor, 0 if all of it is behind
+ */
+float GetAreaLightReach(const struct SceneLight* light, const float* position, const float* normal)
+{
+    vec3 toCenter;
+    vec3_sub(toCenter, light->position, position);
+    const float distanceSquared = vec3_dot(toCenter, toCenter);
+    if(!(distanceSquared > 0.0f))
+        return 0.0f;
+    const float distance = sqrtf(distanceSquared);
+    const float cosSurface = vec3_dot(toCenter, normal) / distance;
+
+    /* Sine of (at least) how far the light reaches around its middle */
+    float spread;
+    if(light->type == LIGHT_SPHERE)
+        spread = light->radius / distance;
+    else
+        spread = sqrtf(vec3_dot(light->edgeU, light->edgeU) + vec3_dot(light->edgeV, light->edgeV)) / distance;
+    spread = fminf(spread, 1.0f);
+
+    float reach = fminf(1.0f, fmaxf(0.0f, cosSurface + spread)) / distanceSquared;
+    if(light->type == LIGHT_RECT) {
+        vec3 lightNormal;
+        vec3_mul_cross(lightNormal, light->edgeU, light->edgeV);
+        vec3_normalize(lightNormal, lightNormal);
+        reach *= fminf(1.0f, fabsf(vec3_dot(toCenter, lightNormal)) / distance + spread);
+    }
+    return reach;
+}
+
+/*
+ * Turns (u, v) in [0, 1) into a direction to a point of the light and how far that is.
+ * Returns the point's weight before the cosine at the surface (see SampleAreaLight):
+ * spheres are sampled evenly over the cone they fill, rects evenly over their area.
+ * Returns 0 when there is nothing to send a ray to
+ */
+static float GetLightPoint(const struct SceneLight* light, const float* position, const float u, const float v,
+    float* outDirection, float* outDistance)
+{
+    if(light->type == LIGHT_SPHERE) {
+        vec3 axis;
+        vec3_sub(axis, light->position, position);
+        const float distanceSquared = vec3_dot(axis, axis);
+        const float radiusSquared = light->radius * light->radius;
+        if(distanceSquared <= radiusSquared)
+            return 0.0f;
+        const float distance = sqrtf(distanceSquared);
+        vec3_scale(axis, axis, 1.0f / distance);
+
+        /* 1 - cos of the cone's half angle, written so it doesn't cancel out for small lights */
+        const float ratio = radiusSquared / distanceSquared;
+        const float coneHeight = ratio / (1.0f + sqrtf(1.0f - ratio));
+        const float cosTheta = 1.0f - u * coneHeight;
+        const float sinTheta = sqrtf(fmaxf(0.0f, 1.0f - cosTheta * cosTheta));
+        const float phi = 2.0f * RAYTRACER_PI * v;
+
+        vec3 tangent, bitangent;
+        vec3 helper = {0, 0, 0};
+        helper[fabsf(axis[0]) > 0.9f ? 1 : 0] = 1.0f;
+        vec3_mul_cross(tangent, helper, axis);
+        vec3_normalize(tangent, tangent);
+        vec3_mul_cross(bitangent, axis, tangent);
+
+        vec3_scale(outDirection, axis, cosTheta);
+        vec3_add_scaled(outDirection, tangent, sinTheta * cosf(phi));
+        vec3_add_scaled(outDirection, bitangent, sinTheta * sinf(phi));
+        *outDistance = distance * cosTheta - sqrtf(fmaxf(0.0f, radiusSquared - distanceSquared * sinTheta * sinTheta));
+
+        /* Radiance shadedColor / (pi r^2) over a pdf of 1 / (2 pi coneHeight) */
+        return 2.0f * coneHeight / radiusSquared;
+    }
+
+    vec3 lightNormal;
+    vec3_mul_cross(lightNormal, light->edgeU, light->edgeV);
+    vec3_normalize(lightNormal, lightNormal);
+
+    vec3 point;
+    vec3_dup(point, light->position);
+    vec3_add_scaled(point, light->edgeU, 2.0f * u - 1.0f);
+    vec3_add_scaled(point, light->edgeV, 2.0f * v - 1.0f);
+    vec3_sub(outDirection, point, position);
+    const float distanceSquared = vec3_dot(outDirection, outDirection);
+    if(!(distanceSquared > 0.0f))
+        return 0.0f;
+    *outDistance = sqrtf(distanceSquared);
+    vec3_scale(outDirection, outDirection, 1.0f / *outDistance);
+
+    /* Radiance shadedColor / area over a pdf of 1 / area, both sides give off light */
+    return fabsf(vec3_dot(lightNormal, outDirection)) / distanceSquared;
+}
+
+/*
+ * Adds side x side stratified samples of a light to estimate, using random points
+ * firstPoint and on (so a refinement doesn't reuse the coarse pass's).
+ * A sample adds its weight to unshadowed, and to lit if the shadow ray gets through.
+ * Multiplied with the light's shadedColor the average gives what a point light would
+ */
+void SampleAreaLight(struct Scene* scene, const int lightIndex, const struct SampleId* sampleId, const float* position,
+    const float* normal, const int side, const int firstPoint, struct AreaLightEstimate* estimate)
+{
+    const struct SceneLight* light = &scene->lights[lightIndex];
+    const unsigned int stream = sampleId->bounce * RNG_STREAMS_PER_BOUNCE + RNG_STREAM_AREA_LIGHT;
+    const int firstCounter = (sampleId->sample * MAX_LIGHTS + lightIndex) * (AREA_LIGHT_POINTS / 2);
+
+    vec3 origin;
+    vec3_dup(origin, position);
+    vec3_add_scaled(origin, normal, AREA_LIGHT_SHADOW_BIAS);
+
+    /* Every 4 counters give 8 points */
+    float randoms[16];
+    int cell;
+    for(cell = 0; cell < side * side; cell++) {
+        const int point = firstPoint + cell;
+        if(cell == 0 || point % 8 == 0)
+            GetSampleRandoms(sampleId->seed, sampleId->row, sampleId->col, firstCounter + point / 8 * 4, stream, randoms);
+
+        const float u = (cell % side + randoms[point % 8 * 2]) / side;
+        const float v = (cell / side + randoms[point % 8 * 2 + 1]) / side;
+        vec3 direction;
+        float distance = 0.0f;
+        const float lightWeight = GetLightPoint(light, position, u, v, direction, &distance);
+        const float weight = lightWeight * fmaxf(0.0f, vec3_dot(direction, normal));
+
+        /* A point behind the surface is shadowed by the surface itself */
+        if(weight > 0.0f) {
+            estimate->unshadowed += weight;
+            if(IsRayBlocked(scene, origin, direction, distance)) {
+                estimate->blocked++;
+            } else {
+                estimate->lit += weight;
+                estimate->visible++;
+            }
+        } else if(lightWeight > 0.0f) {
+            estimate->blocked++;
+        }
+        estimate->samples++;
+    }
+}
+
+/*
+ * Side of the grid a light gets: maxSide for a light that gives all the light at the
+ * first hit, less the less it matters (its share of the light times the photons left).
+ * Never less than 2x2, a single ray makes a light that's partly hidden all or nothing
+ */
+int GetAreaLightSide(const float importance, const int maxSide)
+{
+    int side = (int)ceilf(maxSide * sqrtf(importance));
+    if(side < 2)
+        side = 2;
+    if(side > maxSide)
+        side = maxSide;
+    return side;
+}
@@ -0,0 +1,57 @@
+#ifndef AREALIGHT_H_
+#define AREALIGHT_H_
+
+#include "scene.h"
+#include "raytracer.h"
+
+/*
+ * Soft shadows from sphere and rect lights (see LoadSceneLights).
+ *
+ * A hit sends shadow rays to points spread over the light and averages what gets through.
+ * The points are stratified: the light is split into a side x side grid (over the solid angle
+ * of a sphere, over the area of a rect) with one jittered point in every cell, so they
+ * cover the light evenly and far fewer are needed than with uniform points. The jitter
+ * comes from rng.h, so the shadows are the same with any threads or processes.
+ *
+ * Unless the scene asks for a fixed number (--light-samples) the grids depend on how much
+ * the light matters at the hit: its share of all the light reaching the hit (without shadows)
+ * times the photons left in the ray. A light that gives all of it gets a coarse
+ * AREA_LIGHT_COARSE_SIDE^2 grid, dimmer lights and deep reflections less, down to 2x2.
+ * Only if the coarse shadow rays disagree (some get through, some don't: the hit is in a
+ * penumbra) a finer grid of up to AREA_LIGHT_MAX_SIDE^2 is added. How the shading changes
+ * over an unshadowed light is smooth, the stratified grid gets that right already.
+ */
+
+/* Grid of the first pass, and the finest refinement */
+#define AREA_LIGHT_COARSE_SIDE 3
+#define AREA_LIGHT_MAX_SIDE 8
+
+/* Most shadow rays one light can get at one hit (--light-samples) */
+#define AREA_LIGHT_MAX_SAMPLES 256
+
+/* Shadow rays start this far off the surface so they don't hit it */
+#define AREA_LIGHT_SHADOW_BIAS 0.1f
+
+/*
+ * What the samples of one light at one hit added up to. lit and unshadowed are in
+ * units of the light's shadedColor, divide by samples for the average.
+ * visible and blocked count the shadow rays that got through and the ones that didn't
+ */
+struct AreaLightEstimate {
+    float lit;
+    float unshadowed;
+    int samples;
+    int visible;
+    int blocked;
+};
+
+void InitAreaLightEstimate(struct AreaLightEstimate* estimate);
+
+float GetAreaLightReach(const struct SceneLight* light, const float* position, const float* normal);
+
+void SampleAreaLight(struct Scene* scene, const int lightIndex, const struct SampleId* sampleId, const float* position,
+    const float* normal, const int side, const int firstPoint, struct AreaLightEstimate* estimate);
+
+int GetAreaLightSide(const float importance, const int maxSide);
+
+#endif
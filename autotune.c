@@ -0,0 +1,192 @@
+/* gethostname isn't in C99 */
+#define _POSIX_C_SOURCE 200809L
+
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* My libraries */
+#include "scene.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "schedule.h"
+#include "hash.h"
+#include "autotune.h"
+
+/*
+ * What gets tried, defaults of each layout first (tileSize, policy, chunk; every thread).
+ * Without OpenMP there's nothing to hand out, so only the layouts (the default policies) are tried
+ */
+static const struct TraceSchedule AUTOTUNE_CANDIDATES[] = {
+    {0, SCHEDULE_DEFAULT, 0, 0},
+    {0, SCHEDULE_DYNAMIC, 1, 0},
+    {0, SCHEDULE_DYNAMIC, 4, 0},
+    {0, SCHEDULE_STATIC, 1, 0},
+    {0, SCHEDULE_STATIC, 0, 0},
+    {FRAMEBUFFER_TILE_SIZE, SCHEDULE_DEFAULT, 0, 0},
+    {FRAMEBUFFER_TILE_SIZE, SCHEDULE_GUIDED, 0, 0},
+    {FRAMEBUFFER_TILE_SIZE, SCHEDULE_STATIC, 1, 0},
+    {8, SCHEDULE_DEFAULT, 0, 0},
+    {8, SCHEDULE_DYNAMIC, 4, 0},
+    {32, SCHEDULE_DEFAULT, 0, 0},
+    {32, SCHEDULE_STATIC, 1, 0},
+};
+
+/* Name of this machine, "unknown" if it has none */
+static void GetHostName(char* outName, const size_t size)
+{
+    if(gethostname(outName, size) != 0 || outName[0] == '\0')
+        snprintf(outName, size, "unknown");
+    outName[size - 1] = '\0';
+}
+
+/*
+ * Key of a tuned schedule: the host, the build (threads, MPI, fast math), and the render
+ * as far as it changes how long pixels take (see GetRenderKey). tilesAllowed is part of it
+ * since without it only rows were tried
+ */
+unsigned long long GetTuneKey(struct Scene* scene, struct Camera* camera, const int pixelFormat, const float irradianceError,
+    const int tilesAllowed)
+{
+    char host[256];
+    char build[64];
+    GetHostName(host, sizeof(host));
+    snprintf(build, sizeof(build), "threads %d", GetMaxTraceThreads());
+#ifdef USE_MPI
+    strcat(build, " mpi");
+#endif
+#ifdef USE_FAST_MATH
+    strcat(build, " fastmath");
+#endif
+
+    unsigned long long hash = GetRenderKey(scene, camera, pixelFormat, irradianceError);
+    hash = HashBytes(hash, host, strlen(host));
+    hash = HashBytes(hash, build, strlen(build));
+    return HashBytes(hash, &tilesAllowed, sizeof(int));
+}
+
+/* Whether a schedule read from a file is one this build can use */
+static int IsValidSchedule(const struct TraceSchedule* schedule)
+{
+    const int tileSize = schedule->tileSize;
+    if(tileSize != 0 && (tileSize < SCHEDULE_MIN_TILE_SIZE || tileSize > SCHEDULE_MAX_TILE_SIZE
+        || (tileSize & (tileSize - 1)) != 0))
+        return 0;
+    return schedule->policy >= 0 && schedule->chunk >= 0 && schedule->threads >= 1
+        && schedule->threads <= GetMaxTraceThreads();
+}
+
+/*
+ * Reads the schedule tuned for key from fileName (the last line with that key).
+ * Returns 0 if the file doesn't exist or has none for key
+ */
+int LoadTunedSchedule(const char* fileName, const unsigned long long key, struct TraceSchedule* outSchedule,
+    double* outRaysPerSecond)
+{
+    FILE* file = fopen(fileName, "r");
+    if(!file)
+        return 0;
+
+    int found = 0;
+    char line[512];
+    while(fgets(line, sizeof(line), file)) {
+        unsigned long long lineKey;
+        char policy[32];
+        struct TraceSchedule schedule;
+        double raysPerSecond;
+        if(sscanf(line, "%llx %d %31s %d %d %lf", &lineKey, &schedule.tileSize, policy, &schedule.chunk, &schedule.threads,
+            &raysPerSecond) != 6 || lineKey != key)
+            continue;
+        schedule.policy = ParseSchedulePolicy(policy);
+        if(!IsValidSchedule(&schedule))
+            continue;
+        *outSchedule = schedule;
+        *outRaysPerSecond = raysPerSecond;
+        found = 1;
+    }
+    fclose(file);
+    return found;
+}
+
+/* Adds the schedule tuned for key to fileName (the host goes at the end so people can tell lines apart). Returns 1 on success */
+int SaveTunedSchedule(const char* fileName, const unsigned long long key, const struct TraceSchedule* schedule,
+    const double raysPerSecond)
+{
+    FILE* file = fopen(fileName, "a");
+    if(!file) {
+        printf("Couldn't open %s to save the tuned schedule\n", fileName);
+        return 0;
+    }
+    char host[256];
+    GetHostName(host, sizeof(host));
+    fprintf(file, "%016llx %d %s %d %d %.0f %s\n", key, schedule->tileSize, GetSchedulePolicyName(schedule->policy),
+        schedule->chunk, schedule->threads, raysPerSecond, host);
+    return fclose(file) == 0;
+}
+
+/* Traces the proxy with schedule AUTOTUNE_RUNS times, prints how fast the fastest run was and returns it (rays per second) */
+static double MeasureSchedule(ProxyRenderFunction render, void* context, const long long proxyRays,
+    const struct TraceSchedule* schedule)
+{
+    double fastest = 0.0;
+    int run;
+    for(run = 0; run < AUTOTUNE_RUNS; run++) {
+        const double seconds = render(context, schedule);
+        if(run == 0 || seconds < fastest)
+            fastest = seconds;
+    }
+    const double raysPerSecond = fastest > 0.0 ? proxyRays / fastest : 0.0;
+
+    char description[128];
+    DescribeTraceSchedule(schedule, description, sizeof(description));
+    printf("  %-48s %.3f M primary rays/s\n", description, raysPerSecond * 1e-6);
+    return raysPerSecond;
+}
+
+/*
+ * Tries the candidates on the proxy (render traces it, proxyRays primary rays) and puts the
+ * fastest in outSchedule. Tiles are only tried if tilesAllowed. Returns how fast it was (primary rays per second)
+ */
+double AutoTuneSchedule(ProxyRenderFunction render, void* context, const long long proxyRays, const int tilesAllowed,
+    struct TraceSchedule* outSchedule)
+{
+    const int candidateCount = sizeof(AUTOTUNE_CANDIDATES) / sizeof(AUTOTUNE_CANDIDATES[0]);
+    struct TraceSchedule best = AUTOTUNE_CANDIDATES[0];
+    best.threads = GetMaxTraceThreads();
+    double bestRaysPerSecond = 0.0;
+
+    /* The first run pays for page faults and cold caches, it isn't counted */
+    render(context, &best);
+
+    int i;
+    for(i = 0; i < candidateCount; i++) {
+        struct TraceSchedule schedule = AUTOTUNE_CANDIDATES[i];
+        if(schedule.tileSize > 0 && !tilesAllowed)
+            continue;
+#ifndef USE_OPENMP
+        if(schedule.policy != SCHEDULE_DEFAULT)
+            continue;
+#endif
+        schedule.threads = GetMaxTraceThreads();
+        const double raysPerSecond = MeasureSchedule(render, context, proxyRays, &schedule);
+        if(raysPerSecond > bestRaysPerSecond * (1.0 + AUTOTUNE_MIN_GAIN)) {
+            best = schedule;
+            bestRaysPerSecond = raysPerSecond;
+        }
+    }
+
+    /* Fewer threads, for as long as that's faster */
+    struct TraceSchedule fewer = best;
+    for(fewer.threads = best.threads / 2; fewer.threads >= 1; fewer.threads /= 2) {
+        const double raysPerSecond = MeasureSchedule(render, context, proxyRays, &fewer);
+        if(raysPerSecond <= bestRaysPerSecond * (1.0 + AUTOTUNE_MIN_GAIN))
+            break;
+        best = fewer;
+        bestRaysPerSecond = raysPerSecond;
+    }
+
+    *outSchedule = best;
+    return bestRaysPerSecond;
+}
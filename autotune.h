@@ -0,0 +1,54 @@
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+
+#include "scene.h"
+#include "camera.h"
+#include "schedule.h"
+
+/*
+ * Auto-tuner for how the trace loops hand out their work (--auto-tune, see schedule.h).
+ *
+ * A short list of schedules is tried on a proxy of the frame: the same view with
+ * AUTOTUNE_PROXY_SCALE times fewer rows and columns, traced plainly (without the irradiance
+ * cache, temporal reuse and the like), AUTOTUNE_RUNS times each and the fastest run counted.
+ * The candidates are both layouts and a few tile sizes with the policies and chunks that make
+ * sense for them, all with every thread. The fastest then tries fewer threads, halving them for
+ * as long as that's faster (hyperthreads or a busy machine can make it so). Anything has to be
+ * AUTOTUNE_MIN_GAIN faster than what's been found so far to take its place, so noise doesn't
+ * move the choice away from the defaults, which come first.
+ *
+ * The result goes to a small text file (--tune-file), one line per render that was tuned:
+ * a key for the host, the build and the scene as seen from the camera (see GetTuneKey), then
+ * the schedule and how fast it was. Later runs with the same key take the schedule from there
+ * instead of tuning again, the last line of a key wins. Delete the line (or the file) to tune
+ * again, after the machine changed say.
+ */
+
+/* Where the tuned schedules go by default, in the working directory */
+#define AUTOTUNE_DEFAULT_FILE "raytracer.tune"
+
+/* The proxy has this many times fewer rows and columns than the frame */
+#define AUTOTUNE_PROXY_SCALE 4
+
+/* Every candidate traces the proxy this many times, the fastest counts */
+#define AUTOTUNE_RUNS 2
+
+/* How much faster (relative) a candidate has to be to replace the fastest so far */
+#define AUTOTUNE_MIN_GAIN 0.03
+
+/* Traces the proxy frame handing out the work as schedule says, and returns how many seconds it took */
+typedef double (*ProxyRenderFunction)(void* context, const struct TraceSchedule* schedule);
+
+unsigned long long GetTuneKey(struct Scene* scene, struct Camera* camera, const int pixelFormat, const float irradianceError,
+    const int tilesAllowed);
+
+int LoadTunedSchedule(const char* fileName, const unsigned long long key, struct TraceSchedule* outSchedule,
+    double* outRaysPerSecond);
+
+int SaveTunedSchedule(const char* fileName, const unsigned long long key, const struct TraceSchedule* schedule,
+    const double raysPerSecond);
+
+double AutoTuneSchedule(ProxyRenderFunction render, void* context, const long long proxyRays, const int tilesAllowed,
+    struct TraceSchedule* outSchedule);
+
+#endif
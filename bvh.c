@@ -0,0 +1,200 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+
+/* My libraries */
+#include "bvh.h"
+
+/* What the recursive build needs to carry around */
+struct BvhBuild {
+    const float* itemBoundsMin;
+    const float* itemBoundsMax;
+    int leafSize;
+    struct BvhNode* nodes;
+    int nodeCount;
+    int* order;
+};
+
+static float Centroid(struct BvhBuild* build, const int item, const int axis)
+{
+    return build->itemBoundsMin[item*3 + axis] + build->itemBoundsMax[item*3 + axis];
+}
+
+/* 
+ * Moves items around so the k-th smallest centroid (along axis) ends up at k,
+ * smaller ones before it and bigger ones after it
+ */
+static void SelectByCentroid(struct BvhBuild* build, int begin, int end, const int k, const int axis)
+{
+    int* order = build->order;
+    while(end - begin > 1) {
+        float pivot = Centroid(build, order[(begin + end) / 2], axis);
+        int i = begin;
+        int j = end - 1;
+        while(i <= j) {
+            while(Centroid(build, order[i], axis) < pivot)
+                i++;
+            while(Centroid(build, order[j], axis) > pivot)
+                j--;
+            if(i <= j) {
+                int swap = order[i];
+                order[i] = order[j];
+                order[j] = swap;
+                i++;
+                j--;
+            }
+        }
+        if(k <= j)
+            end = j + 1;
+        else if(k >= i)
+            begin = i;
+        else
+            return;
+    }
+}
+
+/* Builds the node for items begin to end - 1 (of order) and everything below it */
+static void BuildNode(struct BvhBuild* build, const int begin, const int end)
+{
+    int nodeIndex = build->nodeCount++;
+    struct BvhNode* node = &build->nodes[nodeIndex];
+    float centroidMin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float centroidMax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    int i, k;
+
+    for(k = 0; k < 3; k++) {
+        node->boundsMin[k] = FLT_MAX;
+        node->boundsMax[k] = -FLT_MAX;
+    }
+    for(i = begin; i < end; i++) {
+        int item = build->order[i];
+        for(k = 0; k < 3; k++) {
+            float centroid = Centroid(build, item, k);
+            node->boundsMin[k] = fminf(node->boundsMin[k], build->itemBoundsMin[item*3 + k]);
+            node->boundsMax[k] = fmaxf(node->boundsMax[k], build->itemBoundsMax[item*3 + k]);
+            centroidMin[k] = fminf(centroidMin[k], centroid);
+            centroidMax[k] = fmaxf(centroidMax[k], centroid);
+        }
+    }
+
+    const int count = end - begin;
+    if(count <= build->leafSize) {
+        node->first = begin;
+        node->count = count;
+        return;
+    }
+
+    /* 
+     * Split along the longest axis. The left side always gets a multiple of the
+     * leaf size so every leaf but the last one comes out full
+     */
+    int axis = 0;
+    for(k = 1; k < 3; k++) {
+        if(centroidMax[k] - centroidMin[k] > centroidMax[axis] - centroidMin[axis])
+            axis = k;
+    }
+    const int leftCount = build->leafSize * ((count + 2 * build->leafSize - 1) / (2 * build->leafSize));
+    SelectByCentroid(build, begin, end, begin + leftCount, axis);
+
+    node->count = 0;
+    BuildNode(build, begin, begin + leftCount);
+    build->nodes[nodeIndex].first = build->nodeCount;
+    BuildNode(build, begin + leftCount, end);
+}
+
+/* 
+ * Builds a hierarchy over itemCount boxes (3 floats per corner per item).
+ * outNodes needs room for BVH_NODE_COUNT(itemCount, leafSize) nodes.
+ * outOrder gets the item that belongs in each slot; leaves refer to slots,
+ * so the caller reorders its items to match.
+ */
+void BuildBvh(const float* itemBoundsMin, const float* itemBoundsMax, const int itemCount, const int leafSize,
+    struct BvhNode* outNodes, int* outOrder)
+{
+    struct BvhBuild build;
+    int i;
+    build.itemBoundsMin = itemBoundsMin;
+    build.itemBoundsMax = itemBoundsMax;
+    build.leafSize = leafSize;
+    build.nodes = outNodes;
+    build.nodeCount = 0;
+    build.order = outOrder;
+    for(i = 0; i < itemCount; i++)
+        outOrder[i] = i;
+    BuildNode(&build, 0, itemCount);
+}
+
+/* 
+ * Slab test against a node. Returns the distance the ray enters it,
+ * or FLT_MAX if it misses or enters further away than maxDistance
+ */
+static inline float EnterNode(const struct BvhNode* node, const float* origin, const float* inverseDirection, const float maxDistance)
+{
+    float nearest = 0.0f;
+    float farthest = maxDistance;
+    int k;
+    for(k = 0; k < 3; k++) {
+        /* Axis aligned rays get infinities here, which the min/max handle */
+        float t0 = (node->boundsMin[k] - origin[k]) * inverseDirection[k];
+        float t1 = (node->boundsMax[k] - origin[k]) * inverseDirection[k];
+        nearest = fmaxf(nearest, fminf(t0, t1));
+        farthest = fminf(farthest, fmaxf(t0, t1));
+    }
+    return (nearest <= farthest) ? nearest : FLT_MAX;
+}
+
+/* 
+ * Walks the hierarchy front to back, calling leafFunction on every leaf that
+ * could still have something closer than the closest hit so far
+ */
+void TraverseBvh(const struct BvhNode* nodes, const float* origin, const float* direction, float maxDistance,
+    BvhLeafFunction leafFunction, void* context)
+{
+    const float inverseDirection[3] = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+    int stack[BVH_MAX_DEPTH];
+    float stackDistance[BVH_MAX_DEPTH];
+    int stackSize = 0;
+
+    if(EnterNode(&nodes[0], origin, inverseDirection, maxDistance) == FLT_MAX)
+        return;
+
+    int nodeIndex = 0;
+    for(;;) {
+        const struct BvhNode* node = &nodes[nodeIndex];
+        if(node->count > 0) {
+            leafFunction(context, node->first, node->count, &maxDistance);
+        } else {
+            int left = nodeIndex + 1;
+            int right = node->first;
+            float leftDistance = EnterNode(&nodes[left], origin, inverseDirection, maxDistance);
+            float rightDistance = EnterNode(&nodes[right], origin, inverseDirection, maxDistance);
+            if(leftDistance > rightDistance) {
+                int swap = left;
+                float swapDistance = leftDistance;
+                left = right;
+                right = swap;
+                leftDistance = rightDistance;
+                rightDistance = swapDistance;
+            }
+            if(leftDistance != FLT_MAX) {
+                if(rightDistance != FLT_MAX && stackSize < BVH_MAX_DEPTH) {
+                    stack[stackSize] = right;
+                    stackDistance[stackSize] = rightDistance;
+                    stackSize++;
+                }
+                nodeIndex = left;
+                continue;
+            }
+        }
+
+        /* Pop the next node, skipping the ones a closer hit has ruled out since */
+        do {
+            if(stackSize == 0)
+                return;
+            stackSize--;
+        } while(stackDistance[stackSize] > maxDistance);
+        nodeIndex = stack[stackSize];
+    }
+}
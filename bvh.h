@@ -0,0 +1,37 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+/* 
+ * Bounding volume hierarchy over boxes.
+ * Used as the bottom level (triangle packets of a mesh) and the top level
+ * (mesh instances of a scene).
+ * Nodes are stored depth first: an inner node's left child is right after it
+ * and its right child is at "first". Leaves have count > 0 and cover
+ * items first to first + count - 1.
+ */
+struct BvhNode {
+    float boundsMin[3];
+    int first;
+    float boundsMax[3];
+    int count;
+};
+
+/* Deepest a hierarchy can get and still be traversed */
+#define BVH_MAX_DEPTH 64
+
+/* Building with n items and at most leafSize items per leaf always makes this many nodes */
+#define BVH_NODE_COUNT(itemCount, leafSize) (2 * (((itemCount) + (leafSize) - 1) / (leafSize)) - 1)
+
+/* 
+ * Called for every leaf a ray reaches, closest first.
+ * Shrinks *maxDistance when it finds something closer
+ */
+typedef void (*BvhLeafFunction)(void* context, int first, int count, float* maxDistance);
+
+void BuildBvh(const float* itemBoundsMin, const float* itemBoundsMax, const int itemCount, const int leafSize,
+    struct BvhNode* outNodes, int* outOrder);
+
+void TraverseBvh(const struct BvhNode* nodes, const float* origin, const float* direction, float maxDistance,
+    BvhLeafFunction leafFunction, void* context);
+
+#endif
@@ -0,0 +1,71 @@
+/* syscall() isn't in C99 */
+#define _GNU_SOURCE
+
+/* Default libraries */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* My libraries */
+#include "cachecounter.h"
+
+/* 
+ * Starts counting last level cache misses for this thread only.
+ * Returns CACHE_COUNTER_NONE if there are no counters to be had
+ */
+int OpenCacheMissCounter(void)
+{
+#if defined(__linux__) && defined(SYS_perf_event_open)
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    int counter = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    if(counter < 0)
+        return CACHE_COUNTER_NONE;
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    return counter;
+#else
+    return CACHE_COUNTER_NONE;
+#endif
+}
+
+/* Stops a counter and returns what it counted, or -1 if it never worked */
+long long CloseCacheMissCounter(int counter)
+{
+    if(counter == CACHE_COUNTER_NONE)
+        return -1;
+
+    long long count = -1;
+#ifdef __linux__
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if(read(counter, &count, sizeof(count)) != sizeof(count))
+        count = -1;
+#endif
+    close(counter);
+    return count;
+}
+
+/* Benchmark line for a traced region. countersMissing is how many threads had no counter */
+void PrintCacheMisses(const char* label, long long cacheMisses, const int countersMissing, const long long pixels, const double seconds)
+{
+    if(countersMissing) {
+        printf("%s: %.4f seconds, cache misses not available (no hardware counters, try perf stat -e cache-misses)\n",
+            label, seconds);
+        return;
+    }
+    printf("%s: %.4f seconds, %lld cache misses (%.2f per pixel)\n",
+        label, seconds, cacheMisses, (double)cacheMisses / pixels);
+}
@@ -0,0 +1,18 @@
+#ifndef CACHECOUNTER_H_
+#define CACHECOUNTER_H_
+
+/* 
+ * Counts hardware cache misses for the calling thread (perf_event_open on Linux).
+ * Counters might not exist (virtual machines, containers, perf_event_paranoid)
+ * so everything here copes with that and just reports them as missing.
+ */
+
+#define CACHE_COUNTER_NONE -1
+
+int OpenCacheMissCounter(void);
+
+long long CloseCacheMissCounter(int counter);
+
+void PrintCacheMisses(const char* label, long long cacheMisses, const int countersMissing, const long long pixels, const double seconds);
+
+#endif
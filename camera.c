@@ -0,0 +1,246 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+/* Use SSE for generating rays (if we can) */
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "camera.h"
+
+/* 
+ * Sets up the default camera: the eye sits behind the image plane z = 0 
+ * (see GetEyePosition) and pixel (i, j) is the point (i, j, 0) on it
+ */
+void InitCamera(struct Camera* camera, const int imageWidth, const int imageHeight, const int fieldOfView)
+{
+    GetEyePosition(camera->eyePos, imageWidth, imageHeight, fieldOfView);
+    vec3_scale(camera->rayBase, camera->eyePos, -1.0f);
+
+    vec3 rowStep = {1, 0, 0};
+    vec3 colStep = {0, 1, 0};
+    vec3_dup(camera->rayRowStep, rowStep);
+    vec3_dup(camera->rayColStep, colStep);
+
+    vec3 up = {CAMERA_DEFAULT_UP_X, CAMERA_DEFAULT_UP_Y, CAMERA_DEFAULT_UP_Z};
+    vec3_dup(camera->up, up);
+    camera->verticalFov = (float)fieldOfView;
+    camera->imageWidth = imageWidth;
+    camera->imageHeight = imageHeight;
+    camera->samplesPerPixel = 1;
+    camera->seed = 0;
+}
+
+/* Direction (in view space) through the middle of pixel (row, col) */
+static void UnprojectPixel(mat4x4 inverseProjection, const int row, const int col, const int imageWidth, const int imageHeight, float* outDirection)
+{
+    /* Row 0 is the bottom of the bitmap, just like the bottom of clip space */
+    vec4 clip = {
+        -1.0f + (2.0f * col + 1.0f) / imageWidth,
+        -1.0f + (2.0f * row + 1.0f) / imageHeight,
+        -1.0f, 1.0f
+    };
+    vec4 view;
+    mat4x4_mul_vec4(view, inverseProjection, clip);
+    vec3_scale(outDirection, view, 1.0f / view[3]);
+}
+
+/* 
+ * Sets up a camera at eye looking at target with any orientation.
+ * Built from the usual view and projection matrices: pixels are unprojected
+ * through the inverse projection and turned into world space with the inverse view.
+ */
+void InitLookAtCamera(struct Camera* camera, float* eye, float* target, float* up, const float verticalFovDegrees,
+    const int imageWidth, const int imageHeight)
+{
+    const float pi = 3.1415926f;
+
+    mat4x4 view, inverseView, projection, inverseProjection;
+    mat4x4_look_at(view, eye, target, up);
+    mat4x4_invert(inverseView, view);
+    mat4x4_perspective(projection, verticalFovDegrees * pi / 180.0f, (float)imageWidth / imageHeight, 1.0f, 10000.0f);
+    mat4x4_invert(inverseProjection, projection);
+
+    /* Directions are linear in the pixel so three pixels tell us everything */
+    vec3 origin, nextRow, nextCol;
+    UnprojectPixel(inverseProjection, 0, 0, imageWidth, imageHeight, origin);
+    UnprojectPixel(inverseProjection, 1, 0, imageWidth, imageHeight, nextRow);
+    UnprojectPixel(inverseProjection, 0, 1, imageWidth, imageHeight, nextCol);
+    vec3_sub(nextRow, nextRow, origin);
+    vec3_sub(nextCol, nextCol, origin);
+
+    /* Rotate them into world space (w = 0 so they don't get translated) */
+    vec4 viewDirection, worldDirection;
+    viewDirection[3] = 0.0f;
+    vec3_dup(viewDirection, origin);
+    mat4x4_mul_vec4(worldDirection, inverseView, viewDirection);
+    vec3_dup(camera->rayBase, worldDirection);
+    vec3_dup(viewDirection, nextRow);
+    mat4x4_mul_vec4(worldDirection, inverseView, viewDirection);
+    vec3_dup(camera->rayRowStep, worldDirection);
+    vec3_dup(viewDirection, nextCol);
+    mat4x4_mul_vec4(worldDirection, inverseView, viewDirection);
+    vec3_dup(camera->rayColStep, worldDirection);
+
+    vec3_dup(camera->eyePos, eye);
+    vec3_dup(camera->up, up);
+    camera->verticalFov = verticalFovDegrees;
+    camera->imageWidth = imageWidth;
+    camera->imageHeight = imageHeight;
+    camera->samplesPerPixel = 1;
+    camera->seed = 0;
+}
+
+/* Points an existing camera from eye at target, keeping its up vector, field of view, size and sampling */
+void AimCamera(struct Camera* camera, float* eye, float* target)
+{
+    vec3 up;
+    vec3_dup(up, camera->up);
+    const int samplesPerPixel = camera->samplesPerPixel;
+    const unsigned long long seed = camera->seed;
+    InitLookAtCamera(camera, eye, target, up, camera->verticalFov, camera->imageWidth, camera->imageHeight);
+    camera->samplesPerPixel = samplesPerPixel;
+    camera->seed = seed;
+}
+
+/* Moves the eye without turning the camera */
+void SetCameraPosition(struct Camera* camera, float* position)
+{
+    vec3_dup(camera->eyePos, position);
+}
+
+/* 
+ * Normalized direction of the ray through a single pixel.
+ * Goes through GenerateCameraRays so it matches a tile's rays bit for bit
+ */
+void GetCameraRayDirection(struct Camera* camera, const int row, const int col, float* outDirection)
+{
+    GenerateCameraRays(camera, row, col, 1, 1, &outDirection[0], &outDirection[1], &outDirection[2]);
+}
+
+/* 
+ * Normalizes direction the way GenerateCameraRays does 4 at a time, so both give the same bits.
+ * Exact except in USE_FAST_MATH builds: a fast rsqrt flips the path of a few pixels
+ */
+static void NormalizeRayDirection(float* direction)
+{
+    const float lengthSquared = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+    vec3_scale(direction, direction, inverse_sqrt(lengthSquared));
+}
+
+/*
+ * Normalized direction through any point of the image, for jittered samples.
+ * Pixel (row, col) covers row - 0.5 to row + 0.5 and col - 0.5 to col + 0.5
+ */
+void GetCameraRayDirectionAt(struct Camera* camera, const float row, const float col, float* outDirection)
+{
+    vec3 rowPart, colPart;
+    vec3_scale(rowPart, camera->rayRowStep, row);
+    vec3_scale(colPart, camera->rayColStep, col);
+    vec3_add(outDirection, camera->rayBase, rowPart);
+    vec3_add(outDirection, outDirection, colPart);
+    NormalizeRayDirection(outDirection);
+}
+
+/*
+ * Where position shows up in the image: the (fractional) row and column whose ray goes
+ * through it, the inverse of GetCameraRayDirectionAt. Solves
+ *     position - eye = t * (rayBase + row * rayRowStep + col * rayColStep)
+ * for t, t * row and t * col. Returns 0 if position is behind the camera
+ */
+int ProjectToCamera(const struct Camera* camera, const float* position, float* outRow, float* outCol)
+{
+    vec3 offset, rowCrossCol, colCrossBase, baseCrossRow;
+    vec3_sub(offset, position, camera->eyePos);
+    vec3_mul_cross(rowCrossCol, camera->rayRowStep, camera->rayColStep);
+    vec3_mul_cross(colCrossBase, camera->rayColStep, camera->rayBase);
+    vec3_mul_cross(baseCrossRow, camera->rayBase, camera->rayRowStep);
+    const float determinant = vec3_dot(camera->rayBase, rowCrossCol);
+    const float t = vec3_dot(offset, rowCrossCol) / determinant;
+    if(!(t > 0.0f))
+        return 0;
+    *outRow = vec3_dot(offset, colCrossBase) / determinant / t;
+    *outCol = vec3_dot(offset, baseCrossRow) / determinant / t;
+    return 1;
+}
+
+/*
+ * Makes outCamera see what camera sees with pixels factor times as big: imageWidth / factor by
+ * imageHeight / factor of them (at least one), each looking through the middle of the
+ * factor x factor pixels of camera it covers
+ */
+void ShrinkCamera(struct Camera* outCamera, const struct Camera* camera, const int factor)
+{
+    *outCamera = *camera;
+    vec3 offset;
+    vec3_add(offset, camera->rayRowStep, camera->rayColStep);
+    vec3_add_scaled(outCamera->rayBase, offset, 0.5f * (factor - 1));
+    vec3_scale(outCamera->rayRowStep, camera->rayRowStep, (float)factor);
+    vec3_scale(outCamera->rayColStep, camera->rayColStep, (float)factor);
+    outCamera->imageWidth = camera->imageWidth / factor > 0 ? camera->imageWidth / factor : 1;
+    outCamera->imageHeight = camera->imageHeight / factor > 0 ? camera->imageHeight / factor : 1;
+}
+
+/* 
+ * Generates normalized ray directions for a rows x cols tile starting at (row, col).
+ * Output is stored structure-of-arrays, row after row (index r * cols + c).
+ * Every row starts from an exact base + row * step so errors don't build up down
+ * the tile, and columns are done 4 at a time with SSE.
+ */
+void GenerateCameraRays(struct Camera* camera, const int row, const int col, const int rows, const int cols,
+    float* outX, float* outY, float* outZ)
+{
+    int r, c, k;
+    for(r = 0; r < rows; r++) {
+        vec3 rowDirection;
+        vec3_scale(rowDirection, camera->rayRowStep, (float)(row + r));
+        vec3_add(rowDirection, rowDirection, camera->rayBase);
+
+        float* x = &outX[r * cols];
+        float* y = &outY[r * cols];
+        float* z = &outZ[r * cols];
+        c = 0;
+
+#ifdef __SSE__
+        const __m128 baseX = _mm_set1_ps(rowDirection[0]);
+        const __m128 baseY = _mm_set1_ps(rowDirection[1]);
+        const __m128 baseZ = _mm_set1_ps(rowDirection[2]);
+        const __m128 stepX = _mm_set1_ps(camera->rayColStep[0]);
+        const __m128 stepY = _mm_set1_ps(camera->rayColStep[1]);
+        const __m128 stepZ = _mm_set1_ps(camera->rayColStep[2]);
+        const __m128 four = _mm_set1_ps(4.0f);
+        __m128 columns = _mm_setr_ps((float)col, (float)(col + 1), (float)(col + 2), (float)(col + 3));
+
+        for(; c + 4 <= cols; c += 4) {
+            __m128 dx = _mm_add_ps(baseX, _mm_mul_ps(columns, stepX));
+            __m128 dy = _mm_add_ps(baseY, _mm_mul_ps(columns, stepY));
+            __m128 dz = _mm_add_ps(baseZ, _mm_mul_ps(columns, stepZ));
+            __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 inverseLength = inverse_sqrt4(lengthSquared);
+            _mm_storeu_ps(&x[c], _mm_mul_ps(dx, inverseLength));
+            _mm_storeu_ps(&y[c], _mm_mul_ps(dy, inverseLength));
+            _mm_storeu_ps(&z[c], _mm_mul_ps(dz, inverseLength));
+            columns = _mm_add_ps(columns, four);
+        }
+#endif
+
+        /* Whatever doesn't fit in 4 wide */
+        for(; c < cols; c++) {
+            vec3 direction;
+            for(k = 0; k < 3; k++)
+                direction[k] = rowDirection[k] + (float)(col + c) * camera->rayColStep[k];
+            NormalizeRayDirection(direction);
+            x[c] = direction[0];
+            y[c] = direction[1];
+            z[c] = direction[2];
+        }
+    }
+}
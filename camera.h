@@ -0,0 +1,55 @@
+#ifndef CAMERA_H_
+#define CAMERA_H_
+
+#include "linmath.h"
+
+/* 
+ * Camera that turns pixels into primary rays.
+ * The (unnormalized) direction through pixel (row, col) is
+ *     rayBase + row * rayRowStep + col * rayColStep
+ * so rays for a whole tile can be made with a couple of adds per pixel
+ * instead of a subtract and a full normalize each.
+ */
+struct Camera {
+    vec3 eyePos;
+    vec3 rayBase;
+    vec3 rayRowStep;
+    vec3 rayColStep;
+
+    /* Kept around so a look-at camera can be re-aimed (see AimCamera) */
+    vec3 up;
+    float verticalFov;
+    int imageWidth;
+    int imageHeight;
+
+    /* Jittered samples averaged per pixel, and the seed of the jitter (see rng.h). 1 traces the middle of the pixel */
+    int samplesPerPixel;
+    unsigned long long seed;
+};
+
+/* Default up vector for look-at cameras. Rows of the default camera run along +x */
+#define CAMERA_DEFAULT_UP_X 1.0f
+#define CAMERA_DEFAULT_UP_Y 0.0f
+#define CAMERA_DEFAULT_UP_Z 0.0f
+
+void InitCamera(struct Camera* camera, const int imageWidth, const int imageHeight, const int fieldOfView);
+
+void InitLookAtCamera(struct Camera* camera, float* eye, float* target, float* up, const float verticalFovDegrees,
+    const int imageWidth, const int imageHeight);
+
+void AimCamera(struct Camera* camera, float* eye, float* target);
+
+void SetCameraPosition(struct Camera* camera, float* position);
+
+void GetCameraRayDirection(struct Camera* camera, const int row, const int col, float* outDirection);
+
+void GetCameraRayDirectionAt(struct Camera* camera, const float row, const float col, float* outDirection);
+
+int ProjectToCamera(const struct Camera* camera, const float* position, float* outRow, float* outCol);
+
+void ShrinkCamera(struct Camera* outCamera, const struct Camera* camera, const int factor);
+
+void GenerateCameraRays(struct Camera* camera, const int row, const int col, const int rows, const int cols,
+    float* outX, float* outY, float* outZ);
+
+#endif
@@ -0,0 +1,238 @@
+/* open and fdatasync aren't in C99 */
+#define _POSIX_C_SOURCE 200809L
+
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* My libraries */
+#include "scene.h"
+#include "pixelformat.h"
+#include "timing.h"
+#include "hash.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "RTCKPT01"
+
+/* What comes before the rows of every record */
+struct CheckpointRecord {
+    char magic[8];
+    unsigned long long key;
+    int row;
+    int rowCount;
+    int width;
+    int pixelFormat;
+    unsigned long long payloadSize;
+    unsigned long long checksum;
+};
+
+/* Marks a row of this process done, without writing anything */
+static void MarkRowDone(struct Checkpoint* checkpoint, const int row)
+{
+    const int index = row - checkpoint->rowStart;
+    if(checkpoint->rowDone[index])
+        return;
+    checkpoint->rowDone[index] = 1;
+    checkpoint->bandRowsLeft[row / CHECKPOINT_BAND_ROWS - checkpoint->firstBand]--;
+    checkpoint->resumedRows++;
+}
+
+/*
+ * Copies the rows of this process out of every good record of a journal.
+ * Stops at the first record that isn't complete (what a killed process leaves behind).
+ * Returns 0 if the journal doesn't exist
+ */
+static int ReadJournal(struct Checkpoint* checkpoint, const char* fileName)
+{
+    FILE* file = fopen(fileName, "rb");
+    if(!file)
+        return 0;
+
+    struct CheckpointRecord record;
+    unsigned char* payload = NULL;
+    size_t payloadCapacity = 0;
+    while(fread(&record, sizeof(record), 1, file) == 1 && memcmp(record.magic, CHECKPOINT_MAGIC, 8) == 0) {
+        if(record.payloadSize > payloadCapacity) {
+            unsigned char* grown = (unsigned char*)realloc(payload, record.payloadSize);
+            if(!grown)
+                break;
+            payload = grown;
+            payloadCapacity = record.payloadSize;
+        }
+        if(fread(payload, 1, record.payloadSize, file) != record.payloadSize)
+            break;
+
+        if(record.key != checkpoint->key || record.width != checkpoint->width
+            || record.pixelFormat != checkpoint->pixelFormat || record.rowCount <= 0
+            || record.payloadSize != (unsigned long long)record.rowCount * checkpoint->rowBytes
+            || HashBytes(HASH_SEED, payload, record.payloadSize) != record.checksum) {
+            checkpoint->ignoredRecords++;
+            continue;
+        }
+
+        /* Only the rows that are this process's */
+        int row;
+        for(row = record.row; row < record.row + record.rowCount; row++) {
+            if(row < checkpoint->rowStart || row >= checkpoint->rowStart + checkpoint->rowCount)
+                continue;
+            memcpy(checkpoint->rows + (size_t)(row - checkpoint->rowStart) * checkpoint->rowBytes,
+                payload + (size_t)(row - record.row) * checkpoint->rowBytes, checkpoint->rowBytes);
+            MarkRowDone(checkpoint, row);
+        }
+    }
+    free(payload);
+    fclose(file);
+    return 1;
+}
+
+/*
+ * Sets up checkpointing of rowCount rows starting at rowStart, which get rendered into rows.
+ * With resume the rows already in the journals are copied into rows first (see IsCheckpointRowDone),
+ * otherwise this process's journal starts over. Returns 1 on success
+ */
+int OpenCheckpoint(struct Checkpoint* checkpoint, const char* fileName, const int resume, const unsigned long long key,
+    const int width, const int pixelFormat, const int rowStart, const int rowCount, void* rows,
+    const int worldRank, const int worldSize)
+{
+    memset(checkpoint, 0, sizeof(*checkpoint));
+    checkpoint->file = -1;
+    checkpoint->key = key;
+    checkpoint->width = width;
+    checkpoint->pixelFormat = pixelFormat;
+    checkpoint->rowBytes = (size_t)width * GetPixelFormatSize(pixelFormat);
+    checkpoint->rowStart = rowStart;
+    checkpoint->rowCount = rowCount;
+    checkpoint->rows = (unsigned char*)rows;
+    checkpoint->lastSync = GetSeconds();
+
+    checkpoint->firstBand = rowStart / CHECKPOINT_BAND_ROWS;
+    const int bandCount = (rowStart + rowCount - 1) / CHECKPOINT_BAND_ROWS - checkpoint->firstBand + 1;
+    checkpoint->rowDone = (unsigned char*)calloc(rowCount, 1);
+    checkpoint->bandRowsLeft = (int*)malloc(bandCount * sizeof(int));
+    if(!checkpoint->rowDone || !checkpoint->bandRowsLeft) {
+        CloseCheckpoint(checkpoint);
+        return 0;
+    }
+    int band;
+    for(band = 0; band < bandCount; band++) {
+        const int first = (checkpoint->firstBand + band) * CHECKPOINT_BAND_ROWS;
+        const int begin = first > rowStart ? first : rowStart;
+        const int end = first + CHECKPOINT_BAND_ROWS < rowStart + rowCount ? first + CHECKPOINT_BAND_ROWS : rowStart + rowCount;
+        checkpoint->bandRowsLeft[band] = end - begin;
+    }
+
+    if(worldSize > 1)
+        snprintf(checkpoint->fileName, sizeof(checkpoint->fileName), "%s.%d", fileName, worldRank);
+    else
+        snprintf(checkpoint->fileName, sizeof(checkpoint->fileName), "%s", fileName);
+
+    if(resume) {
+        char journalName[512];
+        int i;
+        ReadJournal(checkpoint, fileName);
+        for(i = 0; ; i++) {
+            snprintf(journalName, sizeof(journalName), "%s.%d", fileName, i);
+            if(!ReadJournal(checkpoint, journalName))
+                break;
+        }
+    }
+
+    checkpoint->file = open(checkpoint->fileName, O_WRONLY | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC), 0644);
+    if(checkpoint->file < 0) {
+        printf("could not open checkpoint journal %s\n", checkpoint->fileName);
+        CloseCheckpoint(checkpoint);
+        return 0;
+    }
+    return 1;
+}
+
+/* Whether a row (in the whole image) came from the journal and doesn't need to be traced */
+int IsCheckpointRowDone(const struct Checkpoint* checkpoint, const int row)
+{
+    return checkpoint->rowDone[row - checkpoint->rowStart];
+}
+
+/* Appends the band (as far as it's this process's) to the journal in one write */
+static void WriteBand(struct Checkpoint* checkpoint, const int band)
+{
+    const int first = band * CHECKPOINT_BAND_ROWS;
+    const int begin = first > checkpoint->rowStart ? first : checkpoint->rowStart;
+    const int end = first + CHECKPOINT_BAND_ROWS < checkpoint->rowStart + checkpoint->rowCount
+        ? first + CHECKPOINT_BAND_ROWS : checkpoint->rowStart + checkpoint->rowCount;
+
+    struct CheckpointRecord record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.magic, CHECKPOINT_MAGIC, 8);
+    record.key = checkpoint->key;
+    record.row = begin;
+    record.rowCount = end - begin;
+    record.width = checkpoint->width;
+    record.pixelFormat = checkpoint->pixelFormat;
+    record.payloadSize = (unsigned long long)record.rowCount * checkpoint->rowBytes;
+
+    const unsigned char* payload = checkpoint->rows + (size_t)(begin - checkpoint->rowStart) * checkpoint->rowBytes;
+    record.checksum = HashBytes(HASH_SEED, payload, record.payloadSize);
+
+    unsigned char* buffer = (unsigned char*)malloc(sizeof(record) + record.payloadSize);
+    int written = 0;
+    if(buffer) {
+        memcpy(buffer, &record, sizeof(record));
+        memcpy(buffer + sizeof(record), payload, record.payloadSize);
+        written = write(checkpoint->file, buffer, sizeof(record) + record.payloadSize)
+            == (ssize_t)(sizeof(record) + record.payloadSize);
+        free(buffer);
+    }
+
+    int syncNow = 0;
+#ifdef USE_OPENMP
+    #pragma omp critical(checkpointStats)
+#endif
+    {
+        if(written) {
+            checkpoint->bandsWritten++;
+        } else if(!checkpoint->writeFailed) {
+            checkpoint->writeFailed = 1;
+            printf("could not write to checkpoint journal %s, rows after this aren't saved\n", checkpoint->fileName);
+        }
+        if(written && GetSeconds() - checkpoint->lastSync >= CHECKPOINT_SYNC_SECONDS) {
+            checkpoint->lastSync = GetSeconds();
+            syncNow = 1;
+        }
+    }
+    if(syncNow)
+        fdatasync(checkpoint->file);
+}
+
+/*
+ * Call once a row has been traced into the rows. Thread safe: whoever
+ * finishes the last row of a band appends the band to the journal
+ */
+void FinishCheckpointRow(struct Checkpoint* checkpoint, const int row)
+{
+    const int band = row / CHECKPOINT_BAND_ROWS;
+    int left;
+    checkpoint->rowDone[row - checkpoint->rowStart] = 1;
+#ifdef USE_OPENMP
+    #pragma omp atomic capture
+#endif
+    left = --checkpoint->bandRowsLeft[band - checkpoint->firstBand];
+    if(left == 0)
+        WriteBand(checkpoint, band);
+}
+
+/* Flushes and closes the journal */
+void CloseCheckpoint(struct Checkpoint* checkpoint)
+{
+    if(checkpoint->file >= 0) {
+        fdatasync(checkpoint->file);
+        close(checkpoint->file);
+    }
+    checkpoint->file = -1;
+    free(checkpoint->rowDone);
+    free(checkpoint->bandRowsLeft);
+    checkpoint->rowDone = NULL;
+    checkpoint->bandRowsLeft = NULL;
+}
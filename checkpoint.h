@@ -0,0 +1,67 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stddef.h>
+
+/*
+ * Checkpoint journal for long renders (see --checkpoint and --resume).
+ *
+ * Every finished band of CHECKPOINT_BAND_ROWS rows (clipped to the process's rows) is
+ * appended to a journal as one record: which rows, a key for the render they belong to,
+ * a checksum and the rows as they're stored (see --pixel-format). A record is written
+ * with a single write() to a file opened for appending, so a process that gets killed
+ * leaves at most one torn record at the end, which the checksum catches.
+ * With more than one process each one appends to FILE.rank, otherwise to FILE.
+ *
+ * Resuming reads every journal (FILE, then FILE.0, FILE.1, ... up to the first that doesn't exist),
+ * copies the rows of records with the right key into the image and only traces the rest.
+ * Rows are identified by where they are in the image, so a render can be resumed with a
+ * different number of processes or a different --partition.
+ */
+
+/* Rows per journal record */
+#define CHECKPOINT_BAND_ROWS 16
+
+/* Journals are flushed to disk at most this often, so a lost node loses at most this much */
+#define CHECKPOINT_SYNC_SECONDS 10.0
+
+struct Checkpoint {
+    /* This process's journal, open for appending */
+    int file;
+    char fileName[512];
+
+    /* Which render the records belong to (see GetRenderKey) */
+    unsigned long long key;
+
+    /* This process's rows of the image, as they're stored */
+    int width;
+    int pixelFormat;
+    size_t rowBytes;
+    int rowStart;
+    int rowCount;
+    unsigned char* rows;
+
+    /* Rows (of this process) that are done, and rows left in every band */
+    unsigned char* rowDone;
+    int* bandRowsLeft;
+    int firstBand;
+
+    /* Stats */
+    int resumedRows;
+    int ignoredRecords;
+    int bandsWritten;
+    int writeFailed;
+    double lastSync;
+};
+
+int OpenCheckpoint(struct Checkpoint* checkpoint, const char* fileName, const int resume, const unsigned long long key,
+    const int width, const int pixelFormat, const int rowStart, const int rowCount, void* rows,
+    const int worldRank, const int worldSize);
+
+int IsCheckpointRowDone(const struct Checkpoint* checkpoint, const int row);
+
+void FinishCheckpointRow(struct Checkpoint* checkpoint, const int row);
+
+void CloseCheckpoint(struct Checkpoint* checkpoint);
+
+#endif
@@ -0,0 +1,175 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "denoise.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* 1D B3 spline kernel, the 5x5 kernel is its outer product */
+static const float DENOISE_KERNEL[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+/* Keeps what the denoiser needs from a pixel's primary hit */
+void SetDenoiseGuide(struct DenoiseGuide* guide, const struct RayHit* primaryHit)
+{
+    guide->primitiveId = primaryHit->primitiveId;
+    if(primaryHit->primitiveId < 0) {
+        vec3_zero(guide->normal);
+        vec3_zero(guide->color);
+        guide->depth = 0.0f;
+        guide->colorVariance = -1.0f;
+        return;
+    }
+    vec3_dup(guide->normal, primaryHit->normal);
+    vec3_dup(guide->color, primaryHit->color);
+    guide->depth = primaryHit->distance;
+    guide->colorVariance = primaryHit->colorVariance;
+}
+
+/* For a pixel that wasn't traced, so nothing is known about it: it's left as it is */
+void SetMissingDenoiseGuide(struct DenoiseGuide* guide)
+{
+    guide->primitiveId = DENOISE_NO_GUIDE;
+}
+
+/*
+ * One pass over the pixels of a tile, from "from" into "to" with taps step pixels apart.
+ * Variances (fromVariances into toVariances) are the variance of each pixel's brightness,
+ * -1 if it isn't known: the tolerance is then fixedTolerance
+ */
+static void DenoiseTile(const float* from, const float* fromVariances, float* to, float* toVariances,
+    const struct DenoiseGuide* guides, const int width, const int height, const int tileRow, const int tileCol,
+    const int step, const float fixedTolerance, const float minTolerance)
+{
+    const int rowEnd = tileRow + DENOISE_TILE_SIZE < height ? tileRow + DENOISE_TILE_SIZE : height;
+    const int colEnd = tileCol + DENOISE_TILE_SIZE < width ? tileCol + DENOISE_TILE_SIZE : width;
+    int row, col, i, j, k;
+
+    for(row = tileRow; row < rowEnd; row++) {
+        for(col = tileCol; col < colEnd; col++) {
+            const size_t index = (size_t)row * width + col;
+            const struct DenoiseGuide* guide = &guides[index];
+            const float* color = &from[index * 3];
+            const float variance = fromVariances[index];
+
+            /* Nothing was hit (or nothing is known about it), there's nothing to filter */
+            if(guide->primitiveId < 0) {
+                vec3_dup(&to[index * 3], color);
+                toVariances[index] = variance;
+                continue;
+            }
+
+            const float brightness = (color[0] + color[1] + color[2]) / 3.0f;
+            const float tolerance = fmaxf(minTolerance, variance < 0.0f ? fixedTolerance : DENOISE_VARIANCE_SIGMA * sqrtf(variance));
+            const float brightnessScale = 1.0f / (tolerance * tolerance);
+            const float depthScale = 1.0f / (DENOISE_DEPTH_SIGMA * step * guide->depth);
+            vec3 sum = {0, 0, 0};
+            float weightSum = 0.0f;
+            float varianceSum = 0.0f;
+            for(i = 0; i < 5; i++) {
+                const int tapRow = row + (i - 2) * step;
+                if(tapRow < 0 || tapRow >= height)
+                    continue;
+                for(j = 0; j < 5; j++) {
+                    const int tapCol = col + (j - 2) * step;
+                    if(tapCol < 0 || tapCol >= width)
+                        continue;
+                    const size_t tapIndex = (size_t)tapRow * width + tapCol;
+                    const struct DenoiseGuide* tapGuide = &guides[tapIndex];
+                    if(tapGuide->primitiveId != guide->primitiveId)
+                        continue;
+
+                    const float* tapColor = &from[tapIndex * 3];
+                    const float difference = (tapColor[0] + tapColor[1] + tapColor[2]) / 3.0f - brightness;
+                    float facing = fmaxf(0.0f, vec3_dot(tapGuide->normal, guide->normal));
+                    for(k = 0; k < DENOISE_NORMAL_SQUARINGS; k++)
+                        facing *= facing;
+                    const float weight = DENOISE_KERNEL[i] * DENOISE_KERNEL[j] * facing
+                        * expf(-fabsf(tapGuide->depth - guide->depth) * depthScale - difference * difference * brightnessScale);
+                    vec3_add_scaled(sum, tapColor, weight);
+                    weightSum += weight;
+                    varianceSum += weight * weight * fmaxf(0.0f, fromVariances[tapIndex]);
+                }
+            }
+
+            /* The pixel itself always counts, so weightSum is never 0 */
+            vec3_scale(&to[index * 3], sum, 1.0f / weightSum);
+            toVariances[index] = variance < 0.0f ? variance : varianceSum / (weightSum * weightSum);
+        }
+    }
+}
+
+/*
+ * Denoises width x height float pixels in place, guided by what every pixel's camera ray hit
+ * (guides, same layout) with passes passes of the a-trous filter (see denoise.h)
+ */
+void DenoiseImage(float* pixels, const struct DenoiseGuide* guides, const int width, const int height, const int passes)
+{
+    const size_t pixelCount = (size_t)width * height;
+    const int tilesAcross = (width + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+    const int tileCount = tilesAcross * ((height + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE);
+    float* buffers = (float*)malloc(pixelCount * (sizeof(vec3) + sizeof(float)) * 2);
+    if(!buffers)
+        return;
+    float* from = buffers;
+    float* to = buffers + pixelCount * 3;
+    float* fromVariances = buffers + pixelCount * 6;
+    float* toVariances = buffers + pixelCount * 7;
+    size_t i;
+
+    /* Tolerances are relative to the brightest primary hit */
+    float maxLightingValue = 0.0f;
+    for(i = 0; i < pixelCount; i++) {
+        const struct DenoiseGuide* guide = &guides[i];
+        vec3_dup(&from[i * 3], guide->color);
+        fromVariances[i] = guide->colorVariance;
+        if(guide->primitiveId >= 0)
+            maxLightingValue = fmaxf(maxLightingValue, fmaxf(guide->color[0], fmaxf(guide->color[1], guide->color[2])));
+    }
+    if(!(maxLightingValue > 0.0f)) {
+        free(buffers);
+        return;
+    }
+
+    /* Passes go back and forth between the two buffers */
+    int pass, tile;
+    for(pass = 0; pass < passes; pass++) {
+        const int step = 1 << pass;
+        const float fixedTolerance = DENOISE_COLOR_SIGMA * maxLightingValue / step;
+        const float minTolerance = DENOISE_MIN_TOLERANCE * maxLightingValue;
+
+#ifdef USE_OPENMP
+        #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) private(tile) schedule(dynamic, 1)
+#endif
+        for(tile = 0; tile < tileCount; tile++)
+            DenoiseTile(from, fromVariances, to, toVariances, guides, width, height,
+                (tile / tilesAcross) * DENOISE_TILE_SIZE, (tile % tilesAcross) * DENOISE_TILE_SIZE,
+                step, fixedTolerance, minTolerance);
+
+        float* swap = from;
+        from = to;
+        to = swap;
+        swap = fromVariances;
+        fromVariances = toVariances;
+        toVariances = swap;
+    }
+
+    /* Swap the primary hits' light for the filtered one, their reflections stay */
+    for(i = 0; i < pixelCount; i++) {
+        if(guides[i].primitiveId < 0)
+            continue;
+        vec3 change;
+        vec3_sub(change, &from[i * 3], guides[i].color);
+        vec3_add(&pixels[i * 3], &pixels[i * 3], change);
+    }
+    free(buffers);
+}
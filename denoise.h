@@ -0,0 +1,73 @@
+#ifndef DENOISE_H_
+#define DENOISE_H_
+
+#include "raytracer.h"
+
+/*
+ * Edge-aware denoiser (--denoise), run on the float image between tracing and the tonemap.
+ *
+ * An a-trous wavelet filter ("Edge-Avoiding A-Trous Wavelet Transform for fast Global
+ * Illumination Filtering", Dammertz et al. 2010): every pass blurs with a 5x5 B3 spline
+ * kernel whose taps are spread 1, 2, 4, 8... pixels apart, so a few passes of 25 taps reach
+ * as far as a huge kernel would. Each tap is weighted down by how different it is from the
+ * pixel being filtered, using what its camera ray hit first (its guide): a tap on another
+ * primitive counts nothing, facing another way (normal) or lying at another depth counts
+ * less, and so does a brightness that's too different. With --spp every pixel knows how
+ * noisy it is (the variance of its samples, which every pass filters along, as in SVGF), so
+ * only differences the noise can't explain stop the filter. With one sample the tolerance is
+ * a share of the brightest value instead, halved every pass.
+ *
+ * Only the light of the primary hit itself (its shadow rays) is filtered, what its reflections
+ * add is kept as traced. Nearly every surface here reflects, and on a curved mirror the
+ * reflection changes faster from pixel to pixel than the primary hit can tell: filtering it
+ * too blurred detail away and made the image worse than the noise did.
+ *
+ * Passes go over the image in tiles, spread over the threads. A pass needs the whole image
+ * of the previous one, so the denoiser always sees the full image (with MPI, on the root).
+ */
+
+/* Passes by default (taps reach 2 * (1 + 2 + 4 + 8) = 30 pixels), and at most */
+#define DENOISE_DEFAULT_PASSES 4
+#define DENOISE_MAX_PASSES 8
+
+/* With --spp, brightness differences of this many standard deviations of the noise are cut off at */
+#define DENOISE_VARIANCE_SIGMA 4.0f
+
+/* With one sample, brightness difference (relative to the brightest pixel) cut off at in the first pass */
+#define DENOISE_COLOR_SIGMA 0.1f
+
+/* Smallest tolerance either way (relative to the brightest pixel) */
+#define DENOISE_MIN_TOLERANCE 0.001f
+
+/* Normals are compared by their dot product squared this many times (to the power 64) */
+#define DENOISE_NORMAL_SQUARINGS 6
+
+/* Relative depth difference per pixel of tap distance a tap is cut off at */
+#define DENOISE_DEPTH_SIGMA 0.02f
+
+/* Pixels per side of the tiles a pass is split into */
+#define DENOISE_TILE_SIZE 32
+
+/* primitiveId of a pixel without a guide (taken from a --resume journal), it's left as it is */
+#define DENOISE_NO_GUIDE -3
+
+/*
+ * What a pixel's camera ray hit first and the light of that hit alone (see RayHit).
+ * depth is how far along the ray it is. Pixels with a negative primitiveId (no hit, or
+ * --spp samples that hit different primitives) aren't filtered
+ */
+struct DenoiseGuide {
+    vec3 normal;
+    float depth;
+    int primitiveId;
+    vec3 color;
+    float colorVariance;
+};
+
+void SetDenoiseGuide(struct DenoiseGuide* guide, const struct RayHit* primaryHit);
+
+void SetMissingDenoiseGuide(struct DenoiseGuide* guide);
+
+void DenoiseImage(float* pixels, const struct DenoiseGuide* guides, const int width, const int height, const int passes);
+
+#endif
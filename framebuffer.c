@@ -0,0 +1,244 @@
+/* posix_memalign isn't in C99 */
+#define _POSIX_C_SOURCE 200809L
+
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "camera.h"
+#include "cachecounter.h"
+#include "pixelformat.h"
+#include "framebuffer.h"
+#include "numa.h"
+#include "tilecull.h"
+#include "denoise.h"
+#include "temporal.h"
+#include "schedule.h"
+#include "heatmap.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* Takes every other bit (0, 2, 4, ..., 14) and squashes them together */
+static inline int CompactBits(int value)
+{
+    value &= 0x5555;
+    value = (value | (value >> 1)) & 0x3333;
+    value = (value | (value >> 2)) & 0x0f0f;
+    value = (value | (value >> 4)) & 0x00ff;
+    return value;
+}
+
+/* Spreads the bits of a tile coordinate out to every other bit (the opposite of CompactBits) */
+static inline int MortonBits(int value)
+{
+    value &= 0x00ff;
+    value = (value | (value << 4)) & 0x0f0f;
+    value = (value | (value << 2)) & 0x3333;
+    value = (value | (value << 1)) & 0x5555;
+    return value;
+}
+
+/* Where the index-th pixel of a tile (in Morton order) sits in the tile */
+static inline void MortonToTile(const int index, int* outRow, int* outCol)
+{
+    *outCol = CompactBits(index);
+    *outRow = CompactBits(index >> 1);
+}
+
+/*
+ * tileSize has to be a power of two (see SCHEDULE_MAX_TILE_SIZE).
+ * With numa set the tiles are first touched by the threads that will trace them
+ * (see numa.h) instead of all at once by the calling thread
+ */
+struct Framebuffer* NewFramebuffer(const int width, const int rowStart, const int rowCount, const int tileSize,
+    const int numa)
+{
+    struct Framebuffer* framebuffer = (struct Framebuffer*)malloc(sizeof(struct Framebuffer));
+    framebuffer->width = width;
+    framebuffer->rowStart = rowStart;
+    framebuffer->rowCount = rowCount;
+    framebuffer->tileSize = tileSize;
+    framebuffer->tilePixels = tileSize * tileSize;
+    framebuffer->tilesAcross = (width + tileSize - 1) / tileSize;
+    framebuffer->tilesDown = (rowCount + tileSize - 1) / tileSize;
+
+    /* Edge tiles are stored whole too, which keeps every tile the same size and aligned */
+    const int tileCount = framebuffer->tilesAcross * framebuffer->tilesDown;
+    const size_t tileBytes = framebuffer->tilePixels * sizeof(vec3);
+    framebuffer->numaChunk = 0;
+    if(numa) {
+#ifdef USE_OPENMP
+        framebuffer->numaChunk = GetNumaChunk(tileBytes, tileCount, OPENMP_THREAD_AMOUNT);
+#else
+        framebuffer->numaChunk = GetNumaChunk(tileBytes, tileCount, 1);
+#endif
+        framebuffer->tiles = (float*)AllocateNumaMemory(tileCount * tileBytes);
+        if(!framebuffer->tiles) {
+            free(framebuffer);
+            return NULL;
+        }
+        FirstTouchNuma(framebuffer->tiles, tileBytes, tileCount, framebuffer->numaChunk);
+        return framebuffer;
+    }
+
+    if(posix_memalign((void**)&framebuffer->tiles, 64, tileCount * tileBytes) != 0) {
+        printf("could not allocate a %d:%d framebuffer\n", width, rowCount);
+        free(framebuffer);
+        return NULL;
+    }
+    memset(framebuffer->tiles, 0, tileCount * tileBytes);
+    return framebuffer;
+}
+
+void FreeFramebuffer(struct Framebuffer* framebuffer)
+{
+    if(!framebuffer)
+        return;
+    free(framebuffer->tiles);
+    free(framebuffer);
+}
+
+/* 
+ * Traces one tile, Morton order, straight into its memory.
+ * Also keeps the tile's primary hits in outGuides (width per row, see denoise.h) unless it's NULL,
+ * and takes the light of primary hits from the previous frame with a temporal cache (see temporal.h).
+ * With a heatmap the tile is timed as one of its cells (see heatmap.h).
+ * Returns how many circle and plane tests its primary rays needed after culling (see tilecull.h)
+ */
+static long long RenderTile(struct Scene* scene, struct Camera* camera, struct Framebuffer* framebuffer, const int tile,
+    struct DenoiseGuide* outGuides, struct TemporalCache* temporal, struct Heatmap* heatmap)
+{
+    struct HeatmapTimer timer;
+    if(heatmap)
+        StartHeatmapCell(&timer);
+    const int tileSize = framebuffer->tileSize;
+    const int tileRow = (tile / framebuffer->tilesAcross) * tileSize;
+    const int tileCol = (tile % framebuffer->tilesAcross) * tileSize;
+    int rows = framebuffer->rowCount - tileRow;
+    int cols = framebuffer->width - tileCol;
+    if(rows > tileSize)
+        rows = tileSize;
+    if(cols > tileSize)
+        cols = tileSize;
+
+    /* Primary rays for the whole tile in one go (rows x cols, row by row) */
+    float directionX[SCHEDULE_MAX_TILE_SIZE * SCHEDULE_MAX_TILE_SIZE];
+    float directionY[SCHEDULE_MAX_TILE_SIZE * SCHEDULE_MAX_TILE_SIZE];
+    float directionZ[SCHEDULE_MAX_TILE_SIZE * SCHEDULE_MAX_TILE_SIZE];
+    GenerateCameraRays(camera, framebuffer->rowStart + tileRow, tileCol, rows, cols, directionX, directionY, directionZ);
+    struct PrimitiveList primaryList;
+    BuildPrimitiveList(scene, camera, framebuffer->rowStart + tileRow, tileCol, rows, cols, &primaryList);
+
+    float* tilePixels = &framebuffer->tiles[(size_t)tile * framebuffer->tilePixels * 3];
+    int index;
+    for(index = 0; index < framebuffer->tilePixels; index++) {
+        int row, col;
+        MortonToTile(index, &row, &col);
+        if(row >= rows || col >= cols)
+            continue;
+
+        vec3 finalOutput = {0, 0, 0};
+        vec3 direction = {directionX[row*cols + col], directionY[row*cols + col], directionZ[row*cols + col]};
+        int pathLength = 0;
+        struct RayHit primaryHit;
+        if(temporal)
+            TraceTemporalPixel(temporal, scene, camera, &primaryList, framebuffer->rowStart + tileRow + row, tileCol + col,
+                direction, finalOutput, outGuides ? &primaryHit : NULL);
+        else
+            TraceCameraRayDirection(scene, camera, &primaryList, framebuffer->rowStart + tileRow + row, tileCol + col, direction,
+                finalOutput, outGuides ? &primaryHit : NULL, NULL, &pathLength);
+        vec3_dup(&tilePixels[index*3], finalOutput);
+        if(outGuides)
+            SetDenoiseGuide(&outGuides[(size_t)(tileRow + row) * framebuffer->width + tileCol + col], &primaryHit);
+    }
+    if(heatmap)
+        FinishHeatmapCell(heatmap, &timer, framebuffer->rowStart + tileRow, tileCol, rows, cols);
+    return (long long)(primaryList.circleCount + primaryList.planeCount) * rows * cols;
+}
+
+/* 
+ * Traces every pixel of the framebuffer, one tile per thread at a time unless the schedule
+ * says otherwise (or numaChunk tiles per thread in turn, matching how they were first touched).
+ * Also counts the cache misses of every thread (see cachecounter.h) and the
+ * circle and plane tests primary rays needed (see tilecull.h).
+ * outGuides gets every pixel's primary hit row by row for the denoiser (can be NULL),
+ * heatmap (can be NULL) what every tile cost
+ */
+void RenderFramebuffer(struct Scene* scene, struct Camera* camera, struct Framebuffer* framebuffer,
+    const struct TraceSchedule* schedule, struct DenoiseGuide* outGuides, struct TemporalCache* temporal,
+    struct Heatmap* heatmap, long long* outCacheMisses, int* outCountersMissing, long long* outPrimaryTests)
+{
+    const int tileCount = framebuffer->tilesAcross * framebuffer->tilesDown;
+    long long primaryTests = 0;
+    long long cacheMisses = 0;
+    int countersMissing = 0;
+    int tile;
+
+#ifdef USE_OPENMP
+    if(framebuffer->numaChunk > 0)
+        omp_set_schedule(omp_sched_static, framebuffer->numaChunk);
+    else
+        ApplyTraceSchedule(schedule, SCHEDULE_DYNAMIC, 1);
+    #pragma omp parallel num_threads(schedule->threads) private(tile) reduction(+:cacheMisses, countersMissing, primaryTests)
+#else
+    (void)schedule;
+#endif
+    {
+        int counter = OpenCacheMissCounter();
+#ifdef USE_OPENMP
+        #pragma omp for schedule(runtime)
+#endif
+        for(tile = 0; tile < tileCount; tile++)
+            primaryTests += RenderTile(scene, camera, framebuffer, tile, outGuides, temporal, heatmap);
+
+        long long count = CloseCacheMissCounter(counter);
+        if(count < 0)
+            countersMissing++;
+        else
+            cacheMisses += count;
+    }
+
+    *outCacheMisses = cacheMisses;
+    *outCountersMissing = countersMissing;
+    *outPrimaryTests = primaryTests;
+}
+
+/* Converts to the usual row by row layout (width * rowCount pixels, stored in pixelFormat) for writing out */
+void FramebufferToRows(struct Framebuffer* framebuffer, const int pixelFormat, void* outRows)
+{
+    const int width = framebuffer->width;
+    const size_t rowBytes = (size_t)width * GetPixelFormatSize(pixelFormat);
+    int row;
+
+#ifdef USE_OPENMP
+    #pragma omp parallel num_threads(OPENMP_THREAD_AMOUNT) private(row)
+#endif
+    {
+        float* rowPixels = (float*)malloc(width * sizeof(vec3));
+        int col;
+#ifdef USE_OPENMP
+        #pragma omp for
+#endif
+        for(row = 0; row < framebuffer->rowCount; row++) {
+            const int tileRow = row / framebuffer->tileSize;
+            const int mortonRow = MortonBits(row % framebuffer->tileSize) << 1;
+            for(col = 0; col < width; col++) {
+                const int tile = tileRow * framebuffer->tilesAcross + col / framebuffer->tileSize;
+                const int index = mortonRow | MortonBits(col % framebuffer->tileSize);
+                vec3_dup(&rowPixels[col*3], &framebuffer->tiles[((size_t)tile * framebuffer->tilePixels + index) * 3]);
+            }
+            PackPixels(pixelFormat, rowPixels, (unsigned char*)outRows + row * rowBytes, width);
+        }
+        free(rowPixels);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+/* 
+ * Tiled float framebuffer.
+ * Tiles are stored one after another instead of whole rows, and pixels inside a
+ * tile are stored (and traced) in Morton (Z) order, so neighbouring rays touch
+ * neighbouring memory. Every tile starts on a cache line, so threads working on
+ * different tiles never share one.
+ * It only gets turned back into rows (and the --pixel-format) when the image is written out.
+ */
+
+/*
+ * Tile size of --layout tiled (see --tile-size). 16x16 pixels of 3 floats is 3072 bytes,
+ * and any power of two from 4 up is a whole number of cache lines too
+ */
+#define FRAMEBUFFER_TILE_SIZE 16
+
+struct Scene;
+struct Camera;
+struct DenoiseGuide;
+struct TemporalCache;
+struct TraceSchedule;
+struct Heatmap;
+
+/* Covers rows rowStart to rowStart + rowCount - 1 of the image */
+struct Framebuffer {
+    int width;
+    int rowStart;
+    int rowCount;
+    int tileSize;
+    int tilePixels;
+    int tilesAcross;
+    int tilesDown;
+    float* tiles;
+
+    /* Tiles each thread takes in turn when tiles are placed for NUMA (see numa.h), 0 otherwise */
+    int numaChunk;
+};
+
+struct Framebuffer* NewFramebuffer(const int width, const int rowStart, const int rowCount, const int tileSize,
+    const int numa);
+
+void FreeFramebuffer(struct Framebuffer* framebuffer);
+
+void RenderFramebuffer(struct Scene* scene, struct Camera* camera, struct Framebuffer* framebuffer,
+    const struct TraceSchedule* schedule, struct DenoiseGuide* outGuides, struct TemporalCache* temporal,
+    struct Heatmap* heatmap, long long* outCacheMisses, int* outCountersMissing, long long* outPrimaryTests);
+
+void FramebufferToRows(struct Framebuffer* framebuffer, const int pixelFormat, void* outRows);
+
+#endif
@@ -0,0 +1,306 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "gbuffer.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* Include MPI (if needed) */
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+/* Identifies G-buffer files (and their version) */
+static const char GBUFFER_FILE_MAGIC[8] = {'R', 'T', 'G', 'B', 'U', 'F', '0', '1'};
+
+/* Makes a G-buffer for rowCount rows of the image starting at rowStart */
+struct GBuffer* NewGBuffer(const int width, const int height, const int rowStart, const int rowCount)
+{
+    struct GBuffer* gbuffer = (struct GBuffer*)calloc(1, sizeof(struct GBuffer));
+    gbuffer->width = width;
+    gbuffer->height = height;
+    gbuffer->rowStart = rowStart;
+    gbuffer->rowCount = rowCount;
+    gbuffer->rows = (struct GBufferRow*)calloc(rowCount, sizeof(struct GBufferRow));
+    return gbuffer;
+}
+
+static void FreeGBufferRows(struct GBuffer* gbuffer)
+{
+    int i;
+    if(!gbuffer->rows)
+        return;
+    for(i = 0; i < gbuffer->rowCount; i++) {
+        free(gbuffer->rows[i].hits);
+        free(gbuffer->rows[i].levels);
+    }
+    free(gbuffer->rows);
+    gbuffer->rows = NULL;
+}
+
+void FreeGBuffer(struct GBuffer* gbuffer)
+{
+    int i;
+    if(!gbuffer)
+        return;
+    FreeGBufferRows(gbuffer);
+    for(i = 0; i < gbuffer->levelCount; i++)
+        free(gbuffer->levels[i].hits);
+    free(gbuffer);
+}
+
+/* 
+ * Stores the path traced through (row, col). row is relative to rowStart.
+ * Only the thread tracing a row may add to it.
+ */
+void AddGBufferPath(struct GBuffer* gbuffer, const int row, const int col, struct PathVertex* path, const int pathLength)
+{
+    struct GBufferRow* gbufferRow = &gbuffer->rows[row];
+    int i;
+
+    if(gbufferRow->count + pathLength > gbufferRow->capacity) {
+        int capacity = gbufferRow->capacity ? gbufferRow->capacity * 2 : gbuffer->width;
+        while(capacity < gbufferRow->count + pathLength)
+            capacity *= 2;
+        gbufferRow->hits = (struct GBufferHit*)realloc(gbufferRow->hits, capacity * sizeof(struct GBufferHit));
+        gbufferRow->levels = (unsigned char*)realloc(gbufferRow->levels, capacity);
+        gbufferRow->capacity = capacity;
+    }
+
+    for(i = 0; i < pathLength; i++) {
+        struct GBufferHit* hit = &gbufferRow->hits[gbufferRow->count];
+        hit->pixel = (gbuffer->rowStart + row) * gbuffer->width + col;
+        vec3_dup(hit->position, path[i].position);
+        vec3_dup(hit->normal, path[i].normal);
+        hit->photons = path[i].photons;
+        gbufferRow->levels[gbufferRow->count] = (unsigned char)i;
+        gbufferRow->count++;
+    }
+}
+
+/* 
+ * Moves the per-row hits into their bounce levels once tracing is done.
+ * Rows are walked in order so every level ends up sorted by pixel
+ */
+void FinishGBuffer(struct GBuffer* gbuffer)
+{
+    int counts[MAX_RAY_REFLECTIONS] = {0};
+    int i, j;
+
+    for(i = 0; i < gbuffer->rowCount; i++) {
+        for(j = 0; j < gbuffer->rows[i].count; j++)
+            counts[gbuffer->rows[i].levels[j]]++;
+    }
+
+    gbuffer->levelCount = 0;
+    for(i = 0; i < MAX_RAY_REFLECTIONS; i++) {
+        gbuffer->levels[i].count = 0;
+        gbuffer->levels[i].hits = NULL;
+        if(counts[i] > 0) {
+            gbuffer->levels[i].hits = (struct GBufferHit*)malloc(counts[i] * sizeof(struct GBufferHit));
+            gbuffer->levelCount = i + 1;
+        }
+    }
+
+    for(i = 0; i < gbuffer->rowCount; i++) {
+        for(j = 0; j < gbuffer->rows[i].count; j++) {
+            struct GBufferLevel* level = &gbuffer->levels[gbuffer->rows[i].levels[j]];
+            level->hits[level->count++] = gbuffer->rows[i].hits[j];
+        }
+    }
+
+    FreeGBufferRows(gbuffer);
+}
+
+/* 
+ * Collects every process' levels on rank 0 so it ends up with the whole image.
+ * Ranks own contiguous rows in rank order, so appending keeps levels sorted by pixel
+ */
+void GatherGBuffer(struct GBuffer* gbuffer, const int worldRank, const int worldSize)
+{
+#ifdef USE_MPI
+    int levelCounts[MAX_RAY_REFLECTIONS];
+    int* allCounts = (int*)malloc(worldSize * MAX_RAY_REFLECTIONS * sizeof(int));
+    int* byteCounts = (int*)malloc(worldSize * sizeof(int));
+    int* byteOffsets = (int*)malloc(worldSize * sizeof(int));
+    int i, j;
+
+    for(i = 0; i < MAX_RAY_REFLECTIONS; i++)
+        levelCounts[i] = gbuffer->levels[i].count;
+    MPI_Gather(levelCounts, MAX_RAY_REFLECTIONS, MPI_INT,
+        allCounts, MAX_RAY_REFLECTIONS, MPI_INT, 0, MPI_COMM_WORLD);
+
+    int levelCount = gbuffer->levelCount;
+    MPI_Allreduce(MPI_IN_PLACE, &levelCount, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+    for(i = 0; i < levelCount; i++) {
+        struct GBufferHit* allHits = NULL;
+        int total = 0;
+        if(worldRank == 0) {
+            for(j = 0; j < worldSize; j++) {
+                byteCounts[j] = allCounts[j * MAX_RAY_REFLECTIONS + i] * sizeof(struct GBufferHit);
+                byteOffsets[j] = total * sizeof(struct GBufferHit);
+                total += allCounts[j * MAX_RAY_REFLECTIONS + i];
+            }
+            allHits = (struct GBufferHit*)malloc((total > 0 ? total : 1) * sizeof(struct GBufferHit));
+        }
+
+        MPI_Gatherv(gbuffer->levels[i].hits, gbuffer->levels[i].count * sizeof(struct GBufferHit), MPI_BYTE,
+            allHits, byteCounts, byteOffsets, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+        if(worldRank == 0) {
+            free(gbuffer->levels[i].hits);
+            gbuffer->levels[i].hits = allHits;
+            gbuffer->levels[i].count = total;
+        }
+    }
+
+    if(worldRank == 0) {
+        gbuffer->levelCount = levelCount;
+        gbuffer->rowStart = 0;
+        gbuffer->rowCount = gbuffer->height;
+    }
+
+    free(allCounts);
+    free(byteCounts);
+    free(byteOffsets);
+#else
+    (void)gbuffer;
+    (void)worldRank;
+    (void)worldSize;
+#endif
+}
+
+/* Shows what every bounce level costs to keep around */
+void PrintGBufferMemory(struct GBuffer* gbuffer)
+{
+    size_t totalBytes = 0;
+    int i;
+    printf("G-buffer memory per bounce level (%d bytes per hit):\n", (int)sizeof(struct GBufferHit));
+    for(i = 0; i < gbuffer->levelCount; i++) {
+        size_t bytes = (size_t)gbuffer->levels[i].count * sizeof(struct GBufferHit);
+        totalBytes += bytes;
+        printf("  level %2d: %9d hits %9.2f MB (total %9.2f MB)\n", i, gbuffer->levels[i].count,
+            bytes / (1024.0 * 1024.0), totalBytes / (1024.0 * 1024.0));
+    }
+}
+
+/* Writes the G-buffer to disk. Returns 1 on success */
+int SaveGBuffer(struct GBuffer* gbuffer, const char* fileName)
+{
+    FILE* file = fopen(fileName, "wb");
+    if(!file) {
+        printf("could not open %s for writing\n", fileName);
+        return 0;
+    }
+
+    int header[3] = {gbuffer->width, gbuffer->height, gbuffer->levelCount};
+    int success = fwrite(GBUFFER_FILE_MAGIC, 1, sizeof(GBUFFER_FILE_MAGIC), file) == sizeof(GBUFFER_FILE_MAGIC)
+        && fwrite(header, sizeof(int), 3, file) == 3;
+
+    int i;
+    for(i = 0; success && i < gbuffer->levelCount; i++) {
+        struct GBufferLevel* level = &gbuffer->levels[i];
+        success = fwrite(&level->count, sizeof(int), 1, file) == 1
+            && (int)fwrite(level->hits, sizeof(struct GBufferHit), level->count, file) == level->count;
+    }
+
+    if(fclose(file) != 0)
+        success = 0;
+    if(!success)
+        printf("could not write G-buffer to %s\n", fileName);
+    return success;
+}
+
+/* Reads a G-buffer written by SaveGBuffer. Returns NULL on failure */
+struct GBuffer* LoadGBuffer(const char* fileName)
+{
+    FILE* file = fopen(fileName, "rb");
+    if(!file) {
+        printf("could not open G-buffer %s\n", fileName);
+        return NULL;
+    }
+
+    char magic[sizeof(GBUFFER_FILE_MAGIC)];
+    int header[3];
+    if(fread(magic, 1, sizeof(magic), file) != sizeof(magic) 
+        || memcmp(magic, GBUFFER_FILE_MAGIC, sizeof(magic)) != 0
+        || fread(header, sizeof(int), 3, file) != 3
+        || header[0] <= 0 || header[1] <= 0 || header[2] < 0 || header[2] > MAX_RAY_REFLECTIONS) {
+        printf("%s is not a G-buffer file\n", fileName);
+        fclose(file);
+        return NULL;
+    }
+
+    /* Loaded G-buffers are already split into levels, they never need rows */
+    struct GBuffer* gbuffer = NewGBuffer(header[0], header[1], 0, 0);
+    FreeGBufferRows(gbuffer);
+    gbuffer->rowCount = gbuffer->height;
+    gbuffer->levelCount = header[2];
+
+    int i;
+    int success = 1;
+    for(i = 0; success && i < gbuffer->levelCount; i++) {
+        struct GBufferLevel* level = &gbuffer->levels[i];
+        success = fread(&level->count, sizeof(int), 1, file) == 1 && level->count >= 0
+            && level->count <= gbuffer->width * gbuffer->height;
+        if(success) {
+            level->hits = (struct GBufferHit*)malloc((level->count > 0 ? level->count : 1) * sizeof(struct GBufferHit));
+            success = (int)fread(level->hits, sizeof(struct GBufferHit), level->count, file) == level->count;
+        }
+    }
+    fclose(file);
+
+    if(!success) {
+        printf("G-buffer %s is truncated\n", fileName);
+        FreeGBuffer(gbuffer);
+        return NULL;
+    }
+    return gbuffer;
+}
+
+/* 
+ * Shades every stored hit with the scene's (new) lights.
+ * Levels go in bounce order, so each pixel adds its colors up in the same
+ * order TraceRay does and unchanged lights give the exact same image.
+ * Area lights need the seed the G-buffer was rendered with for the same shadows,
+ * and the scene's spheres, planes and meshes to cast them.
+ * outImage has to be zeroed and hold width * height pixels.
+ */
+void ReshadeGBuffer(struct GBuffer* gbuffer, struct Scene* scene, const unsigned long long seed, float* outImage)
+{
+    int i, j;
+    for(i = 0; i < gbuffer->levelCount; i++) {
+        struct GBufferLevel* level = &gbuffer->levels[i];
+
+        /* A pixel shows up at most once per level so no two threads touch the same pixel */
+#ifdef USE_OPENMP
+        #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) schedule(static)
+#endif
+        for(j = 0; j < level->count; j++) {
+            struct GBufferHit* hit = &level->hits[j];
+            struct Ray collisionPointNormal = InitRay();
+            vec3_dup(collisionPointNormal.origin, hit->position);
+            vec3_dup(collisionPointNormal.direction, hit->normal);
+            collisionPointNormal.validRay = 1;
+
+            struct SampleId sampleId = {seed, hit->pixel / gbuffer->width, hit->pixel % gbuffer->width, 0, i};
+            vec3 color;
+            float photons = hit->photons;
+            CalculateLighting(scene, &sampleId, collisionPointNormal, color, &photons);
+            vec3_add(&outImage[hit->pixel*3], &outImage[hit->pixel*3], color);
+        }
+    }
+}
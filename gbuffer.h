@@ -0,0 +1,64 @@
+#ifndef GBUFFER_H_
+#define GBUFFER_H_
+
+#include "linmath.h"
+#include "raytracer.h"
+
+/* 
+ * Deferred shading G-buffer.
+ * Stores every hit of every pixel's path grouped by bounce level, so the lights
+ * can be changed and the image shaded again without tracing a single ray.
+ * Levels only hold the pixels whose path actually got that deep.
+ */
+
+/* One stored hit. pixel is row * width + col in the full image */
+struct GBufferHit {
+    int pixel;
+    vec3 position;
+    vec3 normal;
+    float photons;
+};
+
+/* All the hits at one bounce level, sorted by pixel */
+struct GBufferLevel {
+    int count;
+    struct GBufferHit* hits;
+};
+
+/* Hits are collected per row while tracing so rows can be traced in parallel */
+struct GBufferRow {
+    int count;
+    int capacity;
+    struct GBufferHit* hits;
+    unsigned char* levels;
+};
+
+struct GBuffer {
+    int width;
+    int height;
+    int rowStart;
+    int rowCount;
+    struct GBufferRow* rows;
+    int levelCount;
+    struct GBufferLevel levels[MAX_RAY_REFLECTIONS];
+};
+
+struct GBuffer* NewGBuffer(const int width, const int height, const int rowStart, const int rowCount);
+
+void FreeGBuffer(struct GBuffer* gbuffer);
+
+void AddGBufferPath(struct GBuffer* gbuffer, const int row, const int col, struct PathVertex* path, const int pathLength);
+
+void FinishGBuffer(struct GBuffer* gbuffer);
+
+void GatherGBuffer(struct GBuffer* gbuffer, const int worldRank, const int worldSize);
+
+void PrintGBufferMemory(struct GBuffer* gbuffer);
+
+int SaveGBuffer(struct GBuffer* gbuffer, const char* fileName);
+
+struct GBuffer* LoadGBuffer(const char* fileName);
+
+void ReshadeGBuffer(struct GBuffer* gbuffer, struct Scene* scene, const unsigned long long seed, float* outImage);
+
+#endif
@@ -0,0 +1,58 @@
+/* Default libraries */
+#include <stdlib.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "scene.h"
+#include "camera.h"
+#include "mesh.h"
+#include "instance.h"
+#include "hash.h"
+
+unsigned long long HashBytes(unsigned long long hash, const void* data, const size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Identifies the image being rendered: the camera (and its sampling), the compiled spheres, planes and lights (and their sampling),
+ * the instances and every mesh's vertices and triangles (the rest of a mesh is built from them), how pixels are stored and how far light may be taken from the
+ * irradiance cache (irradianceError, 0 without one)
+ */
+unsigned long long GetRenderKey(struct Scene* scene, struct Camera* camera, const int pixelFormat,
+    const float irradianceError)
+{
+    unsigned long long hash = HASH_SEED;
+    int i;
+    hash = HashBytes(hash, camera->eyePos, sizeof(vec3));
+    hash = HashBytes(hash, camera->rayBase, sizeof(vec3));
+    hash = HashBytes(hash, camera->rayRowStep, sizeof(vec3));
+    hash = HashBytes(hash, camera->rayColStep, sizeof(vec3));
+    hash = HashBytes(hash, &camera->imageWidth, sizeof(int));
+    hash = HashBytes(hash, &camera->imageHeight, sizeof(int));
+    hash = HashBytes(hash, &camera->samplesPerPixel, sizeof(int));
+    hash = HashBytes(hash, &camera->seed, sizeof(camera->seed));
+    hash = HashBytes(hash, &pixelFormat, sizeof(int));
+    hash = HashBytes(hash, &irradianceError, sizeof(float));
+
+    hash = HashBytes(hash, scene->circles, scene->circleCount * sizeof(struct SceneCircle));
+    hash = HashBytes(hash, scene->planes, scene->planeCount * sizeof(struct ScenePlane));
+    hash = HashBytes(hash, scene->lights, scene->lightCount * sizeof(struct SceneLight));
+    hash = HashBytes(hash, &scene->lightSamples, sizeof(int));
+    for(i = 0; i < scene->meshCount; i++) {
+        struct Mesh* mesh = scene->meshes[i];
+        hash = HashBytes(hash, &mesh->vertexCount, sizeof(int));
+        hash = HashBytes(hash, &mesh->triangleCount, sizeof(int));
+        hash = HashBytes(hash, mesh->vertices, (size_t)mesh->vertexCount * 3 * sizeof(float));
+        hash = HashBytes(hash, mesh->indices, (size_t)mesh->triangleCount * 3 * sizeof(unsigned int));
+    }
+    return HashBytes(hash, scene->instances, scene->instanceCount * sizeof(struct SceneInstance));
+}
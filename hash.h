@@ -0,0 +1,22 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+
+#include "scene.h"
+#include "camera.h"
+
+/*
+ * FNV-1a, for the keys and checksums that tell whether something is still the same
+ * (cached scenes, checkpoint records). Start from HASH_SEED and feed it one buffer at a time.
+ * GetRenderKey hashes what decides the image of a render, for the checkpoint journal to tell
+ * its records apart and the auto-tuner to find the schedule it tuned for a render
+ */
+#define HASH_SEED 14695981039346656037ULL
+
+unsigned long long HashBytes(unsigned long long hash, const void* data, const size_t size);
+
+unsigned long long GetRenderKey(struct Scene* scene, struct Camera* camera, const int pixelFormat,
+    const float irradianceError);
+
+#endif
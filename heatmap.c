@@ -0,0 +1,313 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Helper libraries */
+#include "linmath.h"
+#include "render_bmp.h"
+
+/* My libraries */
+#include "raytracer.h"
+#include "timing.h"
+#include "heatmap.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* Include MPI (if needed) */
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+struct Heatmap* NewHeatmap(const int width, const int rowStart, const int rowCount, const int cellRows, const int cellCols,
+    const int worldRank)
+{
+    struct Heatmap* heatmap = (struct Heatmap*)malloc(sizeof(struct Heatmap));
+    heatmap->width = width;
+    heatmap->rowStart = rowStart;
+    heatmap->rowCount = rowCount;
+    heatmap->cellRows = cellRows;
+    heatmap->cellCols = cellCols;
+    heatmap->cellsAcross = (width + cellCols - 1) / cellCols;
+    heatmap->cellCount = heatmap->cellsAcross * ((rowCount + cellRows - 1) / cellRows);
+    heatmap->worldRank = worldRank;
+    heatmap->cells = (struct HeatmapCell*)calloc(heatmap->cellCount > 0 ? heatmap->cellCount : 1, sizeof(struct HeatmapCell));
+    if(!heatmap->cells) {
+        printf("Couldn't allocate the heatmap's %d cells\n", heatmap->cellCount);
+        free(heatmap);
+        return NULL;
+    }
+    return heatmap;
+}
+
+void FreeHeatmap(struct Heatmap* heatmap)
+{
+    if(!heatmap)
+        return;
+    free(heatmap->cells);
+    free(heatmap);
+}
+
+/* Call when the calling thread starts tracing a cell */
+void StartHeatmapCell(struct HeatmapTimer* outTimer)
+{
+    GetThreadRayCounts(&outTimer->rays);
+    outTimer->cpuBegin = GetThreadCpuSeconds();
+    outTimer->begin = GetSeconds();
+}
+
+/* Call when the calling thread is done with the cell of rows x cols pixels from (row, col) it started with timer */
+void FinishHeatmapCell(struct Heatmap* heatmap, const struct HeatmapTimer* timer, const int row, const int col,
+    const int rows, const int cols)
+{
+    const double end = GetSeconds();
+    const double cpuEnd = GetThreadCpuSeconds();
+    struct RayCounts rays;
+    GetThreadRayCounts(&rays);
+
+    struct HeatmapCell* cell = &heatmap->cells[((row - heatmap->rowStart) / heatmap->cellRows) * heatmap->cellsAcross
+        + col / heatmap->cellCols];
+    cell->row = row;
+    cell->col = col;
+    cell->rows = rows;
+    cell->cols = cols;
+    cell->rank = heatmap->worldRank;
+#ifdef USE_OPENMP
+    cell->thread = omp_get_thread_num();
+#else
+    cell->thread = 0;
+#endif
+    cell->seconds = end - timer->begin;
+    cell->cpuSeconds = cpuEnd - timer->cpuBegin;
+    cell->rays.pathRays = rays.pathRays - timer->rays.pathRays;
+    cell->rays.reflections = rays.reflections - timer->rays.reflections;
+    cell->rays.shadowRays = rays.shadowRays - timer->rays.shadowRays;
+}
+
+/*
+ * MPI: collects every process's cells on the root, which then has the whole image's.
+ * Every process has to call this
+ */
+void GatherHeatmap(struct Heatmap* heatmap, const int worldRank, const int worldSize)
+{
+#ifdef USE_MPI
+    int* cellCounts = (int*)malloc(worldSize * sizeof(int));
+    int* byteCounts = (int*)malloc(worldSize * sizeof(int));
+    int* byteOffsets = (int*)malloc(worldSize * sizeof(int));
+    MPI_Gather(&heatmap->cellCount, 1, MPI_INT, cellCounts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    struct HeatmapCell* allCells = NULL;
+    int total = 0;
+    int i;
+    if(worldRank == 0) {
+        for(i = 0; i < worldSize; i++) {
+            byteCounts[i] = cellCounts[i] * sizeof(struct HeatmapCell);
+            byteOffsets[i] = total * sizeof(struct HeatmapCell);
+            total += cellCounts[i];
+        }
+        allCells = (struct HeatmapCell*)malloc((total > 0 ? total : 1) * sizeof(struct HeatmapCell));
+    }
+
+    MPI_Gatherv(heatmap->cells, heatmap->cellCount * sizeof(struct HeatmapCell), MPI_BYTE,
+        allCells, byteCounts, byteOffsets, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    /* The root's cells are no longer laid out by where they are, they're only listed */
+    if(worldRank == 0) {
+        free(heatmap->cells);
+        heatmap->cells = allCells;
+        heatmap->cellCount = total;
+    }
+
+    free(cellCounts);
+    free(byteCounts);
+    free(byteOffsets);
+#else
+    (void)heatmap;
+    (void)worldRank;
+    (void)worldSize;
+#endif
+}
+
+/* CPU seconds per pixel of a cell */
+static double GetCellCost(const struct HeatmapCell* cell)
+{
+    return cell->cpuSeconds / ((double)cell->rows * cell->cols);
+}
+
+static int CompareCosts(const void* a, const void* b)
+{
+    const double costA = *(const double*)a;
+    const double costB = *(const double*)b;
+    return (costA > costB) - (costA < costB);
+}
+
+/* How long every thread (of every process) traced, and how uneven the cells were */
+void PrintHeatmapSummary(const struct Heatmap* heatmap)
+{
+    int ranks = 0;
+    int threads = 0;
+    int traced = 0;
+    int i;
+    for(i = 0; i < heatmap->cellCount; i++) {
+        const struct HeatmapCell* cell = &heatmap->cells[i];
+        if(cell->rows == 0)
+            continue;
+        ranks = cell->rank + 1 > ranks ? cell->rank + 1 : ranks;
+        threads = cell->thread + 1 > threads ? cell->thread + 1 : threads;
+        traced++;
+    }
+    if(traced == 0) {
+        printf("Heatmap: no cells were traced\n");
+        return;
+    }
+
+    /* Per process and thread */
+    const int slots = ranks * threads;
+    double* seconds = (double*)calloc(slots, sizeof(double));
+    int* cells = (int*)calloc(slots, sizeof(int));
+    struct RayCounts* rays = (struct RayCounts*)calloc(slots, sizeof(struct RayCounts));
+    double* costs = (double*)malloc(traced * sizeof(double));
+    double totalSeconds = 0.0;
+    int slowest = -1;
+    traced = 0;
+    for(i = 0; i < heatmap->cellCount; i++) {
+        const struct HeatmapCell* cell = &heatmap->cells[i];
+        if(cell->rows == 0)
+            continue;
+        const int slot = cell->rank * threads + cell->thread;
+        seconds[slot] += cell->seconds;
+        cells[slot]++;
+        rays[slot].pathRays += cell->rays.pathRays;
+        rays[slot].reflections += cell->rays.reflections;
+        rays[slot].shadowRays += cell->rays.shadowRays;
+        totalSeconds += cell->seconds;
+        costs[traced++] = GetCellCost(cell);
+        if(slowest < 0 || GetCellCost(cell) > GetCellCost(&heatmap->cells[slowest]))
+            slowest = i;
+    }
+
+    int rank, thread;
+    for(rank = 0; rank < ranks; rank++) {
+        double rankSeconds = 0.0;
+        for(thread = 0; thread < threads; thread++) {
+            const int slot = rank * threads + thread;
+            rankSeconds += seconds[slot];
+            if(cells[slot] == 0)
+                continue;
+            printf("Heatmap: process %d thread %d traced %d cells in %.4f seconds (%.1f%%), %lld rays "
+                "(%lld reflections, %lld shadow rays)\n", rank, thread, cells[slot], seconds[slot],
+                100.0 * seconds[slot] / totalSeconds, rays[slot].pathRays, rays[slot].reflections, rays[slot].shadowRays);
+        }
+        if(ranks > 1)
+            printf("Heatmap: process %d traced for %.4f seconds in all (%.1f%%)\n", rank, rankSeconds,
+                100.0 * rankSeconds / totalSeconds);
+    }
+
+    qsort(costs, traced, sizeof(double), CompareCosts);
+    const struct HeatmapCell* cell = &heatmap->cells[slowest];
+    const double median = costs[traced / 2];
+    printf("Heatmap: slowest cell rows %d-%d columns %d-%d, %.2f CPU microseconds per pixel (%.1f times the median)\n",
+        cell->row, cell->row + cell->rows - 1, cell->col, cell->col + cell->cols - 1, GetCellCost(cell) * 1e6,
+        median > 0.0 ? GetCellCost(cell) / median : 0.0);
+
+    free(seconds);
+    free(cells);
+    free(rays);
+    free(costs);
+}
+
+/* Black, blue, red, yellow, white for value 0 to 1, as a BGR pixel */
+static void HeatColor(float value, unsigned char* outPixel)
+{
+    static const float stops[5][3] = {
+        {0.0f, 0.0f, 0.0f},
+        {0.0f, 0.0f, 1.0f},
+        {1.0f, 0.0f, 0.0f},
+        {1.0f, 1.0f, 0.0f},
+        {1.0f, 1.0f, 1.0f}
+    };
+    value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+    const float position = value * 4.0f;
+    const int stop = position >= 4.0f ? 3 : (int)position;
+    const float blend = position - stop;
+    int channel;
+    for(channel = 0; channel < 3; channel++) {
+        const float color = stops[stop][channel] + (stops[stop + 1][channel] - stops[stop][channel]) * blend;
+        outPixel[2 - channel] = (unsigned char)(color * 255.0f + 0.5f);
+    }
+}
+
+/* Turns "rendered_0042.bmp" and HEATMAP_CSV_SUFFIX into "rendered_0042.heatmap.csv" */
+void GetHeatmapFileName(const char* imageFileName, const char* suffix, char* outFileName, const int outSize)
+{
+    const char* extension = strrchr(imageFileName, '.');
+    const char* directory = strrchr(imageFileName, '/');
+    if(directory && extension < directory)
+        extension = NULL;
+    int stemLength = extension ? (int)(extension - imageFileName) : (int)strlen(imageFileName);
+    snprintf(outFileName, outSize, "%.*s%s", stemLength, imageFileName, suffix);
+}
+
+/*
+ * Saves the heatmap of an image height rows high (see heatmap.h): the false color image to
+ * imageFileName and every cell to csvFileName. Returns 1 on success
+ */
+int SaveHeatmap(const struct Heatmap* heatmap, const int height, const char* imageFileName, const char* csvFileName)
+{
+    const int width = heatmap->width;
+    int traced = 0;
+    int i;
+    double* costs = (double*)malloc((heatmap->cellCount > 0 ? heatmap->cellCount : 1) * sizeof(double));
+    for(i = 0; i < heatmap->cellCount; i++) {
+        if(heatmap->cells[i].rows > 0)
+            costs[traced++] = GetCellCost(&heatmap->cells[i]);
+    }
+    double scale = 0.0;
+    if(traced > 0) {
+        qsort(costs, traced, sizeof(double), CompareCosts);
+        scale = costs[(int)(HEATMAP_SCALE_PERCENTILE * (traced - 1))];
+    }
+    free(costs);
+    if(!(scale > 0.0))
+        scale = 1.0;
+
+    unsigned char* image = (unsigned char*)calloc((size_t)width * height, 3);
+    for(i = 0; i < heatmap->cellCount; i++) {
+        const struct HeatmapCell* cell = &heatmap->cells[i];
+        if(cell->rows == 0)
+            continue;
+        unsigned char color[3];
+        HeatColor((float)(GetCellCost(cell) / scale), color);
+        int row, col;
+        for(row = cell->row; row < cell->row + cell->rows && row < height; row++) {
+            for(col = cell->col; col < cell->col + cell->cols && col < width; col++)
+                memcpy(&image[((size_t)row * width + col) * 3], color, 3);
+        }
+    }
+    generateBitmapImage(image, height, width, (char*)imageFileName);
+    free(image);
+
+    FILE* file = fopen(csvFileName, "w");
+    if(!file) {
+        printf("Couldn't open %s to save the heatmap cells\n", csvFileName);
+        return 0;
+    }
+    fprintf(file, "rank,thread,row,col,rows,cols,seconds,cpu_seconds,path_rays,reflections,shadow_rays\n");
+    for(i = 0; i < heatmap->cellCount; i++) {
+        const struct HeatmapCell* cell = &heatmap->cells[i];
+        if(cell->rows == 0)
+            continue;
+        fprintf(file, "%d,%d,%d,%d,%d,%d,%.9f,%.9f,%lld,%lld,%lld\n", cell->rank, cell->thread, cell->row, cell->col,
+            cell->rows, cell->cols, cell->seconds, cell->cpuSeconds, cell->rays.pathRays, cell->rays.reflections, cell->rays.shadowRays);
+    }
+    if(fclose(file) != 0) {
+        printf("Couldn't write %s\n", csvFileName);
+        return 0;
+    }
+    printf("Heatmap saved to %s (white is %.2f CPU microseconds per pixel or more), its cells to %s\n", imageFileName,
+        scale * 1e6, csvFileName);
+    return 1;
+}
@@ -0,0 +1,84 @@
+#ifndef HEATMAP_H_
+#define HEATMAP_H_
+
+#include "linmath.h"
+#include "raytracer.h"
+
+/*
+ * Where a frame's render time goes (--heatmap).
+ *
+ * The trace loops work in cells: the segments of TILE_CULL_ROW_SEGMENT pixels that share a
+ * primitive list in the rows layout (see tilecull.h), or the tiles of the tiled layout. With a
+ * heatmap the thread tracing a cell times it, on the wall clock and in CPU time of the thread,
+ * and counts its rays (see GetThreadRayCounts): camera rays, their reflections (the bounces)
+ * and shadow rays. A cell is only written by the thread that traced it, so that needs no locks.
+ *
+ * Once the frame is traced (and the cells of every process gathered on the root) they're saved
+ * next to the image (see GetHeatmapFileName) as a BMP, every pixel colored by the CPU time per pixel of its cell (the wall
+ * clock also counts the time a thread waited for a core, which speckles it), from black
+ * through blue, red and yellow to white at the HEATMAP_SCALE_PERCENTILE cell (so a few slow
+ * cells don't wash out the rest), and as a CSV, one line per cell with where it is,
+ * which process and thread traced it and what it cost. The (wall clock) time every thread and
+ * process spent tracing is printed too, which is what the MPI partition (see partition.h) has to even out.
+ * Rows a --checkpoint already had aren't traced and stay black.
+ */
+
+/* What replaces the extension of the image file for the heatmap files */
+#define HEATMAP_IMAGE_SUFFIX ".heatmap.bmp"
+#define HEATMAP_CSV_SUFFIX ".heatmap.csv"
+
+/* Cells as slow as this share of all cells (or slower) are white */
+#define HEATMAP_SCALE_PERCENTILE 0.99
+
+/* What one cell cost. rows is 0 for cells that weren't traced */
+struct HeatmapCell {
+    int row;
+    int col;
+    int rows;
+    int cols;
+    int rank;
+    int thread;
+    double seconds;
+    double cpuSeconds;
+    struct RayCounts rays;
+};
+
+/* Cells of cellRows x cellCols pixels covering rows rowStart to rowStart + rowCount - 1 of the image */
+struct Heatmap {
+    int width;
+    int rowStart;
+    int rowCount;
+    int cellRows;
+    int cellCols;
+    int cellsAcross;
+    int cellCount;
+    int worldRank;
+    struct HeatmapCell* cells;
+};
+
+/* When (and after how many rays) a thread started the cell it's tracing */
+struct HeatmapTimer {
+    double begin;
+    double cpuBegin;
+    struct RayCounts rays;
+};
+
+struct Heatmap* NewHeatmap(const int width, const int rowStart, const int rowCount, const int cellRows, const int cellCols,
+    const int worldRank);
+
+void FreeHeatmap(struct Heatmap* heatmap);
+
+void StartHeatmapCell(struct HeatmapTimer* outTimer);
+
+void FinishHeatmapCell(struct Heatmap* heatmap, const struct HeatmapTimer* timer, const int row, const int col,
+    const int rows, const int cols);
+
+void GatherHeatmap(struct Heatmap* heatmap, const int worldRank, const int worldSize);
+
+void PrintHeatmapSummary(const struct Heatmap* heatmap);
+
+void GetHeatmapFileName(const char* imageFileName, const char* suffix, char* outFileName, const int outSize);
+
+int SaveHeatmap(const struct Heatmap* heatmap, const int height, const char* imageFileName, const char* csvFileName);
+
+#endif
@@ -0,0 +1,279 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "scene.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "instance.h"
+
+/* Puts a world space box around the 8 transformed corners of the mesh bounds */
+static void CalculateInstanceBounds(struct SceneInstance* instance, struct Mesh* mesh)
+{
+    struct BvhNode* root = &mesh->nodes[0];
+    int corner, k;
+    for(k = 0; k < 3; k++) {
+        instance->boundsMin[k] = FLT_MAX;
+        instance->boundsMax[k] = -FLT_MAX;
+    }
+    for(corner = 0; corner < 8; corner++) {
+        vec4 local = {
+            (corner & 1) ? root->boundsMax[0] : root->boundsMin[0],
+            (corner & 2) ? root->boundsMax[1] : root->boundsMin[1],
+            (corner & 4) ? root->boundsMax[2] : root->boundsMin[2],
+            1.0f
+        };
+        vec4 world;
+        mat4x4_mul_vec4(world, instance->transform, local);
+        for(k = 0; k < 3; k++) {
+            instance->boundsMin[k] = fminf(instance->boundsMin[k], world[k]);
+            instance->boundsMax[k] = fmaxf(instance->boundsMax[k], world[k]);
+        }
+    }
+}
+
+/* 
+ * Adds a copy of one of the scene's meshes, placed with transform.
+ * BuildSceneInstances has to run again before rendering. Returns 1 on success
+ */
+int AddSceneInstance(struct Scene* scene, const int meshIndex, mat4x4 transform)
+{
+    if(meshIndex < 0 || meshIndex >= scene->meshCount) {
+        printf("instance uses mesh %d but there are only %d meshes\n", meshIndex, scene->meshCount);
+        return 0;
+    }
+
+    /* A packed scene (maybe broadcast from another process) isn't ours to change */
+    if(scene->packed) {
+        printf("can't add instances to a packed scene\n");
+        return 0;
+    }
+
+    /* Grow by doubling, scenes can have tens of thousands of these */
+    if(scene->instanceCount == scene->instanceCapacity) {
+        int capacity = scene->instanceCapacity ? scene->instanceCapacity * 2 : 1;
+        struct SceneInstance* instances = (struct SceneInstance*)realloc(scene->instances, capacity * sizeof(struct SceneInstance));
+        if(!instances) {
+            printf("could not allocate %d instances\n", capacity);
+            return 0;
+        }
+        scene->instances = instances;
+        scene->instanceCapacity = capacity;
+    }
+
+    struct SceneInstance* instance = &scene->instances[scene->instanceCount++];
+    instance->meshIndex = meshIndex;
+    mat4x4_dup(instance->transform, transform);
+    mat4x4_invert(instance->inverse, transform);
+    CalculateInstanceBounds(instance, scene->meshes[meshIndex]);
+    return 1;
+}
+
+/* 
+ * Reads instances from a file. One per line:
+ * "instance mesh x y z [scale [rx ry rz]]" where mesh is the index of a --mesh,
+ * the mesh gets scaled, rotated (degrees, around z, y then x) and then moved to x y z.
+ * Lines starting with # are ignored. Returns 1 on success
+ */
+int LoadSceneInstances(const char* fileName, struct Scene* scene)
+{
+    FILE* file = fopen(fileName, "r");
+    if(!file) {
+        printf("could not open instances file %s\n", fileName);
+        return 0;
+    }
+
+    char line[256];
+    int lineNumber = 0;
+    int success = 1;
+    while(success && fgets(line, sizeof(line), file)) {
+        lineNumber++;
+
+        char command[32];
+        if(sscanf(line, "%31s", command) != 1 || command[0] == '#')
+            continue;
+
+        int meshIndex;
+        float position[3];
+        float scale = 1.0f;
+        float rotation[3] = {0.0f, 0.0f, 0.0f};
+        int values = sscanf(line, "%*s %d %f %f %f %f %f %f %f", &meshIndex, &position[0], &position[1], &position[2],
+            &scale, &rotation[0], &rotation[1], &rotation[2]);
+        if(strcmp(command, "instance") != 0 || (values != 4 && values != 5 && values != 8)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            printf("%s:%d: could not understand \"%s\"\n", fileName, lineNumber, line);
+            success = 0;
+            break;
+        }
+
+        const float degreesToRadians = 3.1415926f / 180.0f;
+        mat4x4 transform;
+        mat4x4_translate(transform, position[0], position[1], position[2]);
+        mat4x4_rotate_X(transform, transform, rotation[0] * degreesToRadians);
+        mat4x4_rotate_Y(transform, transform, rotation[1] * degreesToRadians);
+        mat4x4_rotate_Z(transform, transform, rotation[2] * degreesToRadians);
+        mat4x4_scale_aniso(transform, transform, scale, scale, scale);
+        success = AddSceneInstance(scene, meshIndex, transform);
+    }
+    fclose(file);
+
+    return success;
+}
+
+/* 
+ * Builds the top level hierarchy. Instances get reordered to match it.
+ * Returns 1 on success
+ */
+int BuildSceneInstances(struct Scene* scene)
+{
+    if(scene->packed) {
+        printf("can't rebuild the instances of a packed scene\n");
+        return 0;
+    }
+
+    const int count = scene->instanceCount;
+    free(scene->instanceNodes);
+    scene->instanceNodes = NULL;
+    if(count == 0)
+        return 1;
+
+    float* boundsMin = (float*)malloc(count * 3 * sizeof(float));
+    float* boundsMax = (float*)malloc(count * 3 * sizeof(float));
+    int* order = (int*)malloc(count * sizeof(int));
+    struct SceneInstance* instances = (struct SceneInstance*)malloc(count * sizeof(struct SceneInstance));
+    scene->instanceNodes = (struct BvhNode*)malloc(BVH_NODE_COUNT(count, INSTANCE_LEAF_SIZE) * sizeof(struct BvhNode));
+    if(!boundsMin || !boundsMax || !order || !instances || !scene->instanceNodes) {
+        printf("could not allocate the hierarchy for %d instances\n", count);
+        free(boundsMin);
+        free(boundsMax);
+        free(order);
+        free(instances);
+        return 0;
+    }
+
+    int i;
+    for(i = 0; i < count; i++) {
+        memcpy(&boundsMin[i*3], scene->instances[i].boundsMin, 3 * sizeof(float));
+        memcpy(&boundsMax[i*3], scene->instances[i].boundsMax, 3 * sizeof(float));
+    }
+    BuildBvh(boundsMin, boundsMax, count, INSTANCE_LEAF_SIZE, scene->instanceNodes, order);
+    for(i = 0; i < count; i++)
+        instances[i] = scene->instances[order[i]];
+
+    free(scene->instances);
+    scene->instances = instances;
+    scene->instanceCapacity = count;
+    free(boundsMin);
+    free(boundsMax);
+    free(order);
+    return 1;
+}
+
+void FreeSceneInstances(struct Scene* scene)
+{
+    if(!scene->packed) {
+        free(scene->instances);
+        free(scene->instanceNodes);
+    }
+    scene->instances = NULL;
+    scene->instanceNodes = NULL;
+    scene->instanceCount = 0;
+    scene->instanceCapacity = 0;
+}
+
+/* Shows what the instances cost compared to storing every copy of every mesh */
+void PrintInstanceMemory(struct Scene* scene)
+{
+    double meshBytes = 0.0;
+    double flattenedBytes = 0.0;
+    int i;
+    for(i = 0; i < scene->meshCount; i++)
+        meshBytes += scene->meshes[i]->memorySize;
+    for(i = 0; i < scene->instanceCount; i++)
+        flattenedBytes += scene->meshes[scene->instances[i].meshIndex]->memorySize;
+
+    double instanceBytes = (double)scene->instanceCount * sizeof(struct SceneInstance)
+        + (double)BVH_NODE_COUNT(scene->instanceCount, INSTANCE_LEAF_SIZE) * sizeof(struct BvhNode);
+    printf("Instances: %d copies of %d meshes, %.2f MB (meshes %.2f MB + instances %.2f MB), %.2f MB if every copy was stored\n",
+        scene->instanceCount, scene->meshCount, (meshBytes + instanceBytes) / (1024.0 * 1024.0),
+        meshBytes / (1024.0 * 1024.0), instanceBytes / (1024.0 * 1024.0), flattenedBytes / (1024.0 * 1024.0));
+}
+
+/* The world space ray and the closest hit so far, for IntersectInstanceLeaf */
+struct InstanceRay {
+    struct Scene* scene;
+    float* origin;
+    float* direction;
+    int closestInstance;
+    int closestTriangle;
+    float closestDistance;
+};
+
+/* Moves the ray into each instance's space and tests its mesh */
+static void IntersectInstanceLeaf(void* context, int first, int count, float* maxDistance)
+{
+    struct InstanceRay* ray = (struct InstanceRay*)context;
+    int i;
+    for(i = first; i < first + count; i++) {
+        struct SceneInstance* instance = &ray->scene->instances[i];
+        vec4 worldOrigin = {ray->origin[0], ray->origin[1], ray->origin[2], 1.0f};
+        vec4 worldDirection = {ray->direction[0], ray->direction[1], ray->direction[2], 0.0f};
+        vec4 localOrigin, localDirection;
+        mat4x4_mul_vec4(localOrigin, instance->inverse, worldOrigin);
+        mat4x4_mul_vec4(localDirection, instance->inverse, worldDirection);
+
+        /* The local direction isn't normalized, which keeps the distances in world units */
+        float distance;
+        int triangle;
+        if(IntersectMesh(ray->scene->meshes[instance->meshIndex], localOrigin, localDirection, *maxDistance, &distance, &triangle)) {
+            *maxDistance = distance;
+            ray->closestInstance = i;
+            ray->closestTriangle = triangle;
+            ray->closestDistance = distance;
+        }
+    }
+}
+
+/* 
+ * Finds the closest instance the ray hits before maxDistance.
+ * Returns 1 and fills in the distance, instance and world space normal (not flipped to face the ray) if something was hit
+ */
+int IntersectInstances(struct Scene* scene, float* origin, float* direction, const float maxDistance,
+    float* outDistance, int* outInstance, float* outNormal)
+{
+    if(scene->instanceCount == 0)
+        return 0;
+
+    struct InstanceRay ray;
+    ray.scene = scene;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.closestInstance = -1;
+    TraverseBvh(scene->instanceNodes, origin, direction, maxDistance, IntersectInstanceLeaf, &ray);
+    if(ray.closestInstance < 0)
+        return 0;
+
+    /* Normals go back to world space with the inverse transpose */
+    struct SceneInstance* instance = &scene->instances[ray.closestInstance];
+    vec3 localNormal;
+    int i, j;
+    GetMeshTriangleNormal(scene->meshes[instance->meshIndex], ray.closestTriangle, localNormal);
+    for(i = 0; i < 3; i++) {
+        outNormal[i] = 0.0f;
+        for(j = 0; j < 3; j++)
+            outNormal[i] += instance->inverse[i][j] * localNormal[j];
+    }
+    vec3_normalize(outNormal, outNormal);
+
+    *outDistance = ray.closestDistance;
+    *outInstance = ray.closestInstance;
+    return 1;
+}
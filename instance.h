@@ -0,0 +1,45 @@
+#ifndef INSTANCE_H_
+#define INSTANCE_H_
+
+#include "linmath.h"
+
+/* 
+ * Mesh instances: a transform plus the index of a mesh the scene already has,
+ * so a copy of an object costs the same no matter how big the object is.
+ * A top level hierarchy over the instances sits on top of each mesh's own one,
+ * and rays are moved into the mesh's space to test it
+ */
+
+/* Instances per leaf of the top level hierarchy */
+#define INSTANCE_LEAF_SIZE 2
+
+struct Scene;
+struct Mesh;
+
+struct SceneInstance {
+    /* Index into Scene.meshes, not a pointer, so instances can be copied between processes as they are */
+    int meshIndex;
+
+    /* Object to world, and back */
+    mat4x4 transform;
+    mat4x4 inverse;
+
+    /* World space box around the transformed mesh */
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+int AddSceneInstance(struct Scene* scene, const int meshIndex, mat4x4 transform);
+
+int LoadSceneInstances(const char* fileName, struct Scene* scene);
+
+int BuildSceneInstances(struct Scene* scene);
+
+void FreeSceneInstances(struct Scene* scene);
+
+void PrintInstanceMemory(struct Scene* scene);
+
+int IntersectInstances(struct Scene* scene, float* origin, float* direction, const float maxDistance,
+    float* outDistance, int* outInstance, float* outNormal);
+
+#endif
@@ -0,0 +1,514 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "camera.h"
+#include "partition.h"
+#include "timing.h"
+#include "irradiance.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* Include MPI (if needed) */
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+/*
+ * What a grid path hit at one bounce and the light there (primitiveId is PRIMITIVE_ID_NONE past its last hit).
+ * spacing is how far apart the grid's paths would be there if nothing bent them: the grid step seen at the length of the path
+ */
+struct IrradianceCandidate {
+    vec3 position;
+    vec3 normal;
+    vec3 color;
+    float spacing;
+    int primitiveId;
+};
+
+static float GetBrightness(const float* color)
+{
+    return (color[0] + color[1] + color[2]) / 3.0f;
+}
+
+/* Spreads the bits of a cell of a level over the buckets */
+static unsigned int HashCell(const int level, const int x, const int y, const int z)
+{
+    unsigned int hash = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u
+        ^ (unsigned int)level * 2654435761u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    return hash ^ (hash >> 16);
+}
+
+/*
+ * Traces the path of every grid pixel in grid rows gridRowStart to gridRowEnd and shades
+ * each of its hits with one photon, with the random numbers the pixel's own path uses.
+ * The first hit already got exactly that light from the path
+ */
+static void ShadeGridRows(struct Scene* scene, struct Camera* camera, const int width, const int height,
+    const int gridCols, const int gridRowStart, const int gridRowEnd, struct IrradianceCandidate* candidates)
+{
+    int gridRow;
+#ifdef USE_OPENMP
+    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) schedule(dynamic)
+#endif
+    for(gridRow = gridRowStart; gridRow < gridRowEnd; gridRow++) {
+        const int row = gridRow * IRRADIANCE_GRID_STEP + IRRADIANCE_GRID_STEP / 2 < height
+            ? gridRow * IRRADIANCE_GRID_STEP + IRRADIANCE_GRID_STEP / 2 : height - 1;
+        int gridCol, bounce;
+        for(gridCol = 0; gridCol < gridCols; gridCol++) {
+            const int col = gridCol * IRRADIANCE_GRID_STEP + IRRADIANCE_GRID_STEP / 2 < width
+                ? gridCol * IRRADIANCE_GRID_STEP + IRRADIANCE_GRID_STEP / 2 : width - 1;
+            struct IrradianceCandidate* pixelCandidates =
+                &candidates[((size_t)gridRow * gridCols + gridCol) * MAX_RAY_REFLECTIONS];
+
+            vec3 direction, nextDirection;
+            vec3 color = {0, 0, 0};
+            struct PathVertex path[MAX_RAY_REFLECTIONS];
+            int pathLength = 0;
+            struct RayHit primaryHit;
+            struct SampleId sampleId = {camera->seed, row, col, 0, 0};
+            GetCameraRayDirection(camera, row, col, direction);
+            GetCameraRayDirectionAt(camera, (float)row, col + 1.0f, nextDirection);
+            vec3_sub(nextDirection, nextDirection, direction);
+            const float gridAngle = IRRADIANCE_GRID_STEP * vec3_len(nextDirection);
+            TracePath(scene, NULL, &sampleId, camera->eyePos, direction, color, &primaryHit, path, &pathLength, NULL, NULL);
+            float distance = 0.0f;
+
+            /* A path ends at its first miss, so vertex i is bounce i */
+            for(bounce = 0; bounce < MAX_RAY_REFLECTIONS; bounce++) {
+                struct IrradianceCandidate* candidate = &pixelCandidates[bounce];
+                vec3_zero(candidate->color);
+                if(bounce >= pathLength) {
+                    candidate->primitiveId = PRIMITIVE_ID_NONE;
+                    continue;
+                }
+                vec3 segment;
+                vec3_sub(segment, path[bounce].position, bounce == 0 ? camera->eyePos : path[bounce - 1].position);
+                distance += vec3_len(segment);
+                candidate->spacing = gridAngle * distance;
+
+                if(bounce == 0) {
+                    vec3_dup(candidate->color, primaryHit.color);
+                } else {
+                    struct Ray normalRay = InitRay();
+                    vec3_dup(normalRay.origin, path[bounce].position);
+                    vec3_dup(normalRay.direction, path[bounce].normal);
+                    float photons = 1.0f;
+                    sampleId.bounce = bounce;
+                    CalculateLighting(scene, &sampleId, normalRay, candidate->color, &photons);
+                }
+                vec3_dup(candidate->position, path[bounce].position);
+                vec3_dup(candidate->normal, path[bounce].normal);
+                candidate->primitiveId = path[bounce].primitiveId;
+            }
+        }
+    }
+}
+
+/*
+ * Fits the gradient of a candidate's light through its neighbours on the grid (same bounce, same
+ * primitive) and checks none of them is further off it than maxError. Returns 0 if it can't be a record
+ */
+static int FitRecord(const struct IrradianceCandidate* candidates, const int gridRows, const int gridCols,
+    const int gridRow, const int gridCol, const int bounce, const float maxError, const float darkLight,
+    struct IrradianceRecord* outRecord)
+{
+    static const int neighbourSteps[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    const struct IrradianceCandidate* candidate = &candidates[((size_t)gridRow * gridCols + gridCol) * MAX_RAY_REFLECTIONS + bounce];
+    const struct IrradianceCandidate* neighbours[4];
+    int neighbourCount = 0;
+    int i, channel;
+    if(candidate->primitiveId < 0)
+        return 0;
+    for(i = 0; i < 4; i++) {
+        const int neighbourRow = gridRow + neighbourSteps[i][0];
+        const int neighbourCol = gridCol + neighbourSteps[i][1];
+        if(neighbourRow < 0 || neighbourRow >= gridRows || neighbourCol < 0 || neighbourCol >= gridCols)
+            continue;
+        const struct IrradianceCandidate* neighbour =
+            &candidates[((size_t)neighbourRow * gridCols + neighbourCol) * MAX_RAY_REFLECTIONS + bounce];
+        if(neighbour->primitiveId == candidate->primitiveId)
+            neighbours[neighbourCount++] = neighbour;
+    }
+
+    /* With 2 neighbours the plane fits them exactly, so there would be nothing to check it with */
+    if(neighbourCount < 3)
+        return 0;
+
+    /* Least squares over the neighbours' offsets along the surface (tangent and bitangent) */
+    vec3 helper = {1, 0, 0};
+    if(fabsf(candidate->normal[0]) > 0.9f) {
+        helper[0] = 0.0f;
+        helper[1] = 1.0f;
+    }
+    vec3 tangent, bitangent;
+    vec3_mul_cross(tangent, helper, candidate->normal);
+    vec3_normalize(tangent, tangent);
+    vec3_mul_cross(bitangent, candidate->normal, tangent);
+    float uu = 0.0f, uv = 0.0f, vv = 0.0f;
+    float offsetsU[4], offsetsV[4];
+    float reach = 0.0f;
+    float minNormalDot = 1.0f;
+    for(i = 0; i < neighbourCount; i++) {
+        vec3 offset;
+        vec3_sub(offset, neighbours[i]->position, candidate->position);
+        offsetsU[i] = vec3_dot(offset, tangent);
+        offsetsV[i] = vec3_dot(offset, bitangent);
+        uu += offsetsU[i] * offsetsU[i];
+        uv += offsetsU[i] * offsetsV[i];
+        vv += offsetsV[i] * offsetsV[i];
+        reach = fmaxf(reach, vec3_len(offset));
+        minNormalDot = fminf(minNormalDot, vec3_dot(neighbours[i]->normal, candidate->normal));
+    }
+
+    /*
+     * Curved mirrors (and grazing angles) spread the paths apart, and whole shadows could fit
+     * between them unseen. Fitting the light between hits only works where they stay about as
+     * close as the pixels they came from
+     */
+    if(reach > IRRADIANCE_MAX_SPREAD * candidate->spacing)
+        return 0;
+    const float determinant = uu * vv - uv * uv;
+    if(!(determinant > 1e-6f * (uu + vv) * (uu + vv)))
+        return 0;
+    for(channel = 0; channel < 3; channel++) {
+        float differenceU = 0.0f, differenceV = 0.0f;
+        for(i = 0; i < neighbourCount; i++) {
+            const float difference = neighbours[i]->color[channel] - candidate->color[channel];
+            differenceU += difference * offsetsU[i];
+            differenceV += difference * offsetsV[i];
+        }
+        const float gradientU = (vv * differenceU - uv * differenceV) / determinant;
+        const float gradientV = (uu * differenceV - uv * differenceU) / determinant;
+        vec3_scale(outRecord->gradient[channel], tangent, gradientU);
+        vec3_add_scaled(outRecord->gradient[channel], bitangent, gradientV);
+    }
+
+    /* Something that isn't smooth lies between them (shadow edge) */
+    const float tolerance = maxError * fmaxf(GetBrightness(candidate->color), darkLight);
+    for(i = 0; i < neighbourCount; i++) {
+        float predicted = 0.0f;
+        for(channel = 0; channel < 3; channel++) {
+            predicted += candidate->color[channel] + offsetsU[i] * vec3_dot(outRecord->gradient[channel], tangent)
+                + offsetsV[i] * vec3_dot(outRecord->gradient[channel], bitangent);
+        }
+        if(fabsf(predicted / 3.0f - GetBrightness(neighbours[i]->color)) > tolerance)
+            return 0;
+    }
+
+    vec3_dup(outRecord->position, candidate->position);
+    vec3_dup(outRecord->normal, candidate->normal);
+    vec3_dup(outRecord->color, candidate->color);
+    outRecord->reach = reach;
+    outRecord->minNormalDot = minNormalDot;
+    outRecord->primitiveId = candidate->primitiveId;
+    return reach > 0.0f;
+}
+
+/* Smallest level whose cells are at least as big as the record's reach */
+static int GetRecordLevel(const struct IrradianceCache* cache, const struct IrradianceRecord* record)
+{
+    int level = 0;
+    while(level < IRRADIANCE_MAX_LEVELS - 1 && ldexpf(cache->baseCellSize, level) < record->reach)
+        level++;
+    return level;
+}
+
+/* Calls for each cell of its level the record overlaps: counts them, and files the record under them if index >= 0 */
+static int FileRecord(struct IrradianceCache* cache, const struct IrradianceRecord* record, const int index)
+{
+    const int level = GetRecordLevel(cache, record);
+    const float cellSize = ldexpf(cache->baseCellSize, level);
+    int low[3], high[3], cell[3], i;
+    for(i = 0; i < 3; i++) {
+        low[i] = (int)floorf((record->position[i] - record->reach) / cellSize);
+        high[i] = (int)floorf((record->position[i] + record->reach) / cellSize);
+    }
+    int count = 0;
+    for(cell[0] = low[0]; cell[0] <= high[0]; cell[0]++) {
+        for(cell[1] = low[1]; cell[1] <= high[1]; cell[1]++) {
+            for(cell[2] = low[2]; cell[2] <= high[2]; cell[2]++) {
+                count++;
+                if(index < 0)
+                    continue;
+                const int bucket = HashCell(level, cell[0], cell[1], cell[2]) & (cache->bucketCount - 1);
+
+                /* Two of its cells can land in the same bucket, it only needs to be there once */
+                if(cache->buckets[bucket] >= 0 && cache->entries[cache->buckets[bucket]].record == index)
+                    continue;
+                struct IrradianceEntry* entry = &cache->entries[cache->entryCount];
+                vec3_dup(entry->position, record->position);
+                entry->reachSquared = record->reach * record->reach;
+                entry->primitiveId = record->primitiveId;
+                entry->record = index;
+                entry->next = cache->buckets[bucket];
+                cache->buckets[bucket] = cache->entryCount++;
+            }
+        }
+    }
+    cache->levelMask |= 1u << level;
+    return count;
+}
+
+/*
+ * Builds the cache of a frame (see irradiance.h) for a width x height image seen through camera.
+ * maxError is the relative error allowed between records. With worldSize > 1 every process
+ * has to call this, they share the work. Returns NULL if there's no memory, or nothing to gain:
+ * point lights cast no shadows and cost less to shade than a lookup does
+ */
+struct IrradianceCache* BuildIrradianceCache(struct Scene* scene, struct Camera* camera, const int width, const int height,
+    const float maxError, const int worldRank, const int worldSize)
+{
+    int light;
+    for(light = 0; light < scene->lightCount && scene->lights[light].type == LIGHT_POINT; light++)
+        ;
+    if(light == scene->lightCount) {
+        if(worldRank == 0)
+            printf("Irradiance cache not built: without area lights every hit is cheaper to shade than to look up\n");
+        return NULL;
+    }
+
+    const double begin = GetSeconds();
+    const int gridRows = (height + IRRADIANCE_GRID_STEP - 1) / IRRADIANCE_GRID_STEP;
+    const int gridCols = (width + IRRADIANCE_GRID_STEP - 1) / IRRADIANCE_GRID_STEP;
+    const size_t candidateCount = (size_t)gridRows * gridCols * MAX_RAY_REFLECTIONS;
+    struct IrradianceCache* cache = (struct IrradianceCache*)calloc(1, sizeof(struct IrradianceCache));
+    struct IrradianceCandidate* candidates = (struct IrradianceCandidate*)malloc(candidateCount * sizeof(struct IrradianceCandidate));
+    int* slots = (int*)malloc(candidateCount * sizeof(int));
+    if(!cache || !candidates || !slots) {
+        printf("Couldn't allocate the irradiance cache (%d x %d grid)\n", gridCols, gridRows);
+        free(cache);
+        free(candidates);
+        free(slots);
+        return NULL;
+    }
+    cache->maxError = maxError;
+
+    /* Every process shades a block of grid rows, then they swap them */
+    int gridRowStarts[worldSize];
+    int gridRowCounts[worldSize];
+    PartitionRowsEqually(gridRows, worldSize, gridRowStarts, gridRowCounts);
+    ShadeGridRows(scene, camera, width, height, gridCols, gridRowStarts[worldRank],
+        gridRowStarts[worldRank] + gridRowCounts[worldRank], candidates);
+#ifdef USE_MPI
+    if(worldSize > 1) {
+        const int gridRowBytes = gridCols * MAX_RAY_REFLECTIONS * sizeof(struct IrradianceCandidate);
+        int counts[worldSize];
+        int offsets[worldSize];
+        int i;
+        for(i = 0; i < worldSize; i++) {
+            counts[i] = gridRowCounts[i] * gridRowBytes;
+            offsets[i] = gridRowStarts[i] * gridRowBytes;
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_BYTE, candidates, counts, offsets, MPI_BYTE, MPI_COMM_WORLD);
+    }
+#endif
+
+    /* Errors in the dark are compared with a share of the brightest light instead */
+    size_t index;
+    float maxBrightness = 0.0f;
+    for(index = 0; index < candidateCount; index++) {
+        if(candidates[index].primitiveId >= 0) {
+            cache->candidateCount++;
+            maxBrightness = fmaxf(maxBrightness, GetBrightness(candidates[index].color));
+        }
+    }
+    cache->darkLight = IRRADIANCE_DARK_SHARE * maxBrightness;
+
+    /*
+     * Records are fitted twice: first to see which candidates make one, then into their place
+     * in grid order, so the records (and the hash) come out the same with any number of threads
+     */
+    int pass, gridRow;
+    for(pass = 0; pass < 2; pass++) {
+#ifdef USE_OPENMP
+        #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) schedule(dynamic)
+#endif
+        for(gridRow = 0; gridRow < gridRows; gridRow++) {
+            struct IrradianceRecord record;
+            int gridCol, bounce;
+            for(gridCol = 0; gridCol < gridCols; gridCol++) {
+                for(bounce = 0; bounce < MAX_RAY_REFLECTIONS; bounce++) {
+                    const size_t candidate = ((size_t)gridRow * gridCols + gridCol) * MAX_RAY_REFLECTIONS + bounce;
+                    if(pass == 0)
+                        slots[candidate] = FitRecord(candidates, gridRows, gridCols, gridRow, gridCol, bounce, maxError,
+                            cache->darkLight, &record) ? 0 : -1;
+                    else if(slots[candidate] >= 0)
+                        FitRecord(candidates, gridRows, gridCols, gridRow, gridCol, bounce, maxError, cache->darkLight,
+                            &cache->records[slots[candidate]]);
+                }
+            }
+        }
+        if(pass > 0)
+            break;
+        for(index = 0; index < candidateCount; index++) {
+            if(slots[index] >= 0)
+                slots[index] = cache->recordCount++;
+        }
+        cache->records = (struct IrradianceRecord*)malloc((cache->recordCount > 0 ? cache->recordCount : 1)
+            * sizeof(struct IrradianceRecord));
+        if(!cache->records) {
+            printf("Couldn't allocate %d irradiance records\n", cache->recordCount);
+            free(candidates);
+            free(slots);
+            FreeIrradianceCache(cache);
+            return NULL;
+        }
+    }
+    free(candidates);
+    free(slots);
+    struct IrradianceRecord* records = cache->records;
+    int record;
+    for(record = 0; record < cache->recordCount; record++) {
+        if(record == 0 || records[record].reach < cache->baseCellSize)
+            cache->baseCellSize = records[record].reach;
+    }
+
+    /* Count the cells first to size the hash */
+    int entryCount = 0;
+    for(record = 0; record < cache->recordCount; record++)
+        entryCount += FileRecord(cache, &records[record], -1);
+    cache->bucketCount = 1;
+    while(cache->bucketCount < 2 * entryCount)
+        cache->bucketCount *= 2;
+    cache->buckets = (int*)malloc(cache->bucketCount * sizeof(int));
+    cache->entries = (struct IrradianceEntry*)malloc((entryCount > 0 ? entryCount : 1) * sizeof(struct IrradianceEntry));
+    if(!cache->buckets || !cache->entries) {
+        printf("Couldn't allocate the irradiance cache's hash (%d entries)\n", entryCount);
+        FreeIrradianceCache(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0xff, cache->bucketCount * sizeof(int));
+    for(record = 0; record < cache->recordCount; record++)
+        FileRecord(cache, &records[record], record);
+
+    cache->buildSeconds = GetSeconds() - begin;
+    return cache;
+}
+
+/*
+ * Takes the light of a hit (what CalculateLighting would give) from the records around it.
+ * Returns 0 if none of them reach it, the hit has to be shaded then. Thread safe
+ */
+int LookupIrradiance(struct IrradianceCache* cache, struct Scene* scene, const struct SampleId* sampleId, const int primitiveId,
+    struct Ray collisionPointNormal, float* outRayColor, float* outputReflectedPhotons)
+{
+#ifdef USE_OPENMP
+    struct IrradianceStats* stats = &cache->stats[omp_get_thread_num() % IRRADIANCE_STAT_SLOTS];
+#else
+    struct IrradianceStats* stats = &cache->stats[0];
+#endif
+    const float* position = collisionPointNormal.origin;
+    const float* normal = collisionPointNormal.direction;
+    int visitedBuckets[IRRADIANCE_MAX_LEVELS];
+    int visitedCount = 0;
+    vec3 sum = {0, 0, 0};
+    float weightSum = 0.0f;
+    int level, i, channel;
+    stats->lookups++;
+
+    for(level = 0; level < IRRADIANCE_MAX_LEVELS; level++) {
+        if(!(cache->levelMask & (1u << level)))
+            continue;
+        const float cellSize = ldexpf(cache->baseCellSize, level);
+        const int bucket = HashCell(level, (int)floorf(position[0] / cellSize), (int)floorf(position[1] / cellSize),
+            (int)floorf(position[2] / cellSize)) & (cache->bucketCount - 1);
+
+        /* Levels can share a bucket, its records only count once */
+        for(i = 0; i < visitedCount && visitedBuckets[i] != bucket; i++)
+            ;
+        if(i < visitedCount)
+            continue;
+        visitedBuckets[visitedCount++] = bucket;
+
+        int entry;
+        for(entry = cache->buckets[bucket]; entry >= 0; entry = cache->entries[entry].next) {
+            const struct IrradianceEntry* filed = &cache->entries[entry];
+            if(filed->primitiveId != primitiveId)
+                continue;
+            vec3 offset;
+            vec3_sub(offset, position, filed->position);
+            if(vec3_dot(offset, offset) >= filed->reachSquared)
+                continue;
+            const struct IrradianceRecord* record = &cache->records[filed->record];
+            if(vec3_dot(normal, record->normal) < record->minNormalDot - IRRADIANCE_NORMAL_SLACK)
+                continue;
+            const float distance = vec3_len(offset);
+
+            /* Closer records count more, and records fade out where they stop reaching */
+            const float weight = 1.0f - distance / record->reach;
+            for(channel = 0; channel < 3; channel++)
+                sum[channel] += weight * (record->color[channel] + vec3_dot(record->gradient[channel], offset));
+            weightSum += weight;
+        }
+    }
+    if(!(weightSum > 0.0f))
+        return 0;
+
+    vec3 color;
+    for(channel = 0; channel < 3; channel++)
+        color[channel] = fmaxf(0.0f, sum[channel] / weightSum) * *outputReflectedPhotons;
+    stats->hits++;
+
+    /* A few answers get shaded too, to see how far off they are */
+    if((sampleId->row * 31 + sampleId->col * 17 + sampleId->bounce) % IRRADIANCE_CHECK_STRIDE == 0) {
+        vec3 reference = {0, 0, 0};
+        CalculateLighting(scene, sampleId, collisionPointNormal, reference, outputReflectedPhotons);
+        const float error = fabsf(GetBrightness(color) - GetBrightness(reference));
+        stats->checked++;
+        stats->error += error;
+        stats->reference += GetBrightness(reference);
+        stats->maxError = fmaxf(stats->maxError,
+            error / fmaxf(GetBrightness(reference), cache->darkLight * *outputReflectedPhotons));
+    }
+    vec3_dup(outRayColor, color);
+    return 1;
+}
+
+/* Prints how many records were made, how many lookups they answered and how far off they were */
+void PrintIrradianceStats(struct IrradianceCache* cache, const int worldRank)
+{
+    struct IrradianceStats total;
+    memset(&total, 0, sizeof(total));
+    int i;
+    for(i = 0; i < IRRADIANCE_STAT_SLOTS; i++) {
+        total.lookups += cache->stats[i].lookups;
+        total.hits += cache->stats[i].hits;
+        total.checked += cache->stats[i].checked;
+        total.error += cache->stats[i].error;
+        total.reference += cache->stats[i].reference;
+        total.maxError = fmaxf(total.maxError, cache->stats[i].maxError);
+    }
+    const double megabytes = ((double)cache->recordCount * sizeof(struct IrradianceRecord)
+        + (double)cache->bucketCount * sizeof(int) + (double)cache->entryCount * sizeof(struct IrradianceEntry)) / (1024.0 * 1024.0);
+    printf("Irradiance cache, process %d: %d records from %d grid hits (%.2f MB, built in %.2f seconds), "
+        "%.1f%% of %lld lookups answered, error of %lld checked answers %.2f%% on average, at most %.1f%%\n",
+        worldRank, cache->recordCount, cache->candidateCount, megabytes, cache->buildSeconds,
+        total.lookups > 0 ? 100.0 * total.hits / total.lookups : 0.0, total.lookups, total.checked,
+        total.reference > 0.0 ? 100.0 * total.error / total.reference : 0.0, 100.0f * total.maxError);
+}
+
+void FreeIrradianceCache(struct IrradianceCache* cache)
+{
+    if(!cache)
+        return;
+    free(cache->records);
+    free(cache->buckets);
+    free(cache->entries);
+    free(cache);
+}
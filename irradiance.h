@@ -0,0 +1,126 @@
+#ifndef IRRADIANCE_H_
+#define IRRADIANCE_H_
+
+#include "linmath.h"
+#include "scene.h"
+#include "camera.h"
+#include "raytracer.h"
+
+/*
+ * Irradiance cache of the direct lighting (--irradiance-cache).
+ *
+ * The light CalculateLighting works out only depends on where a hit is and which way it
+ * faces, and on a diffuse surface it changes smoothly except at shadow edges. So before a
+ * frame is traced, every path of a sparse grid of pixels (every IRRADIANCE_GRID_STEP-th pixel
+ * of every IRRADIANCE_GRID_STEP-th row) is traced and each of its hits is shaded once as a
+ * record. A record is compared with the records of the neighbouring grid pixels that hit the
+ * same primitive at the same bounce: a plane is fitted through their light (the gradient),
+ * and if any of them is further off that plane than the allowed error (relative to the
+ * record's light) something that isn't smooth lies between them, a shadow edge or a light
+ * coming over the horizon, and the record is dropped. Hits there are shaded as usual. So are
+ * records whose neighbours are much further apart than the grid's step seen from that far
+ * along the path, which is where reflections off curved surfaces spread the paths apart.
+ *
+ * While tracing, a hit takes its light from the records of its primitive around it, each
+ * extrapolated along its gradient and weighted by how close it is, if any reach it and face
+ * close enough to the same way. Records reach as far as their neighbours.
+ *
+ * Only scenes with area lights get a cache: point lights cast no shadows here, and shading a
+ * hit with them costs less than looking it up.
+ *
+ * Records live in a spatial hash with a level per power of two of their reach, each one
+ * filed under the cells of its level it overlaps, so a lookup only checks one cell per level.
+ * The cache is built before tracing starts and only read while tracing, so threads share it
+ * without locks and the image doesn't depend on which thread got where first (adding records
+ * as hits come along would). With MPI the processes split the grid and swap their records.
+ * Every IRRADIANCE_CHECK_STRIDE-th answered lookup also shades the hit for the error statistics.
+ */
+
+/* Records are made for every this many pixels and rows */
+#define IRRADIANCE_GRID_STEP 4
+
+/* Allowed relative error of the light by default (see --irradiance-error) */
+#define IRRADIANCE_DEFAULT_ERROR 0.05f
+
+/* Records are dropped where the paths of the grid are further apart than this many times the grid step (seen at their length) */
+#define IRRADIANCE_MAX_SPREAD 2.0f
+
+/* Light below this share of the brightest record counts as this much when comparing errors */
+#define IRRADIANCE_DARK_SHARE 0.01f
+
+/* A hit may face this much further away from a record than the record's neighbours did */
+#define IRRADIANCE_NORMAL_SLACK 0.01f
+
+/* Every this many answered lookups one also gets shaded to measure the error */
+#define IRRADIANCE_CHECK_STRIDE 61
+
+/* Levels of the spatial hash (each one's cells are twice as big as the one before) */
+#define IRRADIANCE_MAX_LEVELS 32
+
+/* Per thread counters (each on its own cache line) */
+#ifdef USE_OPENMP
+#define IRRADIANCE_STAT_SLOTS OPENMP_THREAD_AMOUNT
+#else
+#define IRRADIANCE_STAT_SLOTS 1
+#endif
+
+/* Light per photon at a hit, and how it changes along the surface (gradient[channel] is a direction) */
+struct IrradianceRecord {
+    vec3 position;
+    vec3 normal;
+    vec3 color;
+    vec3 gradient[3];
+    float reach;
+    float minNormalDot;
+    int primitiveId;
+};
+
+/* A record filed under a cell, with what's needed to tell whether it reaches a hit without going to the record */
+struct IrradianceEntry {
+    vec3 position;
+    float reachSquared;
+    int primitiveId;
+    int record;
+    int next;
+};
+
+struct IrradianceStats {
+    long long lookups;
+    long long hits;
+    long long checked;
+    double error;
+    double reference;
+    float maxError;
+    char padding[20];
+};
+
+struct IrradianceCache {
+    float maxError;
+    float darkLight;
+    int recordCount;
+    int candidateCount;
+    struct IrradianceRecord* records;
+
+    /* Hash of (level, cell) to a chain of entries */
+    float baseCellSize;
+    unsigned int levelMask;
+    int bucketCount;
+    int* buckets;
+    struct IrradianceEntry* entries;
+    int entryCount;
+
+    double buildSeconds;
+    struct IrradianceStats stats[IRRADIANCE_STAT_SLOTS];
+};
+
+struct IrradianceCache* BuildIrradianceCache(struct Scene* scene, struct Camera* camera, const int width, const int height,
+    const float maxError, const int worldRank, const int worldSize);
+
+int LookupIrradiance(struct IrradianceCache* cache, struct Scene* scene, const struct SampleId* sampleId, const int primitiveId,
+    struct Ray collisionPointNormal, float* outRayColor, float* outputReflectedPhotons);
+
+void PrintIrradianceStats(struct IrradianceCache* cache, const int worldRank);
+
+void FreeIrradianceCache(struct IrradianceCache* cache);
+
+#endif
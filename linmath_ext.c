@@ -16,3 +16,4 @@ void vec3_zero(float *vecName)
     vecName[1] = 0.0f;
     vecName[2] = 0.0f;
 }
+
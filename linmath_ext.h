@@ -6,11 +6,107 @@
 #ifndef LINMATH_EXT_H
 #define LINMATH_EXT_H
 
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 /* makes it easy to print a vector3 */
 void vec3_print(float* vecName, int includeNewLine);
 
 /* zeroes out a vector3 */
 void vec3_zero(float *vecName);
 
+/* 
+ * Fast 1/sqrt(x): the hardware estimate (12 bits) plus one Newton step
+ * gets within a couple of float ulps, without a sqrt and a divide
+ */
+#ifdef __SSE__
+static inline __m128 rsqrt4_fast(__m128 x)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 threeHalves = _mm_set1_ps(1.5f);
+    __m128 estimate = _mm_rsqrt_ps(x);
+    __m128 halfXEstimateSquared = _mm_mul_ps(_mm_mul_ps(half, x), _mm_mul_ps(estimate, estimate));
+    return _mm_mul_ps(estimate, _mm_sub_ps(threeHalves, halfXEstimateSquared));
+}
+#endif
+
+static inline float rsqrt_fast(float x)
+{
+#ifdef __SSE__
+    return _mm_cvtss_f32(rsqrt4_fast(_mm_set_ss(x)));
+#else
+    return 1.0f / sqrtf(x);
+#endif
+}
+
+/* normalizes a vector3 with rsqrt_fast */
+static inline void vec3_norm_fast(float* outVec, const float* vecName)
+{
+    float inverseLength = rsqrt_fast(vecName[0]*vecName[0] + vecName[1]*vecName[1] + vecName[2]*vecName[2]);
+    outVec[0] = vecName[0] * inverseLength;
+    outVec[1] = vecName[1] * inverseLength;
+    outVec[2] = vecName[2] * inverseLength;
+}
+
+/* 
+ * Math for the hot kernels (intersections and lighting).
+ * Everything stays in float so nothing gets converted to double and back.
+ * USE_FAST_MATH builds use rsqrt_fast instead of a sqrtf and a divide;
+ * "make validate_fastmath" checks how far that moves the image.
+ */
+
+/* dot product of two vector3s. Uses fused multiply-adds when the cpu has them */
+static inline float vec3_dot(const float* a, const float* b)
+{
+#ifdef __FMA__
+    return fmaf(a[2], b[2], fmaf(a[1], b[1], a[0] * b[0]));
+#else
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+#endif
+}
+
+/* 1/sqrt(x) */
+static inline float inverse_sqrt(float x)
+{
+#ifdef USE_FAST_MATH
+    return rsqrt_fast(x);
+#else
+    return 1.0f / sqrtf(x);
+#endif
+}
+
+/* 1/sqrt(x) 4 at a time, rounded like inverse_sqrt */
+#ifdef __SSE__
+static inline __m128 inverse_sqrt4(__m128 x)
+{
+#ifdef USE_FAST_MATH
+    return rsqrt4_fast(x);
+#else
+    return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(x));
+#endif
+}
+#endif
+
+/* normalizes a vector3, returns its length squared */
+static inline float vec3_normalize(float* outVec, const float* vecName)
+{
+    float lengthSquared = vec3_dot(vecName, vecName);
+    float inverseLength = inverse_sqrt(lengthSquared);
+    outVec[0] = vecName[0] * inverseLength;
+    outVec[1] = vecName[1] * inverseLength;
+    outVec[2] = vecName[2] * inverseLength;
+    return lengthSquared;
+}
+
+/* adds a vector3 times a scale to another (outVec += vecName * scale) */
+static inline void vec3_add_scaled(float* outVec, const float* vecName, const float scale)
+{
+    outVec[0] += vecName[0] * scale;
+    outVec[1] += vecName[1] * scale;
+    outVec[2] += vecName[2] * scale;
+}
 
-#endif
\ No newline at end of file
+#endif
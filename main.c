@@ -11,6 +11,34 @@
 /* My libs */
 #include "linmath_ext.h"
 #include "raytracer.h"
+#include "scene.h"
+#include "camera.h"
+#include "options.h"
+#include "adaptive.h"
+#include "animation.h"
+#include "gbuffer.h"
+#include "rawimage.h"
+#include "mesh.h"
+#include "instance.h"
+#include "framebuffer.h"
+#include "cachecounter.h"
+#include "pixelformat.h"
+#include "partition.h"
+#include "numa.h"
+#include "nodeshare.h"
+#include "scenepack.h"
+#include "tilecull.h"
+#include "tonemap.h"
+#include "rt.h"
+#include "renderserver.h"
+#include "checkpoint.h"
+#include "hash.h"
+#include "denoise.h"
+#include "temporal.h"
+#include "irradiance.h"
+#include "schedule.h"
+#include "autotune.h"
+#include "heatmap.h"
 
 /* Include OpenMP (if needed) */
 #ifdef USE_OPENMP
@@ -22,188 +50,1126 @@
 #include <mpi.h>
 #endif
 
-int main()
+/* The pixel the CLI prints the math of (see SetDebugPixel) */
+#define DEBUG_PIXEL_ROW 200
+#define DEBUG_PIXEL_COL 200
+
+/*
+ * Rows each thread takes in turn with --numa (see numa.h), so every pass over the image
+ * hands a row to the thread it was placed next to. 0 without --numa
+ */
+static int GetRowChunk(struct RenderOptions* options, const int rows)
 {
-    /* Image sizes. 1920x1080 is proper, but 1072 I used for benchmarking
-       as 1080 is not divisible by 16. */
-    const int width = 1920;
-    const int height = 1080;
-    //const int height = 1072;
-    const int fov = 30;
+    if(!options->numa)
+        return 0;
+#ifdef USE_OPENMP
+    return GetNumaChunk((size_t)options->width * GetPixelFormatSize(options->pixelFormat), rows, OPENMP_THREAD_AMOUNT);
+#else
+    return GetNumaChunk((size_t)options->width * GetPixelFormatSize(options->pixelFormat), rows, 1);
+#endif
+}
+
+/*
+ * Scales the raw lighting values so the brightest one ends up at 255
+ * and converts them to 24-bit BGR pixels for the bitmap
+ */
+static void TonemapImage(const int pixelFormat, const void* pixels, const int width, const int height,
+    const int rowChunk, unsigned char* outImage)
+{
+    /* Grab the value range to scale our image by (0-255) */
+    printf("Calculating maximum lighting value...\n");
+    float maxLightingValue = FindMaxLightingValue(pixelFormat, pixels, width, height, rowChunk);
+    printf("Maximum lighting value: %.2f \n", maxLightingValue);
+
+    ScaleToBitmap(pixelFormat, pixels, width, height, rowChunk, maxLightingValue, outImage);
+}
+
+/*
+ * Traces one row of the image into outRow (width pixels, stored in pixelFormat).
+ * Primary ray directions for the row are made up front with GenerateCameraRays, and every
+ * TILE_CULL_ROW_SEGMENT pixels share a primitive list (see tilecull.h).
+ * gbufferRow is the row's index in the G-buffer (if there is one).
+ * outGuides gets the row's primary hits for the denoiser, unless it's NULL.
+ * With a temporal cache the light of primary hits is taken from the previous frame where it can (see temporal.h).
+ * With a heatmap every segment of the row is timed as a cell of it (see heatmap.h).
+ * scratch needs room for width * 6 floats and belongs to the calling thread.
+ * Returns how many circle and plane tests the row's primary rays needed
+ */
+static long long TraceRow(struct Scene* scene, struct Camera* camera, const int row, const int width,
+    const int pixelFormat, void* outRow, struct GBuffer* gbuffer, const int gbufferRow, struct DenoiseGuide* outGuides,
+    struct TemporalCache* temporal, struct Heatmap* heatmap, float* scratch)
+{
+    float* directions = scratch;
+    float* directionX = directions;
+    float* directionY = directions + width;
+    float* directionZ = directions + width * 2;
+    float* colors = directions + width * 3;
+    GenerateCameraRays(camera, row, 0, 1, width, directionX, directionY, directionZ);
+
+    struct PrimitiveList primaryList;
+    struct HeatmapTimer timer;
+    long long primaryTests = 0;
+    int segment = 0;
+    int j;
+    for (j = 0; j < width; j++) {
+        if(j % TILE_CULL_ROW_SEGMENT == 0) {
+            segment = width - j < TILE_CULL_ROW_SEGMENT ? width - j : TILE_CULL_ROW_SEGMENT;
+            if(heatmap)
+                StartHeatmapCell(&timer);
+            BuildPrimitiveList(scene, camera, row, j, 1, segment, &primaryList);
+            primaryTests += (long long)(primaryList.circleCount + primaryList.planeCount) * segment;
+        }
+        vec3 finalOutput = {0, 0, 0};
+        vec3 direction = {directionX[j], directionY[j], directionZ[j]};
+        struct PathVertex path[MAX_RAY_REFLECTIONS];
+        int pathLength = 0;
+        struct RayHit primaryHit;
+        if(temporal)
+            TraceTemporalPixel(temporal, scene, camera, &primaryList, row, j, direction, finalOutput,
+                outGuides ? &primaryHit : NULL);
+        else
+            TraceCameraRayDirection(scene, camera, &primaryList, row, j, direction, finalOutput,
+                outGuides ? &primaryHit : NULL, gbuffer ? path : NULL, &pathLength);
+        vec3_dup(&colors[j*3], finalOutput);
+        if(outGuides)
+            SetDenoiseGuide(&outGuides[j], &primaryHit);
+        if(gbuffer)
+            AddGBufferPath(gbuffer, gbufferRow, j, path, pathLength);
+        if(heatmap && j % TILE_CULL_ROW_SEGMENT == segment - 1)
+            FinishHeatmapCell(heatmap, &timer, row, j - segment + 1, 1, segment);
+    }
+
+    PackPixels(pixelFormat, colors, outRow, width);
+    return primaryTests;
+}
+
+/*
+ * The loops of TraceRows: traces every pixel of rows rowStart to rowStart + rowCount - 1 (width
+ * pixels each) handing rows or tiles to threads as schedule says (see schedule.h), or as --numa
+ * placed them. Rows go straight to outRows, tiles to *outFramebuffer (the caller turns it into
+ * rows and frees it), NULL for rows. heatmap (can be NULL) gets what every cell cost.
+ * Adds the cache misses, threads without a counter and primary ray tests to the out counters.
+ * Returns 1 on success, 0 if memory ran out
+ */
+static int TraceScheduled(struct RenderOptions* options, const struct TraceSchedule* schedule,
+    struct Scene* scene, struct Camera* camera, const int width, const int rowStart, const int rowCount, void* outRows,
+    struct GBuffer* gbuffer, struct DenoiseGuide* outGuides, struct TemporalCache* temporal, struct Checkpoint* checkpoint,
+    struct Heatmap* heatmap, long long* outCacheMisses, int* outCountersMissing, long long* outPrimaryTests,
+    struct Framebuffer** outFramebuffer)
+{
+    const size_t rowBytes = (size_t)width * GetPixelFormatSize(options->pixelFormat);
+    long long cacheMisses = 0;
+    long long primaryTests = 0;
+    int countersMissing = 0;
+    int scratchMissing = 0;
+    int i;
+
+    struct Framebuffer* framebuffer = NULL;
+    if(schedule->tileSize > 0) {
+        framebuffer = NewFramebuffer(width, rowStart, rowCount, schedule->tileSize, options->numa);
+        if(!framebuffer)
+            return 0;
+        RenderFramebuffer(scene, camera, framebuffer, schedule, outGuides, temporal, heatmap, &cacheMisses,
+            &countersMissing, &primaryTests);
+    } else {
+#ifdef USE_OPENMP
+        const int rowChunk = GetRowChunk(options, rowCount);
+        if(rowChunk > 0)
+            omp_set_schedule(omp_sched_static, rowChunk);
+        else
+            ApplyTraceSchedule(schedule, SCHEDULE_GUIDED, 0);
+        #pragma omp parallel num_threads(schedule->threads) private(i) reduction(+:cacheMisses, countersMissing, primaryTests, scratchMissing)
+#endif
+        {
+            int counter = OpenCacheMissCounter();
+            float* scratch = (float*)malloc(width * sizeof(vec3) * 2);
+            if(!scratch) {
+                printf("could not allocate %d bytes of trace scratch\n", (int)(width * sizeof(vec3) * 2));
+                scratchMissing++;
+            }
+#ifdef USE_OPENMP
+            #pragma omp for schedule(runtime)
+#endif
+            for (i = 0; i < rowCount; i++) {
+                struct DenoiseGuide* rowGuides = outGuides ? &outGuides[(size_t)i * width] : NULL;
+                /* Every thread has to get through the loop, the ones without scratch just don't trace */
+                if(!scratch)
+                    continue;
+                if(checkpoint && IsCheckpointRowDone(checkpoint, rowStart + i)) {
+                    int j;
+                    for(j = 0; rowGuides && j < width; j++)
+                        SetMissingDenoiseGuide(&rowGuides[j]);
+                    continue;
+                }
+                primaryTests += TraceRow(scene, camera, rowStart + i, width, options->pixelFormat,
+                    (unsigned char*)outRows + i * rowBytes, gbuffer, i, rowGuides, temporal, heatmap, scratch);
+                if(checkpoint)
+                    FinishCheckpointRow(checkpoint, rowStart + i);
+            }
+            free(scratch);
+
+            long long count = CloseCacheMissCounter(counter);
+            if(count < 0)
+                countersMissing++;
+            else
+                cacheMisses += count;
+        }
+    }
+
+    *outCacheMisses += cacheMisses;
+    *outCountersMissing += countersMissing;
+    *outPrimaryTests += primaryTests;
+    *outFramebuffer = framebuffer;
+    return scratchMissing == 0;
+}
+
+/*
+ * Traces every pixel of rows rowStart to rowStart + rowCount - 1 into outRows
+ * (stored in the --pixel-format), either row by row or tile by tile (see --layout and framebuffer.h),
+ * handed to threads as the --schedule says.
+ * With --numa outRows has to be first touched with GetRowChunk(options, rowCount) rows per thread.
+ * With a checkpoint, rows it already has are skipped and finished rows go to its journal.
+ * outGuides (width * rowCount, can be NULL) gets every pixel's primary hit for the denoiser,
+ * skipped rows get none (see SetMissingDenoiseGuide).
+ * With a temporal cache (--temporal) the rows reuse what the previous frame shaded, and how much is printed.
+ * With a heatmap (--heatmap) every cell of the rows gets timed and its rays counted.
+ * Prints how long it took and how many cache misses it caused.
+ */
+static void TraceRows(struct RenderOptions* options, struct Scene* scene, struct Camera* camera,
+    const int rowStart, const int rowCount, void* outRows, struct GBuffer* gbuffer, struct DenoiseGuide* outGuides,
+    struct TemporalCache* temporal, struct Checkpoint* checkpoint, struct Heatmap* heatmap, const int world_rank)
+{
+    const int width = options->width;
+    long long cacheMisses = 0;
+    long long primaryTests = 0;
+    int countersMissing = 0;
 
-    /* Timing */
 #ifdef USE_OPENMP
     double begin = omp_get_wtime();
 #else
     clock_t begin = clock();
 #endif
+    if(temporal && !BeginTemporalFrame(temporal, scene, camera, rowStart, rowCount))
+        exit(1);
+
+    struct Framebuffer* framebuffer = NULL;
+    if(!TraceScheduled(options, &options->schedule, scene, camera, width, rowStart, rowCount, outRows, gbuffer,
+        outGuides, temporal, checkpoint, heatmap, &cacheMisses, &countersMissing, &primaryTests, &framebuffer))
+        exit(1);
 
+#ifdef USE_OPENMP
+    double seconds = omp_get_wtime() - begin;
+#else
+    double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+#endif
+    char label[64];
 #ifdef USE_MPI
-     // Initialize the MPI environment
-    MPI_Init(NULL, NULL);
-    // Find out rank, size
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    snprintf(label, sizeof(label), "Process %d trace (%s layout)", world_rank, framebuffer ? "tiled" : "rows");
+#else
+    snprintf(label, sizeof(label), "Trace (%s layout)", framebuffer ? "tiled" : "rows");
+    (void)world_rank;
+#endif
+    PrintCacheMisses(label, cacheMisses, countersMissing, (long long)width * rowCount, seconds);
+    printf("%s: primary rays test %.2f of the %d circles and planes after tile culling\n", label,
+        (double)primaryTests / ((double)width * rowCount), scene->circleCount + scene->planeCount);
+    if(temporal)
+        EndTemporalFrame(temporal, world_rank);
 
-    printf("I am MPI process %d of %d\n", world_rank, world_size);
+    /* Everything after this wants plain rows */
+    if(framebuffer) {
+        FramebufferToRows(framebuffer, options->pixelFormat, outRows);
+        FreeFramebuffer(framebuffer);
+    }
+}
+
+/* The proxy frame the auto-tuner times schedules on (see autotune.h) */
+struct ProxyFrame {
+    struct RenderOptions* options;
+    struct Scene* scene;
+    struct Camera camera;
+    void* rows;
+};
+
+/* Traces the proxy frame (a ProxyFrame) with schedule, like TraceRows does a frame. Returns how many seconds it took */
+static double TraceProxyFrame(void* context, const struct TraceSchedule* schedule)
+{
+    struct ProxyFrame* proxy = (struct ProxyFrame*)context;
+    long long cacheMisses = 0;
+    long long primaryTests = 0;
+    int countersMissing = 0;
 
-    if(height % world_size != 0) {
-        printf("image height of %d needs to be divisible by world_size (%d)", height, world_size);
+#ifdef USE_OPENMP
+    double begin = omp_get_wtime();
+#else
+    clock_t begin = clock();
+#endif
+    struct Framebuffer* framebuffer = NULL;
+    if(!TraceScheduled(proxy->options, schedule, proxy->scene, &proxy->camera, proxy->camera.imageWidth, 0,
+        proxy->camera.imageHeight, proxy->rows, NULL, NULL, NULL, NULL, NULL, &cacheMisses, &countersMissing,
+        &primaryTests, &framebuffer))
         exit(1);
+    if(framebuffer) {
+        FramebufferToRows(framebuffer, proxy->options->pixelFormat, proxy->rows);
+        FreeFramebuffer(framebuffer);
     }
+#ifdef USE_OPENMP
+    return omp_get_wtime() - begin;
+#else
+    return (double)(clock() - begin) / CLOCKS_PER_SEC;
 #endif
+}
 
-    /* Camera Position */
-    vec3 eyePos;
-    GetEyePosition(eyePos, width, height, fov);
-    printf("Eye position is calculated at %f:%f:%f for image of size %d:%d\n", eyePos[0], eyePos[1], eyePos[2], width, height);
-
-    /* 
-     * For each pixel in our image, calculate the ray and populate the image
-     * with that pixel color
-     */
-    int i, j, k;
+/*
+ * --auto-tune: takes the schedule tuned for this host and render from the --tune-file, or tunes
+ * it on a proxy of the frame and adds it to the file (see autotune.h). With MPI the root
+ * does it and hands the schedule to the others
+ */
+static void TuneSchedule(struct RenderOptions* options, struct Scene* scene, struct Camera* camera, const int world_rank,
+    const int world_size)
+{
+    /* Tiles are only tried where --layout tiled would work */
+    const int tilesAllowed = !options->gbufferFile && !options->checkpointFile;
+    if(world_rank == 0) {
+        const unsigned long long key = GetTuneKey(scene, camera, options->pixelFormat, options->irradianceError, tilesAllowed);
+        char description[128];
+        double raysPerSecond;
+        if(LoadTunedSchedule(options->tuneFile, key, &options->schedule, &raysPerSecond)) {
+            DescribeTraceSchedule(&options->schedule, description, sizeof(description));
+            printf("Schedule tuned earlier taken from %s: %s (%.3f M primary rays/s on the proxy)\n", options->tuneFile,
+                description, raysPerSecond * 1e-6);
+        } else {
+            struct ProxyFrame proxy;
+            proxy.options = options;
+            proxy.scene = scene;
+            ShrinkCamera(&proxy.camera, camera, AUTOTUNE_PROXY_SCALE);
+            proxy.rows = malloc((size_t)proxy.camera.imageWidth * proxy.camera.imageHeight
+                * GetPixelFormatSize(options->pixelFormat));
+            if(!proxy.rows)
+                exit(1);
+            printf("Tuning the schedule on a %d:%d proxy of the frame:\n", proxy.camera.imageWidth, proxy.camera.imageHeight);
 
-    /* allocate memory. need this dynamic memory or the stack will overflow. */
-    float * rawImage = (float *)malloc(height * width * sizeof(vec3));
+            /* The proxy's pixels aren't the image's, so none of them gets its math printed */
+            SetDebugPixel(-1, -1);
+            raysPerSecond = AutoTuneSchedule(TraceProxyFrame, &proxy,
+                (long long)proxy.camera.imageWidth * proxy.camera.imageHeight * camera->samplesPerPixel, tilesAllowed,
+                &options->schedule);
+            SetDebugPixel(DEBUG_PIXEL_ROW, DEBUG_PIXEL_COL);
+            free(proxy.rows);
 
-#ifdef USE_MPI
-    int buffer_size = height / world_size;
-    float * rawImageBuffer = (float*)malloc(buffer_size * width * sizeof(vec3));
-    for (i = 0; i < buffer_size; i++) {
-        for (j = 0; j < width; j++) {
-            vec3 imageLocation = {(world_rank * buffer_size) + i, j, 0};
-            vec3 finalOutput = {0, 0, 0};
-            TraceRay(eyePos, imageLocation, finalOutput);
-            vec3_dup(&rawImageBuffer[(i*width + j)*3], finalOutput);
+            DescribeTraceSchedule(&options->schedule, description, sizeof(description));
+            printf("Tuned schedule: %s\n", description);
+            if(SaveTunedSchedule(options->tuneFile, key, &options->schedule, raysPerSecond))
+                printf("Tuned schedule saved to %s\n", options->tuneFile);
         }
     }
-    printf("Process %d finished raytracing\n", world_rank);
-    MPI_Barrier(MPI_COMM_WORLD);
-    MPI_Gather(rawImageBuffer, buffer_size * width * 3, MPI_FLOAT, 
-        rawImage, buffer_size * width * 3, MPI_FLOAT, 0, MPI_COMM_WORLD);
+#ifdef USE_MPI
+    if(world_size > 1)
+        MPI_Bcast(&options->schedule, sizeof(struct TraceSchedule), MPI_BYTE, 0, MPI_COMM_WORLD);
 #else
+    (void)world_size;
+#endif
+}
+
+/*
+ * The heatmap of rows rowStart to rowStart + rowCount - 1, in cells the way the layout traces
+ * them (see heatmap.h). NULL without --heatmap
+ */
+static struct Heatmap* NewFrameHeatmap(struct RenderOptions* options, const int rowStart, const int rowCount,
+    const int world_rank)
+{
+    if(!options->heatmap)
+        return NULL;
+    const int tileSize = options->schedule.tileSize;
+    struct Heatmap* heatmap = tileSize > 0
+        ? NewHeatmap(options->width, rowStart, rowCount, tileSize, tileSize, world_rank)
+        : NewHeatmap(options->width, rowStart, rowCount, 1, TILE_CULL_ROW_SEGMENT, world_rank);
+    if(!heatmap)
+        exit(1);
+    return heatmap;
+}
+
+/*
+ * Starts journaling the rows this process traces (see --checkpoint), after taking
+ * the ones the journals already have with --resume. Returns NULL without --checkpoint
+ */
+static struct Checkpoint* OpenFrameCheckpoint(struct RenderOptions* options, struct Scene* scene, struct Camera* camera,
+    const int rowStart, const int rowCount, void* rows, const int world_rank, const int world_size,
+    struct Checkpoint* outCheckpoint)
+{
+    if(!options->checkpointFile)
+        return NULL;
+    if(!OpenCheckpoint(outCheckpoint, options->checkpointFile, options->resume,
+        GetRenderKey(scene, camera, options->pixelFormat, options->irradianceError), options->width, options->pixelFormat,
+        rowStart, rowCount, rows, world_rank, world_size))
+        exit(1);
+    if(options->resume)
+        printf("Checkpoint %s: resumed %d of rows %d-%d from the journals (%d records of other renders ignored)\n",
+            outCheckpoint->fileName, outCheckpoint->resumedRows, rowStart, rowStart + rowCount - 1,
+            outCheckpoint->ignoredRecords);
+    return outCheckpoint;
+}
+
+static void CloseFrameCheckpoint(struct Checkpoint* checkpoint)
+{
+    if(!checkpoint)
+        return;
+    printf("Checkpoint %s: journaled %d bands of up to %d rows\n", checkpoint->fileName,
+        checkpoint->bandsWritten, CHECKPOINT_BAND_ROWS);
+    CloseCheckpoint(checkpoint);
+}
+
+/*
+ * Runs the denoiser (see --denoise) over rows pixels stored in the --pixel-format, with
+ * every pixel's primary hit in guides. Packed formats are denoised as floats and packed again
+ */
+static void DenoiseRows(struct RenderOptions* options, void* pixels, const struct DenoiseGuide* guides, const int rows)
+{
+    const int width = options->width;
+    float* floatPixels = (float*)pixels;
+    if(options->pixelFormat != PIXEL_FORMAT_FLOAT) {
+        floatPixels = (float*)malloc((size_t)rows * width * sizeof(vec3));
+        UnpackPixels(options->pixelFormat, pixels, floatPixels, (size_t)rows * width);
+    }
+
 #ifdef USE_OPENMP
-    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) private(i, j) schedule(guided)
+    double begin = omp_get_wtime();
+#else
+    clock_t begin = clock();
 #endif
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            vec3 imageLocation = {i, j, 0};
-            vec3 finalOutput = {0, 0, 0};
-            TraceRay(eyePos, imageLocation, finalOutput);
-            vec3_dup(&rawImage[(i*width + j)*3], finalOutput);
-        }
+    DenoiseImage(floatPixels, guides, width, rows, options->denoisePasses);
+#ifdef USE_OPENMP
+    double seconds = omp_get_wtime() - begin;
+#else
+    double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+#endif
+    printf("Denoised %d rows with %d passes in %.4f seconds\n", rows, options->denoisePasses, seconds);
+
+    if(floatPixels != (float*)pixels) {
+        PackPixels(options->pixelFormat, floatPixels, pixels, (size_t)rows * width);
+        free(floatPixels);
     }
+}
+
+/*
+ * Adaptive version of TraceRows. Interpolation needs plain floats,
+ * so packed formats are rendered to a float buffer first and packed after
+ */
+static void RenderAdaptiveRows(struct RenderOptions* options, struct Scene* scene, struct Camera* camera,
+    const int rowStart, const int rowCount, void* outRows, unsigned char* outMask)
+{
+    const int width = options->width;
+    float* rawRows = (float*)outRows;
+    if(options->pixelFormat != PIXEL_FORMAT_FLOAT)
+        rawRows = (float*)malloc((size_t)rowCount * width * sizeof(vec3));
+
+    RenderAdaptive(scene, camera, width, rowStart, rowCount, options->adaptiveThreshold, rawRows, outMask);
+    if(options->adaptiveCompare)
+        CompareAdaptive(scene, camera, width, rowStart, rowCount, rawRows, outMask);
+
+    if(rawRows != outRows) {
+        PackPixels(options->pixelFormat, rawRows, outRows, (size_t)rowCount * width);
+        free(rawRows);
+    }
+}
+
+#ifdef USE_MPI
+/* Turns every process's block of rows into counts and offsets for MPI_Gatherv (rowSize units per row) */
+static void GetGatherCounts(const int* rowStarts, const int* rowCounts, const int worldSize, const int rowSize,
+    int* outCounts, int* outOffsets)
+{
+    int i;
+    for(i = 0; i < worldSize; i++) {
+        outCounts[i] = rowCounts[i] * rowSize;
+        outOffsets[i] = rowStarts[i] * rowSize;
+    }
+}
+
+/*
+ * Everyone waits for the slowest process, so the time the others spend
+ * idle (compared to it) is what a bad split costs
+ */
+static void PrintLoadBalance(const double* renderSeconds, const int worldSize)
+{
+    double slowest = 0.0;
+    double total = 0.0;
+    int i;
+    for(i = 0; i < worldSize; i++) {
+        printf("Process %d rendered its rows in %.4f seconds\n", i, renderSeconds[i]);
+        slowest = fmax(slowest, renderSeconds[i]);
+        total += renderSeconds[i];
+    }
+    double average = total / worldSize;
+    printf("Load balance: slowest %.4f s, average %.4f s (%.2fx), %.1f%% of the process time was spent idle\n",
+        slowest, average, average > 0.0 ? slowest / average : 1.0,
+        slowest > 0.0 ? 100.0 * (1.0 - average / slowest) : 0.0);
+}
 #endif
 
-    /* Grab the value range to scale our image by (0-255) */
-    float maxLightingValue = 0.0f;
+/*
+ * Renders a single image of the scene and saves it to imageFileName.
+ * When worldSize > 1 the rows are split between all the MPI processes (see --partition) and
+ * only rank 0 saves the image. Otherwise this process renders everything by itself.
+ * With nodeShare (--share-framebuffer) the processes of a node render into one shared image.
+ * temporal (--temporal, can be NULL) carries what this process shaded from frame to frame.
+ * Returns 0 if the image didn't match the reference (see --compare-raw)
+ */
+static int RenderFrame(struct RenderOptions* options, struct Scene* scene, struct Camera* camera,
+    const char* imageFileName, const char* maskFileName, const char* heatmapFileName, const char* heatmapCsvFileName,
+    const int world_rank, const int world_size, struct NodeShare* nodeShare, struct TemporalCache* temporal)
+{
+    const int width = options->width;
+    const int height = options->height;
+    const int pixelFormat = options->pixelFormat;
+    const size_t pixelSize = GetPixelFormatSize(pixelFormat);
 
+    /*
+     * For each pixel in our image, calculate the ray and populate the image
+     * with that pixel color
+     */
 #ifdef USE_MPI
-    MPI_Barrier(MPI_COMM_WORLD);
-    if(world_rank == 0)
-        printf("Calculating maximum lighting value...\n");
+    int i;
+#endif
+
+    /*
+     * allocate memory. need this dynamic memory or the stack will overflow. Pixels are stored in the --pixel-format.
+     * With --numa the rows go on the node of the thread that traces them (when this process traces all of them)
+     */
+    const int rowChunk = world_size == 1 ? GetRowChunk(options, height) : 0;
+    const int sharedFramebuffer = nodeShare && world_size > 1;
+    unsigned char * rawImage = NULL;
+    unsigned char* image = NULL;
+    if(sharedFramebuffer) {
+        /* Node shared windows, allocated once the rows are split */
+    } else if(rowChunk > 0) {
+        rawImage = (unsigned char*)AllocateNumaMemory((size_t)height * width * pixelSize);
+        image = (unsigned char*)AllocateNumaMemory((size_t)height * width * 3);
+        if(!rawImage || !image)
+            exit(1);
+        FirstTouchNuma(rawImage, (size_t)width * pixelSize, height, rowChunk);
+        FirstTouchNuma(image, (size_t)width * 3, height, rowChunk);
+        printf("Image memory placed by the threads using it, %d rows at a time (%s)\n", rowChunk,
+            (size_t)rowChunk * width * pixelSize >= NUMA_HUGE_PAGE_SIZE ? "huge pages" : "chunks too small for huge pages");
+    } else {
+        rawImage = (unsigned char *)malloc((size_t)height * width * pixelSize);
+        /* allocate memory for the final picture */
+        image = (unsigned char*)malloc(width * height * 3);
+    }
+
+    /* Which pixels were traced and which were interpolated (adaptive mode only) */
+    unsigned char * adaptiveMask = NULL;
+    if(options->adaptive && !sharedFramebuffer)
+        adaptiveMask = (unsigned char *)malloc(height * width);
+
+    /* Every hit of every path, so lights can be changed later without tracing */
+    struct GBuffer* gbuffer = NULL;
 
-    for (i = 0; i < buffer_size; i++) {
-        for (j = 0; j < width; j++) {
-            for(k = 0; k < 3; k++) {
-                maxLightingValue = fmax(maxLightingValue, rawImageBuffer[(i*width + j)*3 + k]);
+    /* What every cell of the image cost to trace (--heatmap), gathered on the root when the rows were split */
+    struct Heatmap* heatmap = NULL;
+
+    /* What every pixel's primary ray hit, for the denoiser. Only the root denoises when the rows were split */
+    struct DenoiseGuide* guides = NULL;
+    if(options->denoisePasses > 0 && (world_rank == 0 || world_size == 1))
+        guides = (struct DenoiseGuide*)malloc((size_t)height * width * sizeof(struct DenoiseGuide));
+
+    /* Light cached on a sparse grid before anything gets traced, the processes build it together (see irradiance.h) */
+    struct IrradianceCache* irradianceCache = NULL;
+    if(options->irradianceError > 0.0f) {
+        irradianceCache = BuildIrradianceCache(scene, camera, width, height, options->irradianceError, world_rank, world_size);
+        scene->irradianceCache = irradianceCache;
+    }
+
+#ifdef USE_MPI
+    MPI_Win rawWindow = MPI_WIN_NULL;
+    MPI_Win imageWindow = MPI_WIN_NULL;
+    MPI_Win maskWindow = MPI_WIN_NULL;
+    if(world_size > 1) {
+        /* Grab the value range to scale our image by (0-255) */
+        float maxLightingValue = 0.0f;
+
+        /* Which rows every process traces */
+        int rowStarts[world_size];
+        int rowCounts[world_size];
+        float costShares[world_size];
+        if(options->partition == PARTITION_COST)
+            PartitionRowsByCost(scene, camera, width, height, world_rank, world_size, rowStarts, rowCounts, costShares);
+        else
+            PartitionRowsEqually(height, world_size, rowStarts, rowCounts);
+        if(world_rank == 0) {
+            printf("Rows split between processes (%s partition):\n", GetPartitionName(options->partition));
+            for(i = 0; i < world_size; i++) {
+                if(options->partition == PARTITION_COST)
+                    printf("  process %d: rows %d-%d (%d rows, %.1f%% of the predicted time)\n", i, rowStarts[i],
+                        rowStarts[i] + rowCounts[i] - 1, rowCounts[i], 100.0f * costShares[i]);
+                else
+                    printf("  process %d: rows %d-%d (%d rows)\n", i, rowStarts[i], rowStarts[i] + rowCounts[i] - 1, rowCounts[i]);
             }
         }
-    }
+        const int rowStart = rowStarts[world_rank];
+        const int buffer_size = rowCounts[world_rank];
+        const size_t rowBytes = (size_t)width * pixelSize;
 
-    /* Grab the maximum lighting value from all the processes and calculate the max one */
-    float maxLightValuesAll[world_size];
-    MPI_Barrier(MPI_COMM_WORLD);
-    MPI_Gather(&maxLightingValue, 1, MPI_FLOAT, 
-        maxLightValuesAll, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    if(world_rank == 0) {
-        printf("Finding maximum lighting value...\n");
-        for(i = 0; i < world_size; i++)
-        {
-            printf("Process %d's max lighting value is %f\n", i, maxLightValuesAll[i]);
-            maxLightingValue = fmax(maxLightingValue, maxLightValuesAll[i]);
+        /* Byte counts and offsets of every process's rows for the gathers (scaled by bytes per pixel) */
+        int gatherCounts[world_size];
+        int gatherOffsets[world_size];
+
+        /*
+         * With a shared framebuffer this process's rows are its part of the node's image,
+         * otherwise they're buffers of its own that get gathered
+         */
+        unsigned char * rawImageBuffer;
+        unsigned char * adaptiveMaskBuffer = NULL;
+        if(sharedFramebuffer) {
+            rawImage = (unsigned char*)AllocateNodeShared(nodeShare, (size_t)height * rowBytes, &rawWindow);
+            image = (unsigned char*)AllocateNodeShared(nodeShare, (size_t)height * width * 3, &imageWindow);
+            rawImageBuffer = rawImage + rowStart * rowBytes;
+            if(options->adaptive) {
+                adaptiveMask = (unsigned char*)AllocateNodeShared(nodeShare, (size_t)height * width, &maskWindow);
+                adaptiveMaskBuffer = adaptiveMask + rowStart * width;
+            }
+        } else {
+            rawImageBuffer = (unsigned char*)malloc((size_t)buffer_size * rowBytes);
+            if(options->adaptive)
+                adaptiveMaskBuffer = (unsigned char *)malloc(buffer_size * width);
         }
-    }
+        struct DenoiseGuide* guideBuffer = NULL;
+        if(options->denoisePasses > 0)
+            guideBuffer = (struct DenoiseGuide*)malloc((size_t)buffer_size * width * sizeof(struct DenoiseGuide));
 
-    /* Send real maximum lighting value to all the processes */
-    MPI_Barrier(MPI_COMM_WORLD);
-    MPI_Bcast(&maxLightingValue, 1, MPI_FLOAT,
-        0, MPI_COMM_WORLD);
-    MPI_Barrier(MPI_COMM_WORLD);
+        double renderBegin = MPI_Wtime();
+        if(options->gbufferFile)
+            gbuffer = NewGBuffer(width, height, rowStart, buffer_size);
+        if(options->adaptive) {
+            RenderAdaptiveRows(options, scene, camera, rowStart, buffer_size, rawImageBuffer, adaptiveMaskBuffer);
+        } else {
+            struct Checkpoint checkpoint;
+            struct Checkpoint* frameCheckpoint = OpenFrameCheckpoint(options, scene, camera, rowStart, buffer_size,
+                rawImageBuffer, world_rank, world_size, &checkpoint);
+            heatmap = NewFrameHeatmap(options, rowStart, buffer_size, world_rank);
+            TraceRows(options, scene, camera, rowStart, buffer_size, rawImageBuffer, gbuffer, guideBuffer,
+                temporal, frameCheckpoint, heatmap, world_rank);
+            CloseFrameCheckpoint(frameCheckpoint);
+        }
+        double renderSeconds = MPI_Wtime() - renderBegin;
+        printf("Process %d finished raytracing\n", world_rank);
 
-    if(world_rank == 0)
-        printf("Global maximum lighting value is %f\n", maxLightingValue);
+        /* How long everyone took shows how well the rows were split */
+        double renderSecondsAll[world_size];
+        MPI_Gather(&renderSeconds, 1, MPI_DOUBLE, renderSecondsAll, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        if(world_rank == 0)
+            PrintLoadBalance(renderSecondsAll, world_size);
+        if(heatmap)
+            GatherHeatmap(heatmap, world_rank, world_size);
 
-#else
-    printf("Calculating maximum lighting value...\n");
-#ifdef USE_OPENMP
-    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) private(i, j) reduction(max:maxLightingValue)
-#endif
-    for (i = 0; i < height; i++) {
-        for (j = 0; j < width; j++) {
-            for(k = 0; k < 3; k++) {
-                maxLightingValue = fmax(maxLightingValue, rawImage[(i*width + j)*3 + k]);
+        if(gbuffer) {
+            FinishGBuffer(gbuffer);
+            GatherGBuffer(gbuffer, world_rank, world_size);
+        }
+
+        if(sharedFramebuffer) {
+            /*
+             * The node's image is complete once everyone on the node is done. Only leaders
+             * talk between nodes: for the maximum, and to send their node's rows to the root
+             */
+            MPI_Win_fence(0, rawWindow);
+            if(options->adaptive)
+                MPI_Win_fence(0, maskWindow);
+            if(world_rank == 0)
+                printf("Calculating maximum lighting value (within nodes, then between %d nodes)...\n", nodeShare->nodeCount);
+            maxLightingValue = FindMaxLightingValue(pixelFormat, rawImageBuffer, width, buffer_size, 0);
+            maxLightingValue = ReduceMaxOnNodes(nodeShare, maxLightingValue);
+            if(world_rank == 0)
+                printf("Global maximum lighting value is %f\n", maxLightingValue);
+
+            ScaleToBitmap(pixelFormat, rawImageBuffer, width, buffer_size, 0, maxLightingValue,
+                image + (size_t)rowStart * width * 3);
+            MPI_Win_fence(0, imageWindow);
+
+            /* The raw image only goes to the root when it's going to be saved or compared */
+            AssembleRowsOnRoot(nodeShare, image, (size_t)width * 3, rowStarts, rowCounts);
+            if(options->saveRawFile || options->compareRawFile)
+                AssembleRowsOnRoot(nodeShare, rawImage, rowBytes, rowStarts, rowCounts);
+            if(options->adaptive)
+                AssembleRowsOnRoot(nodeShare, adaptiveMask, width, rowStarts, rowCounts);
+            if(world_rank == 0)
+                printf("Framebuffer shared per node (%.2f MB per node), %d nodes sent their rows to the root\n",
+                    (double)height * width * (pixelSize + 3) / (1024.0 * 1024.0), nodeShare->nodeCount - 1);
+        } else {
+            MPI_Barrier(MPI_COMM_WORLD);
+            /* Raw pixels travel packed; only the root needs them (for --save-raw and --compare-raw) */
+            GetGatherCounts(rowStarts, rowCounts, world_size, rowBytes, gatherCounts, gatherOffsets);
+            MPI_Gatherv(rawImageBuffer, buffer_size * rowBytes, MPI_BYTE,
+                rawImage, gatherCounts, gatherOffsets, MPI_BYTE, 0, MPI_COMM_WORLD);
+            if(world_rank == 0)
+                printf("Gathered %.2f MB of %s pixels (%.2f MB as float)\n",
+                    (double)height * width * pixelSize / (1024.0 * 1024.0), GetPixelFormatName(pixelFormat),
+                    (double)height * width * sizeof(vec3) / (1024.0 * 1024.0));
+            if(options->adaptive) {
+                GetGatherCounts(rowStarts, rowCounts, world_size, width, gatherCounts, gatherOffsets);
+                MPI_Gatherv(adaptiveMaskBuffer, buffer_size * width, MPI_UNSIGNED_CHAR,
+                    adaptiveMask, gatherCounts, gatherOffsets, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
             }
+
+            /*
+             * Every denoising pass needs the whole image of the one before (taps reach across
+             * the rows of other processes), so the root denoises and hands everyone their rows back
+             */
+            if(guideBuffer) {
+                const int guideRowSize = width * sizeof(struct DenoiseGuide);
+                GetGatherCounts(rowStarts, rowCounts, world_size, guideRowSize, gatherCounts, gatherOffsets);
+                MPI_Gatherv(guideBuffer, buffer_size * guideRowSize, MPI_BYTE,
+                    guides, gatherCounts, gatherOffsets, MPI_BYTE, 0, MPI_COMM_WORLD);
+                if(world_rank == 0)
+                    DenoiseRows(options, rawImage, guides, height);
+                GetGatherCounts(rowStarts, rowCounts, world_size, rowBytes, gatherCounts, gatherOffsets);
+                MPI_Scatterv(rawImage, gatherCounts, gatherOffsets, MPI_BYTE,
+                    rawImageBuffer, buffer_size * rowBytes, MPI_BYTE, 0, MPI_COMM_WORLD);
+            }
+
+            MPI_Barrier(MPI_COMM_WORLD);
+            if(world_rank == 0)
+                printf("Calculating maximum lighting value...\n");
+
+            maxLightingValue = FindMaxLightingValue(pixelFormat, rawImageBuffer, width, buffer_size, 0);
+
+            /* Grab the maximum lighting value from all the processes and calculate the max one */
+            float maxLightValuesAll[world_size];
+            MPI_Barrier(MPI_COMM_WORLD);
+            MPI_Gather(&maxLightingValue, 1, MPI_FLOAT,
+                maxLightValuesAll, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+            if(world_rank == 0) {
+                printf("Finding maximum lighting value...\n");
+                for(i = 0; i < world_size; i++)
+                {
+                    printf("Process %d's max lighting value is %f\n", i, maxLightValuesAll[i]);
+                    maxLightingValue = fmaxf(maxLightingValue, maxLightValuesAll[i]);
+                }
+            }
+
+            /* Send real maximum lighting value to all the processes */
+            MPI_Barrier(MPI_COMM_WORLD);
+            MPI_Bcast(&maxLightingValue, 1, MPI_FLOAT,
+                0, MPI_COMM_WORLD);
+            MPI_Barrier(MPI_COMM_WORLD);
+
+            if(world_rank == 0)
+                printf("Global maximum lighting value is %f\n", maxLightingValue);
+
+            /* Clamp our lighting values to our 24-bit values for the bitmap */
+            unsigned char* imageBuffer = (unsigned char*)malloc(buffer_size * width * 3);
+            ScaleToBitmap(pixelFormat, rawImageBuffer, width, buffer_size, 0, maxLightingValue, imageBuffer);
+
+            /* Gather all the final data to the root process */
+            MPI_Barrier(MPI_COMM_WORLD);
+            GetGatherCounts(rowStarts, rowCounts, world_size, width * 3, gatherCounts, gatherOffsets);
+            MPI_Gatherv(imageBuffer, buffer_size * width * 3, MPI_CHAR,
+                image, gatherCounts, gatherOffsets, MPI_CHAR, 0, MPI_COMM_WORLD);
+            MPI_Barrier(MPI_COMM_WORLD);
+
+            free(rawImageBuffer);
+            free(imageBuffer);
+            free(adaptiveMaskBuffer);
         }
-    }
+        free(guideBuffer);
+    } else
 #endif
+    {
+        if(options->adaptive) {
+            RenderAdaptiveRows(options, scene, camera, 0, height, rawImage, adaptiveMask);
+        } else {
+            if(options->gbufferFile)
+                gbuffer = NewGBuffer(width, height, 0, height);
+            struct Checkpoint checkpoint;
+            struct Checkpoint* frameCheckpoint = OpenFrameCheckpoint(options, scene, camera, 0, height, rawImage,
+                world_rank, world_size, &checkpoint);
+            heatmap = NewFrameHeatmap(options, 0, height, world_rank);
+            TraceRows(options, scene, camera, 0, height, rawImage, gbuffer, guides, temporal, frameCheckpoint, heatmap,
+                world_rank);
+            CloseFrameCheckpoint(frameCheckpoint);
+        }
 
-    /* allocate memory for the final picture */
-    unsigned char* image = (unsigned char*)malloc(width * height * 3);
+        if(gbuffer)
+            FinishGBuffer(gbuffer);
+        if(guides)
+            DenoiseRows(options, rawImage, guides, height);
 
-#ifdef USE_MPI
+        TonemapImage(pixelFormat, rawImage, width, height, rowChunk, image);
+    }
+
+    /* Only the root process has the full image when the rows were split */
+    int result = 1;
+    if(world_rank == 0 || world_size == 1) {
+        if(pixelFormat != PIXEL_FORMAT_FLOAT)
+            printf("Raw image stored as %s: %.2f MB (%.2f MB as float)\n", GetPixelFormatName(pixelFormat),
+                (double)height * width * pixelSize / (1024.0 * 1024.0), (double)height * width * sizeof(vec3) / (1024.0 * 1024.0));
+
+        if(options->saveRawFile || options->compareRawFile) {
+            /* Raw files are always floats */
+            float* floatImage = (float*)rawImage;
+            if(pixelFormat != PIXEL_FORMAT_FLOAT) {
+                floatImage = (float*)malloc((size_t)height * width * sizeof(vec3));
+                UnpackPixels(pixelFormat, rawImage, floatImage, (size_t)height * width);
+            }
+            if(options->saveRawFile && SaveRawImage(options->saveRawFile, floatImage, width, height))
+                printf("Raw image saved to %s\n", options->saveRawFile);
+            if(options->compareRawFile)
+                result = CompareRawImage(options->compareRawFile, floatImage, width, height,
+                    options->maxRmsError, options->maxBadPixelPercent);
+            if(floatImage != (float*)rawImage)
+                free(floatImage);
+        }
+
+        clock_t start_saveimg = clock();
+        printf("Generating final output image...\n");
+        /* Generate a human viewable image to a bitmap */
+        generateBitmapImage(image, height, width, (char*)imageFileName);
+        printf("Image generated!! (%s)\n", imageFileName);
+        clock_t end_saveimg = clock();
+        double time_spent_saveimg = (double)(end_saveimg - start_saveimg) / CLOCKS_PER_SEC;
+        printf("Img generation Processing Time: %.4f seconds\n", time_spent_saveimg);
+
+        /* Save the traced vs. interpolated mask next to the image so quality can be checked */
+        if(options->adaptive) {
+            unsigned char* maskImage = (unsigned char*)malloc(width * height * 3);
+            AdaptiveMaskToImage(adaptiveMask, width * height, maskImage);
+            generateBitmapImage(maskImage, height, width, (char*)maskFileName);
+            printf("Adaptive sample mask saved to %s\n", maskFileName);
+            free(maskImage);
+        }
+
+        if(heatmap) {
+            PrintHeatmapSummary(heatmap);
+            SaveHeatmap(heatmap, height, heatmapFileName, heatmapCsvFileName);
+        }
 
-    /* Clamp our lighting values to our 24-bit values for the bitmap */
-    unsigned char* imageBuffer = (unsigned char*)malloc(buffer_size * width * 3);
-    for (i = 0; i < buffer_size; i++) {
-        for (j = 0; j < width; j++) {
-            vec3 newPixel;
-            vec3_scale(newPixel, &rawImageBuffer[(i*width + j)*3], 255.0f/maxLightingValue);
-            imageBuffer[((i*width + j)*3)] = (unsigned char) newPixel[2];
-            imageBuffer[((i*width + j)*3)+1] = (unsigned char) newPixel[1];
-            imageBuffer[((i*width + j)*3)+2] = (unsigned char) newPixel[0];
+        if(gbuffer) {
+            PrintGBufferMemory(gbuffer);
+            if(SaveGBuffer(gbuffer, options->gbufferFile))
+                printf("G-buffer saved to %s\n", options->gbufferFile);
         }
     }
+    FreeGBuffer(gbuffer);
+    FreeHeatmap(heatmap);
+    free(guides);
+    if(irradianceCache) {
+        PrintIrradianceStats(irradianceCache, world_rank);
+        scene->irradianceCache = NULL;
+        FreeIrradianceCache(irradianceCache);
+    }
 
-    /* Gather all the final data to the root process */
-    MPI_Barrier(MPI_COMM_WORLD);
-    MPI_Gather(imageBuffer, buffer_size * width * 3, MPI_CHAR, 
-        image, buffer_size * width * 3, MPI_CHAR, 0, MPI_COMM_WORLD);
-    MPI_Barrier(MPI_COMM_WORLD);
+    /* free memory  */
+#ifdef USE_MPI
+    if(sharedFramebuffer) {
+        MPI_Win_free(&rawWindow);
+        MPI_Win_free(&imageWindow);
+        if(maskWindow != MPI_WIN_NULL)
+            MPI_Win_free(&maskWindow);
+        return result;
+    }
+#endif
+    free(rawImage);
+    free(image);
+    free(adaptiveMask);
+    return result;
+}
 
-    /* All other processes terminate at this point */
+/* What the options add to the default scene */
+static void GetSceneDesc(struct RenderOptions* options, struct RtSceneDesc* desc)
+{
+    RtDefaultSceneDesc(desc);
+    desc->lightsFile = options->lightsFile;
+    desc->instancesFile = options->instancesFile;
+    desc->meshCount = options->meshCount;
+    int i;
+    for(i = 0; i < options->meshCount; i++)
+        desc->meshFiles[i] = options->meshFiles[i];
+    desc->lightSamples = options->lightSamples;
+    desc->verbose = 1;
+}
+
+/*
+ * Shades a saved G-buffer with the scene's lights (or the ones from --lights)
+ * and saves the image. Only needs one process. Area lights cast their shadows
+ * with the meshes of --mesh and --instances, pass the ones the G-buffer was made with.
+ */
+static int ReshadeMain(struct RenderOptions* options)
+{
+#ifdef USE_MPI
+    int world_rank = 0;
+    MPI_Init(NULL, NULL);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
     if(world_rank != 0) {
         MPI_Finalize();
         return 0;
     }
-#else 
-    printf("Maximum lighting value: %.2f \n", maxLightingValue);
-    /* Clamp our lighting values to our 24-bit values for the bitmap */
+#endif
+
+    int result = 1;
+    struct Scene scene;
+    struct RtSceneDesc desc;
+    struct GBuffer* gbuffer = NULL;
+    GetSceneDesc(options, &desc);
+    if(RtCreateScene(&desc, NULL, &scene) && (gbuffer = LoadGBuffer(options->reshadeFile))) {
+        const int width = gbuffer->width;
+        const int height = gbuffer->height;
+        printf("Re-shading %s (%d:%d) with %d lights\n", options->reshadeFile, width, height, scene.lightCount);
+        PrintGBufferMemory(gbuffer);
+
+#ifdef USE_OPENMP
+        double begin = omp_get_wtime();
+#else
+        clock_t begin = clock();
+#endif
+        float* rawImage = (float*)calloc(width * height, sizeof(vec3));
+        unsigned char* image = (unsigned char*)malloc(width * height * 3);
+        ReshadeGBuffer(gbuffer, &scene, options->seed, rawImage);
+        TonemapImage(PIXEL_FORMAT_FLOAT, rawImage, width, height, 0, image);
+        generateBitmapImage(image, height, width, (char*)options->outputFile);
+        printf("Image generated!! (%s)\n", options->outputFile);
+
+#ifdef USE_OPENMP
+        double end = omp_get_wtime();
+        printf("Re-shade Processing Time: %.4f seconds\n", end - begin);
+#else
+        clock_t end = clock();
+        printf("Re-shade Processing Time: %.4f seconds\n", (double)(end - begin) / CLOCKS_PER_SEC);
+#endif
+        free(rawImage);
+        free(image);
+        FreeGBuffer(gbuffer);
+        result = 0;
+    }
+    RtFreeScene(&scene);
+
+#ifdef USE_MPI
+    MPI_Finalize();
+#endif
+    return result;
+}
+
+/* Converts an OBJ mesh to a baked one (see --bake-mesh) */
+static int BakeMeshMain(struct RenderOptions* options)
+{
+    struct Mesh* mesh = LoadMesh(options->bakeMeshInput);
+    if(!mesh)
+        return 1;
+    PrintMeshMemory(mesh, options->bakeMeshInput);
+
+    int result = 1;
+    if(SaveBakedMesh(mesh, options->bakeMeshOutput)) {
+        printf("Baked mesh saved to %s\n", options->bakeMeshOutput);
+        result = 0;
+    }
+    FreeMesh(mesh);
+    return result;
+}
+
+/*
+ * Sets up the camera and loads the scene from the files in the options (see RtCreateScene),
+ * compiled for that camera. Returns 1 on success
+ */
+static int LoadScene(struct RenderOptions* options, const int fov, struct Scene* scene, struct Camera* camera)
+{
+    if(options->lookAtCamera)
+        RtCreateLookAtCamera(camera, options->cameraEye, options->cameraTarget, options->cameraUp, options->cameraFov,
+            options->width, options->height);
+    else
+        RtCreateCamera(camera, options->width, options->height, fov);
+
+    /* Animations with target keys re-aim the camera with this field of view */
+    camera->verticalFov = options->cameraFov;
+    camera->samplesPerPixel = options->samplesPerPixel;
+    camera->seed = options->seed;
+
+    struct RtSceneDesc desc;
+    GetSceneDesc(options, &desc);
+    return RtCreateScene(&desc, camera, scene);
+}
+
+int main(int argc, char** argv)
+{
+    struct RenderOptions options;
+    DefaultRenderOptions(&options);
+    if(!ParseRenderOptions(&options, argc, argv)) {
+        PrintRenderUsage(argv[0]);
+        return 1;
+    }
+
+    /* Image sizes. See DefaultRenderOptions */
+    const int width = options.width;
+    const int height = options.height;
+    const int fov = 30;
+
+    /* The server sets up its own scenes and cameras for every request */
+    if(options.serveSocket)
+        return RunRenderServer(options.serveSocket) ? 0 : 1;
+    if(options.requestSocket)
+        return SendRenderRequest(options.requestSocket, options.requestLine, options.outputFile) ? 0 : 1;
+
+    /* The CLI always prints how this pixel's ray went, library clients have to ask for it */
+    SetDebugPixel(DEBUG_PIXEL_ROW, DEBUG_PIXEL_COL);
+
+    /* Re-shading doesn't trace anything so it doesn't need the rest of the setup */
+    if(options.reshadeFile)
+        return ReshadeMain(&options);
+    if(options.bakeMeshInput)
+        return BakeMeshMain(&options);
+
+    /* Load the animation up front so a bad file fails fast */
+    struct Animation* animation = NULL;
+    if(options.animationFile) {
+        animation = (struct Animation*)malloc(sizeof(struct Animation));
+        if(!LoadAnimation(options.animationFile, animation))
+            return 1;
+    }
+    const int frameCount = animation ? animation->frameCount : 1;
+
+    /* Timing */
 #ifdef USE_OPENMP
-    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) private(i, j)
+    double begin = omp_get_wtime();
+#else
+    clock_t begin = clock();
+#endif
+
+    int world_rank = 0;
+    int world_size = 1;
+#ifdef USE_MPI
+     // Initialize the MPI environment
+    MPI_Init(NULL, NULL);
+    // Find out rank, size
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    printf("I am MPI process %d of %d\n", world_rank, world_size);
+
+    /* Processes on the same node can share the scene and the framebuffer (see nodeshare.h) */
+    struct NodeShare nodeShare;
+    const int useNodeShare = world_size > 1 && (options.shareScene || options.shareFramebuffer);
+    if(useNodeShare && !InitNodeShare(&nodeShare))
+        exit(1);
 #endif
-    for (i = 0; i < height; i++) {
-        vec3 newPixel;
-        for (j = 0; j < width; j++) {
-            vec3_scale(newPixel, &rawImage[(i*width + j)*3], 255.0f/maxLightingValue);
-            image[((i*width + j)*3)] = (unsigned char) newPixel[2];
-            image[((i*width + j)*3)+1] = (unsigned char) newPixel[1];
-            image[((i*width + j)*3)+2] = (unsigned char) newPixel[0];
+
+    /* Threads stay on their cores for the whole run so the memory they touch stays local */
+    if(options.numa)
+        PinThreads();
+
+    /*
+     * Whole frames only go to processes when there are enough of them to go around.
+     * Otherwise every frame is split by rows like a single image is
+     */
+    const int splitFrames = animation && options.splitFramesAcrossProcesses && world_size > 1
+        && frameCount >= world_size;
+
+    if(world_size > 1 && !splitFrames && height < world_size) {
+        printf("image height of %d needs at least one row for each of the %d processes\n", height, world_size);
+        exit(1);
+    }
+
+    /* The scene and the camera are set up once and reused for every frame */
+    struct Scene scene = NewScene();
+    struct Camera camera;
+#ifdef USE_MPI
+    /*
+     * Only the root reads the files and builds the hierarchies. The others get the result
+     * packed (see scenepack.h) in one broadcast and use it as it arrives
+     */
+    void* packedScene = NULL;
+    int ownsPackedScene = 0;
+    if(world_size > 1) {
+        const int shareScene = useNodeShare && options.shareScene;
+        size_t packedSize = 0;
+        double loadBegin = MPI_Wtime();
+        if(world_rank == 0) {
+            if(LoadScene(&options, fov, &scene, &camera))
+                packedScene = PackScene(&scene, &camera, &packedSize);
+            RtFreeScene(&scene);
+        }
+        double loadSeconds = MPI_Wtime() - loadBegin;
+        double broadcastSeconds = 0.0;
+        packedScene = BroadcastPackedScene(packedScene, &packedSize, shareScene ? &nodeShare : NULL, &broadcastSeconds);
+        if(!packedScene || !UsePackedScene(packedScene, packedSize, &scene, &camera))
+            exit(1);
+        ownsPackedScene = !shareScene;
+        if(world_rank == 0) {
+            PrintPackedSceneMemory(packedScene);
+            printf("Scene loaded and packed in %.4f seconds, broadcast to %d processes in %.4f seconds\n",
+                loadSeconds, world_size, broadcastSeconds);
+            if(shareScene)
+                printf("Scene kept once per node: %.2f MB per node instead of %.2f MB (%d processes on this node)\n",
+                    packedSize / (1024.0 * 1024.0), (double)packedSize * nodeShare.nodeSize / (1024.0 * 1024.0), nodeShare.nodeSize);
         }
+    } else
+#endif
+    if(!LoadScene(&options, fov, &scene, &camera))
+        exit(1);
+    printf("Eye position is calculated at %f:%f:%f for image of size %d:%d\n", camera.eyePos[0], camera.eyePos[1], camera.eyePos[2], width, height);
+
+    /* How the trace loops hand out work, timed on this machine for this scene (see --auto-tune) */
+    if(options.autoTune)
+        TuneSchedule(&options, &scene, &camera, world_rank, world_size);
+
+    /* What the previous frame shaded, for the next one (see --temporal) */
+    struct TemporalCache temporalCache;
+    struct TemporalCache* temporal = NULL;
+    if(options.temporalRefresh > 0) {
+        InitTemporalCache(&temporalCache, width, options.temporalRefresh);
+        temporal = &temporalCache;
     }
+
+    int result = 0;
+    int frame;
+    for(frame = 0; frame < frameCount; frame++) {
+        if(splitFrames && frame % world_size != world_rank)
+            continue;
+
+        char imageFileName[512];
+        char maskFileName[512];
+        char heatmapFileName[512];
+        char heatmapCsvFileName[512];
+        if(animation) {
+            ApplyAnimationFrame(animation, frame, &scene, &camera);
+            GetFrameFileName(options.outputFile, frame, imageFileName, sizeof(imageFileName));
+            GetFrameFileName("adaptive_mask.bmp", frame, maskFileName, sizeof(maskFileName));
+            printf("Rendering frame %d of %d (eye at %f:%f:%f)\n", frame + 1, frameCount,
+                camera.eyePos[0], camera.eyePos[1], camera.eyePos[2]);
+        } else {
+            snprintf(imageFileName, sizeof(imageFileName), "%s", options.outputFile);
+            snprintf(maskFileName, sizeof(maskFileName), "adaptive_mask.bmp");
+        }
+        GetHeatmapFileName(imageFileName, HEATMAP_IMAGE_SUFFIX, heatmapFileName, sizeof(heatmapFileName));
+        GetHeatmapFileName(imageFileName, HEATMAP_CSV_SUFFIX, heatmapCsvFileName, sizeof(heatmapCsvFileName));
+
+        struct NodeShare* frameShare = NULL;
+#ifdef USE_MPI
+        if(useNodeShare && options.shareFramebuffer)
+            frameShare = &nodeShare;
 #endif
+        int matched;
+        if(splitFrames)
+            matched = RenderFrame(&options, &scene, &camera, imageFileName, maskFileName, heatmapFileName, heatmapCsvFileName,
+                0, 1, NULL, temporal);
+        else
+            matched = RenderFrame(&options, &scene, &camera, imageFileName, maskFileName, heatmapFileName, heatmapCsvFileName,
+                world_rank, world_size, frameShare, temporal);
+        if(!matched)
+            result = 1;
+    }
+    if(temporal)
+        FreeTemporalCache(temporal);
 
-clock_t start_saveimg = clock();
-printf("Generating final output image...\n");
-    /* Generate a human viewable image to a bitmap */
-    generateBitmapImage(image, height, width, "rendered.bmp");
-    printf("Image generated!!\n");
-clock_t end_saveimg = clock();
-double time_spent_saveimg = (double)(end_saveimg - start_saveimg) / CLOCKS_PER_SEC;
-printf("Img generation Processing Time: %.4f seconds\n", time_spent_saveimg);
+#ifdef USE_MPI
+    /* Everyone has to be done before the time means anything */
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(world_rank != 0) {
+        free(animation);
+        RtFreeScene(&scene);
+        if(ownsPackedScene)
+            free(packedScene);
+        if(useNodeShare)
+            FreeNodeShare(&nodeShare);
+        MPI_Finalize();
+        return 0;
+    }
+#endif
 
 #ifdef USE_OPENMP
     double end = omp_get_wtime();
@@ -213,15 +1179,17 @@ printf("Img generation Processing Time: %.4f seconds\n", time_spent_saveimg);
     double time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
     printf("Total Processing Time: %.4f seconds\n", time_spent);
 #endif
+    if(animation)
+        printf("Rendered %d frames\n", frameCount);
 
-
-    /* free memory  */
+    free(animation);
+    RtFreeScene(&scene);
 #ifdef USE_MPI
-    free(rawImageBuffer);
-    free(imageBuffer);
+    if(ownsPackedScene)
+        free(packedScene);
+    if(useNodeShare)
+        FreeNodeShare(&nodeShare);
     MPI_Finalize();
 #endif
-    free(rawImage);
-    free(image);
-
-}
\ No newline at end of file
+    return result;
+}
@@ -0,0 +1,702 @@
+/* mmap and friends are POSIX, not C99 */
+#define _POSIX_C_SOURCE 200809L
+
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/* POSIX */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Use SSE for intersecting triangles (if we can) */
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "bvh.h"
+#include "mesh.h"
+
+/* Identifies baked mesh files (and their version) */
+static const char MESH_FILE_MAGIC[8] = {'R', 'T', 'M', 'E', 'S', 'H', '0', '2'};
+
+/* 
+ * Layout of a baked mesh file. Sections start on 64 byte boundaries
+ * so the packets can be used straight out of the mapping
+ */
+struct BakedMeshHeader {
+    char magic[8];
+    int vertexCount;
+    int triangleCount;
+    int packetCount;
+    int nodeCount;
+    long long verticesOffset;
+    long long indicesOffset;
+    long long packetsOffset;
+    long long nodesOffset;
+    long long fileSize;
+};
+
+static size_t AlignTo64(size_t value)
+{
+    return (value + 63) & ~(size_t)63;
+}
+
+/* Works out where everything goes in one block (used for both baked files and heap meshes) */
+static void GetMeshLayout(struct BakedMeshHeader* header)
+{
+    header->verticesOffset = AlignTo64(sizeof(struct BakedMeshHeader));
+    header->indicesOffset = AlignTo64(header->verticesOffset + (size_t)header->vertexCount * 3 * sizeof(float));
+    header->packetsOffset = AlignTo64(header->indicesOffset + (size_t)header->triangleCount * 3 * sizeof(unsigned int));
+    header->nodesOffset = header->packetsOffset + (size_t)header->packetCount * sizeof(struct TrianglePacket);
+    header->fileSize = header->nodesOffset + (size_t)header->nodeCount * sizeof(struct BvhNode);
+}
+
+/* Points the mesh at the sections of a block laid out by GetMeshLayout */
+static void SetMeshPointers(struct Mesh* mesh, struct BakedMeshHeader* header, char* block)
+{
+    mesh->vertexCount = header->vertexCount;
+    mesh->triangleCount = header->triangleCount;
+    mesh->packetCount = header->packetCount;
+    mesh->vertices = (float*)(block + header->verticesOffset);
+    mesh->indices = (unsigned int*)(block + header->indicesOffset);
+    mesh->packets = (struct TrianglePacket*)(block + header->packetsOffset);
+    mesh->nodeCount = header->nodeCount;
+    mesh->nodes = (struct BvhNode*)(block + header->nodesOffset);
+}
+
+/* 
+ * Builds the hierarchy over the triangles and puts them in the order it wants,
+ * so every leaf is exactly one packet
+ */
+static int BuildMeshHierarchy(struct Mesh* mesh)
+{
+    float* triangleMin = (float*)malloc(mesh->triangleCount * 3 * sizeof(float));
+    float* triangleMax = (float*)malloc(mesh->triangleCount * 3 * sizeof(float));
+    int* order = (int*)malloc(mesh->triangleCount * sizeof(int));
+    unsigned int* indices = (unsigned int*)malloc(mesh->triangleCount * 3 * sizeof(unsigned int));
+    if(!triangleMin || !triangleMax || !order || !indices) {
+        free(triangleMin);
+        free(triangleMax);
+        free(order);
+        free(indices);
+        return 0;
+    }
+
+    int i, k, corner;
+    for(i = 0; i < mesh->triangleCount; i++) {
+        for(k = 0; k < 3; k++) {
+            triangleMin[i*3 + k] = FLT_MAX;
+            triangleMax[i*3 + k] = -FLT_MAX;
+            for(corner = 0; corner < 3; corner++) {
+                float value = mesh->vertices[mesh->indices[i*3 + corner] * 3 + k];
+                triangleMin[i*3 + k] = fminf(triangleMin[i*3 + k], value);
+                triangleMax[i*3 + k] = fmaxf(triangleMax[i*3 + k], value);
+            }
+        }
+    }
+    BuildBvh(triangleMin, triangleMax, mesh->triangleCount, MESH_PACKET_WIDTH, mesh->nodes, order);
+
+    memcpy(indices, mesh->indices, mesh->triangleCount * 3 * sizeof(unsigned int));
+    for(i = 0; i < mesh->triangleCount; i++) {
+        for(corner = 0; corner < 3; corner++)
+            mesh->indices[i*3 + corner] = indices[order[i]*3 + corner];
+    }
+
+    free(triangleMin);
+    free(triangleMax);
+    free(order);
+    free(indices);
+    return 1;
+}
+
+/* Fills in the packets from the vertex and index buffers. Unused lanes get degenerate triangles that never hit */
+static void BuildTrianglePackets(struct Mesh* mesh)
+{
+    int i, k;
+    memset(mesh->packets, 0, mesh->packetCount * sizeof(struct TrianglePacket));
+    for(i = 0; i < mesh->triangleCount; i++) {
+        struct TrianglePacket* packet = &mesh->packets[i / MESH_PACKET_WIDTH];
+        int lane = i % MESH_PACKET_WIDTH;
+        float* a = &mesh->vertices[mesh->indices[i*3] * 3];
+        float* b = &mesh->vertices[mesh->indices[i*3 + 1] * 3];
+        float* c = &mesh->vertices[mesh->indices[i*3 + 2] * 3];
+        for(k = 0; k < 3; k++) {
+            packet->v0[k][lane] = a[k];
+            packet->edge1[k][lane] = b[k] - a[k];
+            packet->edge2[k][lane] = c[k] - a[k];
+        }
+    }
+}
+
+/* Maps a whole file read-only. Returns NULL on failure */
+static void* MapFile(const char* fileName, size_t* outSize)
+{
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0) {
+        printf("could not open mesh %s\n", fileName);
+        return NULL;
+    }
+
+    struct stat fileInfo;
+    void* data = NULL;
+    if(fstat(fd, &fileInfo) == 0 && fileInfo.st_size > 0) {
+        data = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+            data = NULL;
+        *outSize = fileInfo.st_size;
+    }
+    close(fd);
+
+    if(!data)
+        printf("could not map mesh %s\n", fileName);
+    return data;
+}
+
+/* 
+ * Small bounded number parsers for OBJ text.
+ * The mapped file isn't null terminated so strtof can't be trusted at the end of it
+ */
+static const char* SkipSpaces(const char* text, const char* end)
+{
+    while(text < end && (*text == ' ' || *text == '\t'))
+        text++;
+    return text;
+}
+
+static const char* ParseFloat(const char* text, const char* end, float* outValue)
+{
+    double value = 0.0;
+    double sign = 1.0;
+    int digits = 0;
+
+    text = SkipSpaces(text, end);
+    if(text < end && (*text == '-' || *text == '+')) {
+        if(*text == '-')
+            sign = -1.0;
+        text++;
+    }
+    while(text < end && *text >= '0' && *text <= '9') {
+        value = value * 10.0 + (*text - '0');
+        text++;
+        digits++;
+    }
+    if(text < end && *text == '.') {
+        double scale = 0.1;
+        text++;
+        while(text < end && *text >= '0' && *text <= '9') {
+            value += (*text - '0') * scale;
+            scale *= 0.1;
+            text++;
+            digits++;
+        }
+    }
+    if(digits == 0)
+        return NULL;
+    if(text < end && (*text == 'e' || *text == 'E')) {
+        int exponent = 0;
+        int exponentSign = 1;
+        text++;
+        if(text < end && (*text == '-' || *text == '+')) {
+            if(*text == '-')
+                exponentSign = -1;
+            text++;
+        }
+        while(text < end && *text >= '0' && *text <= '9') {
+            exponent = exponent * 10 + (*text - '0');
+            text++;
+        }
+        value *= pow(10.0, exponentSign * exponent);
+    }
+
+    *outValue = (float)(sign * value);
+    return text;
+}
+
+/* Parses a face corner like "7", "7/2" or "7/2/5" and returns the vertex index */
+static const char* ParseFaceIndex(const char* text, const char* end, int* outIndex)
+{
+    int value = 0;
+    int sign = 1;
+    int digits = 0;
+
+    text = SkipSpaces(text, end);
+    if(text < end && *text == '-') {
+        sign = -1;
+        text++;
+    }
+    while(text < end && *text >= '0' && *text <= '9') {
+        value = value * 10 + (*text - '0');
+        text++;
+        digits++;
+    }
+    if(digits == 0)
+        return NULL;
+
+    /* Skip texture coordinate and normal indices */
+    while(text < end && *text != ' ' && *text != '\t' && *text != '\r' && *text != '\n')
+        text++;
+
+    *outIndex = sign * value;
+    return text;
+}
+
+static const char* NextLine(const char* text, const char* end)
+{
+    while(text < end && *text != '\n')
+        text++;
+    return (text < end) ? text + 1 : end;
+}
+
+/* 
+ * Loads an OBJ file. Only vertex positions and faces are used; faces with
+ * more than 3 corners are split into a fan of triangles.
+ * The file is walked twice: once to count everything so the whole mesh
+ * can be allocated in one block, once to fill it in.
+ */
+static struct Mesh* LoadObjMesh(const char* fileName, const char* text, size_t size)
+{
+    const char* end = text + size;
+    const char* line;
+    int vertexCount = 0;
+    int triangleCount = 0;
+
+    /* First pass: count */
+    for(line = text; line < end; line = NextLine(line, end)) {
+        const char* cursor = SkipSpaces(line, end);
+        if(cursor + 1 < end && cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            vertexCount++;
+        } else if(cursor + 1 < end && cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            int corners = 0;
+            int index;
+            cursor++;
+            while((cursor = ParseFaceIndex(cursor, end, &index)))
+                corners++;
+            if(corners >= 3)
+                triangleCount += corners - 2;
+        }
+    }
+
+    if(vertexCount == 0 || triangleCount == 0) {
+        printf("mesh %s has no triangles\n", fileName);
+        return NULL;
+    }
+
+    struct BakedMeshHeader header;
+    memset(&header, 0, sizeof(header));
+    header.vertexCount = vertexCount;
+    header.triangleCount = triangleCount;
+    header.packetCount = (triangleCount + MESH_PACKET_WIDTH - 1) / MESH_PACKET_WIDTH;
+    header.nodeCount = BVH_NODE_COUNT(triangleCount, MESH_PACKET_WIDTH);
+    GetMeshLayout(&header);
+
+    struct Mesh* mesh = (struct Mesh*)calloc(1, sizeof(struct Mesh));
+    if(posix_memalign(&mesh->memory, 64, header.fileSize) != 0) {
+        printf("could not allocate %lld bytes for mesh %s\n", header.fileSize, fileName);
+        free(mesh);
+        return NULL;
+    }
+    mesh->memorySize = header.fileSize;
+    SetMeshPointers(mesh, &header, (char*)mesh->memory);
+
+    /* Second pass: fill in */
+    int vertex = 0;
+    int triangle = 0;
+    int lineNumber = 0;
+    for(line = text; line < end; line = NextLine(line, end)) {
+        const char* cursor = SkipSpaces(line, end);
+        lineNumber++;
+        if(cursor + 1 < end && cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            float* position = &mesh->vertices[vertex * 3];
+            cursor++;
+            if(!(cursor = ParseFloat(cursor, end, &position[0])) 
+                || !(cursor = ParseFloat(cursor, end, &position[1]))
+                || !(cursor = ParseFloat(cursor, end, &position[2]))) {
+                printf("%s:%d: bad vertex\n", fileName, lineNumber);
+                FreeMesh(mesh);
+                return NULL;
+            }
+            vertex++;
+        } else if(cursor + 1 < end && cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t')) {
+            int corners = 0;
+            int first = 0, previous = 0, index;
+            cursor++;
+            while((cursor = ParseFaceIndex(cursor, end, &index))) {
+                /* OBJ indices start at 1, negative ones count back from the last vertex */
+                index = (index < 0) ? vertex + index : index - 1;
+                if(index < 0 || index >= vertexCount) {
+                    printf("%s:%d: face uses vertex that doesn't exist\n", fileName, lineNumber);
+                    FreeMesh(mesh);
+                    return NULL;
+                }
+                if(corners == 0) {
+                    first = index;
+                } else if(corners >= 2) {
+                    mesh->indices[triangle*3] = first;
+                    mesh->indices[triangle*3 + 1] = previous;
+                    mesh->indices[triangle*3 + 2] = index;
+                    triangle++;
+                }
+                previous = index;
+                corners++;
+            }
+        }
+    }
+
+    if(!BuildMeshHierarchy(mesh)) {
+        printf("could not build the hierarchy for mesh %s\n", fileName);
+        FreeMesh(mesh);
+        return NULL;
+    }
+    BuildTrianglePackets(mesh);
+    return mesh;
+}
+
+/*
+ * Checks that a baked mesh only refers to what it has: triangle corners to existing vertices,
+ * inner nodes to later nodes and leaves to existing triangles. Returns 1 if it does
+ */
+static int CheckBakedMesh(struct Mesh* mesh)
+{
+    long long cornerCount = (long long)mesh->triangleCount * 3;
+    long long corner;
+    for(corner = 0; corner < cornerCount; corner++) {
+        if(mesh->indices[corner] >= (unsigned int)mesh->vertexCount)
+            return 0;
+    }
+
+    /* Depth first order: the left child is right after its parent and the right child comes after that */
+    int nodeIndex;
+    for(nodeIndex = 0; nodeIndex < mesh->nodeCount; nodeIndex++) {
+        const struct BvhNode* node = &mesh->nodes[nodeIndex];
+        if(node->count > 0) {
+            if(node->first < 0 || node->first >= mesh->triangleCount || node->count > mesh->triangleCount - node->first)
+                return 0;
+        } else if(node->count < 0 || node->first <= nodeIndex + 1 || node->first >= mesh->nodeCount) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Uses a baked mesh (file mapping or a copy made by CopyMeshMemory) in place */
+static struct Mesh* UseBakedMesh(const char* fileName, void* data, size_t size, const int storage)
+{
+    struct BakedMeshHeader header;
+    if(size < sizeof(header)) {
+        printf("baked mesh %s is damaged or from a different version\n", fileName);
+        return NULL;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    struct BakedMeshHeader expected = header;
+    GetMeshLayout(&expected);
+    if(header.vertexCount <= 0 || header.triangleCount <= 0
+        || header.packetCount != (header.triangleCount + MESH_PACKET_WIDTH - 1) / MESH_PACKET_WIDTH
+        || header.nodeCount != BVH_NODE_COUNT(header.triangleCount, MESH_PACKET_WIDTH)
+        || memcmp(&expected, &header, sizeof(header)) != 0 || (long long)size != header.fileSize) {
+        printf("baked mesh %s is damaged or from a different version\n", fileName);
+        return NULL;
+    }
+
+    struct Mesh* mesh = (struct Mesh*)calloc(1, sizeof(struct Mesh));
+    mesh->memory = data;
+    mesh->memorySize = size;
+    mesh->storage = storage;
+    SetMeshPointers(mesh, &header, (char*)data);
+    if(!CheckBakedMesh(mesh)) {
+        printf("baked mesh %s refers to vertices, triangles or nodes it doesn't have\n", fileName);
+        free(mesh);
+        return NULL;
+    }
+    return mesh;
+}
+
+/* Loads a baked mesh or an OBJ file (whichever it turns out to be). Returns NULL on failure */
+struct Mesh* LoadMesh(const char* fileName)
+{
+    size_t size = 0;
+    void* data = MapFile(fileName, &size);
+    if(!data)
+        return NULL;
+
+    struct Mesh* mesh;
+    if(size >= sizeof(struct BakedMeshHeader) && memcmp(data, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC)) == 0) {
+        mesh = UseBakedMesh(fileName, data, size, MESH_STORAGE_MAPPED);
+        if(!mesh)
+            munmap(data, size);
+        return mesh;
+    }
+
+    /* OBJ text only needs mapping while it's parsed */
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    mesh = LoadObjMesh(fileName, (const char*)data, size);
+    munmap(data, size);
+    return mesh;
+}
+
+void FreeMesh(struct Mesh* mesh)
+{
+    if(!mesh)
+        return;
+    if(mesh->storage == MESH_STORAGE_MAPPED)
+        munmap(mesh->memory, mesh->memorySize);
+    else if(mesh->storage == MESH_STORAGE_HEAP)
+        free(mesh->memory);
+    free(mesh);
+}
+
+/* The header a baked copy of the mesh starts with */
+static void GetBakedMeshHeader(struct Mesh* mesh, struct BakedMeshHeader* outHeader)
+{
+    memset(outHeader, 0, sizeof(*outHeader));
+    memcpy(outHeader->magic, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC));
+    outHeader->vertexCount = mesh->vertexCount;
+    outHeader->triangleCount = mesh->triangleCount;
+    outHeader->packetCount = mesh->packetCount;
+    outHeader->nodeCount = mesh->nodeCount;
+    GetMeshLayout(outHeader);
+}
+
+/* Writes the mesh as a baked file that LoadMesh can map and use as is. Returns 1 on success */
+int SaveBakedMesh(struct Mesh* mesh, const char* fileName)
+{
+    struct BakedMeshHeader header;
+    GetBakedMeshHeader(mesh, &header);
+
+    FILE* file = fopen(fileName, "wb");
+    if(!file) {
+        printf("could not open %s for writing\n", fileName);
+        return 0;
+    }
+
+    /* Same layout as in memory, padding included */
+    static const char padding[64] = {0};
+    int success = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(padding, 1, header.verticesOffset - sizeof(header), file) == (size_t)(header.verticesOffset - sizeof(header))
+        && fwrite(mesh->vertices, sizeof(float) * 3, mesh->vertexCount, file) == (size_t)mesh->vertexCount
+        && fwrite(padding, 1, header.indicesOffset - header.verticesOffset - mesh->vertexCount * 3 * sizeof(float), file)
+            == (size_t)(header.indicesOffset - header.verticesOffset - mesh->vertexCount * 3 * sizeof(float))
+        && fwrite(mesh->indices, sizeof(unsigned int) * 3, mesh->triangleCount, file) == (size_t)mesh->triangleCount
+        && fwrite(padding, 1, header.packetsOffset - header.indicesOffset - mesh->triangleCount * 3 * sizeof(unsigned int), file)
+            == (size_t)(header.packetsOffset - header.indicesOffset - mesh->triangleCount * 3 * sizeof(unsigned int))
+        && fwrite(mesh->packets, sizeof(struct TrianglePacket), mesh->packetCount, file) == (size_t)mesh->packetCount
+        && fwrite(mesh->nodes, sizeof(struct BvhNode), mesh->nodeCount, file) == (size_t)mesh->nodeCount;
+    if(fclose(file) != 0)
+        success = 0;
+
+    if(!success)
+        printf("could not write baked mesh to %s\n", fileName);
+    return success;
+}
+
+/*
+ * Copies the mesh, baked, to memory (mesh->memorySize bytes, 64 byte aligned).
+ * Heap meshes already use the baked layout apart from the header, so it's one copy
+ */
+void CopyMeshMemory(struct Mesh* mesh, void* memory)
+{
+    struct BakedMeshHeader header;
+    GetBakedMeshHeader(mesh, &header);
+    memcpy(memory, mesh->memory, mesh->memorySize);
+    memcpy(memory, &header, sizeof(header));
+}
+
+/*
+ * Uses a mesh that CopyMeshMemory put in memory (e.g. memory shared between processes)
+ * without copying it. FreeMesh leaves the memory alone. Returns NULL if it isn't a mesh
+ */
+struct Mesh* UseMeshMemory(const char* name, void* memory, const size_t size)
+{
+    if(size < sizeof(struct BakedMeshHeader) || memcmp(memory, MESH_FILE_MAGIC, sizeof(MESH_FILE_MAGIC)) != 0) {
+        printf("shared mesh %s is damaged\n", name);
+        return NULL;
+    }
+    return UseBakedMesh(name, memory, size, MESH_STORAGE_BORROWED);
+}
+
+/* Shows what the mesh costs, in total and per triangle */
+void PrintMeshMemory(struct Mesh* mesh, const char* name)
+{
+    size_t vertexBytes = (size_t)mesh->vertexCount * 3 * sizeof(float);
+    size_t indexBytes = (size_t)mesh->triangleCount * 3 * sizeof(unsigned int);
+    size_t packetBytes = (size_t)mesh->packetCount * sizeof(struct TrianglePacket);
+    size_t nodeBytes = (size_t)mesh->nodeCount * sizeof(struct BvhNode);
+    printf("Mesh %s: %d vertices, %d triangles (%s), %.2f MB: vertices %.2f, indices %.2f, packets %.2f, hierarchy %.2f bytes per triangle\n",
+        name, mesh->vertexCount, mesh->triangleCount, mesh->storage == MESH_STORAGE_MAPPED ? "mapped"
+            : mesh->storage == MESH_STORAGE_BORROWED ? "shared" : "in memory",
+        mesh->memorySize / (1024.0 * 1024.0),
+        (double)vertexBytes / mesh->triangleCount, (double)indexBytes / mesh->triangleCount,
+        (double)packetBytes / mesh->triangleCount, (double)nodeBytes / mesh->triangleCount);
+}
+
+/* The ray (set up for the kernel) and the closest hit so far, for IntersectMeshLeaf */
+struct MeshRay {
+    struct Mesh* mesh;
+    float* origin;
+    float* direction;
+#ifdef __SSE__
+    __m128 origin4[3];
+    __m128 direction4[3];
+#endif
+    int closestTriangle;
+    float closestDistance;
+};
+
+/* 
+ * Moller-Trumbore against every triangle of one packet.
+ * Shrinks *closest and returns the triangle if one is hit closer than it
+ */
+static int IntersectPacket(struct MeshRay* ray, const int packetIndex, float* closest)
+{
+    struct TrianglePacket* packet = &ray->mesh->packets[packetIndex];
+    int closestTriangle = -1;
+
+#ifdef __SSE__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 ox = ray->origin4[0], oy = ray->origin4[1], oz = ray->origin4[2];
+    const __m128 dx = ray->direction4[0], dy = ray->direction4[1], dz = ray->direction4[2];
+    __m128 e1x = _mm_load_ps(packet->edge1[0]);
+    __m128 e1y = _mm_load_ps(packet->edge1[1]);
+    __m128 e1z = _mm_load_ps(packet->edge1[2]);
+    __m128 e2x = _mm_load_ps(packet->edge2[0]);
+    __m128 e2y = _mm_load_ps(packet->edge2[1]);
+    __m128 e2z = _mm_load_ps(packet->edge2[2]);
+
+    /* pvec = direction x edge2, det = edge1 . pvec */
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 valid = _mm_cmpgt_ps(_mm_andnot_ps(signMask, det), _mm_set1_ps(1e-8f));
+    if(!_mm_movemask_ps(valid))
+        return -1;
+    __m128 inverseDet = _mm_div_ps(one, det);
+
+    /* tvec = origin - v0, u = (tvec . pvec) / det */
+    __m128 tx = _mm_sub_ps(ox, _mm_load_ps(packet->v0[0]));
+    __m128 ty = _mm_sub_ps(oy, _mm_load_ps(packet->v0[1]));
+    __m128 tz = _mm_sub_ps(oz, _mm_load_ps(packet->v0[2]));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverseDet);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+    /* qvec = tvec x edge1, v = (direction . qvec) / det, t = (edge2 . qvec) / det */
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(MESH_MIN_HIT_DISTANCE)), _mm_cmplt_ps(t, _mm_set1_ps(*closest))));
+
+    int hits = _mm_movemask_ps(valid);
+    if(hits) {
+        float distances[MESH_PACKET_WIDTH];
+        int lane;
+        _mm_storeu_ps(distances, t);
+        for(lane = 0; lane < MESH_PACKET_WIDTH; lane++) {
+            if((hits & (1 << lane)) && distances[lane] < *closest) {
+                *closest = distances[lane];
+                closestTriangle = packetIndex * MESH_PACKET_WIDTH + lane;
+            }
+        }
+    }
+#else
+    int lane;
+    for(lane = 0; lane < MESH_PACKET_WIDTH; lane++) {
+        vec3 edge1 = {packet->edge1[0][lane], packet->edge1[1][lane], packet->edge1[2][lane]};
+        vec3 edge2 = {packet->edge2[0][lane], packet->edge2[1][lane], packet->edge2[2][lane]};
+        vec3 v0 = {packet->v0[0][lane], packet->v0[1][lane], packet->v0[2][lane]};
+        vec3 pvec, tvec, qvec;
+        vec3_mul_cross(pvec, ray->direction, edge2);
+        float det = vec3_dot(edge1, pvec);
+        if(fabsf(det) <= 1e-8f)
+            continue;
+        float inverseDet = 1.0f / det;
+        vec3_sub(tvec, ray->origin, v0);
+        float u = vec3_dot(tvec, pvec) * inverseDet;
+        if(u < 0.0f || u > 1.0f)
+            continue;
+        vec3_mul_cross(qvec, tvec, edge1);
+        float v = vec3_dot(ray->direction, qvec) * inverseDet;
+        if(v < 0.0f || u + v > 1.0f)
+            continue;
+        float t = vec3_dot(edge2, qvec) * inverseDet;
+        if(t > MESH_MIN_HIT_DISTANCE && t < *closest) {
+            *closest = t;
+            closestTriangle = packetIndex * MESH_PACKET_WIDTH + lane;
+        }
+    }
+#endif
+
+    return closestTriangle;
+}
+
+/* Leaves always start on a packet (see BuildMeshHierarchy) */
+static void IntersectMeshLeaf(void* context, int first, int count, float* maxDistance)
+{
+    struct MeshRay* ray = (struct MeshRay*)context;
+    int packetIndex;
+    for(packetIndex = first / MESH_PACKET_WIDTH; packetIndex * MESH_PACKET_WIDTH < first + count; packetIndex++) {
+        int triangle = IntersectPacket(ray, packetIndex, maxDistance);
+        if(triangle >= 0) {
+            ray->closestTriangle = triangle;
+            ray->closestDistance = *maxDistance;
+        }
+    }
+}
+
+/* 
+ * Finds the closest triangle the ray hits between MESH_MIN_HIT_DISTANCE and maxDistance.
+ * The direction doesn't have to be normalized; distances are in multiples of it.
+ * Returns 1 and fills in the distance and triangle if something was hit
+ */
+int IntersectMesh(struct Mesh* mesh, float* origin, float* direction, const float maxDistance,
+    float* outDistance, int* outTriangle)
+{
+    struct MeshRay ray;
+    int k;
+    ray.mesh = mesh;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.closestTriangle = -1;
+#ifdef __SSE__
+    for(k = 0; k < 3; k++) {
+        ray.origin4[k] = _mm_set1_ps(origin[k]);
+        ray.direction4[k] = _mm_set1_ps(direction[k]);
+    }
+#else
+    (void)k;
+#endif
+
+    TraverseBvh(mesh->nodes, origin, direction, maxDistance, IntersectMeshLeaf, &ray);
+    if(ray.closestTriangle < 0)
+        return 0;
+
+    *outDistance = ray.closestDistance;
+    *outTriangle = ray.closestTriangle;
+    return 1;
+}
+
+/* Normalized face normal of a triangle (counter clockwise winding) */
+void GetMeshTriangleNormal(struct Mesh* mesh, const int triangle, float* outNormal)
+{
+    struct TrianglePacket* packet = &mesh->packets[triangle / MESH_PACKET_WIDTH];
+    int lane = triangle % MESH_PACKET_WIDTH;
+    vec3 edge1 = {packet->edge1[0][lane], packet->edge1[1][lane], packet->edge1[2][lane]};
+    vec3 edge2 = {packet->edge2[0][lane], packet->edge2[1][lane], packet->edge2[2][lane]};
+    vec3_mul_cross(outNormal, edge1, edge2);
+    vec3_normalize(outNormal, outNormal);
+}
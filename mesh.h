@@ -0,0 +1,70 @@
+#ifndef MESH_H_
+#define MESH_H_
+
+#include <stddef.h>
+
+/* 
+ * Triangle meshes.
+ * Vertices are shared through an index buffer, and the triangles are also
+ * repacked MESH_PACKET_WIDTH at a time (structure of arrays) so the
+ * intersection kernel can test a whole packet at once with SSE.
+ * A hierarchy over the packets keeps rays away from most of them.
+ * Meshes load from OBJ files or from a pre-baked binary file that is
+ * mmap'd and used in place. Either way there's no allocation per face.
+ */
+
+#define MESH_PACKET_WIDTH 4
+
+struct BvhNode;
+
+/* Where a mesh's data lives (Mesh.storage) */
+#define MESH_STORAGE_HEAP 0
+#define MESH_STORAGE_MAPPED 1
+#define MESH_STORAGE_BORROWED 2
+
+/* Closest a ray has to go before it can hit a triangle (stops reflected rays hitting their own triangle) */
+#define MESH_MIN_HIT_DISTANCE 0.01f
+
+/* Everything the intersection kernel needs for MESH_PACKET_WIDTH triangles */
+struct TrianglePacket {
+    float v0[3][MESH_PACKET_WIDTH];
+    float edge1[3][MESH_PACKET_WIDTH];
+    float edge2[3][MESH_PACKET_WIDTH];
+};
+
+struct Mesh {
+    int vertexCount;
+    int triangleCount;
+    int packetCount;
+    float* vertices;
+    unsigned int* indices;
+    struct TrianglePacket* packets;
+
+    /* Hierarchy over the packets (see bvh.h). The root holds the bounds of the whole mesh */
+    int nodeCount;
+    struct BvhNode* nodes;
+
+    /* Where the data lives: one heap block, a mapped baked file or memory someone else owns */
+    void* memory;
+    size_t memorySize;
+    int storage;
+};
+
+struct Mesh* LoadMesh(const char* fileName);
+
+void FreeMesh(struct Mesh* mesh);
+
+int SaveBakedMesh(struct Mesh* mesh, const char* fileName);
+
+void CopyMeshMemory(struct Mesh* mesh, void* memory);
+
+struct Mesh* UseMeshMemory(const char* name, void* memory, const size_t size);
+
+void PrintMeshMemory(struct Mesh* mesh, const char* name);
+
+int IntersectMesh(struct Mesh* mesh, float* origin, float* direction, const float maxDistance,
+    float* outDistance, int* outTriangle);
+
+void GetMeshTriangleNormal(struct Mesh* mesh, const int triangle, float* outNormal);
+
+#endif
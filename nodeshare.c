@@ -0,0 +1,119 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* My libraries */
+#include "nodeshare.h"
+
+#ifdef USE_MPI
+
+/*
+ * Finds out which processes share a node and picks the first one of each node as its leader.
+ * Every process has to call this. Returns 1 on success
+ */
+int InitNodeShare(struct NodeShare* share)
+{
+    int worldRank, worldSize;
+    MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+    MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+
+    /* Ordered by world rank, so world rank 0 always leads its node */
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, worldRank, MPI_INFO_NULL, &share->node);
+    MPI_Comm_rank(share->node, &share->nodeRank);
+    MPI_Comm_size(share->node, &share->nodeSize);
+    MPI_Comm_split(MPI_COMM_WORLD, share->nodeRank == 0 ? 0 : MPI_UNDEFINED, worldRank, &share->leaders);
+
+    int leader = worldRank;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, share->node);
+    share->worldLeaders = (int*)malloc(worldSize * sizeof(int));
+    MPI_Allgather(&leader, 1, MPI_INT, share->worldLeaders, 1, MPI_INT, MPI_COMM_WORLD);
+
+    int i;
+    share->nodeCount = 0;
+    for(i = 0; i < worldSize; i++) {
+        if(share->worldLeaders[i] == i)
+            share->nodeCount++;
+    }
+    share->sceneWindow = MPI_WIN_NULL;
+
+    if(worldRank == 0)
+        printf("%d processes on %d nodes (%d on this one) share memory per node\n", worldSize, share->nodeCount, share->nodeSize);
+    return 1;
+}
+
+/* Frees the window kept for the scene, so a scene using it has to be freed first */
+void FreeNodeShare(struct NodeShare* share)
+{
+    if(share->sceneWindow != MPI_WIN_NULL)
+        MPI_Win_free(&share->sceneWindow);
+    if(share->leaders != MPI_COMM_NULL)
+        MPI_Comm_free(&share->leaders);
+    MPI_Comm_free(&share->node);
+    free(share->worldLeaders);
+    share->worldLeaders = NULL;
+}
+
+/*
+ * bytes of memory every process on the node sees, 64 byte aligned. Only the leader
+ * really allocates. Every process on the node has to call this, and MPI_Win_free
+ * the window when done. Writes become visible to the others after MPI_Win_fence
+ */
+void* AllocateNodeShared(struct NodeShare* share, const size_t bytes, MPI_Win* outWindow)
+{
+    char* base = NULL;
+    MPI_Aint size = share->nodeRank == 0 ? (MPI_Aint)(bytes + 64) : 0;
+    MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, share->node, &base, outWindow);
+
+    int displacement;
+    MPI_Win_shared_query(*outWindow, 0, &size, &displacement, &base);
+
+    /* Every process maps the memory somewhere else, so the leader decides where the aligned part starts */
+    int offset = (int)((64 - ((uintptr_t)base & 63)) & 63);
+    MPI_Bcast(&offset, 1, MPI_INT, 0, share->node);
+    MPI_Win_fence(0, *outWindow);
+    return base + offset;
+}
+
+/* Maximum of value over every process: within each node first, then only between the leaders */
+float ReduceMaxOnNodes(struct NodeShare* share, const float value)
+{
+    float maxValue = value;
+    MPI_Reduce(&value, &maxValue, 1, MPI_FLOAT, MPI_MAX, 0, share->node);
+    if(share->leaders != MPI_COMM_NULL)
+        MPI_Allreduce(MPI_IN_PLACE, &maxValue, 1, MPI_FLOAT, MPI_MAX, share->leaders);
+    MPI_Bcast(&maxValue, 1, MPI_FLOAT, 0, share->node);
+    return maxValue;
+}
+
+/*
+ * Gets a whole image to the root. nodeRows is the node shared image every process
+ * wrote its own rows of (rowStarts and rowCounts for every world rank), so the root's node
+ * is already done and every other leader sends the rows of its node's processes.
+ * Every process has to call this after a fence on nodeRows' window
+ */
+void AssembleRowsOnRoot(struct NodeShare* share, unsigned char* nodeRows, const size_t rowBytes,
+    const int* rowStarts, const int* rowCounts)
+{
+    int worldRank, worldSize;
+    MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+    MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+
+    MPI_Request* requests = (MPI_Request*)malloc(worldSize * sizeof(MPI_Request));
+    int requestCount = 0;
+    int i;
+    for(i = 0; i < worldSize; i++) {
+        if(share->worldLeaders[i] == 0)
+            continue;
+        unsigned char* rows = nodeRows + rowStarts[i] * rowBytes;
+        int bytes = (int)(rowCounts[i] * rowBytes);
+        if(worldRank == 0)
+            MPI_Irecv(rows, bytes, MPI_BYTE, share->worldLeaders[i], i, MPI_COMM_WORLD, &requests[requestCount++]);
+        else if(share->worldLeaders[i] == worldRank)
+            MPI_Isend(rows, bytes, MPI_BYTE, 0, i, MPI_COMM_WORLD, &requests[requestCount++]);
+    }
+    MPI_Waitall(requestCount, requests, MPI_STATUSES_IGNORE);
+    free(requests);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef NODESHARE_H_
+#define NODESHARE_H_
+
+#include <stddef.h>
+
+/*
+ * Memory shared by the MPI processes of one machine (node), through MPI-3 shared windows.
+ * The first process of every node (its leader) allocates, the others use the leader's
+ * memory directly. Only leaders talk to other nodes.
+ * With --share-scene the packed scene (see scenepack.h) is kept once per node instead of
+ * once per process, and with --share-framebuffer the processes of a node trace straight
+ * into one image, the lighting maximum is reduced node first and then between leaders,
+ * and leaders send their node's rows to the root.
+ * Everything here only exists in the MPI build.
+ */
+
+struct NodeShare;
+
+#ifdef USE_MPI
+#include <mpi.h>
+
+struct NodeShare {
+    /* The processes on this node, and the leaders of every node (MPI_COMM_NULL if not a leader) */
+    MPI_Comm node;
+    MPI_Comm leaders;
+    int nodeRank;
+    int nodeSize;
+    int nodeCount;
+
+    /* World rank of the leader of every world rank's node */
+    int* worldLeaders;
+
+    /* Holds the packed scene with --share-scene (MPI_WIN_NULL otherwise), lives as long as the scene */
+    MPI_Win sceneWindow;
+};
+
+int InitNodeShare(struct NodeShare* share);
+
+void FreeNodeShare(struct NodeShare* share);
+
+void* AllocateNodeShared(struct NodeShare* share, const size_t bytes, MPI_Win* outWindow);
+
+float ReduceMaxOnNodes(struct NodeShare* share, const float value);
+
+void AssembleRowsOnRoot(struct NodeShare* share, unsigned char* nodeRows, const size_t rowBytes,
+    const int* rowStarts, const int* rowCounts);
+
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+/* sched_setaffinity, sched_getcpu and MADV_HUGEPAGE aren't in C99 */
+#define _GNU_SOURCE
+
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+/* My libraries */
+#include "numa.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/*
+ * Allocates memory aligned (and sized) to whole huge pages without touching it,
+ * so it ends up wherever the first thread to write to it lives (see FirstTouchNuma).
+ * Free it with free()
+ */
+void* AllocateNumaMemory(const size_t bytes)
+{
+    size_t size = (bytes + NUMA_HUGE_PAGE_SIZE - 1) / NUMA_HUGE_PAGE_SIZE * NUMA_HUGE_PAGE_SIZE;
+    void* memory = NULL;
+    if(size == 0 || posix_memalign(&memory, NUMA_HUGE_PAGE_SIZE, size) != 0) {
+        printf("could not allocate %.2f MB of huge page aligned memory\n", (double)bytes / (1024.0 * 1024.0));
+        return NULL;
+    }
+    return memory;
+}
+
+/*
+ * How many items (rows or tiles) each thread takes in turn.
+ * A whole huge page worth if that still gives every thread NUMA_MIN_CHUNKS_PER_THREAD
+ * chunks, otherwise smaller chunks (which then share huge pages, see FirstTouchNuma)
+ */
+int GetNumaChunk(const size_t itemBytes, const int itemCount, const int threadCount)
+{
+    int chunk = (int)((NUMA_HUGE_PAGE_SIZE + itemBytes - 1) / itemBytes);
+    int balancedChunk = itemCount / (threadCount * NUMA_MIN_CHUNKS_PER_THREAD);
+    if(chunk > balancedChunk)
+        chunk = balancedChunk;
+    return chunk > 0 ? chunk : 1;
+}
+
+/*
+ * Zeroes itemCount items with the same threads and schedule (static, chunk) that
+ * later write them, so every page is placed on the node of the thread using it.
+ * Huge pages are only asked for when a chunk covers whole ones, since a huge page
+ * shared between threads on different nodes would be remote for some of them
+ */
+void FirstTouchNuma(void* memory, const size_t itemBytes, const int itemCount, const int chunk)
+{
+    int i;
+#ifdef MADV_HUGEPAGE
+    if(itemBytes * chunk >= NUMA_HUGE_PAGE_SIZE)
+        madvise(memory, (itemBytes * itemCount + NUMA_HUGE_PAGE_SIZE - 1) / NUMA_HUGE_PAGE_SIZE * NUMA_HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+
+#ifdef USE_OPENMP
+    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) schedule(static, chunk)
+#endif
+    for(i = 0; i < itemCount; i++)
+        memset((unsigned char*)memory + i * itemBytes, 0, itemBytes);
+#ifndef USE_OPENMP
+    (void)chunk;
+#endif
+}
+
+/* Which NUMA node a CPU belongs to (its sysfs folder has a nodeN entry). -1 if unknown */
+static int GetCpuNode(const int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR* directory = opendir(path);
+    if(!directory)
+        return -1;
+
+    int node = -1;
+    struct dirent* entry;
+    while(node < 0 && (entry = readdir(directory)) != NULL) {
+        if(strncmp(entry->d_name, "node", 4) == 0)
+            sscanf(entry->d_name + 4, "%d", &node);
+    }
+    closedir(directory);
+    return node;
+}
+
+/*
+ * Pins every OpenMP thread to its own core (in order, out of the cores this process
+ * may use, wrapping around if there are more threads) and prints where they ended up.
+ * OpenMP keeps reusing the same threads for the same thread numbers, so this only
+ * has to happen once. Builds without OpenMP only report where they run, since pinning
+ * every MPI process to the first core would stack them up (mpirun --bind-to core does it properly)
+ */
+void PinThreads(void)
+{
+#ifdef USE_OPENMP
+    cpu_set_t allowed;
+    int allowedCpus[CPU_SETSIZE];
+    int allowedCount = 0;
+    int i;
+
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        printf("Could not read which cores this process may use, threads are not pinned\n");
+        return;
+    }
+    for(i = 0; i < CPU_SETSIZE; i++) {
+        if(CPU_ISSET(i, &allowed))
+            allowedCpus[allowedCount++] = i;
+    }
+    if(allowedCount == 0)
+        return;
+
+    int pinnedCpus[OPENMP_THREAD_AMOUNT];
+    int runningCpus[OPENMP_THREAD_AMOUNT];
+
+    #pragma omp parallel num_threads(OPENMP_THREAD_AMOUNT)
+    {
+        const int thread = omp_get_thread_num();
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(allowedCpus[thread % allowedCount], &pinned);
+        pinnedCpus[thread] = -1;
+        if(sched_setaffinity(0, sizeof(pinned), &pinned) == 0)
+            pinnedCpus[thread] = allowedCpus[thread % allowedCount];
+        runningCpus[thread] = sched_getcpu();
+    }
+
+    printf("Thread placement (%d threads on %d cores):\n", OPENMP_THREAD_AMOUNT, allowedCount);
+    for(i = 0; i < OPENMP_THREAD_AMOUNT; i++) {
+        if(pinnedCpus[i] < 0)
+            printf("  thread %2d: could not be pinned, running on core %d (node %d)\n", i,
+                runningCpus[i], GetCpuNode(runningCpus[i]));
+        else
+            printf("  thread %2d: pinned to core %d (node %d)\n", i, pinnedCpus[i], GetCpuNode(pinnedCpus[i]));
+    }
+    if(OPENMP_THREAD_AMOUNT > allowedCount)
+        printf("  more threads than cores, so some of them share\n");
+#else
+    const int cpu = sched_getcpu();
+    printf("Running on core %d (node %d), not pinned\n", cpu, GetCpuNode(cpu));
+#endif
+}
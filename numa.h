@@ -0,0 +1,30 @@
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <stddef.h>
+
+/*
+ * Memory placement for machines with more than one NUMA node (--numa).
+ * Linux puts a page on the node of the thread that first writes to it, so the
+ * image is allocated untouched and every thread then zeroes the rows (or tiles)
+ * it is going to trace, in the same order it will trace them. Threads are pinned
+ * to cores so they stay next to that memory.
+ * Nothing here needs libnuma; without more than one node it all still works, it just
+ * doesn't matter where things end up.
+ */
+
+/* Transparent huge page size on x86-64. Buffers are aligned to it so they can use them */
+#define NUMA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Every thread gets at least this many chunks of the image so the work still evens out */
+#define NUMA_MIN_CHUNKS_PER_THREAD 8
+
+void* AllocateNumaMemory(const size_t bytes);
+
+int GetNumaChunk(const size_t itemBytes, const int itemCount, const int threadCount);
+
+void FirstTouchNuma(void* memory, const size_t itemBytes, const int itemCount, const int chunk);
+
+void PinThreads(void);
+
+#endif
@@ -0,0 +1,487 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "options.h"
+#include "adaptive.h"
+#include "camera.h"
+#include "rawimage.h"
+#include "pixelformat.h"
+#include "partition.h"
+#include "checkpoint.h"
+#include "arealight.h"
+#include "denoise.h"
+#include "temporal.h"
+#include "irradiance.h"
+#include "framebuffer.h"
+#include "schedule.h"
+#include "autotune.h"
+#include "heatmap.h"
+
+/* 
+ * Image sizes. 1920x1080 is proper, but 1072 I used for benchmarking
+ * as 1080 is not divisible by 16.
+ */
+void DefaultRenderOptions(struct RenderOptions* options)
+{
+    options->width = 1920;
+    options->height = 1080;
+
+    options->lookAtCamera = 0;
+    options->cameraUp[0] = CAMERA_DEFAULT_UP_X;
+    options->cameraUp[1] = CAMERA_DEFAULT_UP_Y;
+    options->cameraUp[2] = CAMERA_DEFAULT_UP_Z;
+    options->cameraFov = 40.0f;
+
+    options->samplesPerPixel = 1;
+    options->seed = 0;
+    options->lightSamples = 0;
+
+    options->adaptive = 0;
+    options->adaptiveThreshold = ADAPTIVE_DEFAULT_THRESHOLD;
+    options->adaptiveCompare = 0;
+
+    options->denoisePasses = 0;
+    options->irradianceError = 0.0f;
+
+    DefaultTraceSchedule(&options->schedule);
+    options->heatmap = 0;
+    options->autoTune = 0;
+    options->tuneFile = AUTOTUNE_DEFAULT_FILE;
+    options->numa = 0;
+
+    options->pixelFormat = PIXEL_FORMAT_FLOAT;
+
+    options->partition = PARTITION_EQUAL;
+    options->shareScene = 0;
+    options->shareFramebuffer = 0;
+
+    options->outputFile = "rendered.bmp";
+
+    options->animationFile = NULL;
+    options->splitFramesAcrossProcesses = 1;
+    options->temporalRefresh = 0;
+
+    options->lightsFile = NULL;
+
+    options->meshCount = 0;
+    options->instancesFile = NULL;
+    options->bakeMeshInput = NULL;
+    options->bakeMeshOutput = NULL;
+
+    options->gbufferFile = NULL;
+    options->reshadeFile = NULL;
+
+    options->checkpointFile = NULL;
+    options->resume = 0;
+
+    options->serveSocket = NULL;
+    options->requestSocket = NULL;
+    options->requestLine = NULL;
+
+    options->saveRawFile = NULL;
+    options->compareRawFile = NULL;
+    options->maxRmsError = RAW_DEFAULT_MAX_RMS_ERROR;
+    options->maxBadPixelPercent = RAW_DEFAULT_MAX_BAD_PIXELS;
+}
+
+/* Grabs the value after an option. Returns NULL if it's missing */
+static const char* OptionValue(int* index, int argc, char** argv)
+{
+    if(*index + 1 >= argc) {
+        printf("option %s needs a value\n", argv[*index]);
+        return NULL;
+    }
+    (*index)++;
+    return argv[*index];
+}
+
+/* 
+ * Parses the command line into options.
+ * Returns 1 on success and 0 if something was wrong with the arguments
+ */
+int ParseRenderOptions(struct RenderOptions* options, int argc, char** argv)
+{
+    int i;
+    for(i = 1; i < argc; i++) {
+        const char* value = NULL;
+
+        if(strcmp(argv[i], "--width") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->width = atoi(value);
+        } else if(strcmp(argv[i], "--height") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->height = atoi(value);
+        } else if(strcmp(argv[i], "--camera") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            float* eye = options->cameraEye;
+            float* target = options->cameraTarget;
+            float* up = options->cameraUp;
+            int count = sscanf(value, "%f,%f,%f,%f,%f,%f,%f,%f,%f", &eye[0], &eye[1], &eye[2],
+                &target[0], &target[1], &target[2], &up[0], &up[1], &up[2]);
+            if(count != 6 && count != 9) {
+                printf("--camera needs ex,ey,ez,tx,ty,tz or ex,ey,ez,tx,ty,tz,ux,uy,uz\n");
+                return 0;
+            }
+            options->lookAtCamera = 1;
+        } else if(strcmp(argv[i], "--fov") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->cameraFov = (float)atof(value);
+            if(options->cameraFov <= 0.0f || options->cameraFov >= 180.0f) {
+                printf("--fov must be between 0 and 180 degrees\n");
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--spp") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->samplesPerPixel = atoi(value);
+        } else if(strcmp(argv[i], "--seed") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->seed = strtoull(value, NULL, 0);
+        } else if(strcmp(argv[i], "--light-samples") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->lightSamples = atoi(value);
+        } else if(strcmp(argv[i], "--adaptive") == 0) {
+            options->adaptive = 1;
+        } else if(strcmp(argv[i], "--adaptive-threshold") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->adaptive = 1;
+            options->adaptiveThreshold = (float)atof(value);
+        } else if(strcmp(argv[i], "--adaptive-compare") == 0) {
+            options->adaptive = 1;
+            options->adaptiveCompare = 1;
+        } else if(strcmp(argv[i], "--denoise") == 0) {
+            options->denoisePasses = DENOISE_DEFAULT_PASSES;
+        } else if(strcmp(argv[i], "--denoise-passes") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->denoisePasses = atoi(value);
+            if(options->denoisePasses < 1 || options->denoisePasses > DENOISE_MAX_PASSES) {
+                printf("--denoise-passes must be between 1 and %d\n", DENOISE_MAX_PASSES);
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--irradiance-cache") == 0) {
+            options->irradianceError = IRRADIANCE_DEFAULT_ERROR;
+        } else if(strcmp(argv[i], "--irradiance-error") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->irradianceError = (float)atof(value);
+            if(!(options->irradianceError > 0.0f && options->irradianceError <= 1.0f)) {
+                printf("--irradiance-error must be above 0 and at most 1\n");
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--layout") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            if(strcmp(value, "rows") == 0) {
+                options->schedule.tileSize = 0;
+            } else if(strcmp(value, "tiled") == 0) {
+                if(options->schedule.tileSize == 0)
+                    options->schedule.tileSize = FRAMEBUFFER_TILE_SIZE;
+            } else {
+                printf("--layout must be \"rows\" or \"tiled\"\n");
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--tile-size") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            const int tileSize = atoi(value);
+            if(tileSize < SCHEDULE_MIN_TILE_SIZE || tileSize > SCHEDULE_MAX_TILE_SIZE || (tileSize & (tileSize - 1)) != 0) {
+                printf("--tile-size must be a power of two from %d to %d\n", SCHEDULE_MIN_TILE_SIZE, SCHEDULE_MAX_TILE_SIZE);
+                return 0;
+            }
+            options->schedule.tileSize = tileSize;
+        } else if(strcmp(argv[i], "--schedule") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            char policy[32];
+            int chunk = 0;
+            const int fields = sscanf(value, "%31[^,],%d", policy, &chunk);
+            const int policyValue = fields >= 1 ? ParseSchedulePolicy(policy) : -1;
+            if(policyValue < 0 || chunk < 0) {
+                printf("--schedule must be \"static\", \"dynamic\" or \"guided\", optionally followed by \",CHUNK\"\n");
+                return 0;
+            }
+            options->schedule.policy = policyValue;
+            options->schedule.chunk = chunk;
+        } else if(strcmp(argv[i], "--threads") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->schedule.threads = atoi(value);
+            if(options->schedule.threads < 1 || options->schedule.threads > GetMaxTraceThreads()) {
+                printf("--threads must be between 1 and %d (the threads this build has)\n", GetMaxTraceThreads());
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--heatmap") == 0) {
+            options->heatmap = 1;
+        } else if(strcmp(argv[i], "--auto-tune") == 0) {
+            options->autoTune = 1;
+        } else if(strcmp(argv[i], "--tune-file") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->autoTune = 1;
+            options->tuneFile = value;
+        } else if(strcmp(argv[i], "--numa") == 0) {
+            options->numa = 1;
+        } else if(strcmp(argv[i], "--pixel-format") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            if(strcmp(value, "float") == 0) {
+                options->pixelFormat = PIXEL_FORMAT_FLOAT;
+            } else if(strcmp(value, "half") == 0) {
+                options->pixelFormat = PIXEL_FORMAT_HALF;
+            } else if(strcmp(value, "rgb9e5") == 0) {
+                options->pixelFormat = PIXEL_FORMAT_RGB9E5;
+            } else {
+                printf("--pixel-format must be \"float\", \"half\" or \"rgb9e5\"\n");
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--partition") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            if(strcmp(value, "equal") == 0) {
+                options->partition = PARTITION_EQUAL;
+            } else if(strcmp(value, "cost") == 0) {
+                options->partition = PARTITION_COST;
+            } else {
+                printf("--partition must be \"equal\" or \"cost\"\n");
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--share-scene") == 0) {
+            options->shareScene = 1;
+        } else if(strcmp(argv[i], "--share-framebuffer") == 0) {
+            options->shareFramebuffer = 1;
+        } else if(strcmp(argv[i], "--output") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->outputFile = value;
+        } else if(strcmp(argv[i], "--animation") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->animationFile = value;
+        } else if(strcmp(argv[i], "--frame-split") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            if(strcmp(value, "frames") == 0) {
+                options->splitFramesAcrossProcesses = 1;
+            } else if(strcmp(value, "rows") == 0) {
+                options->splitFramesAcrossProcesses = 0;
+            } else {
+                printf("--frame-split must be \"frames\" or \"rows\"\n");
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--temporal") == 0) {
+            options->temporalRefresh = TEMPORAL_DEFAULT_REFRESH;
+        } else if(strcmp(argv[i], "--temporal-refresh") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->temporalRefresh = atoi(value);
+            if(options->temporalRefresh < 2) {
+                printf("--temporal-refresh must be at least 2 frames\n");
+                return 0;
+            }
+        } else if(strcmp(argv[i], "--lights") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->lightsFile = value;
+        } else if(strcmp(argv[i], "--mesh") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            if(options->meshCount >= MAX_MESHES) {
+                printf("too many meshes (max %d)\n", MAX_MESHES);
+                return 0;
+            }
+            options->meshFiles[options->meshCount++] = value;
+        } else if(strcmp(argv[i], "--instances") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->instancesFile = value;
+        } else if(strcmp(argv[i], "--bake-mesh") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->bakeMeshInput = value;
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->bakeMeshOutput = value;
+        } else if(strcmp(argv[i], "--gbuffer") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->gbufferFile = value;
+        } else if(strcmp(argv[i], "--reshade") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->reshadeFile = value;
+        } else if(strcmp(argv[i], "--checkpoint") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->checkpointFile = value;
+        } else if(strcmp(argv[i], "--resume") == 0) {
+            options->resume = 1;
+        } else if(strcmp(argv[i], "--serve") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->serveSocket = value;
+        } else if(strcmp(argv[i], "--request") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->requestSocket = value;
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->requestLine = value;
+        } else if(strcmp(argv[i], "--save-raw") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->saveRawFile = value;
+        } else if(strcmp(argv[i], "--compare-raw") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->compareRawFile = value;
+        } else if(strcmp(argv[i], "--max-rms-error") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->maxRmsError = (float)atof(value);
+        } else if(strcmp(argv[i], "--max-bad-pixels") == 0) {
+            if(!(value = OptionValue(&i, argc, argv)))
+                return 0;
+            options->maxBadPixelPercent = (float)atof(value);
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 0;
+        }
+    }
+
+    if(options->width <= 0 || options->height <= 0) {
+        printf("image size of %d:%d is invalid\n", options->width, options->height);
+        return 0;
+    }
+    if(options->samplesPerPixel < 1) {
+        printf("--spp needs at least 1 sample per pixel\n");
+        return 0;
+    }
+    if(options->lightSamples < 0 || options->lightSamples > AREA_LIGHT_MAX_SAMPLES) {
+        printf("--light-samples must be between 0 (adaptive) and %d\n", AREA_LIGHT_MAX_SAMPLES);
+        return 0;
+    }
+    if(options->gbufferFile && options->samplesPerPixel > 1) {
+        printf("--gbuffer only records one path per pixel, so it can't be used with --spp\n");
+        return 0;
+    }
+    if(options->gbufferFile && (options->adaptive || options->animationFile)) {
+        printf("--gbuffer only works for a single, fully traced frame\n");
+        return 0;
+    }
+    if(options->schedule.tileSize > 0 && (options->adaptive || options->gbufferFile)) {
+        printf("--layout tiled only works when every pixel is traced without --gbuffer\n");
+        return 0;
+    }
+    if(options->denoisePasses > 0 && (options->adaptive || options->shareFramebuffer)) {
+        printf("--denoise needs every pixel traced into an image of its own, not --adaptive or --share-framebuffer\n");
+        return 0;
+    }
+    if(options->irradianceError > 0.0f && options->gbufferFile) {
+        printf("--irradiance-cache can't be used with --gbuffer, re-shading would give another image\n");
+        return 0;
+    }
+    if(options->temporalRefresh > 0 && (!options->animationFile || options->adaptive || options->samplesPerPixel > 1)) {
+        printf("--temporal reuses the previous frame of an --animation, traced one sample per pixel without --adaptive\n");
+        return 0;
+    }
+    if((options->saveRawFile || options->compareRawFile) && options->animationFile) {
+        printf("--save-raw and --compare-raw only work for a single frame\n");
+        return 0;
+    }
+    if(options->checkpointFile && (options->adaptive || options->gbufferFile || options->schedule.tileSize > 0
+        || options->animationFile)) {
+        printf("--checkpoint only works for a single, fully traced frame in the rows layout without --gbuffer\n");
+        return 0;
+    }
+    if(options->numa && (options->autoTune || options->schedule.policy != SCHEDULE_DEFAULT
+        || options->schedule.threads != GetMaxTraceThreads())) {
+        printf("--numa hands rows and tiles to every thread the way it placed them, it can't be used with --schedule, --threads or --auto-tune\n");
+        return 0;
+    }
+    if(options->heatmap && options->adaptive) {
+        printf("--heatmap times the cells of tracing every pixel, not --adaptive\n");
+        return 0;
+    }
+    if(options->autoTune && options->adaptive) {
+        printf("--auto-tune tunes tracing every pixel, --adaptive has nothing for it to tune\n");
+        return 0;
+    }
+    if(options->resume && !options->checkpointFile) {
+        printf("--resume needs the --checkpoint journal to resume from\n");
+        return 0;
+    }
+    if(options->instancesFile && options->meshCount == 0) {
+        printf("--instances needs at least one --mesh\n");
+        return 0;
+    }
+    if(options->adaptiveThreshold < 0.0f) {
+        printf("adaptive threshold can't be negative\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+void PrintRenderUsage(const char* programName)
+{
+    printf("usage: %s [options]\n", programName);
+    printf("  --width N                  image width (default 1920)\n");
+    printf("  --height N                 image height (default 1080)\n");
+    printf("  --camera E,E,E,T,T,T[,U,U,U]  look-at camera from eye E to target T with up U (default up %g,%g,%g)\n",
+        CAMERA_DEFAULT_UP_X, CAMERA_DEFAULT_UP_Y, CAMERA_DEFAULT_UP_Z);
+    printf("  --fov DEGREES              vertical field of view of the look-at camera (default 40)\n");
+    printf("  --spp N                    average N jittered samples per pixel (default 1, the middle of the pixel)\n");
+    printf("  --seed N                   seed of the jitter, same seed same image with any threads or processes (default 0)\n");
+    printf("  --light-samples N          shadow rays per area light and hit (rounded up to a square), 0 adapts them (default 0)\n");
+    printf("  --adaptive                 trace tile corners and interpolate smooth regions\n");
+    printf("  --adaptive-threshold F     relative color difference allowed before subdividing (default %.2f)\n", ADAPTIVE_DEFAULT_THRESHOLD);
+    printf("  --adaptive-compare         also trace every pixel and report the interpolation error\n");
+    printf("  --denoise                  filter the noise of --spp and area lights, guided by what each pixel hit\n");
+    printf("  --denoise-passes N         passes of the denoiser, each reaching twice as far (default %d)\n", DENOISE_DEFAULT_PASSES);
+    printf("  --irradiance-cache         take the light of hits from records cached on a sparse grid where it's smooth\n");
+    printf("  --irradiance-error F       relative error allowed between cached records (default %.2f)\n", IRRADIANCE_DEFAULT_ERROR);
+    printf("  --layout rows|tiled        trace and store the image row by row (default) or in Morton ordered tiles\n");
+    printf("  --tile-size N              tiled layout with NxN tiles, a power of two from %d to %d (default %d)\n",
+        SCHEDULE_MIN_TILE_SIZE, SCHEDULE_MAX_TILE_SIZE, FRAMEBUFFER_TILE_SIZE);
+    printf("  --schedule POLICY[,CHUNK]  hand rows or tiles to threads static, dynamic or guided (default guided rows, dynamic tiles)\n");
+    printf("  --threads N                threads that trace, up to the %d of this build (default all)\n", GetMaxTraceThreads());
+    printf("  --heatmap                  time every row segment or tile, save it next to the output as IMAGE%s (false color) and IMAGE%s\n",
+        HEATMAP_IMAGE_SUFFIX, HEATMAP_CSV_SUFFIX);
+    printf("  --auto-tune                pick the layout, tile size, schedule and threads by timing a small proxy render\n");
+    printf("  --tune-file FILE           where --auto-tune remembers what it picked per host and scene (default %s)\n",
+        AUTOTUNE_DEFAULT_FILE);
+    printf("  --numa                     pin threads to cores and first touch image memory from the threads using it\n");
+    printf("  --pixel-format float|half|rgb9e5  store raw pixels as 12, 6 or 4 bytes while rendering and sending (default float)\n");
+    printf("  --partition equal|cost     MPI only: split rows evenly (default) or by the work a quick pre-pass predicts\n");
+    printf("  --share-scene              MPI only: keep the broadcast scene once per node in memory its processes share\n");
+    printf("  --share-framebuffer        MPI only: processes of a node render into one shared image, only node leaders communicate\n");
+    printf("  --output FILE              where to save the image (default rendered.bmp)\n");
+    printf("  --animation FILE           render a keyframed frame sequence to numbered images\n");
+    printf("  --frame-split frames|rows  MPI only: give each process whole frames (default) or rows of every frame\n");
+    printf("  --temporal                 reuse the light of hits the previous frame already shaded, reflections are traced\n");
+    printf("  --temporal-refresh N       shade every pixel again at least every N frames (default %d)\n", TEMPORAL_DEFAULT_REFRESH);
+    printf("  --lights FILE              replace the scene lights with the ones in FILE\n");
+    printf("  --mesh FILE                add a triangle mesh (OBJ or baked) to the scene, can be repeated\n");
+    printf("  --instances FILE           place copies of the meshes as listed in FILE instead of each one once\n");
+    printf("  --bake-mesh OBJ FILE       convert an OBJ mesh to a baked mesh that loads without parsing, then exit\n");
+    printf("  --gbuffer FILE             save every hit of every pixel to FILE for re-shading\n");
+    printf("  --reshade FILE             shade a saved G-buffer with the (new) lights instead of tracing\n");
+    printf("  --checkpoint FILE          append every finished band of %d rows to the journal FILE (FILE.rank with MPI)\n", CHECKPOINT_BAND_ROWS);
+    printf("  --resume                   take the rows already in the --checkpoint journals and only trace the rest\n");
+    printf("  --serve SOCKET             keep running and render requests sent to the Unix socket SOCKET\n");
+    printf("  --request SOCKET LINE      send one request line to a --serve process, the image goes to --output\n");
+    printf("  --save-raw FILE            save the unscaled float image to FILE\n");
+    printf("  --compare-raw FILE         compare against an image saved with --save-raw, fail if too far off\n");
+    printf("  --max-rms-error F          allowed rms error for --compare-raw (default %g)\n", RAW_DEFAULT_MAX_RMS_ERROR);
+    printf("  --max-bad-pixels PERCENT   allowed share of pixels off by more than %.0f/255 (default %g)\n",
+        RAW_BAD_PIXEL_ERROR * 255.0f, RAW_DEFAULT_MAX_BAD_PIXELS);
+}
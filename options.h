@@ -0,0 +1,114 @@
+#ifndef OPTIONS_H_
+#define OPTIONS_H_
+
+#include "scene.h"
+#include "schedule.h"
+
+/* 
+ * Everything that can be changed from the command line.
+ * Defaults match what the raytracer always rendered.
+ */
+struct RenderOptions {
+    /* Image sizes */
+    int width;
+    int height;
+
+    /* Look-at camera (the default camera is used when lookAtCamera is 0) */
+    int lookAtCamera;
+    float cameraEye[3];
+    float cameraTarget[3];
+    float cameraUp[3];
+    float cameraFov;
+
+    /* Jittered samples per pixel and their seed (see rng.h) */
+    int samplesPerPixel;
+    unsigned long long seed;
+
+    /* Shadow rays per area light and hit, 0 adapts them (see arealight.h) */
+    int lightSamples;
+
+    /* Adaptive quadtree subsampling */
+    int adaptive;
+    float adaptiveThreshold;
+    int adaptiveCompare;
+
+    /* Passes of the edge-aware denoiser, 0 to not denoise (see denoise.h) */
+    int denoisePasses;
+
+    /* Relative error allowed when taking light from the irradiance cache, 0 to shade every hit (see irradiance.h) */
+    float irradianceError;
+
+    /* Row by row or tiled layout (see framebuffer.h), and how rows or tiles go to threads (see schedule.h) */
+    struct TraceSchedule schedule;
+
+    /* Time every cell of the image and save it as a heatmap and CSV (see heatmap.h) */
+    int heatmap;
+
+    /* Pick the schedule by timing a small proxy render, remembered in tuneFile (see autotune.h) */
+    int autoTune;
+    const char* tuneFile;
+
+    /* Pin threads and place image memory next to the threads that use it (see numa.h) */
+    int numa;
+
+    /* How raw pixels are stored and sent between processes (see pixelformat.h) */
+    int pixelFormat;
+
+    /* How rows are split between MPI processes (see partition.h) */
+    int partition;
+
+    /* MPI: share meshes, and the image being rendered, between the processes of a node (see nodeshare.h) */
+    int shareScene;
+    int shareFramebuffer;
+
+    /* Where the final image goes */
+    const char* outputFile;
+
+    /* Animation (NULL renders a single frame) */
+    const char* animationFile;
+    int splitFramesAcrossProcesses;
+
+    /* Frames between shading a pixel again when reusing the previous frame's light, 0 to not reuse (see temporal.h) */
+    int temporalRefresh;
+
+    /* Lights to use instead of the built in ones (NULL keeps them) */
+    const char* lightsFile;
+
+    /* Triangle meshes (OBJ or baked) to add to the scene */
+    const char* meshFiles[MAX_MESHES];
+    int meshCount;
+
+    /* Where to put copies of the meshes (NULL puts each mesh once, as it is) */
+    const char* instancesFile;
+
+    /* Turn an OBJ file into a baked mesh instead of rendering */
+    const char* bakeMeshInput;
+    const char* bakeMeshOutput;
+
+    /* Deferred shading: save a G-buffer while rendering, or shade a saved one */
+    const char* gbufferFile;
+    const char* reshadeFile;
+
+    /* Journal finished rows to a file, and pick up from it after being stopped (see checkpoint.h) */
+    const char* checkpointFile;
+    int resume;
+
+    /* Run as a render server on a Unix socket, or send one request to one (see renderserver.h) */
+    const char* serveSocket;
+    const char* requestSocket;
+    const char* requestLine;
+
+    /* Save the raw float image, or check it against a saved one */
+    const char* saveRawFile;
+    const char* compareRawFile;
+    float maxRmsError;
+    float maxBadPixelPercent;
+};
+
+void DefaultRenderOptions(struct RenderOptions* options);
+
+int ParseRenderOptions(struct RenderOptions* options, int argc, char** argv);
+
+void PrintRenderUsage(const char* programName);
+
+#endif
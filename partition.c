@@ -0,0 +1,144 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "raytracer.h"
+#include "camera.h"
+#include "timing.h"
+#include "partition.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* Include MPI (if needed) */
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+void PartitionRowsEqually(const int height, const int worldSize, int* outRowStarts, int* outRowCounts)
+{
+    int rowStart = 0;
+    int i;
+    for(i = 0; i < worldSize; i++) {
+        outRowStarts[i] = rowStart;
+        outRowCounts[i] = height / worldSize + (i < height % worldSize ? 1 : 0);
+        rowStart += outRowCounts[i];
+    }
+}
+
+/*
+ * Time it takes to trace every PARTITION_SAMPLE_STRIDE-th pixel of the row
+ * in the middle of each band of PARTITION_SAMPLE_STRIDE rows.
+ * Bands are handed out to the processes in turn so each one does a bit of every part of the image.
+ * Time is used rather than counting bounces since nearly every path in the box bounces
+ * the maximum amount of times; what differs is how much has to be intersected (meshes).
+ */
+static void SampleBandCosts(struct Scene* scene, struct Camera* camera, const int width, const int height,
+    const int worldRank, const int worldSize, double* outBandCosts, const int bandCount)
+{
+    int band;
+#ifdef USE_OPENMP
+    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) schedule(dynamic)
+#endif
+    for(band = 0; band < bandCount; band++) {
+        if(band % worldSize != worldRank)
+            continue;
+        int row = band * PARTITION_SAMPLE_STRIDE + PARTITION_SAMPLE_STRIDE / 2;
+        if(row >= height)
+            row = height - 1;
+
+        /* The faster of a few runs, so a run that got interrupted doesn't count */
+        double fastest = 0.0;
+        int run;
+        for(run = 0; run < PARTITION_SAMPLE_RUNS; run++) {
+            double begin = GetSeconds();
+            int col;
+            for(col = PARTITION_SAMPLE_STRIDE / 2; col < width; col += PARTITION_SAMPLE_STRIDE) {
+                vec3 color = {0, 0, 0};
+                TraceCameraRay(scene, camera, row, col, color, NULL);
+            }
+            double seconds = GetSeconds() - begin;
+            if(run == 0 || seconds < fastest)
+                fastest = seconds;
+        }
+        outBandCosts[band] = fastest;
+    }
+
+#ifdef USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, outBandCosts, bandCount, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#else
+    (void)worldRank;
+#endif
+}
+
+void PartitionRowsByCost(struct Scene* scene, struct Camera* camera, const int width, const int height,
+    const int worldRank, const int worldSize, int* outRowStarts, int* outRowCounts, float* outCostShares)
+{
+    const int bandCount = (height + PARTITION_SAMPLE_STRIDE - 1) / PARTITION_SAMPLE_STRIDE;
+    double* bandCosts = (double*)calloc(bandCount, sizeof(double));
+    SampleBandCosts(scene, camera, width, height, worldRank, worldSize, bandCosts, bandCount);
+
+    /* Every row of a band is predicted to cost what its sampled row did */
+    double totalCost = 0.0;
+    int row;
+    for(row = 0; row < height; row++)
+        totalCost += bandCosts[row / PARTITION_SAMPLE_STRIDE];
+    if(totalCost <= 0.0) {
+        PartitionRowsEqually(height, worldSize, outRowStarts, outRowCounts);
+        for(row = 0; outCostShares && row < worldSize; row++)
+            outCostShares[row] = (float)outRowCounts[row] / height;
+        free(bandCosts);
+        return;
+    }
+
+    /*
+     * Walk down the rows and cut each block where the running total is closest to the next
+     * 1 / worldSize of the total. Every process keeps at least one row
+     */
+    double costBefore = 0.0;
+    int rowStart = 0;
+    int i;
+    for(i = 0; i < worldSize; i++) {
+        int rowEnd = height;
+        double cost = 0.0;
+        if(i < worldSize - 1) {
+            const double target = totalCost * (i + 1) / worldSize;
+            const int lastEnd = height - (worldSize - 1 - i);
+            rowEnd = rowStart + 1;
+            cost = bandCosts[rowStart / PARTITION_SAMPLE_STRIDE];
+            while(rowEnd < lastEnd) {
+                double rowCost = bandCosts[rowEnd / PARTITION_SAMPLE_STRIDE];
+                if(costBefore + cost + rowCost * 0.5 >= target)
+                    break;
+                cost += rowCost;
+                rowEnd++;
+            }
+        } else {
+            cost = totalCost - costBefore;
+        }
+
+        outRowStarts[i] = rowStart;
+        outRowCounts[i] = rowEnd - rowStart;
+        if(outCostShares)
+            outCostShares[i] = (float)(cost / totalCost);
+        costBefore += cost;
+        rowStart = rowEnd;
+    }
+
+    free(bandCosts);
+}
+
+const char* GetPartitionName(const int partition)
+{
+    switch(partition) {
+        case PARTITION_EQUAL: return "equal";
+        case PARTITION_COST: return "cost";
+        default: return "unknown";
+    }
+}
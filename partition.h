@@ -0,0 +1,40 @@
+#ifndef PARTITION_H_
+#define PARTITION_H_
+
+#include "scene.h"
+#include "camera.h"
+
+/*
+ * Splits the rows of an image between MPI processes.
+ * Every process gets one block of rows (rowStarts[rank], rowCounts[rank]) and
+ * the blocks cover the image in order, so gathering them gives the whole image.
+ * Works for any height that's at least the number of processes.
+ */
+
+/* Same amount of rows each (the leftover rows go one each to the first processes) */
+#define PARTITION_EQUAL 0
+
+/* Roughly the same predicted work each, from a low resolution pre-pass */
+#define PARTITION_COST 1
+
+/* The pre-pass traces every Nth pixel of every Nth row */
+#define PARTITION_SAMPLE_STRIDE 8
+
+/* Every sampled row is timed this many times and the fastest time is used */
+#define PARTITION_SAMPLE_RUNS 2
+
+void PartitionRowsEqually(const int height, const int worldSize, int* outRowStarts, int* outRowCounts);
+
+/*
+ * Traces a sparse grid of pixels and times them, then splits the rows
+ * so every process gets about the same predicted time.
+ * The processes share the pre-pass (and add it up with MPI) so it costs each of them
+ * PARTITION_SAMPLE_RUNS / (PARTITION_SAMPLE_STRIDE^2 * worldSize) of the frame. Every process has to call this.
+ * outCostShares (can be NULL) gets each process's share of the predicted work.
+ */
+void PartitionRowsByCost(struct Scene* scene, struct Camera* camera, const int width, const int height,
+    const int worldRank, const int worldSize, int* outRowStarts, int* outRowCounts, float* outCostShares);
+
+const char* GetPartitionName(const int partition);
+
+#endif
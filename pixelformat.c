@@ -0,0 +1,325 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* SSE2 for packing 4 pixels (or 8 channels) at a time, F16C if gcc was allowed to use it */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+/* My libraries */
+#include "pixelformat.h"
+
+/* Largest values the packed formats can hold */
+#define HALF_MAX 65504.0f
+#define RGB9E5_MAX 65408.0f
+
+/* Shared exponent format constants (see EXT_texture_shared_exponent) */
+#define RGB9E5_MANTISSA_BITS 9
+#define RGB9E5_EXPONENT_BIAS 15
+
+/* Bytes per pixel */
+int GetPixelFormatSize(const int format)
+{
+    switch(format) {
+        case PIXEL_FORMAT_HALF:
+            return 3 * sizeof(uint16_t);
+        case PIXEL_FORMAT_RGB9E5:
+            return sizeof(uint32_t);
+        default:
+            return 3 * sizeof(float);
+    }
+}
+
+const char* GetPixelFormatName(const int format)
+{
+    switch(format) {
+        case PIXEL_FORMAT_HALF:
+            return "half";
+        case PIXEL_FORMAT_RGB9E5:
+            return "rgb9e5";
+        default:
+            return "float";
+    }
+}
+
+static inline uint32_t FloatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float BitsToFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* 
+ * Float to half, rounding to nearest even. Too big clamps to the largest half.
+ * Denormals go through a float add that lines the mantissa up
+ */
+static inline uint16_t FloatToHalf(float value)
+{
+    const uint32_t denormalMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+    uint32_t bits = FloatBits(value);
+    uint32_t sign = bits & 0x80000000u;
+    float magnitude = fminf(BitsToFloat(bits ^ sign), HALF_MAX);
+    uint32_t result;
+
+    bits = FloatBits(magnitude);
+    if(bits < (113u << 23)) {
+        result = FloatBits(magnitude + BitsToFloat(denormalMagic)) - denormalMagic;
+    } else {
+        uint32_t mantissaOdd = (bits >> 13) & 1;
+        bits += ((uint32_t)(15 - 127) << 23) + 0xfff + mantissaOdd;
+        result = bits >> 13;
+    }
+    return (uint16_t)(result | (sign >> 16));
+}
+
+static inline float HalfToFloat(uint16_t half)
+{
+    const uint32_t shiftedExponent = 0x7c00 << 13;
+    uint32_t bits = ((uint32_t)half & 0x7fff) << 13;
+    uint32_t exponent = bits & shiftedExponent;
+    bits += (127 - 15) << 23;
+    if(exponent == shiftedExponent) {
+        bits += (128 - 16) << 23;
+    } else if(exponent == 0) {
+        bits += 1 << 23;
+        bits = FloatBits(BitsToFloat(bits) - BitsToFloat(113 << 23));
+    }
+    return BitsToFloat(bits | (((uint32_t)half & 0x8000) << 16));
+}
+
+/* Packs one pixel to the shared exponent format. Negative channels become 0 */
+static inline uint32_t PackRgb9e5(const float* pixel)
+{
+    float channels[3];
+    int k;
+    for(k = 0; k < 3; k++)
+        channels[k] = fminf(fmaxf(pixel[k], 0.0f), RGB9E5_MAX);
+    float brightest = fmaxf(channels[0], fmaxf(channels[1], channels[2]));
+
+    /* floor(log2) straight from the float bits, with the smallest exponent as a floor */
+    int exponent = (int)((FloatBits(brightest) >> 23) & 0xff) - 127;
+    if(exponent < -RGB9E5_EXPONENT_BIAS - 1)
+        exponent = -RGB9E5_EXPONENT_BIAS - 1;
+    exponent += 1 + RGB9E5_EXPONENT_BIAS;
+
+    float scale = BitsToFloat((uint32_t)(127 - (exponent - RGB9E5_EXPONENT_BIAS - RGB9E5_MANTISSA_BITS)) << 23);
+    if((int)(brightest * scale + 0.5f) == (1 << RGB9E5_MANTISSA_BITS)) {
+        exponent++;
+        scale *= 0.5f;
+    }
+
+    uint32_t packed = (uint32_t)exponent << 27;
+    for(k = 0; k < 3; k++)
+        packed |= (uint32_t)(int)(channels[k] * scale + 0.5f) << (k * RGB9E5_MANTISSA_BITS);
+    return packed;
+}
+
+static inline void UnpackRgb9e5(uint32_t packed, float* outPixel)
+{
+    int exponent = (int)(packed >> 27);
+    float scale = BitsToFloat((uint32_t)(exponent - RGB9E5_EXPONENT_BIAS - RGB9E5_MANTISSA_BITS + 127) << 23);
+    int k;
+    for(k = 0; k < 3; k++)
+        outPixel[k] = (float)((packed >> (k * RGB9E5_MANTISSA_BITS)) & 0x1ff) * scale;
+}
+
+#ifdef __SSE2__
+/* Same as FloatToHalf, 4 channels at a time (the 4 halves end up in the low bits of each lane) */
+static inline __m128i FloatToHalf4(__m128 value)
+{
+    const __m128i signMask = _mm_set1_epi32(0x80000000);
+    const __m128i denormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+    __m128i bits = _mm_castps_si128(value);
+    __m128i sign = _mm_and_si128(bits, signMask);
+    __m128 magnitude = _mm_min_ps(_mm_castsi128_ps(_mm_xor_si128(bits, sign)), _mm_set1_ps(HALF_MAX));
+    bits = _mm_castps_si128(magnitude);
+
+    __m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(magnitude, _mm_castsi128_ps(denormalMagic))), denormalMagic);
+    __m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(bits, _mm_set1_epi32((int)(((uint32_t)(15 - 127) << 23) + 0xfff)));
+    normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissaOdd), 13);
+
+    __m128i isDenormal = _mm_cmplt_epi32(bits, _mm_set1_epi32(113 << 23));
+    __m128i result = _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+    return _mm_or_si128(result, _mm_srli_epi32(sign, 16));
+}
+
+/* Same as HalfToFloat, for 4 halves in the low bits of each lane */
+static inline __m128 HalfToFloat4(__m128i half)
+{
+    const __m128i shiftedExponent = _mm_set1_epi32(0x7c00 << 13);
+    __m128i bits = _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x7fff)), 13);
+    __m128i exponent = _mm_and_si128(bits, shiftedExponent);
+    bits = _mm_add_epi32(bits, _mm_set1_epi32((127 - 15) << 23));
+
+    __m128i isSpecial = _mm_cmpeq_epi32(exponent, shiftedExponent);
+    __m128i isDenormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+    bits = _mm_add_epi32(bits, _mm_and_si128(isSpecial, _mm_set1_epi32((128 - 16) << 23)));
+    __m128 denormal = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(1 << 23))), _mm_castsi128_ps(_mm_set1_epi32(113 << 23)));
+    bits = _mm_or_si128(_mm_and_si128(isDenormal, _mm_castps_si128(denormal)), _mm_andnot_si128(isDenormal, bits));
+    return _mm_castsi128_ps(_mm_or_si128(bits, _mm_slli_epi32(_mm_and_si128(half, _mm_set1_epi32(0x8000)), 16)));
+}
+
+/* Narrows 2x4 lanes of 16 bit values to 8 halves (packs_epi32 saturates signed, so shift the range first) */
+static inline __m128i NarrowHalves(__m128i low, __m128i high)
+{
+    const __m128i offset = _mm_set1_epi32(0x8000);
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(low, offset), _mm_sub_epi32(high, offset));
+    return _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000));
+}
+
+/* Three registers of interleaved rgb (4 pixels) to one register per channel */
+static inline void InterleavedToChannels(__m128 a, __m128 b, __m128 c, __m128* outRed, __m128* outGreen, __m128* outBlue)
+{
+    __m128 mixed = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+    *outRed = _mm_shuffle_ps(a, mixed, _MM_SHUFFLE(2, 0, 3, 0));
+    *outGreen = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    *outBlue = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+/* And back */
+static inline void ChannelsToInterleaved(__m128 red, __m128 green, __m128 blue, float* out)
+{
+    _mm_storeu_ps(&out[0], _mm_shuffle_ps(_mm_shuffle_ps(red, green, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(blue, red, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(&out[4], _mm_shuffle_ps(_mm_shuffle_ps(green, blue, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(red, green, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(&out[8], _mm_shuffle_ps(_mm_shuffle_ps(blue, red, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(green, blue, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+/* 2 to the power of exponent, for exponents that make a normal float */
+static inline __m128 PowerOfTwo4(__m128i exponent)
+{
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(exponent, _mm_set1_epi32(127)), 23));
+}
+
+/* Same as PackRgb9e5, 4 pixels (12 floats) at a time */
+static inline __m128i PackRgb9e5x4(const float* pixels)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 maximum = _mm_set1_ps(RGB9E5_MAX);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 red, green, blue;
+    InterleavedToChannels(_mm_loadu_ps(&pixels[0]), _mm_loadu_ps(&pixels[4]), _mm_loadu_ps(&pixels[8]), &red, &green, &blue);
+    red = _mm_min_ps(_mm_max_ps(red, zero), maximum);
+    green = _mm_min_ps(_mm_max_ps(green, zero), maximum);
+    blue = _mm_min_ps(_mm_max_ps(blue, zero), maximum);
+    __m128 brightest = _mm_max_ps(red, _mm_max_ps(green, blue));
+
+    /* Shared exponent, with its smallest value as a floor (SSE2 has no max_epi32) */
+    __m128i exponent = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(brightest), 23), _mm_set1_epi32(127));
+    __m128i smallest = _mm_set1_epi32(-RGB9E5_EXPONENT_BIAS - 1);
+    __m128i tooSmall = _mm_cmplt_epi32(exponent, smallest);
+    exponent = _mm_or_si128(_mm_and_si128(tooSmall, smallest), _mm_andnot_si128(tooSmall, exponent));
+    exponent = _mm_add_epi32(exponent, _mm_set1_epi32(1 + RGB9E5_EXPONENT_BIAS));
+
+    /* Rounding the brightest channel up to 512 needs one more exponent */
+    const __m128i mantissaBase = _mm_set1_epi32(RGB9E5_EXPONENT_BIAS + RGB9E5_MANTISSA_BITS);
+    __m128 scale = PowerOfTwo4(_mm_sub_epi32(mantissaBase, exponent));
+    __m128i brightestMantissa = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(brightest, scale), half));
+    __m128i overflow = _mm_cmpeq_epi32(brightestMantissa, _mm_set1_epi32(1 << RGB9E5_MANTISSA_BITS));
+    exponent = _mm_sub_epi32(exponent, overflow);
+    scale = PowerOfTwo4(_mm_sub_epi32(mantissaBase, exponent));
+
+    __m128i packed = _mm_slli_epi32(exponent, 27);
+    packed = _mm_or_si128(packed, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(red, scale), half)));
+    packed = _mm_or_si128(packed, _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(green, scale), half)), RGB9E5_MANTISSA_BITS));
+    packed = _mm_or_si128(packed, _mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(blue, scale), half)), RGB9E5_MANTISSA_BITS * 2));
+    return packed;
+}
+
+static inline void UnpackRgb9e5x4(__m128i packed, float* outPixels)
+{
+    const __m128i mantissaMask = _mm_set1_epi32(0x1ff);
+    __m128i exponent = _mm_srli_epi32(packed, 27);
+    __m128 scale = PowerOfTwo4(_mm_sub_epi32(exponent, _mm_set1_epi32(RGB9E5_EXPONENT_BIAS + RGB9E5_MANTISSA_BITS)));
+    __m128 red = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(packed, mantissaMask)), scale);
+    __m128 green = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, RGB9E5_MANTISSA_BITS), mantissaMask)), scale);
+    __m128 blue = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, RGB9E5_MANTISSA_BITS * 2), mantissaMask)), scale);
+    ChannelsToInterleaved(red, green, blue, outPixels);
+}
+#endif
+
+/* Converts pixelCount rgb float pixels to the given format */
+void PackPixels(const int format, const float* pixels, void* outPacked, const size_t pixelCount)
+{
+    size_t i = 0;
+
+    if(format == PIXEL_FORMAT_HALF) {
+        uint16_t* halves = (uint16_t*)outPacked;
+        const size_t channelCount = pixelCount * 3;
+#if defined(__F16C__)
+        const __m128 maximum = _mm_set1_ps(HALF_MAX);
+        for(; i + 8 <= channelCount; i += 8) {
+            __m128i low = _mm_cvtps_ph(_mm_min_ps(_mm_loadu_ps(&pixels[i]), maximum), _MM_FROUND_TO_NEAREST_INT);
+            __m128i high = _mm_cvtps_ph(_mm_min_ps(_mm_loadu_ps(&pixels[i + 4]), maximum), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128((__m128i*)&halves[i], _mm_unpacklo_epi64(low, high));
+        }
+#elif defined(__SSE2__)
+        for(; i + 8 <= channelCount; i += 8) {
+            __m128i low = FloatToHalf4(_mm_loadu_ps(&pixels[i]));
+            __m128i high = FloatToHalf4(_mm_loadu_ps(&pixels[i + 4]));
+            _mm_storeu_si128((__m128i*)&halves[i], NarrowHalves(low, high));
+        }
+#endif
+        for(; i < channelCount; i++)
+            halves[i] = FloatToHalf(pixels[i]);
+    } else if(format == PIXEL_FORMAT_RGB9E5) {
+        uint32_t* packed = (uint32_t*)outPacked;
+#ifdef __SSE2__
+        for(; i + 4 <= pixelCount; i += 4)
+            _mm_storeu_si128((__m128i*)&packed[i], PackRgb9e5x4(&pixels[i*3]));
+#endif
+        for(; i < pixelCount; i++)
+            packed[i] = PackRgb9e5(&pixels[i*3]);
+    } else {
+        memcpy(outPacked, pixels, pixelCount * 3 * sizeof(float));
+    }
+}
+
+/* Converts pixelCount pixels in the given format back to rgb floats */
+void UnpackPixels(const int format, const void* packed, float* outPixels, const size_t pixelCount)
+{
+    size_t i = 0;
+
+    if(format == PIXEL_FORMAT_HALF) {
+        const uint16_t* halves = (const uint16_t*)packed;
+        const size_t channelCount = pixelCount * 3;
+#if defined(__F16C__)
+        for(; i + 8 <= channelCount; i += 8) {
+            __m128i eight = _mm_loadu_si128((const __m128i*)&halves[i]);
+            _mm_storeu_ps(&outPixels[i], _mm_cvtph_ps(eight));
+            _mm_storeu_ps(&outPixels[i + 4], _mm_cvtph_ps(_mm_srli_si128(eight, 8)));
+        }
+#elif defined(__SSE2__)
+        for(; i + 8 <= channelCount; i += 8) {
+            __m128i eight = _mm_loadu_si128((const __m128i*)&halves[i]);
+            _mm_storeu_ps(&outPixels[i], HalfToFloat4(_mm_unpacklo_epi16(eight, _mm_setzero_si128())));
+            _mm_storeu_ps(&outPixels[i + 4], HalfToFloat4(_mm_unpackhi_epi16(eight, _mm_setzero_si128())));
+        }
+#endif
+        for(; i < channelCount; i++)
+            outPixels[i] = HalfToFloat(halves[i]);
+    } else if(format == PIXEL_FORMAT_RGB9E5) {
+        const uint32_t* words = (const uint32_t*)packed;
+#ifdef __SSE2__
+        for(; i + 4 <= pixelCount; i += 4)
+            UnpackRgb9e5x4(_mm_loadu_si128((const __m128i*)&words[i]), &outPixels[i*3]);
+#endif
+        for(; i < pixelCount; i++)
+            UnpackRgb9e5(words[i], &outPixels[i*3]);
+    } else {
+        memcpy(outPixels, packed, pixelCount * 3 * sizeof(float));
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef PIXELFORMAT_H_
+#define PIXELFORMAT_H_
+
+#include <stddef.h>
+
+/* 
+ * How raw (float) pixels are stored while rendering and sent between processes.
+ * FLOAT   3 floats, 12 bytes, exact
+ * HALF    3 half floats, 6 bytes, ~3 significant digits (relative error <= 2^-11)
+ * RGB9E5  9 bit mantissas with a shared 5 bit exponent, 4 bytes, error <= 2^-9 of
+ *         the brightest channel of the pixel (the dim channels lose the most)
+ * Both packed formats clamp to their largest value (65504 and 65408).
+ */
+#define PIXEL_FORMAT_FLOAT 0
+#define PIXEL_FORMAT_HALF 1
+#define PIXEL_FORMAT_RGB9E5 2
+
+int GetPixelFormatSize(const int format);
+
+const char* GetPixelFormatName(const int format);
+
+void PackPixels(const int format, const float* pixels, void* outPacked, const size_t pixelCount);
+
+void UnpackPixels(const int format, const void* packed, float* outPixels, const size_t pixelCount);
+
+#endif
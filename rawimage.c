@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "rawimage.h"
+
+/* Identifies raw image files (and their version) */
+static const char RAW_FILE_MAGIC[8] = {'R', 'T', 'R', 'A', 'W', 'F', '0', '1'};
+
+/* Fills in the RAW_IMAGE_HEADER_SIZE bytes that come before the pixels of a width * height image */
+void GetRawImageHeader(const int width, const int height, unsigned char* outHeader)
+{
+    int size[2] = {width, height};
+    memcpy(outHeader, RAW_FILE_MAGIC, sizeof(RAW_FILE_MAGIC));
+    memcpy(outHeader + sizeof(RAW_FILE_MAGIC), size, sizeof(size));
+}
+
+/* Writes width * height RGB float pixels to a file. Returns 1 on success */
+int SaveRawImage(const char* fileName, float* image, const int width, const int height)
+{
+    FILE* file = fopen(fileName, "wb");
+    if(!file) {
+        printf("could not open %s for writing\n", fileName);
+        return 0;
+    }
+
+    unsigned char header[RAW_IMAGE_HEADER_SIZE];
+    GetRawImageHeader(width, height, header);
+    size_t floatCount = (size_t)width * height * 3;
+    int success = fwrite(header, 1, sizeof(header), file) == sizeof(header)
+        && fwrite(image, sizeof(float), floatCount, file) == floatCount;
+    if(fclose(file) != 0)
+        success = 0;
+
+    if(!success)
+        printf("could not write raw image to %s\n", fileName);
+    return success;
+}
+
+/* 
+ * Compares an image against a reference saved with SaveRawImage and prints how far apart they are.
+ * Errors are relative to the brightest reference value, which is what the image gets scaled by.
+ * Returns 1 if the RMS error and the share of bad pixels are both within bounds
+ */
+int CompareRawImage(const char* fileName, float* image, const int width, const int height,
+    const float maxRmsError, const float maxBadPixelPercent)
+{
+    FILE* file = fopen(fileName, "rb");
+    if(!file) {
+        printf("could not open reference image %s\n", fileName);
+        return 0;
+    }
+
+    char magic[sizeof(RAW_FILE_MAGIC)];
+    int header[2];
+    if(fread(magic, 1, sizeof(magic), file) != sizeof(magic) 
+        || memcmp(magic, RAW_FILE_MAGIC, sizeof(magic)) != 0
+        || fread(header, sizeof(int), 2, file) != 2) {
+        printf("%s is not a raw image\n", fileName);
+        fclose(file);
+        return 0;
+    }
+    if(header[0] != width || header[1] != height) {
+        printf("reference image is %d:%d but this image is %d:%d\n", header[0], header[1], width, height);
+        fclose(file);
+        return 0;
+    }
+
+    size_t floatCount = (size_t)width * height * 3;
+    float* reference = (float*)malloc(floatCount * sizeof(float));
+    int readAll = fread(reference, sizeof(float), floatCount, file) == floatCount;
+    fclose(file);
+    if(!readAll) {
+        printf("reference image %s is truncated\n", fileName);
+        free(reference);
+        return 0;
+    }
+
+    size_t i;
+    int k;
+    float maxValue = 0.0f;
+    for(i = 0; i < floatCount; i++)
+        maxValue = fmaxf(maxValue, reference[i]);
+    if(maxValue <= 0.0f)
+        maxValue = 1.0f;
+
+    double sumSquaredError = 0.0;
+    float maxError = 0.0f;
+    int badPixels = 0;
+    for(i = 0; i < (size_t)width * height; i++) {
+        float pixelError = 0.0f;
+        for(k = 0; k < 3; k++) {
+            float error = fabsf(image[i*3 + k] - reference[i*3 + k]) / maxValue;
+            pixelError = fmaxf(pixelError, error);
+            sumSquaredError += error * error;
+        }
+        maxError = fmaxf(maxError, pixelError);
+        if(pixelError > RAW_BAD_PIXEL_ERROR)
+            badPixels++;
+    }
+    free(reference);
+
+    float rmsError = (float)sqrt(sumSquaredError / floatCount);
+    float badPixelPercent = 100.0f * badPixels / (width * height);
+    int withinBounds = rmsError <= maxRmsError && badPixelPercent <= maxBadPixelPercent;
+    printf("Compared against %s: max error %.5f (%.2f/255), rms error %.6f (max %.6f), "
+        "%d pixels off by more than %.0f/255 (%.3f%%, max %.3f%%): %s\n",
+        fileName, maxError, maxError * 255.0f, rmsError, maxRmsError,
+        badPixels, RAW_BAD_PIXEL_ERROR * 255.0f, badPixelPercent, maxBadPixelPercent,
+        withinBounds ? "OK" : "TOO FAR OFF");
+    return withinBounds;
+}
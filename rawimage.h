@@ -0,0 +1,27 @@
+#ifndef RAWIMAGE_H_
+#define RAWIMAGE_H_
+
+/* 
+ * Saves and compares the raw (float) image before it gets scaled down to 24 bits.
+ * Used to check that builds with different math (like USE_FAST_MATH) 
+ * don't drift away from the reference image.
+ */
+
+/* Defaults for how far an image may be from the reference */
+#define RAW_DEFAULT_MAX_RMS_ERROR 0.002f
+#define RAW_DEFAULT_MAX_BAD_PIXELS 0.5f
+
+/* A pixel is "bad" if any channel is off by more than this (relative to the brightest value) */
+#define RAW_BAD_PIXEL_ERROR (2.0f / 255.0f)
+
+/* Bytes before the pixels: an 8 byte magic, then width and height as ints */
+#define RAW_IMAGE_HEADER_SIZE 16
+
+void GetRawImageHeader(const int width, const int height, unsigned char* outHeader);
+
+int SaveRawImage(const char* fileName, float* image, const int width, const int height);
+
+int CompareRawImage(const char* fileName, float* image, const int width, const int height,
+    const float maxRmsError, const float maxBadPixelPercent);
+
+#endif
@@ -10,11 +10,37 @@
 #include "linmath_ext.h"
 #include "raytracer.h"
 #include "scene.h"
+#include "camera.h"
+#include "instance.h"
+#include "tilecull.h"
+#include "rng.h"
+#include "arealight.h"
+#include "irradiance.h"
 
-/* Variables for debugging the math */
-static int DEBUG_COORDINATE_X = 200;
-static int DEBUG_COORDINATE_Y = 200;
-static int DEBUG_RAY_IMAGE = 0;
+/* 
+ * Variables for debugging the math. Every step of the camera ray through the debug pixel
+ * (none unless SetDebugPixel was called) gets printed. The pixel is only set before rendering,
+ * and whether the current ray is it is kept per thread, so threads don't trip each other up
+ */
+static int DEBUG_COORDINATE_X = -1;
+static int DEBUG_COORDINATE_Y = -1;
+static __thread int DEBUG_RAY_IMAGE = 0;
+
+/* Rays every thread traced, counted where they're traced. Read with GetThreadRayCounts */
+static __thread struct RayCounts THREAD_RAY_COUNTS = {0, 0, 0};
+
+/* Picks the pixel to print the math of (-1, -1 for none). Call it before rendering, not while */
+void SetDebugPixel(const int row, const int col)
+{
+    DEBUG_COORDINATE_X = row;
+    DEBUG_COORDINATE_Y = col;
+}
+
+/* The calling thread's rays so far. Take it before and after some work to count the work's rays */
+void GetThreadRayCounts(struct RayCounts* outCounts)
+{
+    *outCounts = THREAD_RAY_COUNTS;
+}
 
 /* 
  * Gets the eye position for the camera based on the field of view
@@ -28,7 +54,7 @@ void GetEyePosition(float* eyePos, const int imageWidth, const int imageHeight,
     /* To get the depth of the camera, we're gonna solve based on the FOV and imageWidth using trig */
     float fovInRadians = ((float)fieldOfView/360.0f) * pi * 2;
     float theta = pi - (pi/2) - fovInRadians; 
-    float dist = tan(theta) * (imageWidth/2);
+    float dist = tanf(theta) * (imageWidth/2);
 
     /* Return the eye position. Remember that the camera is behind the scene, so -dist is required */
     eyePos[0] = imageWidth / 2;
@@ -36,6 +62,113 @@ void GetEyePosition(float* eyePos, const int imageWidth, const int imageHeight,
     eyePos[2] = -dist;
 }
 
+/* Sends a ray from the camera through pixel (row, col) of the image */
+void TraceCameraRay(struct Scene* scene, struct Camera* camera, const int row, const int col, float* outRayColor, struct RayHit* outPrimaryHit)
+{
+    TraceCameraRayPath(scene, camera, row, col, outRayColor, outPrimaryHit, NULL, NULL);
+}
+
+/* Same as TraceCameraRay but records the path too (see TraceRayPath) */
+void TraceCameraRayPath(struct Scene* scene, struct Camera* camera, const int row, const int col, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength)
+{
+    vec3 direction;
+    GetCameraRayDirection(camera, row, col, direction);
+    TraceCameraRayDirection(scene, camera, NULL, row, col, direction, outRayColor, outPrimaryHit, outPath, outPathLength);
+}
+
+/*
+ * Adds a sample's hit to the hit of a pixel (the first sample's) and the sums of
+ * its samples' colors (see AverageHitColor)
+ */
+static void AddHitSample(struct RayHit* pixelHit, const struct RayHit* hit, const int sample, float* colorSum,
+    float* brightnessSquaredSum)
+{
+    const float brightness = (hit->color[0] + hit->color[1] + hit->color[2]) / 3.0f;
+    if(sample == 0)
+        *pixelHit = *hit;
+    else if(hit->primitiveId != pixelHit->primitiveId)
+        pixelHit->primitiveId = PRIMITIVE_ID_MIXED;
+    vec3_add(colorSum, colorSum, hit->color);
+    *brightnessSquaredSum += brightness * brightness;
+}
+
+/* Sets the color of hit to the average of samples samples, and the variance of that average's brightness */
+static void AverageHitColor(struct RayHit* hit, const float* colorSum, const float brightnessSquaredSum, const int samples)
+{
+    const float brightness = (colorSum[0] + colorSum[1] + colorSum[2]) / (3.0f * samples);
+    vec3_scale(hit->color, colorSum, 1.0f / samples);
+    hit->colorVariance = fmaxf(0.0f, brightnessSquaredSum / samples - brightness * brightness) / (samples - 1);
+}
+
+/* 
+ * Same as TraceCameraRayPath, for when the (normalized) direction through the pixel 
+ * was already made for a whole tile with GenerateCameraRays.
+ * primaryList (see tilecull.h) is what the tile's primary rays can hit, NULL to test everything.
+ * With more than one sample per pixel (see struct Camera) jittered directions are traced instead
+ */
+void TraceCameraRayDirection(struct Scene* scene, struct Camera* camera, const struct PrimitiveList* primaryList, const int row, const int col, float* direction, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength)
+{
+    /* enable debug if we are on the debug pixel */
+    DEBUG_RAY_IMAGE = 0;
+    if(row == DEBUG_COORDINATE_X && col == DEBUG_COORDINATE_Y)
+        DEBUG_RAY_IMAGE = 1;
+
+    struct SampleId sampleId = {camera->seed, row, col, 0, 0};
+    if(camera->samplesPerPixel <= 1) {
+        TracePath(scene, primaryList, &sampleId, camera->eyePos, direction, outRayColor, outPrimaryHit, outPath, outPathLength, NULL, NULL);
+        return;
+    }
+
+    /*
+     * Several samples jittered over the pixel, averaged. The jitter only depends on the pixel,
+     * the sample and the seed, so it comes out the same wherever the pixel is traced.
+     * The primary hit is the first sample's, with the average color of all of them (see RayHit). Paths aren't recorded
+     */
+    if(outPathLength)
+        *outPathLength = 0;
+    vec3 sum = {0, 0, 0};
+    vec3 primarySum = {0, 0, 0};
+    float primarySquaredSum = 0.0f;
+    int sample, i;
+    for(sample = 0; sample < camera->samplesPerPixel; sample += 4) {
+        float randoms[16];
+        GetSampleRandoms(camera->seed, row, col, sample, RNG_STREAM_PIXEL_JITTER, randoms);
+        for(i = 0; i < 4 && sample + i < camera->samplesPerPixel; i++) {
+            vec3 jittered;
+            vec3 color = {0, 0, 0};
+            struct RayHit primaryHit;
+            GetCameraRayDirectionAt(camera, row + randoms[i*4] - 0.5f, col + randoms[i*4 + 1] - 0.5f, jittered);
+            sampleId.sample = sample + i;
+            TracePath(scene, primaryList, &sampleId, camera->eyePos, jittered, color, outPrimaryHit ? &primaryHit : NULL, NULL, NULL,
+                NULL, NULL);
+            vec3_add(sum, sum, color);
+            if(outPrimaryHit)
+                AddHitSample(outPrimaryHit, &primaryHit, sample + i, primarySum, &primarySquaredSum);
+        }
+    }
+    vec3_scale(sum, sum, 1.0f / camera->samplesPerPixel);
+    vec3_add(outRayColor, outRayColor, sum);
+    if(outPrimaryHit)
+        AverageHitColor(outPrimaryHit, primarySum, primarySquaredSum, camera->samplesPerPixel);
+}
+
+/*
+ * Same as TraceCameraRayDirection with one sample per pixel, but primaryLight (with primaryLightContext)
+ * gets asked for the light of the primary hit first, so light that's already known isn't worked out
+ * again (see temporal.h). Reflections are always traced
+ */
+void TraceCameraRayReusing(struct Scene* scene, struct Camera* camera, const struct PrimitiveList* primaryList, const int row, const int col, float* direction, float* outRayColor, struct RayHit* outPrimaryHit, PrimaryLightFunction primaryLight, void* primaryLightContext)
+{
+    /* enable debug if we are on the debug pixel */
+    DEBUG_RAY_IMAGE = 0;
+    if(row == DEBUG_COORDINATE_X && col == DEBUG_COORDINATE_Y)
+        DEBUG_RAY_IMAGE = 1;
+
+    struct SampleId sampleId = {camera->seed, row, col, 0, 0};
+    TracePath(scene, primaryList, &sampleId, camera->eyePos, direction, outRayColor, outPrimaryHit, NULL, NULL,
+        primaryLight, primaryLightContext);
+}
+
 struct Ray InitRay()
 {
     struct Ray ray;
@@ -59,7 +192,7 @@ struct Ray InitRay()
  *     - outCollisionNormal ray is populated 
  *     - distance is populated
  */
-int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float sphereRadius, struct Ray* outNewRay, struct Ray* outCollisionNormalRay, float* outDistance)
+int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float sphereRadiusSquared, struct Ray* outNewRay, struct Ray* outCollisionNormalRay, float* outDistance)
 {
     /*
      * So we can represent a sphere like X^2 + Y^2 + Z^2 = R^2
@@ -72,9 +205,9 @@ int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float
     vec3_sub(deltaVec, (*originalRay).origin, sphereCenter);
     
     /* Quadratic formula solving variables */
-    float a = vec3_mul_inner((*originalRay).direction, (*originalRay).direction);
-    float b = 2.0f * vec3_mul_inner((*originalRay).direction, deltaVec);
-    float c = vec3_mul_inner(deltaVec, deltaVec) - (sphereRadius * sphereRadius);
+    float a = vec3_dot((*originalRay).direction, (*originalRay).direction);
+    float b = 2.0f * vec3_dot((*originalRay).direction, deltaVec);
+    float c = vec3_dot(deltaVec, deltaVec) - sphereRadiusSquared;
     float discrim = b*b - 4.0f*a*c;
 
     /* Default behaviour is invalid rays */
@@ -90,8 +223,9 @@ int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float
     }
 
     /* Otherwise solve quadratic for both roots */
-    float sol_a = (-b - sqrt(discrim)) / (2.0f * a);
-    float sol_b = (-b + sqrt(discrim)) / (2.0f * a);
+    float sqrtDiscrim = sqrtf(discrim);
+    float sol_a = (-b - sqrtDiscrim) / (2.0f * a);
+    float sol_b = (-b + sqrtDiscrim) / (2.0f * a);
 
     /* Take the smaller of the too (if needed) */
     float final_sol = sol_a;
@@ -125,7 +259,7 @@ int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float
     /* calculate the normal from the intersection point */
     vec3 hitNormal;
     vec3_sub(hitNormal, hitIntersection, sphereCenter);
-    vec3_norm(hitNormal, hitNormal);
+    vec3_normalize(hitNormal, hitNormal);
     if(DEBUG_RAY_IMAGE) {
         printf("collision normal vector: ");
         vec3_print(hitNormal, 1);
@@ -144,7 +278,7 @@ int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float
     /* Implement bouncing rays */
     vec3 reflectedVector;
     vec3_reflect(reflectedVector, (*originalRay).direction, flippedNormal);
-    vec3_norm(reflectedVector, reflectedVector);
+    vec3_normalize(reflectedVector, reflectedVector);
     vec3_dup((*outNewRay).origin, hitIntersection);
     vec3_dup((*outNewRay).direction, reflectedVector);
     (*outNewRay).validRay = 1;
@@ -172,7 +306,7 @@ int CalculatePlaneCollision(struct Ray* originalRay, float* planeOrigin, float*
     outNewRay->validRay = 0;
     outCollisionNormalRay->validRay = 0;
 
-    float denominator = vec3_mul_inner(planeNormal, originalRay->direction);
+    float denominator = vec3_dot(planeNormal, originalRay->direction);
 
     if(DEBUG_RAY_IMAGE) {
         printf("plane normal:");
@@ -188,7 +322,7 @@ int CalculatePlaneCollision(struct Ray* originalRay, float* planeOrigin, float*
         return 2;
     vec3 deltaPosition;
     vec3_sub(deltaPosition, planeOrigin, originalRay->origin);
-    float numerator = vec3_mul_inner(deltaPosition, planeNormal);
+    float numerator = vec3_dot(deltaPosition, planeNormal);
     
     /* solve x for U + Vx which also is the distance */
     *outDistance = numerator / denominator;
@@ -207,7 +341,7 @@ int CalculatePlaneCollision(struct Ray* originalRay, float* planeOrigin, float*
     /* Handle reflections */
     vec3 reflectedVector;
     vec3_reflect(reflectedVector, (*originalRay).direction, flippedPlaneNormal);
-    vec3_norm(reflectedVector, reflectedVector);
+    vec3_normalize(reflectedVector, reflectedVector);
     vec3_dup((*outNewRay).origin, collisionPoint);
     vec3_dup((*outNewRay).direction, reflectedVector);
     (*outNewRay).validRay = 1;
@@ -215,51 +349,138 @@ int CalculatePlaneCollision(struct Ray* originalRay, float* planeOrigin, float*
     return 1;
 }
 
-void CalculateLighting(struct Ray collisionPointNormal, float* outRayColor, float* outputReflectedPhotons)
+/* 
+ * Finds the closest triangle of any mesh instance in front of the ray (closer than maxDistance).
+ * Triangles are two sided, so the normal is flipped to face the ray like the planes are
+ */
+int CalculateInstanceCollision(struct Ray* originalRay, struct Scene* scene, const float maxDistance, struct Ray* outNewRay, struct Ray* outCollisionNormalRay, float* outDistance, int* outInstance)
+{
+    outNewRay->validRay = 0;
+    outCollisionNormalRay->validRay = 0;
+
+    vec3 normal;
+    if(!IntersectInstances(scene, originalRay->origin, originalRay->direction, maxDistance, outDistance, outInstance, normal))
+        return 0;
+
+    vec3 collisionPoint;
+    vec3_scale(collisionPoint, originalRay->direction, *outDistance);
+    vec3_add(collisionPoint, collisionPoint, originalRay->origin);
+
+    if(vec3_dot(normal, originalRay->direction) > 0.0f)
+        vec3_scale(normal, normal, -1.0f);
+    vec3_dup(outCollisionNormalRay->direction, normal);
+    vec3_dup(outCollisionNormalRay->origin, collisionPoint);
+    outCollisionNormalRay->validRay = 1;
+
+    /* Handle reflections */
+    vec3 reflectedVector;
+    vec3_reflect(reflectedVector, originalRay->direction, normal);
+    vec3_normalize(reflectedVector, reflectedVector);
+    vec3_dup(outNewRay->origin, collisionPoint);
+    vec3_dup(outNewRay->direction, reflectedVector);
+    outNewRay->validRay = 1;
+
+    if(DEBUG_RAY_IMAGE)
+        printf("mesh instance %d hit at distance %.2f\n", *outInstance, *outDistance);
+
+    return 1;
+}
+
+/* 
+ * Whether anything is in the way of a ray closer than maxDistance (a shadow ray).
+ * Spheres and planes count the way camera rays see them: a sphere from outside,
+ * a plane from the side its normal points away from
+ */
+int IsRayBlocked(struct Scene* scene, float* origin, float* direction, const float maxDistance)
 {
-    struct Scene scene = NewScene();
-    
     int i;
-    vec3 finalColor = {0, 0, 0};
+    THREAD_RAY_COUNTS.shadowRays++;
+    for(i = 0; i < scene->circleCount; i++) {
+        vec3 delta;
+        vec3_sub(delta, origin, scene->circles[i].origin);
+        const float b = vec3_dot(direction, delta);
+        const float discrim = b*b - (vec3_dot(delta, delta) - scene->circles[i].radiusSquared);
+        if(discrim < 0.0f)
+            continue;
+        const float distance = -b - sqrtf(discrim);
+        if(distance >= 0.0f && distance < maxDistance)
+            return 1;
+    }
 
-    for(i = 0; i < NUM_LIGHTS; i++) {
+    for(i = 0; i < scene->planeCount; i++) {
+        const float denominator = vec3_dot(scene->planes[i].normal, direction);
+        if(denominator < 0.0001f)
+            continue;
+        vec3 deltaPosition;
+        vec3_sub(deltaPosition, scene->planes[i].origin, origin);
+        const float distance = vec3_dot(deltaPosition, scene->planes[i].normal) / denominator;
+        if(distance >= 0.0f && distance < maxDistance)
+            return 1;
+    }
+
+    if(scene->instanceCount > 0) {
+        float distance;
+        int instance;
+        vec3 normal;
+        if(IntersectInstances(scene, origin, direction, maxDistance, &distance, &instance, normal))
+            return 1;
+    }
+    return 0;
+}
+
+/* 
+ * Lights a hit with every light of the scene. Point lights don't cast shadows,
+ * area lights are sampled with shadow rays (see arealight.h) once all the lights
+ * are known, since how many rays one gets depends on how much the others give
+ */
+void CalculateLighting(struct Scene* scene, const struct SampleId* sampleId, struct Ray collisionPointNormal, float* outRayColor, float* outputReflectedPhotons)
+{
+    int i;
+    vec3 finalColor = {0, 0, 0};
+    float reach[MAX_LIGHTS];
+    int areaLightCount = 0;
+    float totalUnshadowed = 0.0f;
+
+    for(i = 0; i < scene->lightCount; i++) {
+        const float* shaded = scene->lights[i].shadedColor;
+
+        /* Area lights only guess how much they give for now and get added below */
+        if(scene->lights[i].type != LIGHT_POINT) {
+            reach[i] = GetAreaLightReach(&scene->lights[i], collisionPointNormal.origin, collisionPointNormal.direction);
+            totalUnshadowed += (shaded[0] + shaded[1] + shaded[2]) * reach[i];
+            areaLightCount++;
+            continue;
+        }
 
         /* calculate direction and distance to our point light source */
         vec3 lightDirection;
-        vec3_sub(lightDirection, scene.lights[i].position, collisionPointNormal.origin);
-        float distanceToLightSource = vec3_len(lightDirection);
-        vec3_norm(lightDirection, lightDirection);
+        vec3_sub(lightDirection, scene->lights[i].position, collisionPointNormal.origin);
+        float distanceToLightSourceSquared = vec3_normalize(lightDirection, lightDirection);
 
         if(DEBUG_RAY_IMAGE) {
             printf("light direction: ");
             vec3_print(lightDirection, 1);
         }
 
-        /* calculate light intensity based off the inverse square law */
-        vec3 lightIntensityVec;
-        float lightIntensityDenominator = 4.0f * 3.14159f * distanceToLightSource * distanceToLightSource;
-        vec3_scale(lightIntensityVec, scene.lights[i].color, (scene.lights[i].intensity / lightIntensityDenominator));
-        if(DEBUG_RAY_IMAGE) {
-            printf("light intensity vector: ");
-            vec3_print(lightIntensityVec, 1);
-        }
-
-        /* render material color based on albeto and collision normal from the collision */
-        const float albeto = 0.2f;
+        /* 
+         * Light intensity falls off with the inverse square law. The light's color, intensity,
+         * the 4 pi of the inverse square law and the albedo / pi of the material are already
+         * folded into shadedColor (see CompileScene)
+         */
         vec3 appliedColor;
         if(DEBUG_RAY_IMAGE) {
             printf("single ray photons %.3f: ", *outputReflectedPhotons);
-            vec3_print(lightIntensityVec, 1);
+            vec3_print(scene->lights[i].shadedColor, 1);
         }
-        vec3_scale(appliedColor, lightIntensityVec, ((albeto) / 3.14159f));
-        vec3_scale(appliedColor, appliedColor, *outputReflectedPhotons);
-        
+        vec3_scale(appliedColor, scene->lights[i].shadedColor, *outputReflectedPhotons / distanceToLightSourceSquared);
+
 
         /* Apply diffuse angle and add to final lighting */
-        float diffuseAngle = vec3_mul_inner(lightDirection, collisionPointNormal.direction);
+        float diffuseAngle = vec3_dot(lightDirection, collisionPointNormal.direction);
         vec3 angledColor;
-        vec3_scale(angledColor, appliedColor, fmax(0.0f, diffuseAngle));
+        vec3_scale(angledColor, appliedColor, fmaxf(0.0f, diffuseAngle));
         vec3_add(finalColor, finalColor, angledColor);
+        totalUnshadowed += (shaded[0] + shaded[1] + shaded[2]) * fmaxf(0.0f, diffuseAngle) / distanceToLightSourceSquared;
 
         if(DEBUG_RAY_IMAGE) {
             printf("diffuse angle: %f\n", diffuseAngle);
@@ -270,58 +491,135 @@ void CalculateLighting(struct Ray collisionPointNormal, float* outRayColor, floa
         }
     }
 
+    /* 
+     * Area lights get a coarse grid of shadow rays, and a finer one if those disagree.
+     * Both grow with the light's share of the light reaching the hit and the photons left
+     */
+    for(i = 0; areaLightCount > 0 && i < scene->lightCount; i++) {
+        if(scene->lights[i].type == LIGHT_POINT || !(reach[i] > 0.0f))
+            continue;
+        const float* shaded = scene->lights[i].shadedColor;
+        const float importance = totalUnshadowed > 0.0f
+            ? (shaded[0] + shaded[1] + shaded[2]) * reach[i] / totalUnshadowed * *outputReflectedPhotons : 0.0f;
+        struct AreaLightEstimate estimate;
+        InitAreaLightEstimate(&estimate);
+        if(scene->lightSamples > 0) {
+            const int side = (int)ceilf(sqrtf((float)scene->lightSamples));
+            SampleAreaLight(scene, i, sampleId, collisionPointNormal.origin, collisionPointNormal.direction, side, 0, &estimate);
+        } else {
+            const int side = GetAreaLightSide(importance, AREA_LIGHT_COARSE_SIDE);
+            const int refineSide = GetAreaLightSide(importance, AREA_LIGHT_MAX_SIDE);
+            SampleAreaLight(scene, i, sampleId, collisionPointNormal.origin, collisionPointNormal.direction, side, 0, &estimate);
+            if(refineSide > side && estimate.visible > 0 && estimate.blocked > 0)
+                SampleAreaLight(scene, i, sampleId, collisionPointNormal.origin, collisionPointNormal.direction, refineSide, estimate.samples, &estimate);
+        }
+
+        vec3 litColor;
+        vec3_scale(litColor, shaded, *outputReflectedPhotons * estimate.lit / estimate.samples);
+        vec3_add(finalColor, finalColor, litColor);
+
+        if(DEBUG_RAY_IMAGE) {
+            printf("area light %d: %d shadow samples, %.3f of the light gets through\n", i, estimate.samples,
+                estimate.unshadowed > 0.0f ? estimate.lit / estimate.unshadowed : 0.0f);
+            printf("final color: ");
+            vec3_print(finalColor, 1);
+        }
+    }
+
     /* set the final color*/
     vec3_dup(outRayColor, finalColor);
 }
 
-void TraceSingleRay(struct Ray currentRay, struct Ray* outputRay, float* outRayColor, float* outputReflectedPhotons)
+/* 
+ * Finds the closest thing the ray hits, lights it and bounces the ray off it.
+ * Only the circles and planes in list are tested (all of them if list is NULL).
+ * If primaryLight isn't NULL it gets asked for the light of the hit first (outHit can't be NULL then)
+ */
+void TraceSingleRay(struct Scene* currentScene, const struct PrimitiveList* list, const struct SampleId* sampleId, struct Ray currentRay, struct Ray* outputRay, float* outRayColor, float* outputReflectedPhotons, struct RayHit* outHit, PrimaryLightFunction primaryLight, void* primaryLightContext)
 {
-    
     /* we're going to iterate over the scene and only get the closest collision */
-    struct Scene currentScene = NewScene();
 
-    int i;
+    int i, n;
+    const int circleCount = list ? list->circleCount : currentScene->circleCount;
+    const int planeCount = list ? list->planeCount : currentScene->planeCount;
     float minDistance = 1000000.0f;
     struct Ray minDistanceNormalRay = InitRay();
     struct Ray minDistanceOutputRay = InitRay();
+    int minDistancePrimitiveId = PRIMITIVE_ID_NONE;
     minDistanceNormalRay.validRay = 0;
     minDistanceOutputRay.validRay = 0;
 
     /* go through circles first */
-    for(i = 0; i < NUM_CIRCLES; i++) {
+    for(n = 0; n < circleCount; n++) {
+        i = list ? list->circles[n] : n;
         struct Ray newRay = InitRay();
         struct Ray collisionNormalRay = InitRay();
         float distanceToCollision = 0;
 
-        float testRayResult = CalculateCircleCollision(&currentRay, currentScene.circles[i].origin, currentScene.circles[i].radius, 
+        float testRayResult = CalculateCircleCollision(&currentRay, currentScene->circles[i].origin, currentScene->circles[i].radiusSquared, 
             &newRay, &collisionNormalRay, &distanceToCollision);
 
         if(collisionNormalRay.validRay && distanceToCollision < minDistance) {
             minDistanceNormalRay = collisionNormalRay;
             minDistance = distanceToCollision;
             minDistanceOutputRay = newRay;
+            minDistancePrimitiveId = i;
         }
     }
 
     /* go through planes next */
-    for(i = 0; i < NUM_PLANES; i++) {
+    for(n = 0; n < planeCount; n++) {
+        i = list ? list->planes[n] : n;
         struct Ray newRay = InitRay();
         struct Ray collisionNormalRay = InitRay();
         float distanceToCollision = 0;
 
-        float testRayResult = CalculatePlaneCollision(&currentRay, currentScene.planes[i].origin, currentScene.planes[i].normal, 
+        float testRayResult = CalculatePlaneCollision(&currentRay, currentScene->planes[i].origin, currentScene->planes[i].normal, 
             &newRay, &collisionNormalRay, &distanceToCollision);
 
         if(collisionNormalRay.validRay && distanceToCollision < minDistance) {
             minDistanceNormalRay = collisionNormalRay;
             minDistance = distanceToCollision;
             minDistanceOutputRay = newRay;
+            minDistancePrimitiveId = NUM_CIRCLES + i;
         }
     }
 
-    /* Calculate lighting */
+    /* and mesh instances last. They only need to beat what we already have */
+    if(currentScene->instanceCount > 0) {
+        struct Ray newRay = InitRay();
+        struct Ray collisionNormalRay = InitRay();
+        float distanceToCollision = 0;
+        int instance = 0;
+
+        CalculateInstanceCollision(&currentRay, currentScene, minDistance, 
+            &newRay, &collisionNormalRay, &distanceToCollision, &instance);
+
+        if(collisionNormalRay.validRay && distanceToCollision < minDistance) {
+            minDistanceNormalRay = collisionNormalRay;
+            minDistance = distanceToCollision;
+            minDistanceOutputRay = newRay;
+            minDistancePrimitiveId = INSTANCE_PRIMITIVE_ID(instance);
+        }
+    }
+
+    /* Report what we hit (if anyone is asking) */
+    if(outHit) {
+        outHit->primitiveId = PRIMITIVE_ID_NONE;
+        if(minDistanceNormalRay.validRay) {
+            vec3_dup(outHit->position, minDistanceNormalRay.origin);
+            vec3_dup(outHit->normal, minDistanceNormalRay.direction);
+            outHit->distance = minDistance;
+            outHit->primitiveId = minDistancePrimitiveId;
+        }
+    }
+
+    /* Calculate lighting, unless it's known already or the irradiance cache has it */
     if(minDistanceNormalRay.validRay) {
-        CalculateLighting(minDistanceNormalRay, outRayColor, outputReflectedPhotons);
+        if((!primaryLight || !primaryLight(primaryLightContext, sampleId, outHit, outRayColor))
+            && (!currentScene->irradianceCache || !LookupIrradiance(currentScene->irradianceCache, currentScene, sampleId,
+                minDistancePrimitiveId, minDistanceNormalRay, outRayColor, outputReflectedPhotons)))
+            CalculateLighting(currentScene, sampleId, minDistanceNormalRay, outRayColor, outputReflectedPhotons);
     }
 
     if(minDistanceOutputRay.validRay) {
@@ -334,7 +632,26 @@ void TraceSingleRay(struct Ray currentRay, struct Ray* outputRay, float* outRayC
 }
 
 /* Sends a ray through a screen pixel */
-void TraceRay(float* eyePos, float* screenPixel, float* outRayColor)
+void TraceRay(struct Scene* scene, float* eyePos, float* screenPixel, float* outRayColor)
+{
+    TraceRayWithHit(scene, eyePos, screenPixel, outRayColor, NULL);
+}
+
+/* 
+ * Same as TraceRay, but also reports the first thing the ray hit.
+ * outPrimaryHit can be NULL if the caller doesn't care
+ */
+void TraceRayWithHit(struct Scene* scene, float* eyePos, float* screenPixel, float* outRayColor, struct RayHit* outPrimaryHit)
+{
+    TraceRayPath(scene, eyePos, screenPixel, outRayColor, outPrimaryHit, NULL, NULL);
+}
+
+/* 
+ * Same as TraceRayWithHit, but also records every bounce that hit something
+ * (in order) so the lighting can be redone later without tracing again.
+ * outPath needs room for MAX_RAY_REFLECTIONS vertices. outPath can be NULL.
+ */
+void TraceRayPath(struct Scene* scene, float* eyePos, float* screenPixel, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength)
 {
     /* enable debug if we are on the debug pixel */
     DEBUG_RAY_IMAGE = 0;
@@ -345,30 +662,69 @@ void TraceRay(float* eyePos, float* screenPixel, float* outRayColor)
     vec3 direction;
     vec3_sub(direction, screenPixel, eyePos);
     vec3 norm_direction;
-    vec3_norm(norm_direction, direction);
+    vec3_normalize(norm_direction, direction);
 
+    struct SampleId sampleId = {0, (int)screenPixel[0], (int)screenPixel[1], 0, 0};
+    TracePath(scene, NULL, &sampleId, eyePos, norm_direction, outRayColor, outPrimaryHit, outPath, outPathLength, NULL, NULL);
+}
+
+/* 
+ * Traces a ray (and all its reflections) from origin in a normalized direction.
+ * Everything else funnels into this. The first bounce only tests primaryList (if not NULL).
+ * sampleId picks the random numbers of the lighting, its bounce is counted here.
+ * outPrimaryHit gets the first hit, with the light of that hit alone (without its reflections) as its color.
+ * primaryLight (can be NULL) gets asked for that light before the first hit is shaded (see TraceSingleRay)
+ */
+void TracePath(struct Scene* scene, const struct PrimitiveList* primaryList, const struct SampleId* sampleId, float* origin, float* direction, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength, PrimaryLightFunction primaryLight, void* primaryLightContext)
+{
     /* 
      * Convert it to a Ray. 
      * It's important that direction is normalized (as described in the PBR book) as 
      * it's one of the common pitfalls
      */
     struct Ray currentRay = InitRay();
-    vec3_dup(currentRay.origin, eyePos);
-    vec3_dup(currentRay.direction, norm_direction);
+    vec3_dup(currentRay.origin, origin);
+    vec3_dup(currentRay.direction, direction);
 
     /*
      * For tracing the ray. We loop to trace each reflection of the ray too
      */
     struct Ray outputRay = InitRay();
     float outputReflectedPhotons = 1.0f;
+    struct SampleId bounceId = *sampleId;
     int i;
+    if(outPrimaryHit)
+        outPrimaryHit->primitiveId = PRIMITIVE_ID_NONE;
+    if(outPath)
+        *outPathLength = 0;
     for(i = 0; i < MAX_RAY_REFLECTIONS; i++) {
 
         /* Trace the path */
         vec3 currentColor;
         vec3_zero(currentColor);
-        TraceSingleRay(currentRay, &outputRay, currentColor, &outputReflectedPhotons);
+        float photonsAtHit = outputReflectedPhotons;
+        struct RayHit hit;
+        bounceId.bounce = i;
+        THREAD_RAY_COUNTS.pathRays++;
+        THREAD_RAY_COUNTS.reflections += i > 0;
+        TraceSingleRay(scene, i == 0 ? primaryList : NULL, &bounceId, currentRay, &outputRay, currentColor, &outputReflectedPhotons, &hit,
+            i == 0 ? primaryLight : NULL, primaryLightContext);
         vec3_add(outRayColor, outRayColor, currentColor);
+
+        /* Only the first bounce is reported back as the primary hit */
+        if(i == 0 && outPrimaryHit) {
+            *outPrimaryHit = hit;
+            vec3_dup(outPrimaryHit->color, currentColor);
+            outPrimaryHit->colorVariance = -1.0f;
+        }
+        if(outPath && hit.primitiveId != PRIMITIVE_ID_NONE) {
+            struct PathVertex* vertex = &outPath[*outPathLength];
+            vec3_dup(vertex->position, hit.position);
+            vec3_dup(vertex->normal, hit.normal);
+            vertex->photons = photonsAtHit;
+            vertex->primitiveId = hit.primitiveId;
+            (*outPathLength)++;
+        }
         if(DEBUG_RAY_IMAGE) {
             printf("output photons: %.2f, reflection %d color: ", outputReflectedPhotons, i);
             vec3_print(currentColor, 1);
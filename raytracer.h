@@ -11,6 +11,16 @@ struct Pixel {
 } __attribute__((__packed__));
 
 
+/* Scenes are defined in scene.h */
+struct Scene;
+
+/* Cameras are defined in camera.h */
+struct Camera;
+
+/* Per tile primitive lists are defined in tilecull.h */
+struct PrimitiveList;
+
+
 /* Easy struct to represent a ray */
 struct Ray {
     vec3 origin;
@@ -21,16 +31,103 @@ struct Ray {
 /* How many times a ray is allowed to reflect */
 #define MAX_RAY_REFLECTIONS 20
 
+/* Every surface is a diffuse reflector with this albedo */
+#define SURFACE_ALBEDO 0.2f
+#define RAYTRACER_PI 3.14159f
+
+/* 
+ * Primitive ids reported in a RayHit.
+ * Circles come first (0 to NUM_CIRCLES-1), then planes, then one id per mesh instance.
+ */
+#define PRIMITIVE_ID_NONE -1
+#define PRIMITIVE_ID_MIXED -2
+#define INSTANCE_PRIMITIVE_ID(instanceIndex) (NUM_CIRCLES + NUM_PLANES + (instanceIndex))
+
+/* 
+ * Describes the closest thing a ray ran into.
+ * color is the light the path got there (see TracePath). For camera rays with --spp it's
+ * averaged over the samples and colorVariance is the variance of that average's brightness
+ * (mean of the channels), otherwise -1. The rest is the first sample's, but primitiveId is
+ * PRIMITIVE_ID_MIXED when the samples didn't all hit the same primitive
+ */
+struct RayHit {
+    vec3 position;
+    vec3 normal;
+    float distance;
+    int primitiveId;
+    vec3 color;
+    float colorVariance;
+};
+
+/* 
+ * One bounce of a traced path that hit something.
+ * That's everything CalculateLighting needs to shade it again, and what it hit
+ */
+struct PathVertex {
+    vec3 position;
+    vec3 normal;
+    float photons;
+    int primitiveId;
+};
+
+/* 
+ * Which sample a ray belongs to: what picks its random numbers (see rng.h).
+ * bounce counts the reflections so far
+ */
+struct SampleId {
+    unsigned long long seed;
+    int row;
+    int col;
+    int sample;
+    int bounce;
+};
+
+/* Rays the calling thread traced so far (see GetThreadRayCounts) */
+struct RayCounts {
+    /* Camera rays and their reflections, and how many of them were reflections */
+    long long pathRays;
+    long long reflections;
+    long long shadowRays;
+};
+
+/*
+ * Asked for the light of a primary hit before it gets shaded (see TraceCameraRayReusing).
+ * Returns 1 with the light in outColor to take that instead, 0 to shade the hit
+ */
+typedef int (*PrimaryLightFunction)(void* context, const struct SampleId* sampleId, const struct RayHit* hit, float* outColor);
+
+void SetDebugPixel(const int row, const int col);
+
+void GetThreadRayCounts(struct RayCounts* outCounts);
+
 void GetEyePosition(float* eyePos, const int imageWidth, const int imageHeight, const int fieldOfView);
 
 struct Ray InitRay();
 
-int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float sphereRadius, struct Ray* outNewRay, struct Ray* outCollisionNormalRay, float* outDistance);
+int CalculateCircleCollision(struct Ray* originalRay, float* sphereCenter, float sphereRadiusSquared, struct Ray* outNewRay, struct Ray* outCollisionNormalRay, float* outDistance);
 
 int CalculatePlaneCollision(struct Ray* originalRay, float* planeOrigin, float* planeNormal, struct Ray* outNewRay, struct Ray* outCollisionNormalRay, float* outDistance);
 
-void CalculateLighting(struct Ray collisionPointNormal, float* outRayColor, float* outputReflectedPhotons);
+int CalculateInstanceCollision(struct Ray* originalRay, struct Scene* scene, const float maxDistance, struct Ray* outNewRay, struct Ray* outCollisionNormalRay, float* outDistance, int* outInstance);
+
+int IsRayBlocked(struct Scene* scene, float* origin, float* direction, const float maxDistance);
+
+void CalculateLighting(struct Scene* scene, const struct SampleId* sampleId, struct Ray collisionPointNormal, float* outRayColor, float* outputReflectedPhotons);
+
+void TraceRay(struct Scene* scene, float* eyePos, float* screenPixel, float* outRayColor);
+
+void TraceRayWithHit(struct Scene* scene, float* eyePos, float* screenPixel, float* outRayColor, struct RayHit* outPrimaryHit);
+
+void TraceRayPath(struct Scene* scene, float* eyePos, float* screenPixel, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength);
+
+void TracePath(struct Scene* scene, const struct PrimitiveList* primaryList, const struct SampleId* sampleId, float* origin, float* direction, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength, PrimaryLightFunction primaryLight, void* primaryLightContext);
+
+void TraceCameraRay(struct Scene* scene, struct Camera* camera, const int row, const int col, float* outRayColor, struct RayHit* outPrimaryHit);
+
+void TraceCameraRayPath(struct Scene* scene, struct Camera* camera, const int row, const int col, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength);
+
+void TraceCameraRayDirection(struct Scene* scene, struct Camera* camera, const struct PrimitiveList* primaryList, const int row, const int col, float* direction, float* outRayColor, struct RayHit* outPrimaryHit, struct PathVertex* outPath, int* outPathLength);
 
-void TraceRay(float* eyePos, float* screenPixel, float* outRayColor);
+void TraceCameraRayReusing(struct Scene* scene, struct Camera* camera, const struct PrimitiveList* primaryList, const int row, const int col, float* direction, float* outRayColor, struct RayHit* outPrimaryHit, PrimaryLightFunction primaryLight, void* primaryLightContext);
 
 #endif 
\ No newline at end of file
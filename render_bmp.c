@@ -5,15 +5,37 @@
  * Source: https://stackoverflow.com/questions/2654480/writing-bmp-image-in-pure-c-c-without-other-libraries
  */
 #include <stdio.h>
+#include <string.h>
 
 #include "render_bmp.h"
 
-const int FILE_HEADER_SIZE = 14;
-const int INFO_HEADER_SIZE = 40;
+/* Size of a whole BMP file (headers and padded rows) for the image */
+size_t getBitmapSize(int height, int width)
+{
+    int widthInBytes = width * BYTES_PER_PIXEL;
+    int paddingSize = (4 - (widthInBytes) % 4) % 4;
+    return (size_t)FILE_HEADER_SIZE + INFO_HEADER_SIZE + (size_t)(widthInBytes + paddingSize) * height;
+}
+
+/* Writes a whole BMP file for the image into outBitmap (getBitmapSize bytes) */
+void encodeBitmapImage(const unsigned char* image, int height, int width, unsigned char* outBitmap)
+{
+    int widthInBytes = width * BYTES_PER_PIXEL;
+    int paddingSize = (4 - (widthInBytes) % 4) % 4;
+    int stride = (widthInBytes) + paddingSize;
+
+    createBitmapFileHeader(height, stride, outBitmap);
+    createBitmapInfoHeader(height, width, outBitmap + FILE_HEADER_SIZE);
+
+    unsigned char* rows = outBitmap + FILE_HEADER_SIZE + INFO_HEADER_SIZE;
+    int i;
+    for (i = 0; i < height; i++) {
+        memcpy(rows + (size_t)i*stride, image + (size_t)i*widthInBytes, widthInBytes);
+        memset(rows + (size_t)i*stride + widthInBytes, 0, paddingSize);
+    }
+}
 
 void generateBitmapImage (unsigned char* image, int height, int width, char* imageFileName)
-//void generateBitmapImage (struct Pixel** image, int height, int width, char* imageFileName)
-//void generateBitmapImage (struct Pixel* image, int height, int width, char* imageFileName)
 {
     int widthInBytes = width * BYTES_PER_PIXEL;
 
@@ -23,24 +45,20 @@ void generateBitmapImage (unsigned char* image, int height, int width, char* ima
     int stride = (widthInBytes) + paddingSize;
 
     FILE* imageFile = fopen(imageFileName, "wb");
+    if (!imageFile) {
+        printf("could not open %s for writing\n", imageFileName);
+        return;
+    }
 
-    unsigned char* fileHeader = createBitmapFileHeader(height, stride);
+    /* The headers live on the stack so several threads can write images at once */
+    unsigned char fileHeader[FILE_HEADER_SIZE];
+    createBitmapFileHeader(height, stride, fileHeader);
     fwrite(fileHeader, 1, FILE_HEADER_SIZE, imageFile);
 
-    unsigned char* infoHeader = createBitmapInfoHeader(height, width);
+    unsigned char infoHeader[INFO_HEADER_SIZE];
+    createBitmapInfoHeader(height, width, infoHeader);
     fwrite(infoHeader, 1, INFO_HEADER_SIZE, imageFile);
 
-    /*
-    int i;
-    for (i = 0; i < height; i++) {
-        fwrite(image + (i*widthInBytes), BYTES_PER_PIXEL, width, imageFile);
-        fwrite(padding, 1, paddingSize, imageFile);
-    }*/
-    /*int i, j;
-    for (i = 0; i < height; i++) {
-        fwrite(image[i], BYTES_PER_PIXEL, width, imageFile);
-        fwrite(padding, 1, paddingSize, imageFile);
-    }*/
     int i;
     for (i = 0; i < height; i++) {
         fwrite(image + (i*widthInBytes), BYTES_PER_PIXEL, width, imageFile);
@@ -50,17 +68,12 @@ void generateBitmapImage (unsigned char* image, int height, int width, char* ima
     fclose(imageFile);
 }
 
-unsigned char* createBitmapFileHeader (int height, int stride)
+/* Fills in the FILE_HEADER_SIZE bytes of fileHeader */
+void createBitmapFileHeader (int height, int stride, unsigned char* fileHeader)
 {
     int fileSize = FILE_HEADER_SIZE + INFO_HEADER_SIZE + (stride * height);
 
-    static unsigned char fileHeader[] = {
-        0,0,     /// signature
-        0,0,0,0, /// image file size in bytes
-        0,0,0,0, /// reserved
-        0,0,0,0, /// start of pixel array
-    };
-
+    memset(fileHeader, 0, FILE_HEADER_SIZE);
     fileHeader[ 0] = (unsigned char)('B');
     fileHeader[ 1] = (unsigned char)('M');
     fileHeader[ 2] = (unsigned char)(fileSize      );
@@ -68,26 +81,12 @@ unsigned char* createBitmapFileHeader (int height, int stride)
     fileHeader[ 4] = (unsigned char)(fileSize >> 16);
     fileHeader[ 5] = (unsigned char)(fileSize >> 24);
     fileHeader[10] = (unsigned char)(FILE_HEADER_SIZE + INFO_HEADER_SIZE);
-
-    return fileHeader;
 }
 
-unsigned char* createBitmapInfoHeader (int height, int width)
+/* Fills in the INFO_HEADER_SIZE bytes of infoHeader */
+void createBitmapInfoHeader (int height, int width, unsigned char* infoHeader)
 {
-    static unsigned char infoHeader[] = {
-        0,0,0,0, /// header size
-        0,0,0,0, /// image width
-        0,0,0,0, /// image height
-        0,0,     /// number of color planes
-        0,0,     /// bits per pixel
-        0,0,0,0, /// compression
-        0,0,0,0, /// image size
-        0,0,0,0, /// horizontal resolution
-        0,0,0,0, /// vertical resolution
-        0,0,0,0, /// colors in color table
-        0,0,0,0, /// important color count
-    };
-
+    memset(infoHeader, 0, INFO_HEADER_SIZE);
     infoHeader[ 0] = (unsigned char)(INFO_HEADER_SIZE);
     infoHeader[ 4] = (unsigned char)(width      );
     infoHeader[ 5] = (unsigned char)(width >>  8);
@@ -99,6 +98,4 @@ unsigned char* createBitmapInfoHeader (int height, int width)
     infoHeader[11] = (unsigned char)(height >> 24);
     infoHeader[12] = (unsigned char)(1);
     infoHeader[14] = (unsigned char)(BYTES_PER_PIXEL*8);
-
-    return infoHeader;
-}
\ No newline at end of file
+}
@@ -6,13 +6,19 @@
 #ifndef RENDER_BMP_H_
 #define RENDER_BMP_H_
 #define BYTES_PER_PIXEL 3
+#define FILE_HEADER_SIZE 14
+#define INFO_HEADER_SIZE 40
+
+#include <stddef.h>
 
 #include "linmath.h"
 #include "raytracer.h"
 
 void generateBitmapImage(unsigned char* image, int height, int width, char* imageFileName);
 //void generateBitmapImage(struct Pixel* image, int height, int width, char* imageFileName);
-unsigned char* createBitmapFileHeader(int height, int stride);
-unsigned char* createBitmapInfoHeader(int height, int width);
+size_t getBitmapSize(int height, int width);
+void encodeBitmapImage(const unsigned char* image, int height, int width, unsigned char* outBitmap);
+void createBitmapFileHeader(int height, int stride, unsigned char* fileHeader);
+void createBitmapInfoHeader(int height, int width, unsigned char* infoHeader);
 
 #endif
\ No newline at end of file
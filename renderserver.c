@@ -0,0 +1,644 @@
+/* Sockets and poll aren't in C99 */
+#define _POSIX_C_SOURCE 200809L
+
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* My libraries */
+#include "scene.h"
+#include "camera.h"
+#include "rawimage.h"
+#include "rt.h"
+#include "timing.h"
+#include "hash.h"
+#include "renderserver.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/* What a connection is doing */
+#define CLIENT_FREE 0
+#define CLIENT_READING 1
+#define CLIENT_QUEUED 2
+
+struct RenderClient {
+    int state;
+    int socket;
+    char request[RENDER_SERVER_MAX_REQUEST];
+    int length;
+    double receivedAt;
+};
+
+struct CachedScene {
+    int used;
+    unsigned long long key;
+    unsigned long long lastUse;
+    struct Scene scene;
+};
+
+struct RenderServer {
+    int listenSocket;
+    int stopping;
+    double startedAt;
+
+    struct RenderClient clients[RENDER_SERVER_MAX_CLIENTS];
+
+    /* Queued clients, oldest first */
+    int queue[RENDER_SERVER_MAX_CLIENTS];
+    int queueHead;
+    int queueCount;
+
+    struct CachedScene scenes[RENDER_SERVER_SCENE_CACHE];
+    unsigned long long useClock;
+
+    /* Stats */
+    long long jobs;
+    long long failedJobs;
+    long long cacheHits;
+    long long cacheMisses;
+    int maxQueueDepth;
+    double totalLatency;
+    double minLatency;
+    double maxLatency;
+    double lastLatency;
+};
+
+/* Everything a render request asks for */
+struct RenderJob {
+    struct RtSceneDesc desc;
+    int width;
+    int height;
+    int lookAtCamera;
+    float eye[3];
+    float target[3];
+    float up[3];
+    float fov;
+    int samplesPerPixel;
+    unsigned long long seed;
+    int region[4];
+    int raw;
+    const char* outputFile;
+};
+
+/* Sends all of data, returns 1 if it all went out (a client that hung up doesn't kill the server) */
+static int SendAll(const int socket, const void* data, size_t size)
+{
+    const char* bytes = (const char*)data;
+    while(size > 0) {
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if(sent < 0 && errno == EINTR)
+            continue;
+        if(sent <= 0)
+            return 0;
+        bytes += sent;
+        size -= (size_t)sent;
+    }
+    return 1;
+}
+
+/* Sends a reply line */
+static void SendReply(const int socket, const char* format, ...)
+{
+    char line[RENDER_SERVER_MAX_REQUEST];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    strcat(line, "\n");
+    SendAll(socket, line, strlen(line));
+}
+
+static void CloseClient(struct RenderClient* client)
+{
+    close(client->socket);
+    client->state = CLIENT_FREE;
+}
+
+/* Adds what a file is for and everything in it to the hash. Returns 0 if it can't be read */
+static int HashFile(unsigned long long* hash, const char tag, const char* fileName)
+{
+    FILE* file = fopen(fileName, "rb");
+    if(!file)
+        return 0;
+    unsigned char buffer[65536];
+    size_t total = 0;
+    size_t size;
+    *hash = HashBytes(*hash, &tag, 1);
+    while((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        *hash = HashBytes(*hash, buffer, size);
+        total += size;
+    }
+    *hash = HashBytes(*hash, &total, sizeof(total));
+    fclose(file);
+    return 1;
+}
+
+/* Hash of every file that goes into the scene, in order. Returns 0 if one can't be read */
+static int GetSceneKey(const struct RtSceneDesc* desc, unsigned long long* outKey, const char** outBadFile)
+{
+    unsigned long long hash = HASH_SEED;
+    int i;
+    *outBadFile = NULL;
+    if(desc->lightsFile && !HashFile(&hash, 'L', desc->lightsFile))
+        *outBadFile = desc->lightsFile;
+    for(i = 0; i < desc->meshCount && !*outBadFile; i++) {
+        if(!HashFile(&hash, 'M', desc->meshFiles[i]))
+            *outBadFile = desc->meshFiles[i];
+    }
+    if(!*outBadFile && desc->instancesFile && !HashFile(&hash, 'I', desc->instancesFile))
+        *outBadFile = desc->instancesFile;
+    *outKey = hash;
+    return *outBadFile == NULL;
+}
+
+/*
+ * Finds the scene in the cache or loads it into the least recently used slot.
+ * Returns NULL if it can't be loaded
+ */
+static struct Scene* GetCachedScene(struct RenderServer* server, const struct RtSceneDesc* desc,
+    const unsigned long long key, int* outHit)
+{
+    struct CachedScene* slot = &server->scenes[0];
+    int i;
+    for(i = 0; i < RENDER_SERVER_SCENE_CACHE; i++) {
+        struct CachedScene* cached = &server->scenes[i];
+        if(cached->used && cached->key == key) {
+            cached->lastUse = ++server->useClock;
+            server->cacheHits++;
+            *outHit = 1;
+            return &cached->scene;
+        }
+        if(!cached->used || (slot->used && cached->lastUse < slot->lastUse))
+            slot = cached;
+    }
+
+    *outHit = 0;
+    server->cacheMisses++;
+    if(slot->used) {
+        printf("Dropping scene %016llx from the cache\n", slot->key);
+        RtFreeScene(&slot->scene);
+        slot->used = 0;
+    }
+    if(!RtCreateScene(desc, NULL, &slot->scene))
+        return NULL;
+    slot->used = 1;
+    slot->key = key;
+    slot->lastUse = ++server->useClock;
+    return &slot->scene;
+}
+
+/* Reads the key=value words after "render". Returns NULL on success or what was wrong */
+static const char* ParseRenderJob(char* request, struct RenderJob* job)
+{
+    memset(job, 0, sizeof(*job));
+    RtDefaultSceneDesc(&job->desc);
+    job->desc.verbose = 1;
+    job->width = 1920;
+    job->height = 1080;
+    job->up[0] = CAMERA_DEFAULT_UP_X;
+    job->up[1] = CAMERA_DEFAULT_UP_Y;
+    job->up[2] = CAMERA_DEFAULT_UP_Z;
+    job->fov = 40.0f;
+    job->samplesPerPixel = 1;
+    job->region[2] = -1;
+
+    char* save = NULL;
+    char* word = strtok_r(request, " \t", &save);
+    for(word = strtok_r(NULL, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+        char* value = strchr(word, '=');
+        if(!value)
+            return "expected key=value";
+        *value++ = '\0';
+
+        if(strcmp(word, "lights") == 0) {
+            job->desc.lightsFile = value;
+        } else if(strcmp(word, "mesh") == 0) {
+            if(job->desc.meshCount >= MAX_MESHES)
+                return "too many meshes";
+            job->desc.meshFiles[job->desc.meshCount++] = value;
+        } else if(strcmp(word, "instances") == 0) {
+            job->desc.instancesFile = value;
+        } else if(strcmp(word, "width") == 0) {
+            job->width = atoi(value);
+        } else if(strcmp(word, "height") == 0) {
+            job->height = atoi(value);
+        } else if(strcmp(word, "camera") == 0) {
+            int count = sscanf(value, "%f,%f,%f,%f,%f,%f,%f,%f,%f", &job->eye[0], &job->eye[1], &job->eye[2],
+                &job->target[0], &job->target[1], &job->target[2], &job->up[0], &job->up[1], &job->up[2]);
+            if(count != 6 && count != 9)
+                return "camera needs ex,ey,ez,tx,ty,tz or ex,ey,ez,tx,ty,tz,ux,uy,uz";
+            job->lookAtCamera = 1;
+        } else if(strcmp(word, "fov") == 0) {
+            job->fov = (float)atof(value);
+            if(job->fov <= 0.0f || job->fov >= 180.0f)
+                return "fov must be between 0 and 180 degrees";
+        } else if(strcmp(word, "spp") == 0) {
+            job->samplesPerPixel = atoi(value);
+            if(job->samplesPerPixel < 1)
+                return "spp needs at least 1 sample per pixel";
+        } else if(strcmp(word, "seed") == 0) {
+            job->seed = strtoull(value, NULL, 0);
+        } else if(strcmp(word, "region") == 0) {
+            if(sscanf(value, "%d,%d,%d,%d", &job->region[0], &job->region[1], &job->region[2], &job->region[3]) != 4)
+                return "region needs row,col,rows,cols";
+        } else if(strcmp(word, "format") == 0) {
+            if(strcmp(value, "bmp") == 0)
+                job->raw = 0;
+            else if(strcmp(value, "raw") == 0)
+                job->raw = 1;
+            else
+                return "format must be bmp or raw";
+        } else if(strcmp(word, "output") == 0) {
+            job->outputFile = value;
+        } else {
+            return "unknown key";
+        }
+    }
+
+    if(job->width <= 0 || job->height <= 0)
+        return "invalid image size";
+    if(job->region[2] < 0) {
+        job->region[0] = 0;
+        job->region[1] = 0;
+        job->region[2] = job->height;
+        job->region[3] = job->width;
+    }
+    if(job->region[0] < 0 || job->region[1] < 0 || job->region[2] <= 0 || job->region[3] <= 0
+        || job->region[0] + job->region[2] > job->height || job->region[1] + job->region[3] > job->width)
+        return "region is outside the image";
+    if(job->desc.instancesFile && job->desc.meshCount == 0)
+        return "instances needs at least one mesh";
+    return NULL;
+}
+
+/* Renders the region into pixels, bands of rows spread over the threads */
+static void RenderRegion(struct Scene* scene, struct Camera* camera, const int* region, float* pixels)
+{
+    const int bandCount = (region[2] + RENDER_SERVER_BAND_ROWS - 1) / RENDER_SERVER_BAND_ROWS;
+    int band;
+#ifdef USE_OPENMP
+    #pragma omp parallel for num_threads(OPENMP_THREAD_AMOUNT) schedule(dynamic)
+#endif
+    for(band = 0; band < bandCount; band++) {
+        const int row = band * RENDER_SERVER_BAND_ROWS;
+        const int rows = region[2] - row < RENDER_SERVER_BAND_ROWS ? region[2] - row : RENDER_SERVER_BAND_ROWS;
+        RtRender(scene, camera, region[0] + row, region[1], rows, region[3], &pixels[(size_t)row * region[3] * 3]);
+    }
+}
+
+/* Runs a queued render request and replies. Returns 1 if the image went out */
+static int RunRenderJob(struct RenderServer* server, struct RenderClient* client)
+{
+    const double startedAt = GetSeconds();
+    struct RenderJob job;
+    const char* error = ParseRenderJob(client->request, &job);
+    if(error) {
+        SendReply(client->socket, "error %s", error);
+        return 0;
+    }
+
+    unsigned long long key;
+    const char* badFile;
+    if(!GetSceneKey(&job.desc, &key, &badFile)) {
+        SendReply(client->socket, "error could not read %s", badFile);
+        return 0;
+    }
+    int hit;
+    struct Scene* scene = GetCachedScene(server, &job.desc, key, &hit);
+    if(!scene) {
+        SendReply(client->socket, "error could not load the scene");
+        return 0;
+    }
+    const double loadedAt = GetSeconds();
+
+    struct Camera camera;
+    if(job.lookAtCamera)
+        RtCreateLookAtCamera(&camera, job.eye, job.target, job.up, job.fov, job.width, job.height);
+    else
+        RtCreateCamera(&camera, job.width, job.height, 30);
+    camera.samplesPerPixel = job.samplesPerPixel;
+    camera.seed = job.seed;
+
+    const int rows = job.region[2];
+    const int cols = job.region[3];
+    float* pixels = (float*)malloc((size_t)rows * cols * 3 * sizeof(float));
+    if(!pixels) {
+        SendReply(client->socket, "error out of memory");
+        return 0;
+    }
+    RenderRegion(scene, &camera, job.region, pixels);
+    const double renderedAt = GetSeconds();
+
+    /* The image goes out as a raw image (see rawimage.h) or as a BMP, into a file or after the reply */
+    unsigned char* bmp = NULL;
+    unsigned char rawHeader[RAW_IMAGE_HEADER_SIZE];
+    const void* image = pixels;
+    size_t imageSize = RAW_IMAGE_HEADER_SIZE + (size_t)rows * cols * 3 * sizeof(float);
+    int success = 1;
+    GetRawImageHeader(cols, rows, rawHeader);
+    if(!job.raw) {
+        imageSize = RtGetBmpSize(cols, rows);
+        bmp = (unsigned char*)malloc(imageSize);
+        success = bmp && RtEncodeBmp(pixels, cols, rows, bmp);
+        image = bmp;
+    }
+    if(success && job.outputFile) {
+        if(job.raw) {
+            success = SaveRawImage(job.outputFile, pixels, cols, rows);
+        } else {
+            FILE* file = fopen(job.outputFile, "wb");
+            success = file && fwrite(bmp, 1, imageSize, file) == imageSize;
+            if(file && fclose(file) != 0)
+                success = 0;
+        }
+    }
+    const double encodedAt = GetSeconds();
+
+    if(!success) {
+        SendReply(client->socket, "error could not %s the image", job.outputFile ? "write" : "encode");
+    } else {
+        char where[RENDER_SERVER_MAX_REQUEST];
+        if(job.outputFile)
+            snprintf(where, sizeof(where), "output=%s", job.outputFile);
+        else
+            snprintf(where, sizeof(where), "bytes=%zu", imageSize);
+        SendReply(client->socket, "ok scene=%016llx cache=%s width=%d height=%d region=%d,%d,%d,%d "
+            "waitMs=%.3f loadMs=%.3f renderMs=%.3f encodeMs=%.3f %s",
+            key, hit ? "hit" : "miss", cols, rows, job.region[0], job.region[1], rows, cols,
+            (startedAt - client->receivedAt) * 1000.0, (loadedAt - startedAt) * 1000.0,
+            (renderedAt - loadedAt) * 1000.0, (encodedAt - renderedAt) * 1000.0, where);
+        if(!job.outputFile && job.raw) {
+            if(SendAll(client->socket, rawHeader, RAW_IMAGE_HEADER_SIZE))
+                SendAll(client->socket, image, imageSize - RAW_IMAGE_HEADER_SIZE);
+        } else if(!job.outputFile) {
+            SendAll(client->socket, image, imageSize);
+        }
+    }
+    free(bmp);
+    free(pixels);
+    return success;
+}
+
+static void SendStats(struct RenderServer* server, struct RenderClient* client)
+{
+    int scenes = 0;
+    int i;
+    for(i = 0; i < RENDER_SERVER_SCENE_CACHE; i++)
+        scenes += server->scenes[i].used;
+    const long long done = server->jobs;
+    SendReply(client->socket, "ok uptime=%.1f jobs=%lld failed=%lld queued=%d maxQueued=%d scenes=%d "
+        "cacheHits=%lld cacheMisses=%lld latencyMs=%.3f/%.3f/%.3f lastMs=%.3f",
+        GetSeconds() - server->startedAt, done, server->failedJobs, server->queueCount, server->maxQueueDepth, scenes,
+        server->cacheHits, server->cacheMisses,
+        done ? server->minLatency * 1000.0 : 0.0, done ? server->totalLatency / done * 1000.0 : 0.0,
+        server->maxLatency * 1000.0, server->lastLatency * 1000.0);
+}
+
+/* A whole request line came in: queue renders, answer the rest right away */
+static void HandleRequest(struct RenderServer* server, const int index)
+{
+    struct RenderClient* client = &server->clients[index];
+    if(strncmp(client->request, "render", 6) == 0 && (client->request[6] == ' ' || client->request[6] == '\0')) {
+        client->state = CLIENT_QUEUED;
+        server->queue[(server->queueHead + server->queueCount) % RENDER_SERVER_MAX_CLIENTS] = index;
+        server->queueCount++;
+        if(server->queueCount > server->maxQueueDepth)
+            server->maxQueueDepth = server->queueCount;
+        return;
+    }
+
+    if(strcmp(client->request, "stats") == 0) {
+        SendStats(server, client);
+    } else if(strcmp(client->request, "quit") == 0) {
+        server->stopping = 1;
+        SendReply(client->socket, "ok stopping after %d queued jobs", server->queueCount);
+    } else {
+        SendReply(client->socket, "error expected render, stats or quit");
+    }
+    CloseClient(client);
+}
+
+/* Takes every waiting connection (or turns it away if there are too many) */
+static void AcceptClients(struct RenderServer* server)
+{
+    int socket;
+    while((socket = accept(server->listenSocket, NULL, NULL)) >= 0) {
+        int i;
+        for(i = 0; i < RENDER_SERVER_MAX_CLIENTS && server->clients[i].state != CLIENT_FREE; i++)
+            ;
+        if(i == RENDER_SERVER_MAX_CLIENTS) {
+            SendReply(socket, "error server busy");
+            close(socket);
+            continue;
+        }
+        struct RenderClient* client = &server->clients[i];
+        client->state = CLIENT_READING;
+        client->socket = socket;
+        client->length = 0;
+        client->receivedAt = GetSeconds();
+    }
+}
+
+/* Reads what a client sent so far, handles the request once the line is complete */
+static void ReadClient(struct RenderServer* server, const int index)
+{
+    struct RenderClient* client = &server->clients[index];
+    ssize_t size = recv(client->socket, client->request + client->length,
+        RENDER_SERVER_MAX_REQUEST - 1 - client->length, 0);
+    if(size <= 0) {
+        CloseClient(client);
+        return;
+    }
+    client->length += (int)size;
+    client->request[client->length] = '\0';
+
+    char* end = strpbrk(client->request, "\r\n");
+    if(!end && client->length < RENDER_SERVER_MAX_REQUEST - 1)
+        return;
+    if(!end) {
+        SendReply(client->socket, "error request longer than %d bytes", RENDER_SERVER_MAX_REQUEST - 1);
+        CloseClient(client);
+        return;
+    }
+    *end = '\0';
+    HandleRequest(server, index);
+}
+
+static int OpenListenSocket(const char* socketPath)
+{
+    struct sockaddr_un address;
+    if(strlen(socketPath) >= sizeof(address.sun_path)) {
+        printf("socket path %s is too long\n", socketPath);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenSocket < 0) {
+        printf("could not create a socket\n");
+        return -1;
+    }
+    unlink(socketPath);
+    if(bind(listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0
+        || listen(listenSocket, RENDER_SERVER_MAX_CLIENTS) != 0) {
+        printf("could not listen on %s\n", socketPath);
+        close(listenSocket);
+        return -1;
+    }
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL) | O_NONBLOCK);
+    return listenSocket;
+}
+
+/* Serves render requests on socketPath until a quit request. Returns 1 if it shut down cleanly */
+int RunRenderServer(const char* socketPath)
+{
+    struct RenderServer* server = (struct RenderServer*)calloc(1, sizeof(struct RenderServer));
+    if(!server)
+        return 0;
+    server->listenSocket = OpenListenSocket(socketPath);
+    if(server->listenSocket < 0) {
+        free(server);
+        return 0;
+    }
+    server->startedAt = GetSeconds();
+    printf("Serving render requests on %s\n", socketPath);
+    fflush(stdout);
+
+    struct pollfd polls[RENDER_SERVER_MAX_CLIENTS + 1];
+    int polled[RENDER_SERVER_MAX_CLIENTS + 1];
+    int i;
+    while(!server->stopping || server->queueCount > 0) {
+        /* Wait for requests only when there's nothing to render */
+        int pollCount = 0;
+        if(!server->stopping) {
+            polls[pollCount].fd = server->listenSocket;
+            polls[pollCount].events = POLLIN;
+            polled[pollCount++] = -1;
+            for(i = 0; i < RENDER_SERVER_MAX_CLIENTS; i++) {
+                if(server->clients[i].state != CLIENT_READING)
+                    continue;
+                polls[pollCount].fd = server->clients[i].socket;
+                polls[pollCount].events = POLLIN;
+                polled[pollCount++] = i;
+            }
+        }
+        if(pollCount > 0 && poll(polls, pollCount, server->queueCount > 0 ? 0 : -1) > 0) {
+            for(i = 0; i < pollCount; i++) {
+                if(!(polls[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                    continue;
+                if(polled[i] < 0)
+                    AcceptClients(server);
+                else if(server->clients[polled[i]].state == CLIENT_READING)
+                    ReadClient(server, polled[i]);
+            }
+        }
+
+        if(server->queueCount == 0)
+            continue;
+        struct RenderClient* client = &server->clients[server->queue[server->queueHead]];
+        server->queueHead = (server->queueHead + 1) % RENDER_SERVER_MAX_CLIENTS;
+        server->queueCount--;
+
+        const int success = RunRenderJob(server, client);
+        const double latency = GetSeconds() - client->receivedAt;
+        CloseClient(client);
+        server->minLatency = server->jobs == 0 || latency < server->minLatency ? latency : server->minLatency;
+        server->maxLatency = latency > server->maxLatency ? latency : server->maxLatency;
+        server->totalLatency += latency;
+        server->lastLatency = latency;
+        server->jobs++;
+        if(!success)
+            server->failedJobs++;
+        printf("Job %lld %s in %.3f ms, %d queued\n", server->jobs, success ? "done" : "failed",
+            latency * 1000.0, server->queueCount);
+        fflush(stdout);
+    }
+
+    printf("Stopping after %lld jobs (%lld failed), %lld cache hits and %lld misses\n",
+        server->jobs, server->failedJobs, server->cacheHits, server->cacheMisses);
+    for(i = 0; i < RENDER_SERVER_MAX_CLIENTS; i++) {
+        if(server->clients[i].state != CLIENT_FREE)
+            CloseClient(&server->clients[i]);
+    }
+    for(i = 0; i < RENDER_SERVER_SCENE_CACHE; i++) {
+        if(server->scenes[i].used)
+            RtFreeScene(&server->scenes[i].scene);
+    }
+    close(server->listenSocket);
+    unlink(socketPath);
+    free(server);
+    return 1;
+}
+
+/*
+ * Sends one request to a server and prints the reply line. An image that comes
+ * back with the reply is saved to outputFile. Returns 1 if the reply was ok
+ */
+int SendRenderRequest(const char* socketPath, const char* request, const char* outputFile)
+{
+    struct sockaddr_un address;
+    if(strlen(socketPath) >= sizeof(address.sun_path)) {
+        printf("socket path %s is too long\n", socketPath);
+        return 0;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        printf("could not connect to %s\n", socketPath);
+        if(connection >= 0)
+            close(connection);
+        return 0;
+    }
+    if(!SendAll(connection, request, strlen(request)) || !SendAll(connection, "\n", 1)) {
+        printf("could not send the request\n");
+        close(connection);
+        return 0;
+    }
+
+    char reply[RENDER_SERVER_MAX_REQUEST];
+    int length = 0;
+    while(length < RENDER_SERVER_MAX_REQUEST - 1 && recv(connection, &reply[length], 1, 0) == 1 && reply[length] != '\n')
+        length++;
+    reply[length] = '\0';
+    printf("%s\n", reply);
+    int success = strncmp(reply, "ok", 2) == 0;
+
+    /* An image follows the reply if it says how big it is */
+    const char* bytes = strstr(reply, " bytes=");
+    if(success && bytes) {
+        size_t size = (size_t)strtoull(bytes + 7, NULL, 10);
+        FILE* file = fopen(outputFile, "wb");
+        char buffer[65536];
+        size_t received = 0;
+        ssize_t chunk;
+        while(received < size && (chunk = recv(connection, buffer, sizeof(buffer), 0)) > 0) {
+            if(file && fwrite(buffer, 1, (size_t)chunk, file) != (size_t)chunk)
+                success = 0;
+            received += (size_t)chunk;
+        }
+        if(!file || fclose(file) != 0 || received != size) {
+            printf("could not save the image to %s\n", outputFile);
+            success = 0;
+        } else if(success) {
+            printf("Image saved to %s\n", outputFile);
+        }
+    }
+    close(connection);
+    return success;
+}
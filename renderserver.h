@@ -0,0 +1,47 @@
+#ifndef RENDERSERVER_H_
+#define RENDERSERVER_H_
+
+/*
+ * Render server (see --serve): one long running process that takes render jobs over a
+ * Unix domain socket, so small images don't pay for starting a process, the OpenMP
+ * threads and loading the scene every time.
+ *
+ * Loaded scenes stay in memory keyed by a hash of the contents of their files, so the same
+ * lights, meshes and instances are only loaded and built once, wherever the files are.
+ * Cached scenes are compiled without a camera (see CompileScene) so a job's image doesn't
+ * depend on which job loaded the scene.
+ *
+ * One request per connection, a single line of words:
+ *   render [lights=FILE] [mesh=FILE]... [instances=FILE] [width=N] [height=N]
+ *          [camera=ex,ey,ez,tx,ty,tz[,ux,uy,uz]] [fov=DEGREES] [spp=N] [seed=N] [region=row,col,rows,cols]
+ *          [format=bmp|raw] [output=FILE]
+ *   stats
+ *   quit
+ * The reply is one line starting with "ok" or "error", followed by key=value pairs.
+ * Without output= a render reply ends with bytes=N and the image follows: a BMP file or
+ * a raw image as --save-raw writes it (header with the size, then rows * cols * 3 floats).
+ * With output= the image is written there.
+ * A region is tonemapped on its own, ask for raw pixels to put regions together.
+ *
+ * Jobs are queued as they arrive and rendered one after the other, each with all the
+ * threads. stats replies right away with the queue depth, cache hits and job latencies.
+ * quit stops taking requests, finishes what's queued and removes the socket.
+ */
+
+/* Longest request line */
+#define RENDER_SERVER_MAX_REQUEST 4096
+
+/* Connections open at once (reading or queued) */
+#define RENDER_SERVER_MAX_CLIENTS 64
+
+/* Scenes kept loaded, the least recently used one goes first */
+#define RENDER_SERVER_SCENE_CACHE 8
+
+/* Rows of the region one thread renders at a time */
+#define RENDER_SERVER_BAND_ROWS 16
+
+int RunRenderServer(const char* socketPath);
+
+int SendRenderRequest(const char* socketPath, const char* request, const char* outputFile);
+
+#endif
@@ -0,0 +1,121 @@
+/* Use SSE2 for making 4 counters at once (if we can) */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* My libraries */
+#include "rng.h"
+
+/* One Philox round: two 32x32 -> 64 bit multiplies, mixed with the other words and the key */
+static void PhiloxRound(unsigned int* counter, const unsigned int* key)
+{
+    const unsigned long long product0 = (unsigned long long)RNG_PHILOX_M0 * counter[0];
+    const unsigned long long product1 = (unsigned long long)RNG_PHILOX_M1 * counter[2];
+    const unsigned int c1 = counter[1];
+    const unsigned int c3 = counter[3];
+    counter[0] = (unsigned int)(product1 >> 32) ^ c1 ^ key[0];
+    counter[1] = (unsigned int)product1;
+    counter[2] = (unsigned int)(product0 >> 32) ^ c3 ^ key[1];
+    counter[3] = (unsigned int)product0;
+}
+
+/* The 4 random words of one counter (4 words) under a key (2 words) */
+void Philox4x32(const unsigned int* counter, const unsigned int* key, unsigned int* out)
+{
+    unsigned int state[4] = {counter[0], counter[1], counter[2], counter[3]};
+    unsigned int roundKey[2] = {key[0], key[1]};
+    int round;
+    for(round = 0; round < RNG_PHILOX_ROUNDS; round++) {
+        PhiloxRound(state, roundKey);
+        roundKey[0] += RNG_PHILOX_W0;
+        roundKey[1] += RNG_PHILOX_W1;
+    }
+    out[0] = state[0];
+    out[1] = state[1];
+    out[2] = state[2];
+    out[3] = state[3];
+}
+
+#ifdef __SSE2__
+/* High and low halves of the 32x32 bit products of 4 lanes with a constant */
+static inline void MulHiLo4(const __m128i x, const __m128i multiplier, __m128i* outHi, __m128i* outLo)
+{
+    /* _mm_mul_epu32 only does lanes 0 and 2, so the odd lanes get shifted down for a second one */
+    const __m128i even = _mm_mul_epu32(x, multiplier);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), multiplier);
+    *outLo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    *outHi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 3, 1)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 3, 1)));
+}
+#endif
+
+/*
+ * Philox4x32 of 4 counters at once. Counters and results are stored word by word:
+ * word w of counter i is at [w * 4 + i]
+ */
+void Philox4x32x4(const unsigned int* counters, const unsigned int* key, unsigned int* out)
+{
+#ifdef __SSE2__
+    __m128i c0 = _mm_loadu_si128((const __m128i*)&counters[0]);
+    __m128i c1 = _mm_loadu_si128((const __m128i*)&counters[4]);
+    __m128i c2 = _mm_loadu_si128((const __m128i*)&counters[8]);
+    __m128i c3 = _mm_loadu_si128((const __m128i*)&counters[12]);
+    const __m128i m0 = _mm_set1_epi32((int)RNG_PHILOX_M0);
+    const __m128i m1 = _mm_set1_epi32((int)RNG_PHILOX_M1);
+    unsigned int roundKey[2] = {key[0], key[1]};
+    int round;
+    for(round = 0; round < RNG_PHILOX_ROUNDS; round++) {
+        __m128i hi0, lo0, hi1, lo1;
+        MulHiLo4(c0, m0, &hi0, &lo0);
+        MulHiLo4(c2, m1, &hi1, &lo1);
+        c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)roundKey[0]));
+        c1 = lo1;
+        c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)roundKey[1]));
+        c3 = lo0;
+        roundKey[0] += RNG_PHILOX_W0;
+        roundKey[1] += RNG_PHILOX_W1;
+    }
+    _mm_storeu_si128((__m128i*)&out[0], c0);
+    _mm_storeu_si128((__m128i*)&out[4], c1);
+    _mm_storeu_si128((__m128i*)&out[8], c2);
+    _mm_storeu_si128((__m128i*)&out[12], c3);
+#else
+    int i, w;
+    for(i = 0; i < 4; i++) {
+        unsigned int counter[4] = {counters[i], counters[4 + i], counters[8 + i], counters[12 + i]};
+        unsigned int result[4];
+        Philox4x32(counter, key, result);
+        for(w = 0; w < 4; w++)
+            out[w * 4 + i] = result[w];
+    }
+#endif
+}
+
+/* A float in [0, 1) from the top 24 bits, so every value is exact */
+float RngToUnitFloat(const unsigned int bits)
+{
+    return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+/*
+ * 4 random floats in [0, 1) for each of the samples sample to sample + 3 of pixel (row, col),
+ * from stream (see rng.h). Sample sample + i gets outRandoms[i * 4] to outRandoms[i * 4 + 3]
+ */
+void GetSampleRandoms(const unsigned long long seed, const int row, const int col, const int sample,
+    const unsigned int stream, float* outRandoms)
+{
+    const unsigned int key[2] = {(unsigned int)seed, (unsigned int)(seed >> 32)};
+    unsigned int counters[16];
+    unsigned int bits[16];
+    int i, w;
+    for(i = 0; i < 4; i++) {
+        counters[i] = (unsigned int)col;
+        counters[4 + i] = (unsigned int)row;
+        counters[8 + i] = (unsigned int)(sample + i);
+        counters[12 + i] = stream;
+    }
+    Philox4x32x4(counters, key, bits);
+    for(i = 0; i < 4; i++) {
+        for(w = 0; w < 4; w++)
+            outRandoms[i * 4 + w] = RngToUnitFloat(bits[w * 4 + i]);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef RNG_H_
+#define RNG_H_
+
+/*
+ * Counter based random numbers: Philox4x32-10 (Salmon et al., "Parallel random numbers:
+ * as easy as 1, 2, 3", SC11). A random number is a function of what it's for (the counter)
+ * and the seed (the key), with no state in between, so it doesn't matter which thread or
+ * process asks for it or in what order: the same seed gives the same image with any
+ * number of threads or MPI processes, without locks.
+ *
+ * The counter of a camera sample is (col, row, sample, stream). The stream says what the
+ * numbers are used for so different uses never see the same ones. Uses that need more
+ * than one counter per sample (area lights) number them inside the sample word. Every counter gives 4
+ * numbers. Philox4x32x4 makes 4 counters at once with SSE2 and gives the exact same
+ * numbers as Philox4x32.
+ */
+
+/* Philox4x32 multipliers and key steps (Weyl sequence) */
+#define RNG_PHILOX_M0 0xD2511F53u
+#define RNG_PHILOX_M1 0xCD9E8D57u
+#define RNG_PHILOX_W0 0x9E3779B9u
+#define RNG_PHILOX_W1 0xBB67AE85u
+#define RNG_PHILOX_ROUNDS 10
+
+/* Streams: bounce * RNG_STREAMS_PER_BOUNCE + what the numbers are for */
+#define RNG_STREAMS_PER_BOUNCE 16
+#define RNG_STREAM_PIXEL_JITTER 0
+#define RNG_STREAM_AREA_LIGHT 1
+
+void Philox4x32(const unsigned int* counter, const unsigned int* key, unsigned int* out);
+
+void Philox4x32x4(const unsigned int* counters, const unsigned int* key, unsigned int* out);
+
+float RngToUnitFloat(const unsigned int bits);
+
+void GetSampleRandoms(const unsigned long long seed, const int row, const int col, const int sample,
+    const unsigned int stream, float* outRandoms);
+
+#endif
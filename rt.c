@@ -0,0 +1,153 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Helper libraries */
+#include "linmath.h"
+#include "render_bmp.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "camera.h"
+#include "mesh.h"
+#include "instance.h"
+#include "tilecull.h"
+#include "scenecompile.h"
+#include "pixelformat.h"
+#include "tonemap.h"
+#include "rt.h"
+
+/* RtRender traces the rectangle in tiles of this many pixels square, each with its own primitive list */
+#define RT_TILE_SIZE 16
+
+void RtDefaultSceneDesc(struct RtSceneDesc* desc)
+{
+    memset(desc, 0, sizeof(*desc));
+}
+
+/*
+ * Makes the default scene plus whatever desc adds: lights, meshes and their instances.
+ * Builds the instance hierarchy and compiles the scene (see scenecompile.h); with orderFor
+ * the primitives are ordered for that camera, NULL keeps them in order.
+ * Free it with RtFreeScene. Returns 1 on success (outScene is left empty on failure)
+ */
+int RtCreateScene(const struct RtSceneDesc* desc, struct Camera* orderFor, struct Scene* outScene)
+{
+    struct Scene scene = NewScene();
+    scene.lightSamples = desc->lightSamples;
+    int success = !desc->lightsFile || LoadSceneLights(desc->lightsFile, &scene);
+    int i;
+    for(i = 0; success && i < desc->meshCount; i++) {
+        struct Mesh* mesh = LoadMesh(desc->meshFiles[i]);
+        if(!mesh || !AddSceneMesh(&scene, mesh)) {
+            FreeMesh(mesh);
+            success = 0;
+        } else if(desc->verbose) {
+            PrintMeshMemory(mesh, desc->meshFiles[i]);
+        }
+    }
+
+    if(success && desc->instancesFile) {
+        success = LoadSceneInstances(desc->instancesFile, &scene);
+    } else if(success) {
+        mat4x4 identity;
+        mat4x4_identity(identity);
+        for(i = 0; success && i < scene.meshCount; i++)
+            success = AddSceneInstance(&scene, i, identity);
+    }
+    if(success)
+        success = BuildSceneInstances(&scene);
+    if(!success) {
+        RtFreeScene(&scene);
+        *outScene = NewScene();
+        return 0;
+    }
+    if(desc->verbose && scene.instanceCount > 0)
+        PrintInstanceMemory(&scene);
+
+    CompileScene(&scene, orderFor, desc->verbose);
+    *outScene = scene;
+    return 1;
+}
+
+/* Frees the meshes and instances of a scene from RtCreateScene (the rest is part of the struct) */
+void RtFreeScene(struct Scene* scene)
+{
+    int i;
+    FreeSceneInstances(scene);
+    for(i = 0; i < scene->meshCount; i++)
+        FreeMesh(scene->meshes[i]);
+    scene->meshCount = 0;
+}
+
+/* The default camera, looking into the default scene (see InitCamera) */
+void RtCreateCamera(struct Camera* outCamera, const int width, const int height, const int fieldOfView)
+{
+    InitCamera(outCamera, width, height, fieldOfView);
+    outCamera->verticalFov = (float)fieldOfView;
+}
+
+/* A camera at eye looking at target (see InitLookAtCamera) */
+void RtCreateLookAtCamera(struct Camera* outCamera, float* eye, float* target, float* up, const float verticalFovDegrees,
+    const int width, const int height)
+{
+    InitLookAtCamera(outCamera, eye, target, up, verticalFovDegrees, width, height);
+}
+
+/*
+ * Traces the rows x cols rectangle of the camera's image at (row, col) into outPixels:
+ * rows * cols raw (unbounded) RGB floats, row after row. The pixels come out exactly as
+ * they do in a whole image, so rectangles can be rendered separately and put together
+ */
+void RtRender(struct Scene* scene, struct Camera* camera, const int row, const int col, const int rows, const int cols,
+    float* outPixels)
+{
+    float directionX[RT_TILE_SIZE * RT_TILE_SIZE];
+    float directionY[RT_TILE_SIZE * RT_TILE_SIZE];
+    float directionZ[RT_TILE_SIZE * RT_TILE_SIZE];
+    int tileRow, tileCol, r, c;
+    for(tileRow = 0; tileRow < rows; tileRow += RT_TILE_SIZE) {
+        for(tileCol = 0; tileCol < cols; tileCol += RT_TILE_SIZE) {
+            const int tileRows = rows - tileRow < RT_TILE_SIZE ? rows - tileRow : RT_TILE_SIZE;
+            const int tileCols = cols - tileCol < RT_TILE_SIZE ? cols - tileCol : RT_TILE_SIZE;
+            GenerateCameraRays(camera, row + tileRow, col + tileCol, tileRows, tileCols, directionX, directionY, directionZ);
+            struct PrimitiveList primaryList;
+            BuildPrimitiveList(scene, camera, row + tileRow, col + tileCol, tileRows, tileCols, &primaryList);
+
+            for(r = 0; r < tileRows; r++) {
+                for(c = 0; c < tileCols; c++) {
+                    float* pixel = &outPixels[((size_t)(tileRow + r) * cols + tileCol + c) * 3];
+                    vec3 direction = {directionX[r*tileCols + c], directionY[r*tileCols + c], directionZ[r*tileCols + c]};
+                    vec3_zero(pixel);
+                    TraceCameraRayDirection(scene, camera, &primaryList, row + tileRow + r, col + tileCol + c, direction,
+                        pixel, NULL, NULL, NULL);
+                }
+            }
+        }
+    }
+}
+
+/* How big RtEncodeBmp's output for a width x height image is */
+size_t RtGetBmpSize(const int width, const int height)
+{
+    return getBitmapSize(height, width);
+}
+
+/*
+ * Tonemaps a whole image from RtRender (the brightest channel ends up at 255) and
+ * writes it as a BMP file to outBmp (RtGetBmpSize bytes). Returns 1 on success
+ */
+int RtEncodeBmp(const float* pixels, const int width, const int height, unsigned char* outBmp)
+{
+    unsigned char* image = (unsigned char*)malloc((size_t)width * height * 3);
+    if(!image)
+        return 0;
+    float maxLightingValue = FindMaxLightingValue(PIXEL_FORMAT_FLOAT, pixels, width, height, 0);
+    ScaleToBitmap(PIXEL_FORMAT_FLOAT, pixels, width, height, 0, maxLightingValue, image);
+    encodeBitmapImage(image, height, width, outBmp);
+    free(image);
+    return 1;
+}
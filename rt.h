@@ -0,0 +1,58 @@
+#ifndef RT_H_
+#define RT_H_
+
+#include <stddef.h>
+
+#include "scene.h"
+#include "camera.h"
+
+/*
+ * librt: the renderer as a library ("make librt" builds bin/librt.a and bin/librt.so).
+ * Create a scene and a camera, render any rectangle of the image into your own buffer,
+ * and encode the result as a BMP in memory. The raytracer binary uses it the same way.
+ *
+ * Nothing here keeps global state, so it's safe to use from any number of threads at once.
+ * A scene isn't changed by rendering, so threads can share one (each with its own camera
+ * and buffer); scenes, cameras and buffers belong to the caller. Rendering runs on the
+ * calling thread, so a service renders one image per thread.
+ * Link it by path (bin/librt.a) since -lrt is the system's realtime library.
+ */
+
+/* What goes into a scene besides the built in spheres and planes */
+struct RtSceneDesc {
+    /* NULL for the default lights (see LoadSceneLights for the format) */
+    const char* lightsFile;
+
+    /* OBJ or baked meshes (see mesh.h) */
+    const char* meshFiles[MAX_MESHES];
+    int meshCount;
+
+    /* NULL for one copy of every mesh where it is (see LoadSceneInstances for the format) */
+    const char* instancesFile;
+
+    /* Shadow rays per area light and hit, 0 adapts them to the light (see arealight.h) */
+    int lightSamples;
+
+    /* Print what every mesh costs and what compiling the scene did */
+    int verbose;
+};
+
+void RtDefaultSceneDesc(struct RtSceneDesc* desc);
+
+int RtCreateScene(const struct RtSceneDesc* desc, struct Camera* orderFor, struct Scene* outScene);
+
+void RtFreeScene(struct Scene* scene);
+
+void RtCreateCamera(struct Camera* outCamera, const int width, const int height, const int fieldOfView);
+
+void RtCreateLookAtCamera(struct Camera* outCamera, float* eye, float* target, float* up, const float verticalFovDegrees,
+    const int width, const int height);
+
+void RtRender(struct Scene* scene, struct Camera* camera, const int row, const int col, const int rows, const int cols,
+    float* outPixels);
+
+size_t RtGetBmpSize(const int width, const int height);
+
+int RtEncodeBmp(const float* pixels, const int width, const int height, unsigned char* outBmp);
+
+#endif
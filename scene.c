@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <string.h>
+
 #include "scene.h"
 
 /*
@@ -10,7 +13,19 @@ struct Scene NewScene()
 {
     struct Scene scene;
 
-    /* lights */
+    /* lights (all of them point lights) */
+    memset(scene.lights, 0, sizeof(scene.lights));
+    scene.lightCount = NUM_LIGHTS;
+    scene.circleCount = NUM_CIRCLES;
+    scene.planeCount = NUM_PLANES;
+    scene.meshCount = 0;
+    scene.instances = NULL;
+    scene.instanceCount = 0;
+    scene.instanceCapacity = 0;
+    scene.instanceNodes = NULL;
+    scene.packed = 0;
+    scene.lightSamples = 0;
+    scene.irradianceCache = NULL;
     {
         const int index = 0;
         vec3 position = {-100, 1300, -250};
@@ -115,4 +130,94 @@ struct Scene NewScene()
     }
 
     return scene;
-}
\ No newline at end of file
+}
+
+/* 
+ * Replaces the lights in the scene with the ones from a file.
+ * One light per line:
+ *     light <x> <y> <z> <red> <green> <blue> <intensity>
+ *     sphere-light <x> <y> <z> <radius> <red> <green> <blue> <intensity>
+ *     rect-light <x> <y> <z> <ux> <uy> <uz> <vx> <vy> <vz> <red> <green> <blue> <intensity>
+ * A sphere light is a ball of radius around x y z, a rect light the rectangle x y z +- u +- v
+ * (lit on both sides). Area lights give off as much light as a point light of the same
+ * intensity, but spread out, so they cast soft shadows.
+ * Empty lines and lines starting with # are ignored.
+ * Returns 1 on success and 0 on failure (the scene is left alone)
+ */
+int LoadSceneLights(const char* fileName, struct Scene* scene)
+{
+    FILE* file = fopen(fileName, "r");
+    if(!file) {
+        printf("could not open light file %s\n", fileName);
+        return 0;
+    }
+
+    struct SceneLight lights[MAX_LIGHTS];
+    int lightCount = 0;
+    char line[256];
+    int lineNumber = 0;
+    int success = 1;
+    while(success && fgets(line, sizeof(line), file)) {
+        lineNumber++;
+
+        char command[32];
+        if(sscanf(line, "%31s", command) != 1 || command[0] == '#')
+            continue;
+
+        if(lightCount >= MAX_LIGHTS) {
+            success = 0;
+        } else {
+            struct SceneLight* light = &lights[lightCount];
+            memset(light, 0, sizeof(*light));
+            if(strcmp(command, "light") == 0) {
+                light->type = LIGHT_POINT;
+                success = sscanf(line, "%*s %f %f %f %f %f %f %f", 
+                    &light->position[0], &light->position[1], &light->position[2],
+                    &light->color[0], &light->color[1], &light->color[2], &light->intensity) == 7;
+            } else if(strcmp(command, "sphere-light") == 0) {
+                light->type = LIGHT_SPHERE;
+                success = sscanf(line, "%*s %f %f %f %f %f %f %f %f", 
+                    &light->position[0], &light->position[1], &light->position[2], &light->radius,
+                    &light->color[0], &light->color[1], &light->color[2], &light->intensity) == 8;
+            } else if(strcmp(command, "rect-light") == 0) {
+                light->type = LIGHT_RECT;
+                success = sscanf(line, "%*s %f %f %f %f %f %f %f %f %f %f %f %f %f", 
+                    &light->position[0], &light->position[1], &light->position[2],
+                    &light->edgeU[0], &light->edgeU[1], &light->edgeU[2],
+                    &light->edgeV[0], &light->edgeV[1], &light->edgeV[2],
+                    &light->color[0], &light->color[1], &light->color[2], &light->intensity) == 13;
+            } else {
+                success = 0;
+            }
+            lightCount++;
+        }
+
+        if(!success) {
+            line[strcspn(line, "\r\n")] = '\0';
+            printf("%s:%d: could not understand \"%s\" (max %d lights)\n", fileName, lineNumber, line, MAX_LIGHTS);
+        }
+    }
+    fclose(file);
+
+    if(!success)
+        return 0;
+
+    memcpy(scene->lights, lights, lightCount * sizeof(struct SceneLight));
+    scene->lightCount = lightCount;
+    return 1;
+}
+
+/* 
+ * Adds a loaded mesh to the scene. The scene only keeps the pointer,
+ * so the mesh has to outlive it. Nothing is drawn until it gets instanced
+ * (see AddSceneInstance). Returns 1 on success
+ */
+int AddSceneMesh(struct Scene* scene, struct Mesh* mesh)
+{
+    if(scene->meshCount >= MAX_MESHES) {
+        printf("too many meshes (max %d)\n", MAX_MESHES);
+        return 0;
+    }
+    scene->meshes[scene->meshCount++] = mesh;
+    return 1;
+}
@@ -5,16 +5,31 @@
 
 /* 
  * Since scenes are static,
- * we can make it easy and statically allocate everything
+ * we can make it easy and statically allocate everything.
+ * NUM_CIRCLES and NUM_PLANES are what NewScene makes and the most a scene holds;
+ * CompileScene (see scenecompile.h) can leave fewer, and has to run before tracing
  */
 #define NUM_CIRCLES 4
 #define NUM_PLANES 5
 #define NUM_LIGHTS 3
 
+/* Lights can be swapped out at runtime (see LoadSceneLights) so leave some room */
+#define MAX_LIGHTS 16
+
+/* Triangle meshes are loaded at runtime (see mesh.h) and placed with instances (see instance.h) */
+#define MAX_MESHES 8
+struct Mesh;
+struct SceneInstance;
+struct BvhNode;
+struct IrradianceCache;
+
 /* Represents a circle primative */
 struct SceneCircle {
     vec3 origin;
     float radius;
+
+    /* Set by CompileScene */
+    float radiusSquared;
 };
 
 /* Represents a plane primative */
@@ -23,20 +38,56 @@ struct ScenePlane {
     vec3 normal;
 };
 
+/* Kinds of lights (see LoadSceneLights). Only area lights cast shadows (see arealight.h) */
+#define LIGHT_POINT 0
+#define LIGHT_SPHERE 1
+#define LIGHT_RECT 2
+
 /* Represents a scene light */
 struct SceneLight {
     vec3 position;
     float intensity;
     vec3 color;
+
+    /* A sphere of radius around position, or the rectangle position +- edgeU +- edgeV */
+    int type;
+    float radius;
+    vec3 edgeU;
+    vec3 edgeV;
+
+    /* What a hit straight in front of the light at distance 1 gets back. Set by CompileScene */
+    vec3 shadedColor;
 };
 
 /* Represents a scene */
 struct Scene {
     struct SceneCircle circles[NUM_CIRCLES];
+    int circleCount;
     struct ScenePlane planes[NUM_PLANES];
-    struct SceneLight lights[NUM_LIGHTS];
+    int planeCount;
+    struct SceneLight lights[MAX_LIGHTS];
+    int lightCount;
+    struct Mesh* meshes[MAX_MESHES];
+    int meshCount;
+    struct SceneInstance* instances;
+    int instanceCount;
+    int instanceCapacity;
+    struct BvhNode* instanceNodes;
+
+    /* Shadow rays per area light and hit, 0 adapts them to the light (see arealight.h) */
+    int lightSamples;
+
+    /* Set when the meshes and instances live in a packed scene the scene doesn't own (see scenepack.h) */
+    int packed;
+
+    /* Light cached for the frame being traced, NULL shades every hit (see irradiance.h) */
+    struct IrradianceCache* irradianceCache;
 };
 
 struct Scene NewScene();
 
+int LoadSceneLights(const char* fileName, struct Scene* scene);
+
+int AddSceneMesh(struct Scene* scene, struct Mesh* mesh);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,208 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "camera.h"
+#include "scenecompile.h"
+
+static int IsSamePoint(const float* a, const float* b)
+{
+    vec3 delta;
+    vec3_sub(delta, a, b);
+    return vec3_len(delta) <= SCENE_COMPILE_EPSILON * (1.0f + vec3_len(a));
+}
+
+/* Drops spheres without a size and repeats of an earlier sphere. Returns how many were dropped */
+static int CompileCircles(struct Scene* scene, const int verbose)
+{
+    int kept = 0;
+    int i, j;
+    for(i = 0; i < scene->circleCount; i++) {
+        struct SceneCircle* circle = &scene->circles[i];
+        const char* reason = NULL;
+        int same = -1;
+        if(!(circle->radius > 0.0f) || !isfinite(circle->radius))
+            reason = "has no size";
+        for(j = 0; j < kept && !reason; j++) {
+            if(IsSamePoint(scene->circles[j].origin, circle->origin)
+                && fabsf(scene->circles[j].radius - circle->radius) <= SCENE_COMPILE_EPSILON * circle->radius) {
+                reason = "is a duplicate of sphere";
+                same = j;
+            }
+        }
+        if(reason) {
+            if(verbose && same >= 0)
+                printf("  sphere %d %s %d, dropped\n", i, reason, same);
+            else if(verbose)
+                printf("  sphere %d %s, dropped\n", i, reason);
+            continue;
+        }
+        circle->radiusSquared = circle->radius * circle->radius;
+        scene->circles[kept++] = *circle;
+    }
+
+    const int dropped = scene->circleCount - kept;
+    scene->circleCount = kept;
+    return dropped;
+}
+
+/*
+ * Normalizes plane normals that aren't unit length and drops planes without a direction and repeats of an
+ * earlier plane (same normal, and the origins on the same plane). Returns how many were dropped
+ */
+static int CompilePlanes(struct Scene* scene, const int verbose)
+{
+    int kept = 0;
+    int i, j;
+    for(i = 0; i < scene->planeCount; i++) {
+        struct ScenePlane* plane = &scene->planes[i];
+        const char* reason = NULL;
+        int same = -1;
+        if(!(vec3_len(plane->normal) > SCENE_COMPILE_EPSILON))
+            reason = "has no normal";
+        else if(fabsf(vec3_dot(plane->normal, plane->normal) - 1.0f) > SCENE_COMPILE_UNIT_EPSILON)
+            vec3_normalize(plane->normal, plane->normal);
+        for(j = 0; j < kept && !reason; j++) {
+            struct ScenePlane* other = &scene->planes[j];
+            vec3 between;
+            vec3_sub(between, plane->origin, other->origin);
+            if(IsSamePoint(other->normal, plane->normal)
+                && fabsf(vec3_dot(between, other->normal)) <= SCENE_COMPILE_EPSILON * (1.0f + vec3_len(between))) {
+                reason = "is a duplicate of plane";
+                same = j;
+            }
+        }
+        if(reason) {
+            if(verbose && same >= 0)
+                printf("  plane %d %s %d, dropped\n", i, reason, same);
+            else if(verbose)
+                printf("  plane %d %s, dropped\n", i, reason);
+            continue;
+        }
+        scene->planes[kept++] = *plane;
+    }
+
+    const int dropped = scene->planeCount - kept;
+    scene->planeCount = kept;
+    return dropped;
+}
+
+/*
+ * Folds everything about a light that doesn't depend on the hit into one color (see CalculateLighting).
+ * Area lights without an area become point lights
+ */
+static void CompileLights(struct Scene* scene, const int verbose)
+{
+    const float scale = SURFACE_ALBEDO / (4.0f * RAYTRACER_PI * RAYTRACER_PI);
+    int i;
+    for(i = 0; i < scene->lightCount; i++) {
+        struct SceneLight* light = &scene->lights[i];
+        vec3 normal;
+        vec3_mul_cross(normal, light->edgeU, light->edgeV);
+        if((light->type == LIGHT_SPHERE && !(light->radius > 0.0f))
+            || (light->type == LIGHT_RECT && !(vec3_len(normal) > 0.0f))) {
+            if(verbose)
+                printf("  light %d has no area, made a point light\n", i);
+            light->type = LIGHT_POINT;
+        }
+        vec3_scale(light->shadedColor, light->color, light->intensity * scale);
+        if(verbose && (light->intensity == 0.0f || (light->color[0] == 0.0f && light->color[1] == 0.0f && light->color[2] == 0.0f)))
+            printf("  light %d gives no light\n", i);
+    }
+}
+
+/* Stable sort of order[0..count-1] by hits, most first */
+static void SortByHits(int* order, const int* hits, const int count)
+{
+    int i, j;
+    for(i = 1; i < count; i++) {
+        int index = order[i];
+        for(j = i; j > 0 && hits[order[j - 1]] < hits[index]; j--)
+            order[j] = order[j - 1];
+        order[j] = index;
+    }
+}
+
+/* Counts first hits of a sparse grid of camera rays and puts the most hit spheres and planes first */
+static void OrderByHits(struct Scene* scene, struct Camera* camera, const int verbose)
+{
+    int circleHits[NUM_CIRCLES] = {0};
+    int planeHits[NUM_PLANES] = {0};
+    int samples = 0;
+    int row, col, i;
+    for(row = SCENE_COMPILE_SAMPLE_STRIDE / 2; row < camera->imageHeight; row += SCENE_COMPILE_SAMPLE_STRIDE) {
+        for(col = SCENE_COMPILE_SAMPLE_STRIDE / 2; col < camera->imageWidth; col += SCENE_COMPILE_SAMPLE_STRIDE) {
+            vec3 color = {0, 0, 0};
+            struct RayHit hit;
+            TraceCameraRay(scene, camera, row, col, color, &hit);
+            if(hit.primitiveId >= 0 && hit.primitiveId < NUM_CIRCLES)
+                circleHits[hit.primitiveId]++;
+            else if(hit.primitiveId >= NUM_CIRCLES && hit.primitiveId < NUM_CIRCLES + NUM_PLANES)
+                planeHits[hit.primitiveId - NUM_CIRCLES]++;
+            samples++;
+        }
+    }
+
+    int circleOrder[NUM_CIRCLES];
+    int planeOrder[NUM_PLANES];
+    for(i = 0; i < scene->circleCount; i++)
+        circleOrder[i] = i;
+    for(i = 0; i < scene->planeCount; i++)
+        planeOrder[i] = i;
+    SortByHits(circleOrder, circleHits, scene->circleCount);
+    SortByHits(planeOrder, planeHits, scene->planeCount);
+
+    struct SceneCircle circles[NUM_CIRCLES];
+    struct ScenePlane planes[NUM_PLANES];
+    for(i = 0; i < scene->circleCount; i++)
+        circles[i] = scene->circles[circleOrder[i]];
+    for(i = 0; i < scene->planeCount; i++)
+        planes[i] = scene->planes[planeOrder[i]];
+    if(verbose) {
+        printf("  ordered by first hits out of %d camera rays: spheres", samples);
+        for(i = 0; i < scene->circleCount; i++)
+            printf(" %d (%d)", circleOrder[i], circleHits[circleOrder[i]]);
+        printf(", planes");
+        for(i = 0; i < scene->planeCount; i++)
+            printf(" %d (%d)", planeOrder[i], planeHits[planeOrder[i]]);
+        printf("\n");
+    }
+    memcpy(scene->circles, circles, scene->circleCount * sizeof(struct SceneCircle));
+    memcpy(scene->planes, planes, scene->planeCount * sizeof(struct ScenePlane));
+}
+
+/*
+ * Compiles the scene in place (see scenecompile.h). camera can be NULL, then nothing gets reordered.
+ * Prints what it did if verbose
+ */
+void CompileScene(struct Scene* scene, struct Camera* camera, const int verbose)
+{
+    const int circleCount = scene->circleCount;
+    const int planeCount = scene->planeCount;
+    if(verbose)
+        printf("Compiling scene (%d spheres, %d planes, %d lights):\n", circleCount, planeCount, scene->lightCount);
+
+    const int droppedCircles = CompileCircles(scene, verbose);
+    const int droppedPlanes = CompilePlanes(scene, verbose);
+    CompileLights(scene, verbose);
+    if(verbose)
+        printf("  folded r^2 into %d spheres and color * intensity * albedo / (4 pi * pi) into %d lights\n",
+            scene->circleCount, scene->lightCount);
+    if(camera)
+        OrderByHits(scene, camera, verbose);
+    if(!verbose)
+        return;
+
+    printf("  %d spheres and %d planes left (%d and %d dropped), %d primitive tests per ray instead of %d\n",
+        scene->circleCount, scene->planeCount, droppedCircles, droppedPlanes,
+        scene->circleCount + scene->planeCount, circleCount + planeCount);
+}
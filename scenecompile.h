@@ -0,0 +1,33 @@
+#ifndef SCENECOMPILE_H_
+#define SCENECOMPILE_H_
+
+#include "scene.h"
+
+/*
+ * Turns a scene as it was written (see NewScene and the --lights file) into what the
+ * tracer wants, once, before rendering:
+ *   - plane normals that aren't unit length are normalized (normalizing one that is moves
+ *     it by an ulp, which is enough to change a few paths), and planes without a direction,
+ *     spheres without a size and exact duplicates (same sphere, or same plane facing the
+ *     same way) are dropped
+ *   - what every hit would otherwise recompute is stored with the primitive:
+ *     r^2 for spheres, and color * intensity * albedo / (4 pi * pi) for lights
+ *   - with a camera, spheres and planes are reordered by how often a sparse grid of
+ *     camera rays hits them first, so the closest hit is usually found early
+ * and prints what it did. Has to run again after the lights change (not when they only move).
+ */
+
+/* Every Nth pixel of every Nth row is traced to count hits */
+#define SCENE_COMPILE_SAMPLE_STRIDE 32
+
+/* Spheres and planes closer than this (positions) or this much apart (directions) are the same */
+#define SCENE_COMPILE_EPSILON 1e-4f
+
+/* Plane normals whose length squared is this close to 1 are already normalized */
+#define SCENE_COMPILE_UNIT_EPSILON 1e-6f
+
+struct Camera;
+
+void CompileScene(struct Scene* scene, struct Camera* camera, const int verbose);
+
+#endif
@@ -0,0 +1,209 @@
+/* posix_memalign isn't in C99 */
+#define _POSIX_C_SOURCE 200809L
+
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* My libraries */
+#include "scene.h"
+#include "camera.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "instance.h"
+#include "scenepack.h"
+#include "nodeshare.h"
+
+static const char SCENE_PACK_MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '1'};
+
+/* Starts the block. The scene's pointers are copied along but never used */
+struct PackedSceneHeader {
+    char magic[8];
+    long long size;
+    struct Scene scene;
+    struct Camera camera;
+
+    /* Offsets from the start of the block */
+    long long meshOffsets[MAX_MESHES];
+    long long meshSizes[MAX_MESHES];
+    long long instancesOffset;
+    long long instanceNodesOffset;
+    long long instanceNodeCount;
+};
+
+static long long AlignToPack(const long long size)
+{
+    return (size + SCENE_PACK_ALIGNMENT - 1) / SCENE_PACK_ALIGNMENT * SCENE_PACK_ALIGNMENT;
+}
+
+/* Works out where everything goes. Returns the size of the whole block */
+static long long GetPackedSceneLayout(struct Scene* scene, struct PackedSceneHeader* outHeader)
+{
+    memset(outHeader, 0, sizeof(*outHeader));
+    memcpy(outHeader->magic, SCENE_PACK_MAGIC, sizeof(SCENE_PACK_MAGIC));
+
+    long long offset = AlignToPack(sizeof(struct PackedSceneHeader));
+    int i;
+    for(i = 0; i < scene->meshCount; i++) {
+        outHeader->meshOffsets[i] = offset;
+        outHeader->meshSizes[i] = (long long)scene->meshes[i]->memorySize;
+        offset = AlignToPack(offset + outHeader->meshSizes[i]);
+    }
+    outHeader->instancesOffset = offset;
+    offset = AlignToPack(offset + (long long)scene->instanceCount * sizeof(struct SceneInstance));
+    outHeader->instanceNodesOffset = offset;
+    outHeader->instanceNodeCount = scene->instanceCount > 0 ? BVH_NODE_COUNT(scene->instanceCount, INSTANCE_LEAF_SIZE) : 0;
+    offset = AlignToPack(offset + outHeader->instanceNodeCount * (long long)sizeof(struct BvhNode));
+    outHeader->size = offset;
+    return offset;
+}
+
+/*
+ * Packs the scene (with its instance hierarchy already built) and camera into a new
+ * SCENE_PACK_ALIGNMENT aligned block of *outSize bytes. Free it with free(). Returns NULL on failure
+ */
+void* PackScene(struct Scene* scene, struct Camera* camera, size_t* outSize)
+{
+    struct PackedSceneHeader header;
+    GetPackedSceneLayout(scene, &header);
+    header.scene = *scene;
+    header.camera = *camera;
+
+    void* memory = NULL;
+    if(posix_memalign(&memory, SCENE_PACK_ALIGNMENT, (size_t)header.size) != 0) {
+        printf("could not allocate %.2f MB to pack the scene\n", header.size / (1024.0 * 1024.0));
+        return NULL;
+    }
+    char* bytes = (char*)memory;
+    memset(bytes, 0, header.size);
+    memcpy(bytes, &header, sizeof(header));
+    int i;
+    for(i = 0; i < scene->meshCount; i++)
+        CopyMeshMemory(scene->meshes[i], bytes + header.meshOffsets[i]);
+    if(scene->instanceCount > 0) {
+        memcpy(bytes + header.instancesOffset, scene->instances, scene->instanceCount * sizeof(struct SceneInstance));
+        memcpy(bytes + header.instanceNodesOffset, scene->instanceNodes, header.instanceNodeCount * sizeof(struct BvhNode));
+    }
+    *outSize = (size_t)header.size;
+    return memory;
+}
+
+/*
+ * Points outScene and outCamera at a scene PackScene made, wherever it is now.
+ * The memory has to stay around (and unchanged) as long as the scene is used;
+ * FreeMesh and FreeSceneInstances leave it alone. Returns 1 on success
+ */
+int UsePackedScene(void* memory, const size_t size, struct Scene* outScene, struct Camera* outCamera)
+{
+    struct PackedSceneHeader header;
+    if(size < sizeof(header)) {
+        printf("packed scene is damaged\n");
+        return 0;
+    }
+    memcpy(&header, memory, sizeof(header));
+    if(memcmp(header.magic, SCENE_PACK_MAGIC, sizeof(SCENE_PACK_MAGIC)) != 0 || header.size != (long long)size
+        || header.scene.meshCount < 0 || header.scene.meshCount > MAX_MESHES) {
+        printf("packed scene is damaged or from a different version\n");
+        return 0;
+    }
+
+    char* bytes = (char*)memory;
+    *outScene = header.scene;
+    *outCamera = header.camera;
+    outScene->packed = 1;
+    outScene->instanceCapacity = 0;
+    outScene->irradianceCache = NULL;
+    outScene->instances = header.scene.instanceCount > 0 ? (struct SceneInstance*)(bytes + header.instancesOffset) : NULL;
+    outScene->instanceNodes = header.scene.instanceCount > 0 ? (struct BvhNode*)(bytes + header.instanceNodesOffset) : NULL;
+    int i;
+    for(i = 0; i < header.scene.meshCount; i++) {
+        outScene->meshes[i] = UseMeshMemory("in packed scene", bytes + header.meshOffsets[i], (size_t)header.meshSizes[i]);
+        if(!outScene->meshes[i]) {
+            outScene->meshCount = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Shows what the packed scene is made of */
+void PrintPackedSceneMemory(void* memory)
+{
+    struct PackedSceneHeader header;
+    memcpy(&header, memory, sizeof(header));
+
+    double meshBytes = 0.0;
+    int i;
+    for(i = 0; i < header.scene.meshCount; i++)
+        meshBytes += header.meshSizes[i];
+    double instanceBytes = (double)header.scene.instanceCount * sizeof(struct SceneInstance);
+    double nodeBytes = (double)header.instanceNodeCount * sizeof(struct BvhNode);
+    printf("Packed scene: %.2f MB (meshes %.2f MB, %d instances %.2f MB, instance hierarchy %.2f MB, the rest %.2f KB)\n",
+        header.size / (1024.0 * 1024.0), meshBytes / (1024.0 * 1024.0), header.scene.instanceCount,
+        instanceBytes / (1024.0 * 1024.0), nodeBytes / (1024.0 * 1024.0),
+        (header.size - meshBytes - instanceBytes - nodeBytes) / 1024.0);
+}
+
+#ifdef USE_MPI
+
+/*
+ * Gets the root's packed scene (memory and *inOutSize, ignored everywhere else) to every
+ * process with a single MPI_Bcast. With share only the node leaders receive it, into memory
+ * the node shares (kept until FreeNodeShare), and the root's own copy is freed.
+ * outSeconds gets (on the root) the longest any process spent in the broadcast.
+ * Every process has to call this. Returns this process's copy (free() it unless share)
+ * and sets *inOutSize, or returns NULL everywhere if the root had no scene
+ */
+void* BroadcastPackedScene(void* memory, size_t* inOutSize, struct NodeShare* share, double* outSeconds)
+{
+    int worldRank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+
+    long long size = worldRank == 0 && memory ? (long long)*inOutSize : 0;
+    MPI_Bcast(&size, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    if(size == 0) {
+        free(memory);
+        return NULL;
+    }
+    *inOutSize = (size_t)size;
+
+    /* Sent in cache lines so the count fits an int for scenes far over 2 GB */
+    MPI_Datatype line;
+    MPI_Type_contiguous(SCENE_PACK_ALIGNMENT, MPI_BYTE, &line);
+    MPI_Type_commit(&line);
+    const int lineCount = (int)(size / SCENE_PACK_ALIGNMENT);
+
+    void* copy = NULL;
+    MPI_Comm receivers = MPI_COMM_WORLD;
+    if(share) {
+        copy = AllocateNodeShared(share, (size_t)size, &share->sceneWindow);
+        receivers = share->leaders;
+        if(worldRank == 0) {
+            memcpy(copy, memory, (size_t)size);
+            free(memory);
+        }
+    } else if(worldRank == 0) {
+        copy = memory;
+    } else if(posix_memalign(&copy, SCENE_PACK_ALIGNMENT, (size_t)size) != 0) {
+        /* Still has to take part in the broadcast, so this is fatal */
+        printf("could not allocate %.2f MB for the scene\n", size / (1024.0 * 1024.0));
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    double seconds = 0.0;
+    if(receivers != MPI_COMM_NULL) {
+        double begin = MPI_Wtime();
+        MPI_Bcast(copy, lineCount, line, 0, receivers);
+        seconds = MPI_Wtime() - begin;
+    }
+    if(share)
+        MPI_Win_fence(0, share->sceneWindow);
+    MPI_Type_free(&line);
+
+    *outSeconds = seconds;
+    MPI_Reduce(&seconds, outSeconds, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    return copy;
+}
+
+#endif
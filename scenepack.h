@@ -0,0 +1,33 @@
+#ifndef SCENEPACK_H_
+#define SCENEPACK_H_
+
+#include <stddef.h>
+
+#include "scene.h"
+#include "camera.h"
+
+/*
+ * A whole scene (primitives, lights, camera, meshes with their hierarchies and
+ * the instances with theirs) in one contiguous block of memory.
+ * Everything in it is found through offsets from the start of the block, so the block
+ * can be copied anywhere (sent to another process, put in shared memory) and used
+ * right where it lands: nothing gets parsed or rebuilt, only a few pointers get set.
+ * The MPI build loads the scene on the root only and broadcasts it like this.
+ */
+
+/* Every part of the block starts on a cache line, and so must the block itself */
+#define SCENE_PACK_ALIGNMENT 64
+
+void* PackScene(struct Scene* scene, struct Camera* camera, size_t* outSize);
+
+int UsePackedScene(void* memory, const size_t size, struct Scene* outScene, struct Camera* outCamera);
+
+void PrintPackedSceneMemory(void* memory);
+
+#ifdef USE_MPI
+struct NodeShare;
+
+void* BroadcastPackedScene(void* memory, size_t* inOutSize, struct NodeShare* share, double* outSeconds);
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* My libraries */
+#include "schedule.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+void DefaultTraceSchedule(struct TraceSchedule* schedule)
+{
+    schedule->tileSize = 0;
+    schedule->policy = SCHEDULE_DEFAULT;
+    schedule->chunk = 0;
+    schedule->threads = GetMaxTraceThreads();
+}
+
+/* Threads the binary was built for. Per thread counters are sized for them, so no more can trace */
+int GetMaxTraceThreads(void)
+{
+#ifdef USE_OPENMP
+    return OPENMP_THREAD_AMOUNT;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Sets the schedule of the next "schedule(runtime)" loop. Loops have their own default
+ * (defaultPolicy with defaultChunk), used when the schedule doesn't pick one
+ */
+void ApplyTraceSchedule(const struct TraceSchedule* schedule, const int defaultPolicy, const int defaultChunk)
+{
+#ifdef USE_OPENMP
+    const int policy = schedule->policy != SCHEDULE_DEFAULT ? schedule->policy : defaultPolicy;
+    const int chunk = schedule->policy != SCHEDULE_DEFAULT ? schedule->chunk : defaultChunk;
+    switch(policy) {
+        case SCHEDULE_STATIC: omp_set_schedule(omp_sched_static, chunk); break;
+        case SCHEDULE_DYNAMIC: omp_set_schedule(omp_sched_dynamic, chunk); break;
+        default: omp_set_schedule(omp_sched_guided, chunk); break;
+    }
+#else
+    (void)schedule;
+    (void)defaultPolicy;
+    (void)defaultChunk;
+#endif
+}
+
+const char* GetSchedulePolicyName(const int policy)
+{
+    switch(policy) {
+        case SCHEDULE_DEFAULT: return "default";
+        case SCHEDULE_STATIC: return "static";
+        case SCHEDULE_DYNAMIC: return "dynamic";
+        case SCHEDULE_GUIDED: return "guided";
+        default: return "unknown";
+    }
+}
+
+/* The policy called name (see GetSchedulePolicyName), -1 if there's none */
+int ParseSchedulePolicy(const char* name)
+{
+    int policy;
+    for(policy = SCHEDULE_DEFAULT; policy <= SCHEDULE_GUIDED; policy++) {
+        if(strcmp(name, GetSchedulePolicyName(policy)) == 0)
+            return policy;
+    }
+    return -1;
+}
+
+/* Writes something like "tiles of 16x16, dynamic 1, 4 threads" to outText */
+void DescribeTraceSchedule(const struct TraceSchedule* schedule, char* outText, const size_t size)
+{
+    char layout[32];
+    char policy[32];
+    if(schedule->tileSize > 0)
+        snprintf(layout, sizeof(layout), "tiles of %dx%d", schedule->tileSize, schedule->tileSize);
+    else
+        snprintf(layout, sizeof(layout), "rows");
+    if(schedule->policy == SCHEDULE_DEFAULT)
+        snprintf(policy, sizeof(policy), "default (%s)", schedule->tileSize > 0 ? "dynamic 1" : "guided");
+    else if(schedule->chunk > 0)
+        snprintf(policy, sizeof(policy), "%s %d", GetSchedulePolicyName(schedule->policy), schedule->chunk);
+    else
+        snprintf(policy, sizeof(policy), "%s", GetSchedulePolicyName(schedule->policy));
+    snprintf(outText, size, "%s, %s, %d thread%s", layout, policy, schedule->threads, schedule->threads == 1 ? "" : "s");
+}
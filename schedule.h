@@ -0,0 +1,50 @@
+#ifndef SCHEDULE_H_
+#define SCHEDULE_H_
+
+#include <stddef.h>
+
+/*
+ * How the trace loops hand out their work (--layout, --tile-size, --schedule and --threads).
+ * The image is traced row by row or in square tiles, rows or tiles go to threads as an OpenMP
+ * schedule says, and some or all of the threads the binary was built for take part.
+ * The defaults are what the loops always did: rows go out guided, tiles one at a time as
+ * threads free up, and every thread works. None of it changes the image, only how fast it
+ * gets made, and what's fastest depends on the machine, the scene and the size, which is
+ * what --auto-tune is for (see autotune.h).
+ */
+
+/* How rows or tiles go to threads. Without OpenMP there's one thread and nothing to hand out */
+#define SCHEDULE_DEFAULT 0
+#define SCHEDULE_STATIC 1
+#define SCHEDULE_DYNAMIC 2
+#define SCHEDULE_GUIDED 3
+
+/* Tile sizes that can be asked for (powers of two, the framebuffer's Morton order needs them) */
+#define SCHEDULE_MIN_TILE_SIZE 4
+#define SCHEDULE_MAX_TILE_SIZE 32
+
+struct TraceSchedule {
+    /* 0 traces row by row, otherwise tiles of tileSize x tileSize pixels (see framebuffer.h) */
+    int tileSize;
+
+    /* How rows or tiles go to threads, and how many at a time (0 for what the policy does by itself) */
+    int policy;
+    int chunk;
+
+    /* Threads that trace, 1 to GetMaxTraceThreads() */
+    int threads;
+};
+
+void DefaultTraceSchedule(struct TraceSchedule* schedule);
+
+int GetMaxTraceThreads(void);
+
+void ApplyTraceSchedule(const struct TraceSchedule* schedule, const int defaultPolicy, const int defaultChunk);
+
+const char* GetSchedulePolicyName(const int policy);
+
+int ParseSchedulePolicy(const char* name);
+
+void DescribeTraceSchedule(const struct TraceSchedule* schedule, char* outText, const size_t size);
+
+#endif
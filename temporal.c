@@ -0,0 +1,169 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "raytracer.h"
+#include "scene.h"
+#include "camera.h"
+#include "temporal.h"
+
+void InitTemporalCache(struct TemporalCache* cache, const int width, const int refreshPeriod)
+{
+    memset(cache, 0, sizeof(struct TemporalCache));
+    cache->width = width;
+    cache->refreshPeriod = refreshPeriod;
+}
+
+void FreeTemporalCache(struct TemporalCache* cache)
+{
+    free(cache->previous.pixels);
+    free(cache->current.pixels);
+    cache->previous.pixels = NULL;
+    cache->current.pixels = NULL;
+}
+
+/*
+ * Starts a frame of rowCount rows from rowStart, rendered with camera and the lights of scene.
+ * The previous frame is only used if it had the same lights. Returns 0 if there's no memory
+ */
+int BeginTemporalFrame(struct TemporalCache* cache, struct Scene* scene, struct Camera* camera, const int rowStart,
+    const int rowCount)
+{
+    struct TemporalFrame* previous = &cache->previous;
+    struct TemporalFrame* current = &cache->current;
+    cache->lightsChanged = cache->frame > 0 && (previous->lightCount != scene->lightCount
+        || memcmp(previous->lights, scene->lights, scene->lightCount * sizeof(struct SceneLight)) != 0);
+    cache->hasPrevious = cache->frame > 0 && !cache->lightsChanged;
+
+    if(rowCount > current->allocatedRows) {
+        free(current->pixels);
+        current->pixels = (struct TemporalPixel*)malloc((size_t)rowCount * cache->width * sizeof(struct TemporalPixel));
+        current->allocatedRows = current->pixels ? rowCount : 0;
+        if(!current->pixels) {
+            printf("Couldn't allocate the temporal cache for %d rows\n", rowCount);
+            return 0;
+        }
+    }
+    current->camera = *camera;
+    memcpy(current->lights, scene->lights, scene->lightCount * sizeof(struct SceneLight));
+    current->lightCount = scene->lightCount;
+    current->rowStart = rowStart;
+    current->rowCount = rowCount;
+    return 1;
+}
+
+/*
+ * Takes the light of a primary hit from the previous frame (see PrimaryLightFunction): interpolated
+ * between the 4 pixels around where the hit lands in the previous camera, if all of them that count
+ * hit the same primitive at the same depth, facing the same way
+ */
+static int ReusePreviousLight(void* context, const struct SampleId* sampleId, const struct RayHit* hit, float* outColor)
+{
+    struct TemporalCache* cache = (struct TemporalCache*)context;
+    const struct TemporalFrame* previous = &cache->previous;
+    float row, col;
+    if(!ProjectToCamera(&previous->camera, hit->position, &row, &col))
+        return 0;
+    const int topRow = (int)floorf(row);
+    const int leftCol = (int)floorf(col);
+    const float rowWeights[2] = {1.0f - (row - topRow), row - topRow};
+    const float colWeights[2] = {1.0f - (col - leftCol), col - leftCol};
+
+    vec3 offset;
+    vec3_sub(offset, hit->position, previous->camera.eyePos);
+    const float distance = vec3_len(offset);
+    vec3 color = {0, 0, 0};
+    int i, j;
+    for(i = 0; i < 2; i++) {
+        for(j = 0; j < 2; j++) {
+            const float weight = rowWeights[i] * colWeights[j];
+            if(weight <= 0.0f)
+                continue;
+            const int previousRow = topRow + i;
+            const int previousCol = leftCol + j;
+            if(previousRow < previous->rowStart || previousRow >= previous->rowStart + previous->rowCount
+                || previousCol < 0 || previousCol >= cache->width)
+                return 0;
+
+            /* Something else was in front of it, or it's another part of the primitive (the back of a sphere) */
+            const struct TemporalPixel* pixel =
+                &previous->pixels[(size_t)(previousRow - previous->rowStart) * cache->width + previousCol];
+            if(pixel->primitiveId != hit->primitiveId
+                || fabsf(distance - pixel->distance) > TEMPORAL_DEPTH_TOLERANCE * pixel->distance
+                || vec3_dot(pixel->normal, hit->normal) < TEMPORAL_NORMAL_TOLERANCE)
+                return 0;
+            vec3_add_scaled(color, pixel->color, weight);
+        }
+    }
+
+    vec3_dup(outColor, color);
+    cache->current.pixels[(size_t)(sampleId->row - cache->current.rowStart) * cache->width + sampleId->col].state = TEMPORAL_REUSED;
+    return 1;
+}
+
+/*
+ * Traces the camera ray of pixel (row, col) like TraceCameraRayDirection (one sample per pixel),
+ * taking the light of its primary hit from the previous frame where it can, and keeps the hit
+ * for the next frame. outPrimaryHit (can be NULL) gets the hit as TracePath reports it
+ */
+void TraceTemporalPixel(struct TemporalCache* cache, struct Scene* scene, struct Camera* camera,
+    const struct PrimitiveList* primaryList, const int row, const int col, float* direction, float* outRayColor,
+    struct RayHit* outPrimaryHit)
+{
+    struct TemporalPixel* pixel = &cache->current.pixels[(size_t)(row - cache->current.rowStart) * cache->width + col];
+    struct RayHit hit;
+
+    /* Diagonal stripes of pixels take turns being shaded again */
+    const int refresh = (row + col * 3 + cache->frame) % cache->refreshPeriod == 0;
+    if(cache->hasPrevious && !refresh) {
+        pixel->state = TEMPORAL_SHADED;
+        TraceCameraRayReusing(scene, camera, primaryList, row, col, direction, outRayColor, &hit, ReusePreviousLight, cache);
+    } else {
+        pixel->state = cache->hasPrevious ? TEMPORAL_REFRESHED : TEMPORAL_SHADED;
+        TraceCameraRayDirection(scene, camera, primaryList, row, col, direction, outRayColor, &hit, NULL, NULL);
+    }
+
+    pixel->primitiveId = hit.primitiveId;
+    if(hit.primitiveId == PRIMITIVE_ID_NONE) {
+        pixel->state = TEMPORAL_EMPTY;
+        pixel->distance = 0.0f;
+        vec3_zero(pixel->normal);
+        vec3_zero(pixel->color);
+    } else {
+        pixel->distance = hit.distance;
+        vec3_dup(pixel->normal, hit.normal);
+        vec3_dup(pixel->color, hit.color);
+    }
+    if(outPrimaryHit)
+        *outPrimaryHit = hit;
+}
+
+/* Prints how much of the frame was reused and keeps it for the next one */
+void EndTemporalFrame(struct TemporalCache* cache, const int world_rank)
+{
+    struct TemporalFrame* current = &cache->current;
+    const size_t pixelCount = (size_t)current->rowCount * cache->width;
+    size_t counts[TEMPORAL_REFRESHED + 1] = {0};
+    size_t i;
+    for(i = 0; i < pixelCount; i++)
+        counts[current->pixels[i].state]++;
+
+    const double percent = pixelCount > 0 ? 100.0 / pixelCount : 0.0;
+    const char* reason = cache->hasPrevious ? "" : cache->lightsChanged ? " (the lights moved)" : " (first frame)";
+    printf("Temporal reuse, process %d rows %d-%d: %.1f%% of the pixels reused%s, %.1f%% shaded again "
+        "(disoccluded or changed), %.1f%% refreshed, %.1f%% background\n",
+        world_rank, current->rowStart, current->rowStart + current->rowCount - 1, counts[TEMPORAL_REUSED] * percent,
+        reason, counts[TEMPORAL_SHADED] * percent, counts[TEMPORAL_REFRESHED] * percent, counts[TEMPORAL_EMPTY] * percent);
+
+    struct TemporalFrame swap = cache->previous;
+    cache->previous = cache->current;
+    cache->current = swap;
+    cache->frame++;
+}
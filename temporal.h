@@ -0,0 +1,90 @@
+#ifndef TEMPORAL_H_
+#define TEMPORAL_H_
+
+#include "linmath.h"
+#include "scene.h"
+#include "camera.h"
+#include "raytracer.h"
+
+/*
+ * Temporal reprojection for animations (--temporal).
+ *
+ * Frames of a camera move mostly see the same surfaces, and the light a surface gets
+ * straight from the lights doesn't depend on where it's seen from. So every frame keeps
+ * what each pixel's camera ray hit first and the light of that hit alone (see TracePath).
+ * The next frame still traces every primary ray, but before shading the hit it projects
+ * the hit into the previous frame's camera: if the 4 pixels around it there hit the same
+ * primitive at the same depth, facing the same way, their light is interpolated instead of
+ * sending the shadow rays again. Taking a single pixel's light moves it by up to half a pixel
+ * every frame, which showed on curved surfaces within a few frames.
+ * Reflections depend on where they're seen from and are always traced.
+ *
+ * Nothing is reused when the lights changed since the previous frame. Pixels that weren't
+ * visible before (disocclusions) get shaded as usual, and a rotating 1 in --temporal-refresh
+ * of the pixels is shaded again every frame so light taken over and over doesn't drift.
+ * A process only keeps its own rows: with --frame-split rows, hits that moved into another
+ * process's rows get shaded again, with whole frames the previous frame is the last one
+ * the process rendered.
+ */
+
+/* A pixel is shaded again every this many frames by default */
+#define TEMPORAL_DEFAULT_REFRESH 8
+
+/* How far (relative) the distance to the previous eye may be off for the hit to count as the same */
+#define TEMPORAL_DEPTH_TOLERANCE 0.01f
+
+/* Smallest dot product of the normals for the hit to count as the same (about 2.5 degrees) */
+#define TEMPORAL_NORMAL_TOLERANCE 0.999f
+
+/* What happened to a pixel */
+#define TEMPORAL_EMPTY 0
+#define TEMPORAL_SHADED 1
+#define TEMPORAL_REUSED 2
+#define TEMPORAL_REFRESHED 3
+
+/* A pixel's primary hit: its distance from the eye, what it hit, its normal and the light of that hit alone */
+struct TemporalPixel {
+    float distance;
+    int primitiveId;
+    vec3 normal;
+    vec3 color;
+    int state;
+};
+
+/* Rows of one frame, and the camera and lights they were rendered with */
+struct TemporalFrame {
+    struct Camera camera;
+    struct SceneLight lights[MAX_LIGHTS];
+    int lightCount;
+    int rowStart;
+    int rowCount;
+    int allocatedRows;
+    struct TemporalPixel* pixels;
+};
+
+struct TemporalCache {
+    int width;
+    int refreshPeriod;
+
+    /* Frames rendered so far, and whether previous holds one that can be reused (not if the lights changed) */
+    int frame;
+    int hasPrevious;
+    int lightsChanged;
+    struct TemporalFrame previous;
+    struct TemporalFrame current;
+};
+
+void InitTemporalCache(struct TemporalCache* cache, const int width, const int refreshPeriod);
+
+void FreeTemporalCache(struct TemporalCache* cache);
+
+int BeginTemporalFrame(struct TemporalCache* cache, struct Scene* scene, struct Camera* camera, const int rowStart,
+    const int rowCount);
+
+void TraceTemporalPixel(struct TemporalCache* cache, struct Scene* scene, struct Camera* camera,
+    const struct PrimitiveList* primaryList, const int row, const int col, float* direction, float* outRayColor,
+    struct RayHit* outPrimaryHit);
+
+void EndTemporalFrame(struct TemporalCache* cache, const int world_rank);
+
+#endif
@@ -0,0 +1,82 @@
+/* Default libraries */
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "linmath_ext.h"
+#include "scene.h"
+#include "camera.h"
+#include "tilecull.h"
+
+/* Unnormalized direction from the eye through a point of the image (rows and columns can be fractions) */
+static void GetFrustumCorner(struct Camera* camera, const float row, const float col, float* outDirection)
+{
+    vec3 rowPart, colPart;
+    vec3_scale(rowPart, camera->rayRowStep, row);
+    vec3_scale(colPart, camera->rayColStep, col);
+    vec3_add(outDirection, camera->rayBase, rowPart);
+    vec3_add(outDirection, outDirection, colPart);
+}
+
+/*
+ * Finds what the primary rays of the rows x cols tile at (row, col) can hit.
+ * The frustum covers whole pixels (half a pixel past the outer ray directions)
+ * so rays anywhere inside a pixel are covered too
+ */
+void BuildPrimitiveList(struct Scene* scene, struct Camera* camera, const int row, const int col,
+    const int rows, const int cols, struct PrimitiveList* outList)
+{
+    const float top = (float)row - 0.5f;
+    const float bottom = (float)(row + rows) - 0.5f;
+    const float left = (float)col - 0.5f;
+    const float right = (float)(col + cols) - 0.5f;
+
+    /* Corners go around the tile, so neighbours make up the sides */
+    vec3 corners[4];
+    GetFrustumCorner(camera, top, left, corners[0]);
+    GetFrustumCorner(camera, top, right, corners[1]);
+    GetFrustumCorner(camera, bottom, right, corners[2]);
+    GetFrustumCorner(camera, bottom, left, corners[3]);
+
+    vec3 center;
+    GetFrustumCorner(camera, 0.5f * (top + bottom), 0.5f * (left + right), center);
+
+    /* Side normals point into the frustum */
+    vec3 sides[4];
+    int i, k;
+    for(k = 0; k < 4; k++) {
+        vec3_mul_cross(sides[k], corners[k], corners[(k + 1) % 4]);
+        if(vec3_dot(sides[k], center) < 0.0f)
+            vec3_scale(sides[k], sides[k], -1.0f);
+        vec3_normalize(sides[k], sides[k]);
+    }
+
+    /* A sphere is out if it is completely on the outside of one of the sides (with a little slack for rounding) */
+    outList->circleCount = 0;
+    for(i = 0; i < scene->circleCount; i++) {
+        vec3 toCenter;
+        vec3_sub(toCenter, scene->circles[i].origin, camera->eyePos);
+        const float slack = scene->circles[i].radius * 1.001f + vec3_len(toCenter) * 1e-4f;
+        int outside = 0;
+        for(k = 0; k < 4 && !outside; k++)
+            outside = vec3_dot(sides[k], toCenter) < -slack;
+        if(!outside)
+            outList->circles[outList->circleCount++] = i;
+    }
+
+    /*
+     * CalculatePlaneCollision only takes rays going the same way as the normal.
+     * Every ray of the tile is a positive mix of the corners, so if all of them go
+     * against the normal every ray does
+     */
+    outList->planeCount = 0;
+    for(i = 0; i < scene->planeCount; i++) {
+        int facing = 0;
+        for(k = 0; k < 4 && !facing; k++)
+            facing = vec3_dot(scene->planes[i].normal, corners[k]) >= 0.0f;
+        if(facing)
+            outList->planes[outList->planeCount++] = i;
+    }
+}
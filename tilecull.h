@@ -0,0 +1,32 @@
+#ifndef TILECULL_H_
+#define TILECULL_H_
+
+#include "scene.h"
+
+/*
+ * Per tile culling for primary rays.
+ * Every primary ray of a tile starts at the eye and goes through the tile, so together
+ * they fill a four sided cone (the tile's frustum). Spheres completely outside one of its
+ * sides and planes every one of its rays points away from can't be hit by any of them,
+ * so the first bounce of the tile's rays only tests what is left. Reflections still test everything.
+ * The lists are exact (anything a ray could hit stays in), so images don't change.
+ * Mesh instances aren't culled here, they already have their own hierarchy.
+ */
+
+/* Tiles of the row by row layout: this many pixels of a row share a list */
+#define TILE_CULL_ROW_SEGMENT 16
+
+/* The circles and planes (scene indices, in scene order) a tile's primary rays can hit */
+struct PrimitiveList {
+    int circles[NUM_CIRCLES];
+    int circleCount;
+    int planes[NUM_PLANES];
+    int planeCount;
+};
+
+struct Camera;
+
+void BuildPrimitiveList(struct Scene* scene, struct Camera* camera, const int row, const int col,
+    const int rows, const int cols, struct PrimitiveList* outList);
+
+#endif
@@ -0,0 +1,22 @@
+/* clock_gettime isn't in C99 */
+#define _POSIX_C_SOURCE 200809L
+
+/* Default libraries */
+#include <time.h>
+
+/* My libraries */
+#include "timing.h"
+
+double GetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+double GetThreadCpuSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
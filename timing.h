@@ -0,0 +1,15 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+
+/*
+ * Clocks for timing parts of a render. clock() adds up every thread's time, so
+ * anything that wants to know how long something took uses these instead
+ */
+
+/* Wall clock time in seconds */
+double GetSeconds(void);
+
+/* CPU time of the calling thread in seconds, which doesn't count the time it waited for a core */
+double GetThreadCpuSeconds(void);
+
+#endif
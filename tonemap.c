@@ -0,0 +1,84 @@
+/* Default libraries */
+#include <stdlib.h>
+#include <math.h>
+
+/* Helper libraries */
+#include "linmath.h"
+
+/* My libraries */
+#include "pixelformat.h"
+#include "tonemap.h"
+
+/* Include OpenMP (if needed) */
+#ifdef USE_OPENMP
+#include "omp.h"
+#endif
+
+/*
+ * Finds the brightest channel of rows pixels (width per row) stored in pixelFormat.
+ * Packed rows get unpacked one at a time. rowChunk is how many rows each thread
+ * takes in turn (see GetNumaChunk), 0 for one even block each
+ */
+float FindMaxLightingValue(const int pixelFormat, const void* pixels, const int width, const int rows, const int rowChunk)
+{
+    const size_t rowBytes = (size_t)width * GetPixelFormatSize(pixelFormat);
+    float maxLightingValue = 0.0f;
+    int i;
+
+#ifdef USE_OPENMP
+    omp_set_schedule(omp_sched_static, rowChunk);
+    #pragma omp parallel num_threads(OPENMP_THREAD_AMOUNT) private(i) reduction(max:maxLightingValue)
+#else
+    (void)rowChunk;
+#endif
+    {
+        float* row = (float*)malloc(width * sizeof(vec3));
+        int j;
+#ifdef USE_OPENMP
+        #pragma omp for schedule(runtime)
+#endif
+        for (i = 0; i < rows; i++) {
+            UnpackPixels(pixelFormat, (const unsigned char*)pixels + i * rowBytes, row, width);
+            for (j = 0; j < width * 3; j++)
+                maxLightingValue = fmaxf(maxLightingValue, row[j]);
+        }
+        free(row);
+    }
+    return maxLightingValue;
+}
+
+/*
+ * Clamps our lighting values to 24-bit BGR pixels for the bitmap,
+ * scaled so maxLightingValue ends up at 255. rowChunk as for FindMaxLightingValue
+ */
+void ScaleToBitmap(const int pixelFormat, const void* pixels, const int width, const int rows,
+    const int rowChunk, const float maxLightingValue, unsigned char* outImage)
+{
+    const size_t rowBytes = (size_t)width * GetPixelFormatSize(pixelFormat);
+    int i;
+
+#ifdef USE_OPENMP
+    omp_set_schedule(omp_sched_static, rowChunk);
+    #pragma omp parallel num_threads(OPENMP_THREAD_AMOUNT) private(i)
+#else
+    (void)rowChunk;
+#endif
+    {
+        float* row = (float*)malloc(width * sizeof(vec3));
+        int j;
+#ifdef USE_OPENMP
+        #pragma omp for schedule(runtime)
+#endif
+        for (i = 0; i < rows; i++) {
+            vec3 newPixel;
+            UnpackPixels(pixelFormat, (const unsigned char*)pixels + i * rowBytes, row, width);
+            for (j = 0; j < width; j++) {
+                vec3_scale(newPixel, &row[j*3], 255.0f/maxLightingValue);
+                outImage[((i*width + j)*3)] = (unsigned char) newPixel[2];
+                outImage[((i*width + j)*3)+1] = (unsigned char) newPixel[1];
+                outImage[((i*width + j)*3)+2] = (unsigned char) newPixel[0];
+            }
+        }
+        free(row);
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef TONEMAP_H_
+#define TONEMAP_H_
+
+/*
+ * Turns raw (unbounded) lighting values into 8 bit pixels: the brightest
+ * channel of the image ends up at 255 and everything else scales with it.
+ * Pixels can be in any --pixel-format (see pixelformat.h).
+ */
+
+float FindMaxLightingValue(const int pixelFormat, const void* pixels, const int width, const int rows, const int rowChunk);
+
+void ScaleToBitmap(const int pixelFormat, const void* pixels, const int width, const int rows,
+    const int rowChunk, const float maxLightingValue, unsigned char* outImage);
+
+#endif